@@ -9,7 +9,15 @@
 
 #include "cxplat_fault_injection.h"
 
+#if defined(_WIN32)
 #include <windows.h>
+#else
+#include <dlfcn.h>
+#include <stdlib.h>
+#endif
+#include <algorithm>
+#include <string>
+#include <vector>
 
 struct _on_exit
 {
@@ -42,11 +50,13 @@ enum class _fault_injection_expected_outcome
     ExpectFaultDifferentCallsite, /// < Fault should be expected at a different callsite.
 };
 
+#ifndef NDEBUG
 static bool
 _is_fault_injection_enabled_in_environment()
 {
     std::string name("CXPLAT_FAULT_INJECTION_SIMULATION");
     std::string value;
+#if defined(_WIN32)
     size_t required_size = 0;
     getenv_s(&required_size, nullptr, 0, name.c_str());
     if (required_size > 0) {
@@ -54,6 +64,12 @@ _is_fault_injection_enabled_in_environment()
         getenv_s(&required_size, &value[0], required_size, name.c_str());
         value.resize(required_size - 1);
     }
+#else
+    const char* environment_value = getenv(name.c_str());
+    if (environment_value != nullptr) {
+        value = environment_value;
+    }
+#endif
     if (value.empty()) {
         return false;
     }
@@ -64,7 +80,22 @@ _is_fault_injection_enabled_in_environment()
     }
 }
 
-#ifndef NDEBUG
+/**
+ * @brief Get the handle of the test executable. On POSIX, a module is identified by the address it is loaded at, as
+ * an HMODULE is on Windows.
+ */
+static void*
+_get_test_module_handle()
+{
+#if defined(_WIN32)
+    return GetModuleHandle(nullptr);
+#else
+    Dl_info info;
+    REQUIRE(dladdr(reinterpret_cast<void*>(&_get_test_module_handle), &info) != 0);
+    return info.dli_fbase;
+#endif
+}
+
 TEST_CASE("fault_injection", "[fault_injection]")
 {
     if (_is_fault_injection_enabled_in_environment()) {
@@ -88,10 +119,10 @@ TEST_CASE("fault_injection", "[fault_injection]")
     REQUIRE(cxplat_fault_injection_initialize(0) == CXPLAT_STATUS_INVALID_STATE);
 
     // Verify that adding a module succeeds.
-    REQUIRE(cxplat_fault_injection_add_module(GetModuleHandle(nullptr)) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_add_module(_get_test_module_handle()) == CXPLAT_STATUS_SUCCESS);
 
     // Verify that adding a module again succeeds.
-    REQUIRE(cxplat_fault_injection_add_module(GetModuleHandle(nullptr)) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_add_module(_get_test_module_handle()) == CXPLAT_STATUS_SUCCESS);
 
     _on_exit _([&]() {
         if (fault_injection_enabled) {
@@ -117,7 +148,7 @@ TEST_CASE("fault_injection", "[fault_injection]")
             cxplat_fault_injection_uninitialize();
             fault_injection_enabled = false;
             REQUIRE(cxplat_fault_injection_initialize(0) == CXPLAT_STATUS_SUCCESS);
-            REQUIRE(cxplat_fault_injection_add_module(GetModuleHandle(nullptr)) == CXPLAT_STATUS_SUCCESS);
+            REQUIRE(cxplat_fault_injection_add_module(_get_test_module_handle()) == CXPLAT_STATUS_SUCCESS);
             fault_injection_enabled = true;
             fault_expected = false;
             break;
@@ -135,9 +166,107 @@ TEST_CASE("fault_injection", "[fault_injection]")
     }
 
     // Verify that removing a module succeeds.
-    REQUIRE(cxplat_fault_injection_remove_module(GetModuleHandle(nullptr)) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_remove_module(_get_test_module_handle()) == CXPLAT_STATUS_SUCCESS);
 
     // Verify that removing a module again succeeds.
-    REQUIRE(cxplat_fault_injection_remove_module(GetModuleHandle(nullptr)) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_remove_module(_get_test_module_handle()) == CXPLAT_STATUS_SUCCESS);
+}
+
+TEST_CASE("fault_injection_site_run", "[fault_injection]")
+{
+    cxplat_fault_injection_site_run_result_t result;
+
+    // Count the sites without failing any of them.
+    REQUIRE(cxplat_fault_injection_start_site_run(0) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_is_enabled() == true);
+    REQUIRE(cxplat_fault_injection_start_site_run(0) == CXPLAT_STATUS_INVALID_STATE);
+    for (size_t i = 0; i < 3; i++) {
+        REQUIRE(cxplat_fault_injection_inject_fault() == false);
+    }
+    cxplat_fault_injection_stop_site_run(&result);
+    REQUIRE(result.sites_reached == 3);
+    REQUIRE(result.fault_injected == false);
+    REQUIRE(result.leaked_allocations == 0);
+
+    // Fail only the second site.
+    REQUIRE(cxplat_fault_injection_start_site_run(2) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_inject_fault() == false);
+    REQUIRE(cxplat_fault_injection_inject_fault() == true);
+    REQUIRE(cxplat_fault_injection_inject_fault() == false);
+    cxplat_fault_injection_stop_site_run(&result);
+    REQUIRE(result.sites_reached == 3);
+    REQUIRE(result.fault_injected == true);
+
+    // A site beyond the ones reached is never failed.
+    REQUIRE(cxplat_fault_injection_start_site_run(5) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_fault_injection_inject_fault() == false);
+    cxplat_fault_injection_stop_site_run(&result);
+    REQUIRE(result.sites_reached == 1);
+    REQUIRE(result.fault_injected == false);
+}
+
+TEST_CASE("fault_injection_schedule", "[fault_injection]")
+{
+    cxplat_fault_injection_schedule_t schedule = {};
+    schedule.seed = 0x5eed;
+    schedule.classes[CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION].one_in = 4;
+    schedule.classes[CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN].countdown = 3;
+    _on_exit _([]() { cxplat_fault_injection_set_schedule(nullptr); });
+
+    // The same schedule produces the same failure sequence every time it is set.
+    std::vector<bool> first_sequence;
+    std::vector<bool> second_sequence;
+    cxplat_fault_injection_set_schedule(&schedule);
+    REQUIRE(cxplat_fault_injection_is_enabled() == true);
+    for (size_t i = 0; i < 256; i++) {
+        first_sequence.push_back(
+            cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION));
+    }
+    cxplat_fault_injection_set_schedule(&schedule);
+    for (size_t i = 0; i < 256; i++) {
+        // Calls at sites of other classes don't disturb the sequence.
+        (void)cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_WORK_ITEM);
+        second_sequence.push_back(
+            cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION));
+    }
+    REQUIRE(first_sequence == second_sequence);
+    size_t failures = std::count(first_sequence.begin(), first_sequence.end(), true);
+    REQUIRE(failures > 0);
+    REQUIRE(failures < first_sequence.size());
+
+    // A countdown fails exactly the call with that index.
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) == false);
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) == false);
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) == true);
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) == false);
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_OTHER) == false);
+
+    // A schedule survives a round trip through a replay token.
+    char token[CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_SIZE];
+    REQUIRE(cxplat_fault_injection_format_replay_token(&schedule, token, sizeof(token)) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(std::string(token) == "1:5eed:4,0:0,0:0,3:0,0");
+    cxplat_fault_injection_schedule_t parsed_schedule;
+    REQUIRE(cxplat_fault_injection_parse_replay_token(token, &parsed_schedule) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(parsed_schedule.seed == schedule.seed);
+    for (size_t i = 0; i < CXPLAT_FAULT_INJECTION_CLASS_COUNT; i++) {
+        REQUIRE(parsed_schedule.classes[i].one_in == schedule.classes[i].one_in);
+        REQUIRE(parsed_schedule.classes[i].countdown == schedule.classes[i].countdown);
+    }
+
+    REQUIRE(cxplat_fault_injection_format_replay_token(&schedule, token, 8) == CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(cxplat_fault_injection_parse_replay_token("", &parsed_schedule) == CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(
+        cxplat_fault_injection_parse_replay_token("2:5eed:4,0:0,0:0,3:0,0", &parsed_schedule) ==
+        CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(
+        cxplat_fault_injection_parse_replay_token("1:5eed:4,0:0,0:0,3", &parsed_schedule) ==
+        CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(
+        cxplat_fault_injection_parse_replay_token("1:5eed:4,0:0,0:0,3:0,0:0,0", &parsed_schedule) ==
+        CXPLAT_STATUS_INVALID_PARAMETER);
+
+    // Without a schedule, work item and rundown sites are never failed.
+    cxplat_fault_injection_set_schedule(nullptr);
+    REQUIRE(cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) == false);
 }
 #endif // !NDEBUG
@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#if !defined(CMAKE_NUGET)
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+#include "cxplat.h"
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+#include "../src/fault_injection.h"
+
+#include <filesystem>
+#include <fstream>
+
+// The stacks are only fingerprinted, so the frame offsets don't need to be real code addresses.
+static const uintptr_t _first_stack[] = {0x100, 0x200, 0x300};
+static const uintptr_t _second_stack[] = {0x400, 0x500};
+static const uintptr_t _unlogged_stack[] = {0x600};
+
+static const size_t _first_stack_count = sizeof(_first_stack) / sizeof(_first_stack[0]);
+static const size_t _second_stack_count = sizeof(_second_stack) / sizeof(_second_stack[0]);
+
+// Offset of the first fault record, which follows the header and the iteration record of the first run.
+static const uint64_t _first_fault_record_offset =
+    sizeof(cxplat_fault_log_header_t) + sizeof(cxplat_fault_log_record_t);
+
+/**
+ * @brief Give each test its own empty fault log, and delete it when the test ends.
+ */
+class _test_fault_log
+{
+  public:
+    _test_fault_log() : _path(std::filesystem::temp_directory_path() / "cxplat_fault_log_test.fault.log")
+    {
+        std::filesystem::remove(_path);
+    }
+    ~_test_fault_log() { std::filesystem::remove(_path); }
+
+    std::string
+    path() const
+    {
+        return _path.string();
+    }
+
+    /**
+     * @brief Write a log with one run that faulted at the first stack and then at the second.
+     */
+    void
+    write_two_faults() const
+    {
+        cxplat_fault_injection_t fault_injection(0, path().c_str());
+        REQUIRE(fault_injection.record_fault(_first_stack, _first_stack_count));
+        REQUIRE(fault_injection.record_fault(_second_stack, _second_stack_count));
+    }
+
+    void
+    flip_byte(uint64_t offset) const
+    {
+        std::fstream file(_path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        char byte = 0;
+        file.read(&byte, 1);
+        byte ^= 0x5a;
+        file.seekp(offset);
+        file.write(&byte, 1);
+        REQUIRE(file.good());
+    }
+
+  private:
+    std::filesystem::path _path;
+};
+
+TEST_CASE("fault_log round trip", "[fault_log]")
+{
+    _test_fault_log log;
+    log.write_two_faults();
+
+    cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+    REQUIRE(fault_injection.iteration() == 2);
+    REQUIRE(fault_injection.is_known_fault(_first_stack, _first_stack_count));
+    REQUIRE(fault_injection.is_known_fault(_second_stack, _second_stack_count));
+    REQUIRE(!fault_injection.is_known_fault(_unlogged_stack, 1));
+
+    // A logged fault is not injected again.
+    REQUIRE(!fault_injection.record_fault(_first_stack, _first_stack_count));
+}
+
+TEST_CASE("fault_log ignores a torn trailing record", "[fault_log]")
+{
+    _test_fault_log log;
+    log.write_two_faults();
+
+    // Cut the last record short, as a crash while the file was being written back would.
+    std::filesystem::resize_file(log.path(), std::filesystem::file_size(log.path()) - sizeof(uint64_t));
+
+    {
+        cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+        REQUIRE(fault_injection.iteration() == 2);
+        REQUIRE(fault_injection.is_known_fault(_first_stack, _first_stack_count));
+        REQUIRE(!fault_injection.is_known_fault(_second_stack, _second_stack_count));
+    }
+
+    // The next run overwrote the torn record, so the log is intact again.
+    cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+    REQUIRE(fault_injection.iteration() == 3);
+    REQUIRE(fault_injection.is_known_fault(_first_stack, _first_stack_count));
+}
+
+TEST_CASE("fault_log rejects a corrupted checksum", "[fault_log]")
+{
+    _test_fault_log log;
+    log.write_two_faults();
+
+    // Corrupt the last frame of the first fault, which invalidates its checksum.
+    log.flip_byte(
+        _first_fault_record_offset + sizeof(cxplat_fault_log_record_t) + (_first_stack_count - 1) * sizeof(uint64_t));
+
+    // Loading stops at the corrupt record, so neither it nor the valid record after it is loaded.
+    cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+    REQUIRE(fault_injection.iteration() == 2);
+    REQUIRE(!fault_injection.is_known_fault(_first_stack, _first_stack_count));
+    REQUIRE(!fault_injection.is_known_fault(_second_stack, _second_stack_count));
+}
+
+TEST_CASE("fault_log rejects a corrupted header", "[fault_log]")
+{
+    _test_fault_log log;
+    log.write_two_faults();
+    log.flip_byte(0);
+
+    // A file that isn't a fault log starts a new one.
+    cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+    REQUIRE(fault_injection.iteration() == 1);
+    REQUIRE(!fault_injection.is_known_fault(_first_stack, _first_stack_count));
+}
+
+TEST_CASE("fault_log fingerprints depend on frame order", "[fault_log]")
+{
+    const uintptr_t stack[] = {0x100, 0x200};
+    const uintptr_t reversed_stack[] = {0x200, 0x100};
+    const uintptr_t shorter_stack[] = {0x100};
+    REQUIRE(_cxplat_compute_stack_fingerprint(stack, 2) == _cxplat_compute_stack_fingerprint(stack, 2));
+    REQUIRE(_cxplat_compute_stack_fingerprint(stack, 2) != _cxplat_compute_stack_fingerprint(reversed_stack, 2));
+    REQUIRE(_cxplat_compute_stack_fingerprint(stack, 2) != _cxplat_compute_stack_fingerprint(shorter_stack, 1));
+
+    _test_fault_log log;
+    cxplat_fault_injection_t fault_injection(0, log.path().c_str());
+    REQUIRE(fault_injection.record_fault(stack, 2));
+    REQUIRE(!fault_injection.is_known_fault(reversed_stack, 2));
+    REQUIRE(fault_injection.record_fault(reversed_stack, 2));
+}
+#endif
@@ -7,8 +7,13 @@
 #include <catch2/catch.hpp>
 #endif
 #include "cxplat.h"
+#include "cxplat_environment.h"
+
+#include <stdlib.h>
+#if defined(_WIN32)
 #include "cxplat_passed_test_log.h"
 CATCH_REGISTER_LISTENER(cxplat_passed_test_log)
+#endif
 
 TEST_CASE("initialize", "[initialization]")
 {
@@ -17,3 +22,29 @@ TEST_CASE("initialize", "[initialization]")
     cxplat_cleanup();
     cxplat_cleanup();
 }
+
+static void
+_set_test_environment_variable(_In_z_ const char* value)
+{
+#if defined(_WIN32)
+    REQUIRE(_putenv_s("CXPLAT_TEST_BOOLEAN", value) == 0);
+#else
+    REQUIRE(setenv("CXPLAT_TEST_BOOLEAN", value, 1) == 0);
+#endif
+}
+
+TEST_CASE("environment variable as bool", "[initialization]")
+{
+    // Setting a variable to the empty string removes it on Windows.
+    _set_test_environment_variable("");
+    REQUIRE(!cxplat_get_environment_variable_as_bool("CXPLAT_TEST_BOOLEAN"));
+    _set_test_environment_variable("0");
+    REQUIRE(!cxplat_get_environment_variable_as_bool("CXPLAT_TEST_BOOLEAN"));
+    _set_test_environment_variable("False");
+    REQUIRE(!cxplat_get_environment_variable_as_bool("CXPLAT_TEST_BOOLEAN"));
+    _set_test_environment_variable("1");
+    REQUIRE(cxplat_get_environment_variable_as_bool("CXPLAT_TEST_BOOLEAN"));
+    _set_test_environment_variable("true");
+    REQUIRE(cxplat_get_environment_variable_as_bool("CXPLAT_TEST_BOOLEAN"));
+    _set_test_environment_variable("");
+}
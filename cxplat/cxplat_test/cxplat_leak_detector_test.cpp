@@ -0,0 +1,100 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#if !defined(CMAKE_NUGET)
+#include <catch2/catch_all.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+#include "cxplat.h"
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+#include "../src/leak_detector.h"
+
+#include <thread>
+
+// The addresses are only used as keys, so they don't need to point to real allocations.
+static uintptr_t
+_test_address(size_t index)
+{
+    return 0x10000 + index * 0x10;
+}
+
+static void
+_register_test_allocations(cxplat_leak_detector_t& detector, size_t first, size_t count)
+{
+    for (size_t i = first; i < first + count; i++) {
+        detector.register_allocation(_test_address(i), 16);
+    }
+}
+
+static void
+_register_other_test_allocations(cxplat_leak_detector_t& detector, size_t first, size_t count)
+{
+    for (size_t i = first; i < first + count; i++) {
+        detector.register_allocation(_test_address(i), 32);
+    }
+}
+
+TEST_CASE("leak_detector reports leaks", "[leak_detector]")
+{
+    cxplat_leak_detector_t detector;
+    _register_test_allocations(detector, 0, 8);
+    for (size_t i = 0; i < 6; i++) {
+        detector.unregister_allocation(_test_address(i));
+    }
+    REQUIRE(detector.dump_leaks() == 2);
+    REQUIRE(detector.dump_leaks() == 0);
+}
+
+TEST_CASE("leak_detector sample rate", "[leak_detector]")
+{
+    // Sampling counts allocations per thread, so use a new thread to start counting from zero.
+    cxplat_leak_detector_t detector(4);
+    std::thread([&]() {
+        _register_test_allocations(detector, 0, 64);
+
+        // Freeing allocations that weren't sampled is ignored rather than reported as a double free.
+        for (size_t i = 0; i < 32; i++) {
+            detector.unregister_allocation(_test_address(i));
+        }
+    }).join();
+    REQUIRE(detector.dump_leaks() == 8);
+}
+
+TEST_CASE("leak_detector epochs", "[leak_detector]")
+{
+    cxplat_leak_detector_t detector;
+    _register_test_allocations(detector, 0, 4);
+    uint64_t epoch = cxplat_leak_detector_t::start_epoch();
+    _register_test_allocations(detector, 4, 3);
+    REQUIRE(detector.count_allocations_since(epoch) == 3);
+    detector.unregister_allocation(_test_address(5));
+    REQUIRE(detector.count_allocations_since(epoch) == 2);
+    REQUIRE(detector.dump_leaks() == 6);
+}
+
+TEST_CASE("leak_detector interns stacks", "[leak_detector]")
+{
+    cxplat_leak_detector_t detector;
+
+    // Allocations made from the same call site share one stored stack.
+    size_t stack_count = 0;
+    for (size_t round = 0; round < 2; round++) {
+        _register_test_allocations(detector, round * 100, 100);
+        if (round == 0) {
+            stack_count = detector.count_stacks();
+        }
+    }
+    REQUIRE(stack_count >= 1);
+    REQUIRE(detector.count_stacks() == stack_count);
+
+    // Another call site adds another stack.
+    _register_other_test_allocations(detector, 200, 100);
+    REQUIRE(detector.count_stacks() > stack_count);
+
+    // Dumping the leaks drops the stacks too.
+    REQUIRE(detector.dump_leaks() == 300);
+    REQUIRE(detector.count_stacks() == 0);
+}
+#endif
@@ -5,9 +5,19 @@
 #if !defined(CMAKE_NUGET)
 #include <catch2/catch_all.hpp>
 #else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #endif
 #include "cxplat.h"
+#if defined(_WIN32)
+#include "cxplat_pool_tag_statistics.h"
+#include "cxplat_slab_allocator.h"
+#endif
+
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define TEST_TAG 'tset'
 
@@ -85,4 +95,221 @@ TEST_CASE("cxplat_duplicate_utf8_string", "[memory]")
     REQUIRE(memcmp(destination.value, source.value, source.length) == 0);
 
     cxplat_free_utf8_string(&destination);
-}
\ No newline at end of file
+}
+// Pool tag statistics and the slab allocator are only implemented on Windows.
+#if defined(_WIN32)
+TEST_CASE("pool tag statistics", "[memory]")
+{
+    // Use a tag that no other test allocates with, so the counts are exact.
+    const uint32_t tag = 'tspx';
+    cxplat_pool_tag_statistics_t statistics;
+    REQUIRE(cxplat_query_pool_tag_statistics(tag, &statistics) == CXPLAT_STATUS_NOT_FOUND);
+
+    cxplat_pool_tag_snapshot_t* before;
+    REQUIRE(cxplat_capture_pool_tag_snapshot(&before) == CXPLAT_STATUS_SUCCESS);
+
+    void* buffers[3];
+    for (auto& buffer : buffers) {
+        buffer = cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, 100, tag);
+        REQUIRE(buffer != nullptr);
+    }
+    REQUIRE(cxplat_query_pool_tag_statistics(tag, &statistics) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(statistics.tag == tag);
+    REQUIRE(statistics.outstanding_bytes == 300);
+    REQUIRE(statistics.outstanding_allocations == 3);
+    REQUIRE(statistics.peak_bytes >= 300);
+    REQUIRE(statistics.total_allocations == 3);
+    REQUIRE(statistics.total_frees == 0);
+
+    // Reallocation moves the bytes but not the allocation count.
+    buffers[0] = cxplat_reallocate(buffers[0], CXPLAT_POOL_FLAG_NON_PAGED, 100, 200, tag);
+    REQUIRE(buffers[0] != nullptr);
+    REQUIRE(cxplat_query_pool_tag_statistics(tag, &statistics) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(statistics.outstanding_bytes == 400);
+    REQUIRE(statistics.outstanding_allocations == 3);
+
+    // Frees with a tag of 0 are still accounted against the allocation's tag.
+    cxplat_free(buffers[2], CXPLAT_POOL_FLAG_NON_PAGED, 0);
+
+    // The enumeration reports the tag as well.
+    auto find_tag = [](const cxplat_pool_tag_statistics_t* statistics, void* context) {
+        if (statistics->tag != tag) {
+            return true;
+        }
+        *(uint64_t*)context = statistics->outstanding_bytes;
+        return false;
+    };
+    uint64_t enumerated_bytes = 0;
+    cxplat_enumerate_pool_tag_statistics(find_tag, &enumerated_bytes);
+    REQUIRE(enumerated_bytes == 300);
+
+    // The snapshot diff shows the two allocations still outstanding.
+    cxplat_pool_tag_snapshot_t* after;
+    REQUIRE(cxplat_capture_pool_tag_snapshot(&after) == CXPLAT_STATUS_SUCCESS);
+    auto check_difference = [](const cxplat_pool_tag_difference_t* difference, void* context) {
+        if (difference->tag == tag) {
+            *(cxplat_pool_tag_difference_t*)context = *difference;
+        }
+    };
+    cxplat_pool_tag_difference_t difference = {};
+    REQUIRE(cxplat_compare_pool_tag_snapshots(before, after, check_difference, &difference) >= 1);
+    REQUIRE(difference.tag == tag);
+    REQUIRE(difference.outstanding_bytes == 300);
+    REQUIRE(difference.outstanding_allocations == 2);
+    cxplat_free_pool_tag_snapshot(after);
+
+    cxplat_free(buffers[0], CXPLAT_POOL_FLAG_NON_PAGED, tag);
+    cxplat_free(buffers[1], CXPLAT_POOL_FLAG_NON_PAGED, tag);
+
+    // Once everything is freed the tag shows no growth.
+    REQUIRE(cxplat_capture_pool_tag_snapshot(&after) == CXPLAT_STATUS_SUCCESS);
+    difference = {};
+    (void)cxplat_compare_pool_tag_snapshots(before, after, check_difference, &difference);
+    REQUIRE(difference.tag == 0);
+    cxplat_free_pool_tag_snapshot(after);
+    cxplat_free_pool_tag_snapshot(before);
+
+    REQUIRE(cxplat_query_pool_tag_statistics(tag, &statistics) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(statistics.outstanding_bytes == 0);
+    REQUIRE(statistics.outstanding_allocations == 0);
+    REQUIRE(statistics.total_allocations == 4);
+    REQUIRE(statistics.total_frees == 4);
+}
+
+TEST_CASE("pool tag peak", "[memory]")
+{
+    const uint32_t tag = 'kpxc';
+
+    // An allocation large enough to fold into the shared total is always reflected in the peak.
+    void* buffer = cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, 1024 * 1024, tag);
+    REQUIRE(buffer != nullptr);
+    cxplat_free(buffer, CXPLAT_POOL_FLAG_NON_PAGED, tag);
+
+    cxplat_pool_tag_statistics_t statistics;
+    REQUIRE(cxplat_query_pool_tag_statistics(tag, &statistics) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(statistics.outstanding_bytes == 0);
+    REQUIRE(statistics.peak_bytes >= 1024 * 1024);
+}
+
+TEST_CASE("slab allocator", "[memory]")
+{
+    bool was_enabled = cxplat_set_slab_allocator_enabled(true);
+
+    // Allocate across every size class, with and without cache alignment.
+    cxplat_pool_flags_t aligned_pool_flags =
+        (cxplat_pool_flags_t)(CXPLAT_POOL_FLAG_NON_PAGED | CXPLAT_POOL_FLAG_CACHE_ALIGNED);
+    std::vector<std::pair<uint8_t*, size_t>> buffers;
+    for (size_t size = 1; size <= 2048; size *= 2) {
+        uint8_t* buffer = (uint8_t*)cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, size, TEST_TAG);
+        REQUIRE(buffer != nullptr);
+        REQUIRE(buffer[0] == 0);
+        REQUIRE(buffer[size - 1] == 0);
+        memset(buffer, 0xAB, size);
+        buffers.emplace_back(buffer, size);
+
+        uint8_t* aligned_buffer = (uint8_t*)cxplat_allocate(aligned_pool_flags, size, TEST_TAG);
+        REQUIRE(aligned_buffer != nullptr);
+        REQUIRE((((uintptr_t)aligned_buffer) % 64) == 0);
+        cxplat_free(aligned_buffer, aligned_pool_flags, TEST_TAG);
+    }
+
+    // Grow an allocation out of the slab allocator and back in again.
+    uint8_t* buffer = (uint8_t*)cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, 100, TEST_TAG);
+    REQUIRE(buffer != nullptr);
+    memset(buffer, 0x42, 100);
+    buffer = (uint8_t*)cxplat_reallocate(buffer, CXPLAT_POOL_FLAG_NON_PAGED, 100, 4096, TEST_TAG);
+    REQUIRE(buffer != nullptr);
+    REQUIRE(buffer[99] == 0x42);
+    REQUIRE(buffer[4095] == 0);
+    buffer = (uint8_t*)cxplat_reallocate(buffer, CXPLAT_POOL_FLAG_NON_PAGED, 4096, 200, TEST_TAG);
+    REQUIRE(buffer != nullptr);
+    REQUIRE(buffer[99] == 0x42);
+
+    // Memory allocated from the slab allocator can still be freed after it is disabled.
+    cxplat_set_slab_allocator_enabled(false);
+    cxplat_free(buffer, CXPLAT_POOL_FLAG_NON_PAGED, TEST_TAG);
+    for (auto& [allocation, size] : buffers) {
+        REQUIRE(allocation[size - 1] == 0xAB);
+        cxplat_free(allocation, CXPLAT_POOL_FLAG_NON_PAGED, TEST_TAG);
+    }
+
+    cxplat_set_slab_allocator_enabled(was_enabled);
+}
+
+TEST_CASE("slab allocator across threads", "[memory]")
+{
+    bool was_enabled = cxplat_set_slab_allocator_enabled(true);
+
+    // Allocate on one set of threads and free on another, so blocks migrate between thread caches.
+    const size_t thread_count = 4;
+    const size_t allocations_per_thread = 10000;
+    std::vector<std::vector<void*>> allocations(thread_count);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i]() {
+            for (size_t j = 0; j < allocations_per_thread; j++) {
+                allocations[i].push_back(cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, 64, TEST_TAG));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i]() {
+            for (void* allocation : allocations[(i + 1) % thread_count]) {
+                cxplat_free(allocation, CXPLAT_POOL_FLAG_NON_PAGED, TEST_TAG);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& thread_allocations : allocations) {
+        for (void* allocation : thread_allocations) {
+            REQUIRE(allocation != nullptr);
+        }
+    }
+
+    cxplat_set_slab_allocator_enabled(was_enabled);
+}
+
+TEST_CASE("allocator benchmark", "[.][memory][benchmark]")
+{
+    bool was_enabled = cxplat_set_slab_allocator_enabled(false);
+    const size_t iterations = 100000;
+
+    auto run = [&](size_t thread_count, size_t size) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&]() {
+                for (size_t j = 0; j < iterations; j++) {
+                    void* allocation = cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, size, TEST_TAG);
+                    cxplat_free(allocation, CXPLAT_POOL_FLAG_NON_PAGED, TEST_TAG);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return thread_count;
+    };
+
+    for (bool slab : {false, true}) {
+        cxplat_set_slab_allocator_enabled(slab);
+        std::string allocator = (slab) ? "slab" : "heap";
+        for (size_t size : {32, 512}) {
+            for (size_t thread_count : {1, 4}) {
+                BENCHMARK(
+                    allocator + ", " + std::to_string(size) + " bytes, " + std::to_string(thread_count) + " threads")
+                {
+                    return run(thread_count, size);
+                };
+            }
+        }
+    }
+
+    cxplat_set_slab_allocator_enabled(was_enabled);
+}
+#endif
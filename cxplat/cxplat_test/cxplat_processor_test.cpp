@@ -25,7 +25,7 @@ TEST_CASE("processor", "[processor]")
 TEST_CASE("queued_spin_lock", "[processor]")
 {
     REQUIRE(cxplat_initialize() == CXPLAT_STATUS_SUCCESS);
-    cxplat_queue_spin_lock_t lock;
+    cxplat_queue_spin_lock_t lock = {};
     cxplat_lock_queue_handle_t handle;
     cxplat_acquire_in_stack_queued_spin_lock(&lock, &handle);
     cxplat_release_in_stack_queued_spin_lock(&handle);
@@ -44,7 +44,7 @@ TEST_CASE("spin_lock", "[processor]")
 {
     REQUIRE(cxplat_initialize() == CXPLAT_STATUS_SUCCESS);
     cxplat_irql_t irql;
-    cxplat_spin_lock_t lock;
+    cxplat_spin_lock_t lock = 0;
     REQUIRE(cxplat_get_current_irql() == PASSIVE_LEVEL);
     irql = cxplat_acquire_spin_lock(&lock);
     REQUIRE(cxplat_get_current_irql() == DISPATCH_LEVEL);
@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#if !defined(CMAKE_NUGET)
+#include <catch2/catch_all.hpp>
+#else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+#endif
+#include "cxplat.h"
+#include "cxplat_ring_buffer.h"
+
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef struct _test_record
+{
+    uint32_t producer;
+    uint32_t sequence;
+} test_record_t;
+
+static void
+_produce(_Inout_ cxplat_ring_buffer_t* ring, size_t length, uint8_t fill)
+{
+    uint8_t* data;
+    REQUIRE(cxplat_ring_buffer_reserve(ring, length, &data) == CXPLAT_STATUS_SUCCESS);
+    memset(data, fill, length);
+    cxplat_ring_buffer_commit(ring, data);
+}
+
+static void
+_consume(_Inout_ cxplat_ring_buffer_t* ring, size_t expected_length, uint8_t expected_fill)
+{
+    const uint8_t* data;
+    size_t length;
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(length == expected_length);
+    for (size_t i = 0; i < length; i++) {
+        REQUIRE(data[i] == expected_fill);
+    }
+    cxplat_ring_buffer_return(ring);
+}
+
+TEST_CASE("ring_buffer_allocate", "[ring_buffer]")
+{
+    size_t granularity = cxplat_get_ring_buffer_granularity();
+    cxplat_ring_buffer_t* ring = nullptr;
+    REQUIRE(cxplat_allocate_ring_buffer(0, &ring) == CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(cxplat_allocate_ring_buffer(granularity + 1, &ring) == CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(ring == nullptr);
+
+    REQUIRE(cxplat_allocate_ring_buffer(2 * granularity, &ring) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_ring_buffer_get_capacity(ring) == 2 * granularity);
+
+    // The data pages are mapped twice, back to back.
+    uint8_t* data = cxplat_ring_buffer_get_data(ring);
+    data[0] = 42;
+    data[2 * granularity + 1] = 43;
+    REQUIRE(data[2 * granularity] == 42);
+    REQUIRE(data[1] == 43);
+
+    // So is the read-only mapping, which is only created once.
+    const uint8_t* readonly_data = cxplat_ring_buffer_map_readonly(ring);
+    REQUIRE(readonly_data != nullptr);
+    REQUIRE(readonly_data != data);
+    REQUIRE(readonly_data[0] == 42);
+    REQUIRE(readonly_data[2 * granularity + 1] == 43);
+    REQUIRE(cxplat_ring_buffer_map_readonly(ring) == readonly_data);
+
+    cxplat_free_ring_buffer(ring);
+    cxplat_free_ring_buffer(nullptr);
+}
+
+TEST_CASE("ring_buffer_reserve_and_consume", "[ring_buffer]")
+{
+    cxplat_ring_buffer_t* ring = nullptr;
+    REQUIRE(cxplat_allocate_ring_buffer(cxplat_get_ring_buffer_granularity(), &ring) == CXPLAT_STATUS_SUCCESS);
+    size_t capacity = cxplat_ring_buffer_get_capacity(ring);
+
+    const uint8_t* data;
+    size_t length;
+    uint8_t* reserved;
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+    REQUIRE(cxplat_ring_buffer_reserve(ring, 0, &reserved) == CXPLAT_STATUS_INVALID_PARAMETER);
+    REQUIRE(cxplat_ring_buffer_reserve(ring, capacity, &reserved) == CXPLAT_STATUS_INVALID_PARAMETER);
+
+    _produce(ring, 5, 1);
+    _produce(ring, 16, 2);
+    _consume(ring, 5, 1);
+    _consume(ring, 16, 2);
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+
+    // A record committed after a later one is still read first, and discarded records are skipped.
+    uint8_t* first;
+    uint8_t* second;
+    uint8_t* third;
+    REQUIRE(cxplat_ring_buffer_reserve(ring, 8, &first) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_ring_buffer_reserve(ring, 8, &second) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_ring_buffer_reserve(ring, 8, &third) == CXPLAT_STATUS_SUCCESS);
+    memset(third, 3, 8);
+    cxplat_ring_buffer_commit(ring, third);
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+    cxplat_ring_buffer_discard(ring, second);
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+    memset(first, 1, 8);
+    cxplat_ring_buffer_commit(ring, first);
+    _consume(ring, 8, 1);
+    _consume(ring, 8, 3);
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+
+    // Fill the ring buffer until no record fits, then make room for one that wraps around the end.
+    size_t record_length = 64 - sizeof(cxplat_ring_buffer_record_header_t);
+    size_t produced = 0;
+    while (cxplat_ring_buffer_reserve(ring, record_length, &reserved) == CXPLAT_STATUS_SUCCESS) {
+        memset(reserved, (uint8_t)produced, record_length);
+        cxplat_ring_buffer_commit(ring, reserved);
+        produced++;
+    }
+    REQUIRE(produced == capacity / 64);
+    _consume(ring, record_length, 0);
+    _consume(ring, record_length, 1);
+    _produce(ring, 2 * record_length, 0xff);
+    for (size_t i = 2; i < produced; i++) {
+        _consume(ring, record_length, (uint8_t)i);
+    }
+    _consume(ring, 2 * record_length, 0xff);
+    REQUIRE(cxplat_ring_buffer_peek(ring, &data, &length) == CXPLAT_STATUS_NOT_FOUND);
+
+    cxplat_free_ring_buffer(ring);
+}
+
+TEST_CASE("ring_buffer_wait", "[ring_buffer]")
+{
+    cxplat_ring_buffer_t* ring = nullptr;
+    REQUIRE(cxplat_allocate_ring_buffer(cxplat_get_ring_buffer_granularity(), &ring) == CXPLAT_STATUS_SUCCESS);
+
+    REQUIRE(!cxplat_ring_buffer_wait(ring, 10));
+
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        _produce(ring, 8, 7);
+    });
+    REQUIRE(cxplat_ring_buffer_wait(ring, UINT32_MAX));
+    producer.join();
+    _consume(ring, 8, 7);
+
+    cxplat_free_ring_buffer(ring);
+}
+
+TEST_CASE("ring_buffer_multiple_producers", "[ring_buffer]")
+{
+    cxplat_ring_buffer_t* ring = nullptr;
+    REQUIRE(cxplat_allocate_ring_buffer(cxplat_get_ring_buffer_granularity(), &ring) == CXPLAT_STATUS_SUCCESS);
+
+    // Each producer's records must arrive complete and in the order it committed them.
+    const uint32_t producer_count = 4;
+    const uint32_t records_per_producer = 20000;
+    std::vector<std::thread> producers;
+    for (uint32_t i = 0; i < producer_count; i++) {
+        producers.emplace_back([&, i]() {
+            for (uint32_t sequence = 0; sequence < records_per_producer;) {
+                uint8_t* data;
+                if (cxplat_ring_buffer_reserve(ring, sizeof(test_record_t), &data) != CXPLAT_STATUS_SUCCESS) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                test_record_t record = {i, sequence++};
+                memcpy(data, &record, sizeof(record));
+                cxplat_ring_buffer_commit(ring, data);
+            }
+        });
+    }
+
+    std::vector<uint32_t> next_sequence(producer_count, 0);
+    bool in_order = true;
+    for (uint32_t received = 0; received < producer_count * records_per_producer; received++) {
+        const uint8_t* data;
+        size_t length;
+        while (cxplat_ring_buffer_peek(ring, &data, &length) != CXPLAT_STATUS_SUCCESS) {
+            (void)cxplat_ring_buffer_wait(ring, UINT32_MAX);
+        }
+        test_record_t record;
+        memcpy(&record, data, sizeof(record));
+        cxplat_ring_buffer_return(ring);
+        in_order = in_order && length == sizeof(record) && record.producer < producer_count &&
+                   record.sequence == next_sequence[record.producer]++;
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    REQUIRE(in_order);
+
+    cxplat_free_ring_buffer(ring);
+}
+
+TEST_CASE("ring_buffer_benchmark", "[.][ring_buffer][benchmark]")
+{
+    const size_t records_per_run = 100000;
+    cxplat_ring_buffer_t* ring = nullptr;
+    REQUIRE(cxplat_allocate_ring_buffer(1024 * 1024, &ring) == CXPLAT_STATUS_SUCCESS);
+
+    // Each run moves a fixed number of records through the ring buffer, so the records per second are the number
+    // of records divided by the mean time of a run.
+    auto run = [&](size_t producer_count, size_t record_length) {
+        std::vector<std::thread> producers;
+        for (size_t i = 0; i < producer_count; i++) {
+            producers.emplace_back([&]() {
+                for (size_t j = 0; j < records_per_run / producer_count;) {
+                    uint8_t* data;
+                    if (cxplat_ring_buffer_reserve(ring, record_length, &data) != CXPLAT_STATUS_SUCCESS) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    memset(data, 0, record_length);
+                    cxplat_ring_buffer_commit(ring, data);
+                    j++;
+                }
+            });
+        }
+        size_t received = 0;
+        for (; received < (records_per_run / producer_count) * producer_count; received++) {
+            const uint8_t* data;
+            size_t length;
+            while (cxplat_ring_buffer_peek(ring, &data, &length) != CXPLAT_STATUS_SUCCESS) {
+                (void)cxplat_ring_buffer_wait(ring, UINT32_MAX);
+            }
+            cxplat_ring_buffer_return(ring);
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        return received;
+    };
+
+    for (size_t record_length : {16, 64, 256, 1024}) {
+        for (size_t producer_count : {1, 4}) {
+            BENCHMARK(
+                std::to_string(records_per_run) + " records of " + std::to_string(record_length) + " bytes, " +
+                std::to_string(producer_count) + " producers")
+            {
+                return run(producer_count, record_length);
+            };
+        }
+    }
+
+    cxplat_free_ring_buffer(ring);
+}
@@ -7,7 +7,11 @@
 #include <catch2/catch.hpp>
 #endif
 #include "cxplat.h"
-#include <windows.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 TEST_CASE("rundown_protection", "[rundown]")
 {
@@ -22,3 +26,54 @@ TEST_CASE("rundown_protection", "[rundown]")
     cxplat_release_rundown_protection(&rundown_reference);
     cxplat_wait_for_rundown_protection_release(&rundown_reference);
 }
+
+TEST_CASE("rundown_protection_extra_release", "[rundown]")
+{
+    cxplat_rundown_reference_t rundown_reference;
+    cxplat_initialize_rundown_protection(&rundown_reference);
+    REQUIRE_THROWS_AS(cxplat_release_rundown_protection(&rundown_reference), std::runtime_error);
+
+    // The failed release leaves the state untouched, so the reference still works.
+    REQUIRE(cxplat_acquire_rundown_protection(&rundown_reference));
+    cxplat_release_rundown_protection(&rundown_reference);
+    cxplat_wait_for_rundown_protection_release(&rundown_reference);
+    REQUIRE_THROWS_AS(cxplat_release_rundown_protection(&rundown_reference), std::runtime_error);
+    cxplat_reinitialize_rundown_protection(&rundown_reference);
+}
+
+TEST_CASE("rundown_protection_concurrent", "[rundown]")
+{
+    cxplat_rundown_reference_t rundown_reference;
+    cxplat_initialize_rundown_protection(&rundown_reference);
+
+    // Hammer acquire and release from several threads until rundown starts.
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> active_after_rundown = 0;
+    std::atomic<bool> rundown_complete = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            while (!stop) {
+                if (cxplat_acquire_rundown_protection(&rundown_reference)) {
+                    if (rundown_complete) {
+                        active_after_rundown++;
+                    }
+                    cxplat_release_rundown_protection(&rundown_reference);
+                }
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    cxplat_wait_for_rundown_protection_release(&rundown_reference);
+    rundown_complete = true;
+
+    // No reference can be acquired once rundown has completed.
+    REQUIRE(!cxplat_acquire_rundown_protection(&rundown_reference));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(active_after_rundown == 0);
+}
@@ -8,12 +8,13 @@
 #endif
 #include "cxplat.h"
 
-#include <Windows.h>
+#include <chrono>
+#include <thread>
 
 TEST_CASE("query_time_precise_include_suspend", "[time]")
 {
     uint64_t time1 = cxplat_query_time_since_boot_precise(true);
-    Sleep(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
     uint64_t time2 = cxplat_query_time_since_boot_precise(true);
 
     // The time difference should be at least 10000 filetime units (1ms)
@@ -23,7 +24,7 @@ TEST_CASE("query_time_precise_include_suspend", "[time]")
 TEST_CASE("query_time_precise", "[time]")
 {
     uint64_t time1 = cxplat_query_time_since_boot_precise(false);
-    Sleep(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
     uint64_t time2 = cxplat_query_time_since_boot_precise(false);
 
     // The time difference should be at least 10000 filetime units (1ms)
@@ -33,7 +34,7 @@ TEST_CASE("query_time_precise", "[time]")
 TEST_CASE("query_time_approximate_include_suspend", "[time]")
 {
     uint64_t time1 = cxplat_query_time_since_boot_approximate(true);
-    Sleep(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
     uint64_t time2 = cxplat_query_time_since_boot_approximate(true);
 
     // The time difference should be at least 10000 filetime units (1ms)
@@ -43,7 +44,7 @@ TEST_CASE("query_time_approximate_include_suspend", "[time]")
 TEST_CASE("query_time_approximate", "[time]")
 {
     uint64_t time1 = cxplat_query_time_since_boot_approximate(false);
-    Sleep(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
     uint64_t time2 = cxplat_query_time_since_boot_approximate(false);
 
     // The time difference should be at least 10000 filetime units (1ms)
@@ -7,7 +7,11 @@
 #include <catch2/catch.hpp>
 #endif
 #include "cxplat.h"
-#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 typedef struct _work_item_context
 {
@@ -40,7 +44,7 @@ TEST_CASE("queue_preemptible_work_item and free afterwards", "[workitem]")
         CXPLAT_STATUS_SUCCESS);
 
     cxplat_queue_preemptible_work_item(work_item);
-    Sleep(500);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
     REQUIRE(context.value == 2);
 
     // Verify we can re-queue the same work item after it's completed the first time,
@@ -85,3 +89,112 @@ TEST_CASE("free_preemptible_work_item", "[workitem]")
 
     cxplat_cleanup();
 }
+
+static void
+_test_counting_work_item_routine(_In_ cxplat_preemptible_work_item_t* work_item, _Inout_opt_ void* context)
+{
+    (void)work_item;
+    (*(std::atomic<long>*)context)++;
+}
+
+TEST_CASE("queue_preemptible_work_item from many threads", "[workitem]")
+{
+    REQUIRE(cxplat_initialize() == CXPLAT_STATUS_SUCCESS);
+
+    const size_t thread_count = 8;
+    const size_t work_items_per_thread = 64;
+    const size_t queues_per_work_item = 16;
+    std::atomic<long> run_count = 0;
+    std::vector<cxplat_preemptible_work_item_t*> work_items(thread_count * work_items_per_thread);
+    for (auto& work_item : work_items) {
+        REQUIRE(
+            cxplat_allocate_preemptible_work_item(
+                nullptr, &work_item, _test_counting_work_item_routine, (void*)&run_count) == CXPLAT_STATUS_SUCCESS);
+    }
+
+    // Queueing a work item that is already queued runs it again, so every queue is counted.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i]() {
+            for (size_t j = 0; j < queues_per_work_item; j++) {
+                for (size_t k = 0; k < work_items_per_thread; k++) {
+                    cxplat_queue_preemptible_work_item(work_items[i * work_items_per_thread + k]);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    cxplat_wait_for_preemptible_work_items_complete();
+    REQUIRE(run_count == (long)(thread_count * work_items_per_thread * queues_per_work_item));
+
+    // Waiting doesn't stop more work items being queued.
+    cxplat_queue_preemptible_work_item(work_items[0]);
+    cxplat_wait_for_preemptible_work_items_complete();
+    REQUIRE(run_count == (long)(thread_count * work_items_per_thread * queues_per_work_item + 1));
+
+    for (auto work_item : work_items) {
+        cxplat_free_preemptible_work_item(work_item);
+    }
+    cxplat_cleanup();
+}
+
+typedef struct _order_work_item_context
+{
+    std::vector<size_t>* order;
+    size_t index;
+} order_work_item_context_t;
+
+static void
+_test_order_work_item_routine(_In_ cxplat_preemptible_work_item_t* work_item, _Inout_opt_ void* context)
+{
+    (void)work_item;
+    order_work_item_context_t* order_context = (order_work_item_context_t*)context;
+    order_context->order->push_back(order_context->index);
+}
+
+TEST_CASE("cxplat_set_work_item_thread_count", "[workitem]")
+{
+    // Setting the count before initializing applies once the threads start.
+    REQUIRE(cxplat_set_work_item_thread_count(1) == CXPLAT_STATUS_SUCCESS);
+    REQUIRE(cxplat_initialize() == CXPLAT_STATUS_SUCCESS);
+
+    const size_t work_item_count = 64;
+    std::vector<size_t> order;
+    std::vector<order_work_item_context_t> contexts(work_item_count);
+    std::vector<cxplat_preemptible_work_item_t*> work_items(work_item_count);
+    for (size_t i = 0; i < work_item_count; i++) {
+        contexts[i] = {&order, i};
+        REQUIRE(
+            cxplat_allocate_preemptible_work_item(
+                nullptr, &work_items[i], _test_order_work_item_routine, &contexts[i]) == CXPLAT_STATUS_SUCCESS);
+    }
+
+    // A single thread runs the work items in the order they were queued.
+    for (auto work_item : work_items) {
+        cxplat_queue_preemptible_work_item(work_item);
+    }
+    cxplat_wait_for_preemptible_work_items_complete();
+    REQUIRE(order.size() == work_item_count);
+    for (size_t i = 0; i < work_item_count; i++) {
+        REQUIRE(order[i] == i);
+    }
+
+    // Setting the count while initialized restarts the threads, and work items still run afterwards.
+    REQUIRE(cxplat_set_work_item_thread_count(0) == CXPLAT_STATUS_SUCCESS);
+    std::atomic<long> run_count = 0;
+    cxplat_preemptible_work_item_t* work_item = nullptr;
+    REQUIRE(
+        cxplat_allocate_preemptible_work_item(
+            nullptr, &work_item, _test_counting_work_item_routine, (void*)&run_count) == CXPLAT_STATUS_SUCCESS);
+    cxplat_queue_preemptible_work_item(work_item);
+    cxplat_wait_for_preemptible_work_items_complete();
+    REQUIRE(run_count == 1);
+
+    cxplat_free_preemptible_work_item(work_item);
+    for (auto order_work_item : work_items) {
+        cxplat_free_preemptible_work_item(order_work_item);
+    }
+    cxplat_cleanup();
+}
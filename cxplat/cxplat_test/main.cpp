@@ -0,0 +1,13 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This executable supplies its own main so that it can replay tests in-process under fault injection. Since main is
+// defined here, the linker doesn't pull the default one from Catch2WithMain.
+#include "cxplat_fault_injection_driver.h"
+CATCH_REGISTER_LISTENER(cxplat_fault_injection_listener)
+
+int
+main(int argc, char* argv[])
+{
+    return cxplat_fault_injection_main(argc, argv);
+}
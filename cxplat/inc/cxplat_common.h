@@ -28,4 +28,5 @@ typedef _Return_type_success_(CXPLAT_SUCCEEDED(return )) enum {
     CXPLAT_STATUS_ARITHMETIC_OVERFLOW = CXPLAT_PLATFORM_STATUS_ARITHMETIC_OVERFLOW,
     CXPLAT_STATUS_INVALID_STATE = CXPLAT_PLATFORM_STATUS_INVALID_STATE,
     CXPLAT_STATUS_NOT_FOUND = CXPLAT_PLATFORM_STATUS_NOT_FOUND,
+    CXPLAT_STATUS_INVALID_PARAMETER = CXPLAT_PLATFORM_STATUS_INVALID_PARAMETER,
 } cxplat_status_t;
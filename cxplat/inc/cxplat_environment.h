@@ -0,0 +1,20 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "cxplat_common.h"
+
+#include <stdbool.h>
+
+CXPLAT_EXTERN_C_BEGIN
+
+/**
+ * @brief Get an environment variable as a boolean. Only user mode platforms have an environment.
+ *
+ * @param[in] name Environment variable name.
+ * @retval false Environment variable is set to "false", "0", or if it's not set.
+ * @retval true Environment variable is set to any other value.
+ */
+bool
+cxplat_get_environment_variable_as_bool(_In_z_ const char* name);
+
+CXPLAT_EXTERN_C_END
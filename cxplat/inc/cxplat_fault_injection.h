@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "cxplat_common.h"
+
+/**
+ * @brief Classes of call sites that a fault injection schedule can fail independently.
+ */
+typedef enum _cxplat_fault_injection_class
+{
+    CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION, ///< Memory allocations.
+    CXPLAT_FAULT_INJECTION_CLASS_WORK_ITEM,  ///< Work item creation.
+    CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN,    ///< Rundown protection acquisition.
+    CXPLAT_FAULT_INJECTION_CLASS_OTHER,      ///< Any other call to cxplat_fault_injection_inject_fault().
+    CXPLAT_FAULT_INJECTION_CLASS_COUNT,
+} cxplat_fault_injection_class_t;
+
+#ifndef CXPLAT_DEBUGGING_FEATURES_ENABLED
+#define cxplat_fault_injection_is_enabled() false
+#define cxplat_fault_injection_inject_fault() false
+#define cxplat_fault_injection_inject_fault_for_class(fault_class) false
+#else
+#include <stdbool.h>
+#include <stdint.h>
+
+CXPLAT_EXTERN_C_BEGIN
+
+/**
+ * @brief Initialize fault injection.  This must be called before any other
+ * fault injection functions. This function is not thread safe.
+ *
+ * @param[in] stack_depth Number of stack frames to capture when a fault is
+ * injected.
+ *
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_OUT_OF_MEMORY Operation failed due to memory allocation failure.
+ * @retval CXPLAT_STATUS_INVALID_STATE Operation failed due to invalid state (e.g. already initialized).
+ */
+cxplat_status_t
+cxplat_fault_injection_initialize(size_t stack_depth) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Uninitialize fault injection. This must be called after all other
+ * fault injection functions. This function is not thread safe.
+ */
+void
+cxplat_fault_injection_uninitialize() CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Enable fault injection. This function is thread safe.
+ *
+ * @retval true Fault should be injected.
+ * @retval false Fault should not be injected.
+ */
+bool
+cxplat_fault_injection_inject_fault() CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Test if fault injection is enabled. This function is thread safe.
+ *
+ * @retval true Fault injection is enabled.
+ * @retval false Fault injection is disabled.
+ */
+bool
+cxplat_fault_injection_is_enabled() CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Reset fault injection. This function is thread safe.
+ */
+void
+cxplat_fault_injection_reset() CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Add a module to the fault injection list. This function is thread safe.
+ *
+ * @param[in] module_handle
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_OUT_OF_MEMORY Operation failed due to memory allocation failure.
+ * @retval CXPLAT_STATUS_INVALID_STATE Operation failed due to invalid state (e.g. already added).
+ */
+cxplat_status_t
+cxplat_fault_injection_add_module(_In_ void* module_handle) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Remove a module from the fault injection list. This function is thread safe.
+ *
+ * @param[in] module_handle
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_OUT_OF_MEMORY Operation failed due to memory allocation failure.
+ * @retval CXPLAT_STATUS_INVALID_STATE Operation failed due to invalid state (e.g. already removed).
+ */
+cxplat_status_t
+cxplat_fault_injection_remove_module(_In_ void* module_handle) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Decide whether to inject a fault at a call site of the given class.
+ * Allocation and other sites are failed by every fault injection mode, while
+ * work item and rundown sites are only failed by a schedule. This function is
+ * thread safe.
+ *
+ * @param[in] fault_class Class of the call site.
+ * @retval true Fault should be injected.
+ * @retval false Fault should not be injected.
+ */
+bool
+cxplat_fault_injection_inject_fault_for_class(cxplat_fault_injection_class_t fault_class) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief How a fault injection schedule fails the call sites of one class.
+ */
+typedef struct _cxplat_fault_injection_class_schedule
+{
+    uint32_t one_in;    ///< Fail each call with a probability of 1 in one_in, or never if 0.
+    uint64_t countdown; ///< Fail the call with this 1-based index, or none if 0.
+} cxplat_fault_injection_class_schedule_t;
+
+/**
+ * @brief A deterministic fault injection schedule. Whether the Nth call at
+ * sites of a class fails depends only on the seed, the class and N, so a
+ * given schedule produces the same failure sequence on every run.
+ */
+typedef struct _cxplat_fault_injection_schedule
+{
+    uint64_t seed;
+    cxplat_fault_injection_class_schedule_t classes[CXPLAT_FAULT_INJECTION_CLASS_COUNT];
+} cxplat_fault_injection_schedule_t;
+
+/**
+ * @brief Maximum length of a replay token, including the terminating null.
+ */
+#define CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_SIZE 256
+
+/**
+ * @brief Start following a fault injection schedule, restarting the call
+ * counts of every class. While a schedule is set, it decides every fault
+ * instead of the tracked stacks. This function is not thread safe.
+ *
+ * @param[in] schedule Schedule to follow, or NULL to stop following one.
+ */
+void
+cxplat_fault_injection_set_schedule(_In_opt_ const cxplat_fault_injection_schedule_t* schedule) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Format a schedule as a compact replay token of the form
+ * "1:<seed>:<one_in>,<countdown>:..." with one pair per class, in hexadecimal.
+ *
+ * @param[in] schedule Schedule to format.
+ * @param[out] token Buffer to receive the null-terminated token.
+ * @param[in] token_size Size of the buffer, at least CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_SIZE.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_INVALID_PARAMETER The buffer is too small.
+ */
+cxplat_status_t
+cxplat_fault_injection_format_replay_token(
+    _In_ const cxplat_fault_injection_schedule_t* schedule,
+    _Out_writes_z_(token_size) char* token,
+    size_t token_size) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Parse a replay token produced by cxplat_fault_injection_format_replay_token.
+ *
+ * @param[in] token Null-terminated token.
+ * @param[out] schedule Schedule described by the token.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_INVALID_PARAMETER The token is malformed.
+ */
+cxplat_status_t
+cxplat_fault_injection_parse_replay_token(
+    _In_z_ const char* token, _Out_ cxplat_fault_injection_schedule_t* schedule) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Results of an in-process fault injection run.
+ */
+typedef struct _cxplat_fault_injection_site_run_result
+{
+    size_t sites_reached;      ///< Number of fault injection sites reached during the run.
+    bool fault_injected;       ///< Whether the site to fail was reached and failed.
+    size_t leaked_allocations; ///< Allocations leaked during the run, if leak detection is enabled.
+} cxplat_fault_injection_site_run_result_t;
+
+/**
+ * @brief Start an in-process fault injection run. Until the run is stopped, every call to
+ * cxplat_fault_injection_inject_fault() is counted as a fault injection site, and only the site with the given index
+ * fails, whether or not fault injection was initialized. A test driver can count the sites a test reaches by running
+ * it with site_to_fail set to 0, and then replay the test once per site. This function is not thread safe.
+ *
+ * @param[in] site_to_fail 1-based index of the site to fail, or 0 to fail none.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_INVALID_STATE A run is already in progress.
+ */
+cxplat_status_t
+cxplat_fault_injection_start_site_run(size_t site_to_fail) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Stop an in-process fault injection run. Leaks are counted from the allocations made during the run that are
+ * still outstanding, plus any reported if cxplat was cleaned up during the run. This function is not thread safe.
+ *
+ * @param[out] result Results of the run.
+ */
+void
+cxplat_fault_injection_stop_site_run(_Out_ cxplat_fault_injection_site_run_result_t* result) CXPLAT_NOEXCEPT;
+
+CXPLAT_EXTERN_C_END
+#endif
@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "catch2/catch_all.hpp"
+#include "cxplat.h"
+#include "cxplat_fault_injection.h"
+
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A Catch2 listener that records whether the current test case threw an
+ * unexpected exception or hit a fatal error, which the in-process fault
+ * injection driver reports as a crash. Assertions that fail because of an
+ * injected fault are expected and are not counted.
+ */
+class cxplat_fault_injection_listener : public Catch::EventListenerBase
+{
+  public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void
+    testCaseStarting(Catch::TestCaseInfo const&) override
+    {
+        crashed = false;
+    }
+
+    void
+    assertionEnded(Catch::AssertionStats const& assertionStats) override
+    {
+        auto result_type = assertionStats.assertionResult.getResultType();
+        if (result_type == Catch::ResultWas::ThrewException || result_type == Catch::ResultWas::FatalErrorCondition) {
+            crashed = true;
+        }
+    }
+
+    inline static bool crashed = false;
+};
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+/**
+ * @brief Escape a test name so that a test spec matches exactly that test.
+ */
+inline std::string
+_cxplat_escape_test_name(const std::string& name)
+{
+    std::string escaped;
+    for (char c : name) {
+        if (c == '\\' || c == '[' || c == ']' || c == ',' || c == '*' || c == '"' || c == '~') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+/**
+ * @brief Run the session's single selected test with one fault injection site failed.
+ *
+ * @param[in,out] session Session selecting the test to run.
+ * @param[in] site_to_fail 1-based index of the site to fail, or 0 to fail none.
+ * @param[in] reset_state Optional callback to restore state a failed test may have left behind.
+ * @param[out] result Results of the run.
+ */
+inline void
+_cxplat_fault_injection_run_site(
+    Catch::Session& session,
+    size_t site_to_fail,
+    const std::function<void()>& reset_state,
+    _Out_ cxplat_fault_injection_site_run_result_t* result)
+{
+    // Work items queued by the test would otherwise reach their sites in whatever order the pool's threads run them,
+    // so run them on one thread, in the order they were queued, to give each site the same number on every run. This
+    // is set for every run in case a test changed it.
+    if (cxplat_set_work_item_thread_count(1) != CXPLAT_STATUS_SUCCESS) {
+        throw std::runtime_error("Unable to run work items on a single thread");
+    }
+    if (cxplat_fault_injection_start_site_run(site_to_fail) != CXPLAT_STATUS_SUCCESS) {
+        throw std::logic_error("A fault injection run is already in progress");
+    }
+    (void)session.run();
+
+    // Let work queued by the test finish so that its allocations aren't mistaken for leaks.
+    cxplat_wait_for_preemptible_work_items_complete();
+    cxplat_fault_injection_stop_site_run(result);
+    if (reset_state) {
+        reset_state();
+    }
+}
+
+/**
+ * @brief Run each test selected by the session once per fault injection site
+ * it reaches, failing a different site each time, all in this process. Each
+ * site is reported as having crashed, leaked, or passed. A test failing its
+ * assertions because of the injected fault counts as passing.
+ *
+ * @param[in,out] session Session whose command line selects the tests to run.
+ * @param[in] reset_state Optional callback run after each run to restore state
+ * a failed test may have left behind, such as a raised IRQL.
+ * @retval 0 No site crashed or leaked.
+ * @retval 1 At least one site crashed or leaked.
+ */
+inline int
+cxplat_fault_injection_run_sites(Catch::Session& session, const std::function<void()>& reset_state = nullptr)
+{
+    // Resolve the test names up front, since each run below narrows the session to a single test.
+    std::vector<std::string> test_names;
+    auto& config = session.config();
+    for (auto& test_case : Catch::filterTests(Catch::getAllTestCasesSorted(config), config.testSpec(), config)) {
+        test_names.push_back(test_case.getTestCaseInfo().name);
+    }
+
+    Catch::ConfigData config_data = session.configData();
+    size_t failed_sites = 0;
+    for (auto& test_name : test_names) {
+        config_data.testsOrTags = {_cxplat_escape_test_name(test_name)};
+        session.useConfigData(config_data);
+
+        // The first run warms up caches and lazily created state, which would otherwise look like leaks. The second
+        // counts the sites the test reaches and measures the allocations it keeps without a fault.
+        cxplat_fault_injection_site_run_result_t result;
+        _cxplat_fault_injection_run_site(session, 0, reset_state, &result);
+        _cxplat_fault_injection_run_site(session, 0, reset_state, &result);
+        size_t site_count = result.sites_reached;
+        size_t baseline_allocations = result.leaked_allocations;
+
+        size_t crashed_sites = 0;
+        size_t leaked_sites = 0;
+        for (size_t site = 1; site <= site_count; site++) {
+            // Write the site before running it, so that the last line of output identifies a site that kills the
+            // process.
+            std::cout << "Injecting fault at site " << site << " of " << site_count << " in \"" << test_name << "\""
+                      << std::endl;
+            _cxplat_fault_injection_run_site(session, site, reset_state, &result);
+            if (cxplat_fault_injection_listener::crashed) {
+                std::cout << "  Site " << site << " crashed" << std::endl;
+                crashed_sites++;
+            } else if (result.leaked_allocations > baseline_allocations) {
+                std::cout << "  Site " << site << " leaked "
+                          << (result.leaked_allocations - baseline_allocations) << " allocations" << std::endl;
+                leaked_sites++;
+            }
+        }
+        std::cout << "\"" << test_name << "\": " << site_count << " sites, " << crashed_sites << " crashed, "
+                  << leaked_sites << " leaked, " << (site_count - crashed_sites - leaked_sites) << " passed"
+                  << std::endl;
+        failed_sites += crashed_sites + leaked_sites;
+    }
+
+    (void)cxplat_set_work_item_thread_count(0);
+    return (failed_sites == 0) ? 0 : 1;
+}
+#endif
+
+/**
+ * @brief Entry point for a Catch2 test executable. Runs the tests normally
+ * unless --fault-injection-sites is passed, in which case every selected test
+ * is replayed in this process once per fault injection site. The executable
+ * must register cxplat_fault_injection_listener.
+ *
+ * @param[in] argc Argument count.
+ * @param[in] argv Arguments.
+ * @param[in] reset_state Optional callback to restore state between fault injection runs.
+ * @return Process exit code.
+ */
+inline int
+cxplat_fault_injection_main(int argc, char* argv[], const std::function<void()>& reset_state = nullptr)
+{
+    Catch::Session session;
+    bool fault_injection_sites = false;
+    auto cli = session.cli() | Catch::Clara::Opt(fault_injection_sites)["--fault-injection-sites"](
+                                   "replay each test in this process once per fault injection site");
+    session.cli(cli);
+
+    int result = session.applyCommandLine(argc, argv);
+    if (result != 0) {
+        return result;
+    }
+    if (!fault_injection_sites) {
+        return session.run();
+    }
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    return cxplat_fault_injection_run_sites(session, reset_state);
+#else
+    (void)reset_state;
+    std::cerr << "--fault-injection-sites requires a debug build" << std::endl;
+    return 1;
+#endif
+}
@@ -2,11 +2,13 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#if defined(_WIN32)
 #pragma warning(push)
 #pragma warning(disable : 4005 4083 4616)
 #include <driverspecs.h>
-#include <stdint.h>
 #pragma warning(pop)
+#endif
+#include <stdint.h>
 
 CXPLAT_EXTERN_C_BEGIN
 
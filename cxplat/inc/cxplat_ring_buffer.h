@@ -0,0 +1,157 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "cxplat_common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+CXPLAT_EXTERN_C_BEGIN
+
+/***
+ * A ring buffer whose data pages are mapped twice, back to back, so that a record that wraps around the end of the
+ * buffer can still be read and written as one contiguous range.
+ *
+ * Any number of threads can reserve and commit records concurrently, while a single consumer reads them in the order
+ * they were reserved. Each record starts with a cxplat_ring_buffer_record_header_t, and the record after it starts at
+ * the next multiple of CXPLAT_RING_BUFFER_RECORD_ALIGNMENT.
+ */
+typedef struct cxplat_ring_buffer_t cxplat_ring_buffer_t;
+
+#define CXPLAT_RING_BUFFER_RECORD_ALIGNMENT 8
+
+// Set in the length of a record that was discarded instead of committed.
+#define CXPLAT_RING_BUFFER_RECORD_DISCARDED 0x80000000
+
+typedef struct _cxplat_ring_buffer_record_header
+{
+    /// Length of the data after the header, or 0 while the record is not yet committed. Discarded records also have
+    /// CXPLAT_RING_BUFFER_RECORD_DISCARDED set.
+    uint32_t length;
+    uint32_t reserved;
+} cxplat_ring_buffer_record_header_t;
+
+/**
+ * @brief Get the value the capacity of a ring buffer must be a multiple of, which is the allocation granularity
+ * on Windows and the page size on POSIX systems.
+ *
+ * @return Granularity in bytes.
+ */
+size_t
+cxplat_get_ring_buffer_granularity();
+
+/**
+ * @brief Allocate a ring buffer.
+ *
+ * @param[in] capacity Size of the buffer in bytes, which must be a non-zero multiple of
+ *  cxplat_get_ring_buffer_granularity().
+ * @param[out] ring Pointer to memory that will contain the ring buffer on success.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_INVALID_PARAMETER The capacity is not a multiple of the granularity.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to allocate resources for this ring buffer.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_allocate_ring_buffer(size_t capacity, _Outptr_ cxplat_ring_buffer_t** ring);
+
+/**
+ * @brief Free a ring buffer, along with any read-only mapping of it.
+ *
+ * @param[in] ring Ring buffer to free.
+ */
+void
+cxplat_free_ring_buffer(_Frees_ptr_opt_ cxplat_ring_buffer_t* ring);
+
+/**
+ * @brief Get the writable mapping of a ring buffer, which is twice its capacity in size.
+ *
+ * @param[in] ring Ring buffer.
+ * @return Base address of the first copy of the data pages.
+ */
+uint8_t*
+cxplat_ring_buffer_get_data(_In_ const cxplat_ring_buffer_t* ring);
+
+/**
+ * @brief Get the capacity of a ring buffer.
+ *
+ * @param[in] ring Ring buffer.
+ * @return Capacity in bytes.
+ */
+size_t
+cxplat_ring_buffer_get_capacity(_In_ const cxplat_ring_buffer_t* ring);
+
+/**
+ * @brief Get a read-only mapping of a ring buffer, which is twice its capacity in size like the writable one. The
+ * mapping is created the first time it is asked for, and stays valid until the ring buffer is freed.
+ *
+ * @param[in] ring Ring buffer.
+ * @return Base address of the first copy of the data pages, or NULL if the mapping could not be created.
+ */
+_Ret_maybenull_ const uint8_t*
+cxplat_ring_buffer_map_readonly(_Inout_ cxplat_ring_buffer_t* ring);
+
+/**
+ * @brief Reserve space for a record. The caller fills in the data and then passes it to either
+ *  cxplat_ring_buffer_commit() or cxplat_ring_buffer_discard(). Any number of threads can reserve records at once,
+ *  without taking a lock.
+ *
+ * @param[in] ring Ring buffer.
+ * @param[in] length Length of the record data, which must not be 0.
+ * @param[out] data Pointer to memory that will contain the record data on success.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_INVALID_PARAMETER The record could never fit in the ring buffer.
+ * @retval CXPLAT_STATUS_NO_MEMORY The ring buffer doesn't currently have room for the record.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_ring_buffer_reserve(_Inout_ cxplat_ring_buffer_t* ring, size_t length, _Outptr_ uint8_t** data);
+
+/**
+ * @brief Make a reserved record visible to the consumer, waking it if it is waiting.
+ *
+ * @param[in] ring Ring buffer.
+ * @param[in] data Record data returned by cxplat_ring_buffer_reserve().
+ */
+void
+cxplat_ring_buffer_commit(_Inout_ cxplat_ring_buffer_t* ring, _In_ uint8_t* data);
+
+/**
+ * @brief Give up a reserved record. The consumer skips it.
+ *
+ * @param[in] ring Ring buffer.
+ * @param[in] data Record data returned by cxplat_ring_buffer_reserve().
+ */
+void
+cxplat_ring_buffer_discard(_Inout_ cxplat_ring_buffer_t* ring, _In_ uint8_t* data);
+
+/**
+ * @brief Get the oldest committed record without removing it. Only one thread at a time may consume records.
+ *
+ * @param[in] ring Ring buffer.
+ * @param[out] data Pointer to memory that will contain the record data on success.
+ * @param[out] length Pointer to memory that will contain the length of the record data on success.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_NOT_FOUND The oldest record is not yet committed, or there are no records.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_ring_buffer_peek(_Inout_ cxplat_ring_buffer_t* ring, _Outptr_ const uint8_t** data, _Out_ size_t* length);
+
+/**
+ * @brief Remove the record returned by cxplat_ring_buffer_peek(), giving its space back to producers.
+ *
+ * @param[in] ring Ring buffer.
+ */
+void
+cxplat_ring_buffer_return(_Inout_ cxplat_ring_buffer_t* ring);
+
+/**
+ * @brief Wait until the oldest record is committed.
+ *
+ * @param[in] ring Ring buffer.
+ * @param[in] timeout_ms Longest time to wait, in milliseconds, or UINT32_MAX to wait forever.
+ * @retval true A record is ready to be read.
+ * @retval false The wait timed out.
+ */
+bool
+cxplat_ring_buffer_wait(_Inout_ cxplat_ring_buffer_t* ring, uint32_t timeout_ms);
+
+CXPLAT_EXTERN_C_END
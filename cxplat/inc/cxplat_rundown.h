@@ -6,7 +6,7 @@
 CXPLAT_EXTERN_C_BEGIN
 
 /**
- * @brief Initialize the rundown reference table entry for the given context.
+ * @brief Initialize a rundown reference.
  *
  * @param[in] context The address of a cxplat_rundown_reference_t structure.
  */
@@ -14,7 +14,7 @@ void
 cxplat_initialize_rundown_protection(_Out_ cxplat_rundown_reference_t* rundown_reference);
 
 /**
- * @brief Reinitialize the rundown reference table entry for the given context.
+ * @brief Reinitialize a previously run down rundown reference.
  *
  * @param[in] context The address of a previously run down cxplat_rundown_reference_t structure.
  */
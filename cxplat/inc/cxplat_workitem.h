@@ -52,4 +52,19 @@ cxplat_free_preemptible_work_item(_Frees_ptr_opt_ cxplat_preemptible_work_item_t
 void
 cxplat_wait_for_preemptible_work_items_complete();
 
+/**
+ * @brief Set the number of threads that run preemptible work items,
+ *  overriding CXPLAT_WORK_ITEM_THREADS. If cxplat is initialized, the
+ *  threads are restarted once queued work items complete, so no work item
+ *  may be queued concurrently.
+ *
+ * @param[in] thread_count Number of threads, or 0 to go back to
+ *  CXPLAT_WORK_ITEM_THREADS. 1 runs work items one at a time in the order
+ *  they were queued.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to start the threads.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_set_work_item_thread_count(size_t thread_count);
+
 CXPLAT_EXTERN_C_END
@@ -0,0 +1,6 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+// Do not add anything else to this file.
+// Actual platform-specific definitions go in the file below.
+#include "cxplat_posix.h"
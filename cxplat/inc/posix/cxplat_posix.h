@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CXPLAT_RUNTIME_ASSERT(x) assert(x)
+#ifdef NDEBUG // Release build.
+#define CXPLAT_DEBUG_ASSERT(x) (void)(x)
+#else // Debug build.
+#define CXPLAT_DEBUG_ASSERT(x) assert(x)
+#define CXPLAT_DEBUGGING_FEATURES_ENABLED
+#endif //! NDEBUG
+
+// Map specific cxplat_status_t values to negated errno values, as the Linux kernel does.
+#define CXPLAT_PLATFORM_STATUS_SUCCESS 0
+#define CXPLAT_PLATFORM_STATUS_NO_MEMORY (-ENOMEM)
+#define CXPLAT_PLATFORM_STATUS_ARITHMETIC_OVERFLOW (-EOVERFLOW)
+#define CXPLAT_PLATFORM_STATUS_INVALID_STATE (-EBUSY)
+#define CXPLAT_PLATFORM_STATUS_NOT_FOUND (-ENOENT)
+#define CXPLAT_PLATFORM_STATUS_INVALID_PARAMETER (-EINVAL)
+
+#define CXPLAT_SUCCEEDED(status) ((int)(status) >= 0)
+
+typedef struct cxplat_rundown_reference_t
+{
+    volatile uint32_t state; ///< Reference count in the upper bits, rundown active flag in bit 0.
+} cxplat_rundown_reference_t;
+
+// IRQL values, which only exist to satisfy callers written for the Windows kernel.
+#define PASSIVE_LEVEL 0
+#define DISPATCH_LEVEL 2
+#define HIGH_LEVEL 15
+
+// The cxplat headers are annotated for the Microsoft source code annotation language, which other compilers don't
+// understand, so the annotations used by those headers expand to nothing.
+#define _Acquires_lock_(...)
+#define _Deref_out_range_(...)
+#define _Enum_is_bitflag_
+#define _Frees_ptr_
+#define _Frees_ptr_opt_
+#define _Guarded_by_(...)
+#define _IRQL_raises_(...)
+#define _IRQL_requires_(...)
+#define _IRQL_requires_max_(...)
+#define _IRQL_requires_min_(...)
+#define _IRQL_restores_
+#define _IRQL_restores_global_(...)
+#define _IRQL_saves_
+#define _IRQL_saves_global_(...)
+#define _In_
+#define _In_opt_
+#define _In_reads_(...)
+#define _In_z_
+#define _Inout_
+#define _Inout_opt_
+#define _Must_inspect_result_
+#define _Notliteral_
+#define _Out_
+#define _Out_writes_to_(...)
+#define _Out_writes_z_(...)
+#define _Outptr_
+#define _Outptr_result_maybenull_
+#define _Post_invalid_
+#define _Post_same_lock_(...)
+#define _Releases_lock_(...)
+#define _Requires_lock_held_(...)
+#define _Requires_lock_not_held_(...)
+#define _Ret_maybenull_
+#define _Ret_maybenull_z_
+#define _Ret_writes_maybenull_(...)
+#define _Return_type_success_(...)
+#define __drv_allocatesMem(...)
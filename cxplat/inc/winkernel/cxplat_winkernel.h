@@ -20,6 +20,7 @@
 #define CXPLAT_PLATFORM_STATUS_ARITHMETIC_OVERFLOW STATUS_INTEGER_OVERFLOW
 #define CXPLAT_PLATFORM_STATUS_INVALID_STATE STATUS_INVALID_STATE_TRANSITION
 #define CXPLAT_PLATFORM_STATUS_NOT_FOUND STATUS_NOT_FOUND
+#define CXPLAT_PLATFORM_STATUS_INVALID_PARAMETER STATUS_INVALID_PARAMETER
 
 #define CXPLAT_SUCCEEDED(status) NT_SUCCESS(status)
 
@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "cxplat_common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+CXPLAT_EXTERN_C_BEGIN
+
+/**
+ * @brief Allocation statistics for a single pool tag, similar to what poolmon reports.
+ */
+typedef struct cxplat_pool_tag_statistics_t
+{
+    uint32_t tag;                     ///< Pool tag.
+    uint64_t outstanding_bytes;       ///< Bytes currently allocated with this tag.
+    uint64_t outstanding_allocations; ///< Allocations with this tag that have not been freed.
+    uint64_t peak_bytes;              ///< Highest value of outstanding_bytes observed so far.
+    uint64_t total_allocations;       ///< Allocations ever made with this tag.
+    uint64_t total_frees;             ///< Frees ever made with this tag.
+} cxplat_pool_tag_statistics_t;
+
+/**
+ * @brief Change in outstanding allocations for a single pool tag between two snapshots.
+ */
+typedef struct cxplat_pool_tag_difference_t
+{
+    uint32_t tag;                    ///< Pool tag.
+    int64_t outstanding_bytes;       ///< Change in outstanding bytes.
+    int64_t outstanding_allocations; ///< Change in outstanding allocations.
+} cxplat_pool_tag_difference_t;
+
+typedef struct cxplat_pool_tag_snapshot_t cxplat_pool_tag_snapshot_t;
+
+/**
+ * @brief Function called for each pool tag by cxplat_enumerate_pool_tag_statistics.
+ *
+ * @param[in] statistics Statistics for one pool tag.
+ * @param[in] context Context passed to cxplat_enumerate_pool_tag_statistics.
+ * @retval true Continue the enumeration.
+ * @retval false Stop the enumeration.
+ */
+typedef bool (*cxplat_pool_tag_statistics_callback_t)(
+    _In_ const cxplat_pool_tag_statistics_t* statistics, _In_opt_ void* context);
+
+/**
+ * @brief Function called for each pool tag that changed by cxplat_compare_pool_tag_snapshots.
+ *
+ * @param[in] difference Change for one pool tag.
+ * @param[in] context Context passed to cxplat_compare_pool_tag_snapshots.
+ */
+typedef void (*cxplat_pool_tag_difference_callback_t)(
+    _In_ const cxplat_pool_tag_difference_t* difference, _In_opt_ void* context);
+
+/**
+ * @brief Get the allocation statistics for a pool tag. This function is thread safe.
+ * The counters are sharded per processor and read without a lock, so while other threads are allocating the
+ * result is a close approximation rather than an atomic snapshot. peak_bytes may lag the true peak by up to a few
+ * tens of kilobytes per processor.
+ *
+ * @param[in] tag Pool tag to query.
+ * @param[out] statistics Statistics for the pool tag.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_NOT_FOUND No allocation has been made with this tag.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_query_pool_tag_statistics(uint32_t tag, _Out_ cxplat_pool_tag_statistics_t* statistics) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Invoke a callback with the statistics of every pool tag that has been used. This function is thread safe.
+ *
+ * @param[in] callback Function to invoke for each pool tag.
+ * @param[in] context Context to pass to the callback.
+ */
+void
+cxplat_enumerate_pool_tag_statistics(
+    _In_ cxplat_pool_tag_statistics_callback_t callback, _In_opt_ void* context) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Capture the statistics of every pool tag. The snapshot itself is not allocated with cxplat_allocate, so
+ * capturing it does not change any pool tag's statistics.
+ *
+ * @param[out] snapshot Pointer to the captured snapshot.
+ * @retval CXPLAT_STATUS_SUCCESS The operation was successful.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to allocate the snapshot.
+ */
+_Must_inspect_result_ cxplat_status_t
+cxplat_capture_pool_tag_snapshot(_Outptr_ cxplat_pool_tag_snapshot_t** snapshot) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Free a snapshot captured by cxplat_capture_pool_tag_snapshot.
+ *
+ * @param[in] snapshot Snapshot to free.
+ */
+void
+cxplat_free_pool_tag_snapshot(_Frees_ptr_opt_ cxplat_pool_tag_snapshot_t* snapshot) CXPLAT_NOEXCEPT;
+
+/**
+ * @brief Compare the outstanding allocations in two snapshots, e.g. to verify that an operation did not leave any
+ * memory behind.
+ *
+ * @param[in] before Snapshot captured first.
+ * @param[in] after Snapshot captured second.
+ * @param[in] callback Optional function to invoke for each pool tag whose outstanding allocations changed.
+ * @param[in] context Context to pass to the callback.
+ * @return Number of pool tags whose outstanding bytes or allocations changed.
+ */
+size_t
+cxplat_compare_pool_tag_snapshots(
+    _In_ const cxplat_pool_tag_snapshot_t* before,
+    _In_ const cxplat_pool_tag_snapshot_t* after,
+    _In_opt_ cxplat_pool_tag_difference_callback_t callback,
+    _In_opt_ void* context) CXPLAT_NOEXCEPT;
+
+CXPLAT_EXTERN_C_END
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "cxplat_common.h"
+
+#include <stdbool.h>
+
+CXPLAT_EXTERN_C_BEGIN
+
+/**
+ * @brief Environment variable that enables the slab allocator when cxplat is first initialized.
+ */
+#define CXPLAT_SLAB_ALLOCATOR_ENVIRONMENT_VARIABLE_NAME "CXPLAT_SLAB_ALLOCATOR"
+
+/**
+ * @brief Enable or disable the slab allocator. This function is thread safe.
+ *
+ * While enabled, cxplat_allocate serves small allocations from size-class slabs with per-thread caches instead of
+ * the CRT heap. Each allocation remembers where it came from, so memory can be freed or reallocated regardless of
+ * whether the slab allocator is still enabled. Leak detection, fault injection, pool tag statistics and
+ * CXPLAT_POOL_FLAG_CACHE_ALIGNED behave the same either way.
+ *
+ * @param[in] enabled True to enable the slab allocator, false to disable it.
+ * @return Whether the slab allocator was previously enabled.
+ */
+bool
+cxplat_set_slab_allocator_enabled(bool enabled) CXPLAT_NOEXCEPT;
+
+CXPLAT_EXTERN_C_END
@@ -18,10 +18,11 @@
 #define CXPLAT_PLATFORM_STATUS_ARITHMETIC_OVERFLOW __HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW)
 #define CXPLAT_PLATFORM_STATUS_INVALID_STATE __HRESULT_FROM_WIN32(ERROR_INVALID_STATE)
 #define CXPLAT_PLATFORM_STATUS_NOT_FOUND __HRESULT_FROM_WIN32(ERROR_NOT_FOUND)
+#define CXPLAT_PLATFORM_STATUS_INVALID_PARAMETER __HRESULT_FROM_WIN32(ERROR_INVALID_PARAMETER)
 
 #define CXPLAT_SUCCEEDED(status) SUCCEEDED((HRESULT)(status))
 
 typedef struct cxplat_rundown_reference_t
 {
-    void* reserved;
+    volatile long long state; ///< Reference count in the upper bits, rundown active flag in bit 0.
 } cxplat_rundown_reference_t;
@@ -0,0 +1,264 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains initialization/cleanup routines for the POSIX cxplat library.
+#include "../debugging_internal.h"
+#include "../leak_detector.h"
+#include "../workitem_internal.h"
+#include "cxplat.h"
+#include "cxplat_environment.h"
+#include "cxplat_fault_injection.h"
+#include "posix_internal.h"
+#include "symbol_decoder.h"
+
+#include <algorithm>
+#include <dlfcn.h>
+#include <memory>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+extern "C"
+{
+    bool cxplat_fuzzing_enabled = false;
+}
+cxplat_leak_detector_ptr _cxplat_leak_detector_ptr;
+
+/**
+ * @brief Environment variable to enable fault injection testing.
+ */
+#define CXPLAT_FAULT_INJECTION_SIMULATION_ENVIRONMENT_VARIABLE_NAME "CXPLAT_FAULT_INJECTION_SIMULATION"
+#define CXPLAT_MEMORY_LEAK_DETECTION_ENVIRONMENT_VARIABLE_NAME "CXPLAT_MEMORY_LEAK_DETECTION"
+
+/**
+ * @brief Environment variable holding a replay token for a deterministic fault injection schedule to follow.
+ */
+#define CXPLAT_FAULT_INJECTION_SCHEDULE_ENVIRONMENT_VARIABLE_NAME "CXPLAT_FAULT_INJECTION_SCHEDULE"
+
+/**
+ * @brief Environment variable to have the leak detector track only 1 in N allocations, for long soak runs.
+ */
+#define CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE_ENVIRONMENT_VARIABLE_NAME "CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE"
+#endif
+
+/**
+ * @brief Environment variable holding the number of threads that run preemptible work items. If unset or 0, one
+ * thread per active processor is used. 1 runs work items one at a time in the order they were queued.
+ */
+#define CXPLAT_WORK_ITEM_THREADS_ENVIRONMENT_VARIABLE_NAME "CXPLAT_WORK_ITEM_THREADS"
+
+/**
+ * @brief Get an environment variable as a string.
+ *
+ * @param[in] name Environment variable name.
+ * @return String value of environment variable or an empty string if not set.
+ */
+static std::string
+_get_environment_variable_as_string(const std::string& name)
+{
+    const char* value = getenv(name.c_str());
+    return (value != nullptr) ? value : "";
+}
+
+bool
+cxplat_get_environment_variable_as_bool(_In_z_ const char* name)
+{
+    std::string value = _get_environment_variable_as_string(name);
+    if (value.empty()) {
+        return false;
+    }
+
+    // Convert value to lower case.
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (value == "false") {
+        return false;
+    }
+    if (value == "0") {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Get an environment variable as a size_t.
+ *
+ * @param[in] name Environment variable name.
+ * @return Value of environment variable or 0 if it's not set or not a valid number.
+ */
+static size_t
+_get_environment_variable_as_size_t(const std::string& name)
+{
+    std::string value = _get_environment_variable_as_string(name);
+    if (value.empty()) {
+        return 0;
+    }
+    try {
+        return std::stoull(value);
+    } catch (const std::exception&) {
+        return 0;
+    }
+}
+
+static std::mutex cxplat_initialization_mutex;
+static unsigned long _cxplat_initialization_count = 0;
+
+// Set by cxplat_set_work_item_thread_count, and used instead of the environment variable if not 0.
+static size_t _cxplat_work_item_thread_count_override = 0;
+
+static size_t
+_cxplat_get_work_item_thread_count()
+{
+    if (_cxplat_work_item_thread_count_override != 0) {
+        return _cxplat_work_item_thread_count_override;
+    }
+    return _get_environment_variable_as_size_t(CXPLAT_WORK_ITEM_THREADS_ENVIRONMENT_VARIABLE_NAME);
+}
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+/**
+ * @brief Get the handle fault injection uses for the module containing an address, which is the address the module
+ * is loaded at.
+ *
+ * @param[in] address Address in the module, such as a caller's return address.
+ * @return Handle of the module, or null for the executable if the module could not be found.
+ */
+static void*
+_cxplat_get_module_from_address(_In_ const void* address)
+{
+    Dl_info info;
+    if (dladdr(address, &info) == 0) {
+        return nullptr;
+    }
+    return info.dli_fbase;
+}
+#endif
+
+cxplat_status_t
+cxplat_initialize()
+{
+    std::unique_lock lock(cxplat_initialization_mutex);
+    if (_cxplat_initialization_count > 0) {
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+        if (cxplat_fault_injection_is_enabled()) {
+            if (cxplat_fault_injection_add_module(_cxplat_get_module_from_address(__builtin_return_address(0))) !=
+                0) {
+                return CXPLAT_STATUS_NO_MEMORY;
+            }
+        }
+#endif
+
+        // Already initialized.
+        _cxplat_initialization_count++;
+        return CXPLAT_STATUS_SUCCESS;
+    }
+
+    try {
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+        auto fault_injection_stack_depth =
+            _get_environment_variable_as_size_t(CXPLAT_FAULT_INJECTION_SIMULATION_ENVIRONMENT_VARIABLE_NAME);
+        auto leak_detector =
+            cxplat_get_environment_variable_as_bool(CXPLAT_MEMORY_LEAK_DETECTION_ENVIRONMENT_VARIABLE_NAME);
+
+        if (fault_injection_stack_depth || leak_detector) {
+            cxplat_status_t status = _cxplat_symbol_decoder_initialize();
+            if (!CXPLAT_SUCCEEDED(status)) {
+                return status;
+            }
+        }
+        if (fault_injection_stack_depth && !cxplat_fault_injection_is_enabled()) {
+            if (cxplat_fault_injection_initialize(fault_injection_stack_depth) != 0) {
+                return CXPLAT_STATUS_NO_MEMORY;
+            }
+
+            if (cxplat_fault_injection_add_module(_cxplat_get_module_from_address(__builtin_return_address(0))) !=
+                0) {
+                return CXPLAT_STATUS_NO_MEMORY;
+            }
+            // Set flag to remove some asserts that fire from incorrect client behavior.
+            cxplat_fuzzing_enabled = true;
+        }
+
+        auto fault_injection_schedule =
+            _get_environment_variable_as_string(CXPLAT_FAULT_INJECTION_SCHEDULE_ENVIRONMENT_VARIABLE_NAME);
+        if (!fault_injection_schedule.empty()) {
+            cxplat_fault_injection_schedule_t schedule;
+            cxplat_status_t status =
+                cxplat_fault_injection_parse_replay_token(fault_injection_schedule.c_str(), &schedule);
+            if (!CXPLAT_SUCCEEDED(status)) {
+                return status;
+            }
+            cxplat_fault_injection_set_schedule(&schedule);
+            // Set flag to remove some asserts that fire from incorrect client behavior.
+            cxplat_fuzzing_enabled = true;
+        }
+
+        if (leak_detector) {
+            auto sample_rate =
+                _get_environment_variable_as_size_t(CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE_ENVIRONMENT_VARIABLE_NAME);
+            _cxplat_leak_detector_ptr = std::make_unique<cxplat_leak_detector_t>(sample_rate);
+        }
+#endif
+
+        cxplat_status_t status = cxplat_posix_initialize_processor_info();
+        if (!CXPLAT_SUCCEEDED(status)) {
+            return status;
+        }
+
+        status = _cxplat_initialize_thread_pool(_cxplat_get_work_item_thread_count());
+        if (!CXPLAT_SUCCEEDED(status)) {
+            cxplat_posix_clean_up_processor_info();
+            return status;
+        }
+    } catch (const std::bad_alloc&) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    _cxplat_initialization_count++;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_set_work_item_thread_count(size_t thread_count)
+{
+    std::unique_lock lock(cxplat_initialization_mutex);
+    _cxplat_work_item_thread_count_override = thread_count;
+    if (_cxplat_initialization_count == 0) {
+        // The threads are started with the new count on initialization.
+        return CXPLAT_STATUS_SUCCESS;
+    }
+
+    _cxplat_clean_up_thread_pool();
+    return _cxplat_initialize_thread_pool(_cxplat_get_work_item_thread_count());
+}
+
+void
+cxplat_cleanup()
+{
+    std::unique_lock lock(cxplat_initialization_mutex);
+    CXPLAT_RUNTIME_ASSERT(_cxplat_initialization_count > 0);
+    _cxplat_initialization_count--;
+    if (_cxplat_initialization_count > 0) {
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+        cxplat_fault_injection_remove_module(_cxplat_get_module_from_address(__builtin_return_address(0)));
+#endif
+        // Don't clean up until the count hits 0.
+        return;
+    }
+
+    _cxplat_clean_up_thread_pool();
+    cxplat_posix_clean_up_processor_info();
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (_cxplat_leak_detector_ptr) {
+        size_t leaks = _cxplat_leak_detector_ptr->dump_leaks();
+        _cxplat_leak_detector_ptr.reset();
+
+        // An in-process fault injection run reports leaks itself rather than failing on the first one.
+        bool leaks_collected = (leaks > 0) && _cxplat_collect_fault_injection_leaks(leaks);
+
+        // assert to make sure that a leaking test throws an exception thereby failing the test.
+        CXPLAT_DEBUG_ASSERT(leaks == 0 || leaks_collected);
+    }
+    _cxplat_symbol_decoder_deinitialize();
+#endif
+}
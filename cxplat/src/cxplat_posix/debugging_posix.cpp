@@ -0,0 +1,201 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains the platform services used by the leak detector and fault injection.
+#include "../debugging_internal.h"
+#include "cxplat.h"
+#include "posix_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unwind.h>
+
+typedef struct _cxplat_mapped_file
+{
+    int file;
+    uint8_t* view;
+    uint64_t view_size;
+} cxplat_mapped_file_t;
+
+typedef struct _cxplat_stack_walk
+{
+    size_t frames_to_skip;
+    size_t frames_to_capture;
+    size_t frame_count;
+    uintptr_t* frames;
+} cxplat_stack_walk_t;
+
+static _Unwind_Reason_Code
+_cxplat_capture_stack_frame(_In_ struct _Unwind_Context* context, _Inout_ void* parameter)
+{
+    cxplat_stack_walk_t* walk = reinterpret_cast<cxplat_stack_walk_t*>(parameter);
+    uintptr_t address = _Unwind_GetIP(context);
+    if (address == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (walk->frames_to_skip > 0) {
+        walk->frames_to_skip--;
+        return _URC_NO_REASON;
+    }
+    walk->frames[walk->frame_count++] = address;
+    return (walk->frame_count == walk->frames_to_capture) ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+size_t
+_cxplat_capture_stack_back_trace(
+    size_t frames_to_skip, size_t frames_to_capture, _Out_writes_to_(frames_to_capture, return) uintptr_t* frames)
+{
+    if (frames_to_capture == 0) {
+        return 0;
+    }
+
+    // The unwinder walks the unwind tables that the compiler emits for exception handling, so unlike a frame pointer
+    // walk it doesn't depend on how the code was optimized. The first frame it reports is this function.
+    cxplat_stack_walk_t walk = {frames_to_skip + 1, frames_to_capture, 0, frames};
+    (void)_Unwind_Backtrace(_cxplat_capture_stack_frame, &walk);
+    return walk.frame_count;
+}
+
+typedef struct _cxplat_module_search
+{
+    uintptr_t address; ///< Address to find, or 0 for the executable.
+    uintptr_t base_address;
+    size_t size;
+    bool found;
+} cxplat_module_search_t;
+
+static int
+_cxplat_find_module(_In_ struct dl_phdr_info* info, size_t info_size, _Inout_ void* parameter)
+{
+    (void)info_size;
+    cxplat_module_search_t* search = reinterpret_cast<cxplat_module_search_t*>(parameter);
+
+    // A module occupies the range from its lowest loadable segment to the end of its highest one.
+    uintptr_t start = UINTPTR_MAX;
+    uintptr_t end = 0;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        if (header->p_type != PT_LOAD) {
+            continue;
+        }
+        uintptr_t segment_start = info->dlpi_addr + header->p_vaddr;
+        if (segment_start < start) {
+            start = segment_start;
+        }
+        if (segment_start + header->p_memsz > end) {
+            end = segment_start + header->p_memsz;
+        }
+    }
+    if (start >= end) {
+        return 0;
+    }
+
+    // The executable is always reported first.
+    if (search->address == 0 || (search->address >= start && search->address < end)) {
+        search->base_address = start;
+        search->size = end - start;
+        search->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_module_range(_In_opt_ const void* module_handle, _Out_ uintptr_t* base_address, _Out_ size_t* size)
+{
+    // As on Windows, where a module handle is the address the module is loaded at, any address in a module
+    // identifies it, such as the dli_fbase reported by dladdr.
+    cxplat_module_search_t search = {reinterpret_cast<uintptr_t>(module_handle), 0, 0, false};
+    (void)dl_iterate_phdr(_cxplat_find_module, &search);
+    *base_address = search.base_address;
+    *size = search.size;
+    return (search.found) ? CXPLAT_STATUS_SUCCESS : CXPLAT_STATUS_NOT_FOUND;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_process_path(_Out_ std::string& path)
+{
+    char process_name[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", process_name, sizeof(process_name));
+    if (length <= 0 || (size_t)length == sizeof(process_name)) {
+        path.clear();
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+    path.assign(process_name, (size_t)length);
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_open_mapped_file(_In_z_ const char* path, _Outptr_ cxplat_mapped_file_t** file, _Out_ uint64_t* file_size)
+{
+    *file = nullptr;
+    *file_size = 0;
+    cxplat_mapped_file_t* mapped_file = new (std::nothrow) cxplat_mapped_file_t{-1, nullptr, 0};
+    if (mapped_file == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    mapped_file->file = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mapped_file->file < 0) {
+        delete mapped_file;
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+
+    struct stat file_status;
+    if (fstat(mapped_file->file, &file_status) == 0) {
+        *file_size = (uint64_t)file_status.st_size;
+    }
+    *file = mapped_file;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+static void
+_cxplat_unmap_file(_Inout_ cxplat_mapped_file_t* file)
+{
+    if (file->view != nullptr) {
+        (void)munmap(file->view, file->view_size);
+        file->view = nullptr;
+        file->view_size = 0;
+    }
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_file(_Inout_ cxplat_mapped_file_t* file, uint64_t size, _Outptr_result_maybenull_ uint8_t** view)
+{
+    _cxplat_unmap_file(file);
+    *view = nullptr;
+
+    // Touching a mapped page past the end of the file raises SIGBUS rather than growing the file, so grow it first.
+    struct stat file_status;
+    if (fstat(file->file, &file_status) != 0) {
+        return CXPLAT_STATUS_FROM_ERRNO(errno);
+    }
+    if ((uint64_t)file_status.st_size < size && ftruncate(file->file, (off_t)size) != 0) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->file, 0);
+    if (mapping == MAP_FAILED) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    file->view = reinterpret_cast<uint8_t*>(mapping);
+    file->view_size = size;
+    *view = file->view;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+_cxplat_close_mapped_file(_Frees_ptr_ cxplat_mapped_file_t* file, uint64_t used_size)
+{
+    _cxplat_unmap_file(file);
+    if (used_size != 0) {
+        (void)ftruncate(file->file, (off_t)used_size);
+    }
+    (void)close(file->file);
+    delete file;
+}
@@ -0,0 +1,209 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "cxplat_fault_injection.h"
+#include "posix_internal.h"
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+#include "../leak_detector.h"
+#endif
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CXPLAT_CACHE_LINE_SIZE 64
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+extern cxplat_leak_detector_ptr _cxplat_leak_detector_ptr;
+extern "C"
+{
+    size_t cxplat_fuzzing_memory_limit = SIZE_MAX;
+}
+#endif
+
+// Every allocation carries a header so that frees and reallocations can check the pool flags and tag they are
+// passed, and so that a cache aligned allocation can be moved when it is reallocated.
+typedef struct
+{
+    cxplat_pool_flags_t pool_flags;
+    uint32_t tag;
+    size_t size;
+} cxplat_allocation_header_t;
+
+static_assert(sizeof(cxplat_allocation_header_t) <= CXPLAT_CACHE_LINE_SIZE);
+
+static inline cxplat_allocation_header_t*
+_header_from_pointer(const void* memory)
+{
+    return (cxplat_allocation_header_t*)((uint8_t*)memory - sizeof(cxplat_allocation_header_t));
+}
+
+// A cache aligned allocation gives a whole cache line to the header, so that the pointer returned stays aligned.
+static inline size_t
+_pointer_offset(cxplat_pool_flags_t pool_flags)
+{
+    return (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) ? CXPLAT_CACHE_LINE_SIZE : sizeof(cxplat_allocation_header_t);
+}
+
+/**
+ * @brief Allocate memory and fill in its header, without initializing the memory itself.
+ *
+ * @param[in] pool_flags Pool flags to use.
+ * @param[in] size Size of memory to allocate.
+ * @param[in] tag Pool tag to use.
+ * @returns Pointer to memory block allocated, or null on failure.
+ */
+static void*
+_allocate_memory(cxplat_pool_flags_t pool_flags, size_t size, uint32_t tag)
+{
+    size_t offset = _pointer_offset(pool_flags);
+    uint8_t* block;
+    if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
+        void* aligned_block;
+        if (posix_memalign(&aligned_block, CXPLAT_CACHE_LINE_SIZE, offset + size) != 0) {
+            return nullptr;
+        }
+        block = (uint8_t*)aligned_block;
+    } else {
+        block = (uint8_t*)malloc(offset + size);
+        if (block == nullptr) {
+            return nullptr;
+        }
+    }
+
+    void* memory = block + offset;
+    cxplat_allocation_header_t* header = _header_from_pointer(memory);
+    header->pool_flags = pool_flags;
+    header->tag = tag;
+    header->size = size;
+    return memory;
+}
+
+/**
+ * @brief Free memory allocated by _allocate_memory.
+ *
+ * @param[in] pointer Allocation to be freed.
+ */
+static void
+_free_memory(_Frees_ptr_ void* pointer)
+{
+    cxplat_allocation_header_t* header = _header_from_pointer(pointer);
+    free((uint8_t*)pointer - _pointer_offset(header->pool_flags));
+}
+
+__drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(size) void* cxplat_allocate(
+    cxplat_pool_flags_t pool_flags, size_t size, uint32_t tag)
+{
+    CXPLAT_RUNTIME_ASSERT(size > 0);
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (size > cxplat_fuzzing_memory_limit) {
+        return nullptr;
+    }
+
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION)) {
+        return nullptr;
+    }
+#endif
+
+    void* memory = _allocate_memory(pool_flags, size, tag);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    if (!(pool_flags & CXPLAT_POOL_FLAG_UNINITIALIZED)) {
+        memset(memory, 0, size);
+    }
+#ifndef NDEBUG
+    if (pool_flags & CXPLAT_POOL_FLAG_UNINITIALIZED) {
+        // To test returning uninitialized memory, we explicitly fill it with 0xcc.
+        memset(memory, 0xcc, size);
+    }
+#endif
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (_cxplat_leak_detector_ptr) {
+        _cxplat_leak_detector_ptr->register_allocation(reinterpret_cast<uintptr_t>(memory), size);
+    }
+#endif
+
+    return memory;
+}
+
+__drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(new_size) void* cxplat_reallocate(
+    _In_ _Post_invalid_ void* pointer, cxplat_pool_flags_t pool_flags, size_t old_size, size_t new_size, uint32_t tag)
+{
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (new_size > cxplat_fuzzing_memory_limit) {
+        return nullptr;
+    }
+
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION)) {
+        return nullptr;
+    }
+#endif
+
+    cxplat_allocation_header_t* header = _header_from_pointer(pointer);
+    CXPLAT_DEBUG_ASSERT(header->size == old_size);
+    CXPLAT_DEBUG_ASSERT(!tag || header->tag == tag);
+    CXPLAT_DEBUG_ASSERT(header->pool_flags == pool_flags);
+
+    void* p;
+    if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
+        // There is no aligned realloc, so move the allocation.
+        p = _allocate_memory(pool_flags, new_size, header->tag);
+        if (p) {
+            memcpy(p, pointer, std::min(old_size, new_size));
+            _free_memory(pointer);
+        }
+    } else {
+        size_t offset = _pointer_offset(pool_flags);
+        uint8_t* new_block = (uint8_t*)realloc((uint8_t*)pointer - offset, offset + new_size);
+        p = (new_block) ? new_block + offset : nullptr;
+    }
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (p && _cxplat_leak_detector_ptr) {
+        _cxplat_leak_detector_ptr->unregister_allocation(reinterpret_cast<uintptr_t>(pointer));
+    }
+#endif
+    if (p) {
+        // The header moved with the block, or was filled in by _allocate_memory.
+        _header_from_pointer(p)->size = new_size;
+
+        if (new_size > old_size) {
+            if (!(pool_flags & CXPLAT_POOL_FLAG_UNINITIALIZED)) {
+                memset(((char*)p) + old_size, 0, new_size - old_size);
+            } else {
+#ifndef NDEBUG
+                memset(((char*)p) + old_size, 0xcc, new_size - old_size);
+#endif
+            }
+        }
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+        if (_cxplat_leak_detector_ptr) {
+            _cxplat_leak_detector_ptr->register_allocation(reinterpret_cast<uintptr_t>(p), new_size);
+        }
+#endif
+    }
+
+    return p;
+}
+
+void
+cxplat_free(_Frees_ptr_opt_ void* pointer, cxplat_pool_flags_t pool_flags, uint32_t tag)
+{
+    if (pointer == nullptr) {
+        return;
+    }
+    cxplat_allocation_header_t* header = _header_from_pointer(pointer);
+    CXPLAT_DEBUG_ASSERT(!tag || header->tag == tag);
+    CXPLAT_DEBUG_ASSERT(header->pool_flags == pool_flags);
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (_cxplat_leak_detector_ptr) {
+        _cxplat_leak_detector_ptr->unregister_allocation(reinterpret_cast<uintptr_t>(pointer));
+    }
+#endif
+    _free_memory(pointer);
+}
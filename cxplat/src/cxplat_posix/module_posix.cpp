@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#include "cxplat.h"
+#include "posix_internal.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+cxplat_status_t
+cxplat_get_module_path_from_address(_In_ const void* address, _Out_ cxplat_utf8_string_t* utf8_path)
+{
+    Dl_info info;
+    char path[PATH_MAX];
+
+    utf8_path->value = NULL;
+    utf8_path->length = 0;
+
+    if (dladdr(address, &info) == 0 || info.dli_fname == NULL) {
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+
+    // Report a full path, as Windows does. The loader reports shared objects by the path it loaded them from, but
+    // reports the main executable by the name it was started with, which may not resolve from the current directory.
+    if (realpath(info.dli_fname, path) == NULL) {
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (length <= 0) {
+            return CXPLAT_STATUS_NOT_FOUND;
+        }
+        path[length] = '\0';
+    }
+
+    // Paths on POSIX systems are already byte strings, which are UTF-8 on any modern system. Like the other
+    // platforms, the length includes a null terminator.
+    size_t length = strlen(path) + 1;
+    utf8_path->value = (uint8_t*)cxplat_allocate(CXPLAT_POOL_FLAG_NON_PAGED, length, CXPLAT_TAG_UTF8_STRING);
+    if (utf8_path->value == NULL) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    memcpy(utf8_path->value, path, length);
+    utf8_path->length = length;
+    return CXPLAT_STATUS_SUCCESS;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+#include "../tags.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CXPLAT_STATUS_FROM_ERRNO(code) ((cxplat_status_t)(-(code)))
+
+cxplat_status_t
+cxplat_posix_initialize_processor_info();
+
+void
+cxplat_posix_clean_up_processor_info();
+
+/**
+ * @brief Block while a 32-bit word holds an expected value. The wait can end spuriously, so callers must check the
+ * word again.
+ *
+ * @param[in] address Word to wait on.
+ * @param[in] expected Value the word must still hold for the thread to block.
+ */
+static inline void
+cxplat_posix_futex_wait(_In_ volatile uint32_t* address, uint32_t expected)
+{
+    (void)syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Block while a 32-bit word holds an expected value, for at most a given time. The wait can end spuriously,
+ * so callers must check the word again.
+ *
+ * @param[in] address Word to wait on.
+ * @param[in] expected Value the word must still hold for the thread to block.
+ * @param[in] timeout_ms Longest time to wait, in milliseconds, or UINT32_MAX to wait forever.
+ * @retval false The wait timed out.
+ */
+static inline bool
+cxplat_posix_futex_wait_for(_In_ volatile uint32_t* address, uint32_t expected, uint32_t timeout_ms)
+{
+    if (timeout_ms == UINT32_MAX) {
+        cxplat_posix_futex_wait(address, expected);
+        return true;
+    }
+    struct timespec timeout = {(time_t)(timeout_ms / 1000), (long)(timeout_ms % 1000) * 1000000};
+    return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0) == 0 || errno != ETIMEDOUT;
+}
+
+/**
+ * @brief Wake threads blocked in cxplat_posix_futex_wait on a word.
+ *
+ * @param[in] address Word the threads wait on.
+ * @param[in] count Largest number of threads to wake.
+ */
+static inline void
+cxplat_posix_futex_wake(_In_ volatile uint32_t* address, int count)
+{
+    (void)syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/***
+ * A lock that fits in a 32-bit word, so that it can live in the space callers reserve for a Windows spin lock:
+ * 0 means unlocked, 1 locked, and 2 locked with threads possibly waiting, so that an uncontended release never
+ * needs a system call.
+ */
+static inline void
+cxplat_posix_acquire_lock(_Inout_ volatile uint32_t* lock)
+{
+    uint32_t state = 0;
+    if (__atomic_compare_exchange_n(lock, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (state != 2) {
+        state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    }
+    while (state != 0) {
+        cxplat_posix_futex_wait(lock, 2);
+        state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void
+cxplat_posix_release_lock(_Inout_ volatile uint32_t* lock)
+{
+    if (__atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2) {
+        cxplat_posix_futex_wake(lock, 1);
+    }
+}
@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#include "cxplat.h"
+#include "posix_internal.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Number of processor numbers the system can ever use, read from sysfs when cxplat is initialized.
+static uint32_t _cxplat_maximum_processor_count = 0;
+
+/**
+ * @brief Read the number of possible processors from sysfs. The file holds a list of processor number ranges such
+ * as "0-3,8-11", and processor numbers can have gaps, so the count is one more than the highest number listed.
+ *
+ * @returns The number of possible processors, or 0 if it could not be read.
+ */
+static uint32_t
+_cxplat_read_possible_processor_count()
+{
+    FILE* file = fopen("/sys/devices/system/cpu/possible", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    char ranges[256];
+    char* line = fgets(ranges, sizeof(ranges), file);
+    fclose(file);
+    if (line == nullptr) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+    for (char* position = ranges; *position != '\0' && *position != '\n';) {
+        char* end;
+        unsigned long last = strtoul(position, &end, 10);
+        if (end == position) {
+            return 0;
+        }
+        if (*end == '-') {
+            position = end + 1;
+            last = strtoul(position, &end, 10);
+            if (end == position) {
+                return 0;
+            }
+        }
+        if (last + 1 > count) {
+            count = (uint32_t)(last + 1);
+        }
+        position = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+cxplat_status_t
+cxplat_posix_initialize_processor_info()
+{
+    uint32_t count = _cxplat_read_possible_processor_count();
+    if (count == 0) {
+        // sysfs isn't mounted, such as in some containers.
+        long configured = sysconf(_SC_NPROCESSORS_CONF);
+        if (configured <= 0) {
+            return CXPLAT_STATUS_FROM_ERRNO(errno);
+        }
+        count = (uint32_t)configured;
+    }
+    _cxplat_maximum_processor_count = count;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_posix_clean_up_processor_info()
+{
+    _cxplat_maximum_processor_count = 0;
+}
+
+_Must_inspect_result_ uint32_t
+cxplat_get_maximum_processor_count()
+{
+    return _cxplat_maximum_processor_count;
+}
+
+_Must_inspect_result_ uint32_t
+cxplat_get_current_processor_number()
+{
+    // sched_getcpu reads the processor number through the vDSO without a system call.
+    int processor = sched_getcpu();
+    return (processor < 0) ? 0 : (uint32_t)processor;
+}
+
+_Must_inspect_result_ uint32_t
+cxplat_get_active_processor_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count <= 0) ? 1 : (uint32_t)count;
+}
+
+// Both kinds of spin lock are backed by a lock in the first 32 bits of the caller's storage, which must be zeroed
+// before first use, as a Windows spin lock must be initialized.
+static_assert(sizeof(cxplat_spin_lock_t) >= sizeof(uint32_t));
+static_assert(sizeof(cxplat_queue_spin_lock_t) >= sizeof(uint32_t));
+
+_Requires_lock_not_held_(*lock_handle) _Acquires_lock_(*lock_handle) _Post_same_lock_(*spin_lock, *lock_handle)
+    _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_global_(QueuedSpinLock, lock_handle)
+        _IRQL_raises_(DISPATCH_LEVEL) void cxplat_acquire_in_stack_queued_spin_lock(
+            _Inout_ cxplat_queue_spin_lock_t* spin_lock, _Out_ cxplat_lock_queue_handle_t* lock_handle)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_acquire_lock(lock);
+
+    lock_handle->Reserved_1[0] = reinterpret_cast<uint64_t>(lock);
+}
+
+_Requires_lock_held_(*lock_handle) _Releases_lock_(*lock_handle) _IRQL_requires_(DISPATCH_LEVEL)
+    _IRQL_restores_global_(QueuedSpinLock, lock_handle) void cxplat_release_in_stack_queued_spin_lock(
+        _In_ cxplat_lock_queue_handle_t* lock_handle)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(lock_handle->Reserved_1[0]);
+    cxplat_posix_release_lock(lock);
+}
+
+_Requires_lock_not_held_(*lock_handle) _Acquires_lock_(*lock_handle) _Post_same_lock_(*spin_lock, *lock_handle)
+    _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_global_(QueuedSpinLock, lock_handle)
+        _IRQL_raises_(DISPATCH_LEVEL) void cxplat_acquire_in_stack_queued_spin_lock_at_dpc(
+            _Inout_ cxplat_queue_spin_lock_t* spin_lock, _Out_ cxplat_lock_queue_handle_t* lock_handle)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_acquire_lock(lock);
+
+    lock_handle->Reserved_1[0] = reinterpret_cast<uint64_t>(lock);
+}
+
+_Requires_lock_held_(*lock_handle) _Releases_lock_(*lock_handle) _IRQL_requires_(DISPATCH_LEVEL)
+    _IRQL_restores_global_(QueuedSpinLock, lock_handle) void cxplat_release_in_stack_queued_spin_lock_from_dpc(
+        _In_ cxplat_lock_queue_handle_t* lock_handle)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(lock_handle->Reserved_1[0]);
+    cxplat_posix_release_lock(lock);
+}
+
+_Requires_lock_not_held_(*spin_lock) _Acquires_lock_(*spin_lock) _IRQL_requires_max_(DISPATCH_LEVEL) _IRQL_saves_
+    _IRQL_raises_(DISPATCH_LEVEL)
+cxplat_irql_t
+cxplat_acquire_spin_lock(_Inout_ cxplat_spin_lock_t* spin_lock)
+{
+    cxplat_irql_t old_irql = cxplat_raise_irql(DISPATCH_LEVEL);
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_acquire_lock(lock);
+    return old_irql;
+}
+
+_Requires_lock_held_(*spin_lock) _Releases_lock_(*spin_lock)
+    _IRQL_requires_(DISPATCH_LEVEL) void cxplat_release_spin_lock(
+        _Inout_ cxplat_spin_lock_t* spin_lock, _In_ _IRQL_restores_ cxplat_irql_t old_irql)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_release_lock(lock);
+    cxplat_lower_irql(old_irql);
+}
+
+_Requires_lock_not_held_(*spin_lock) _Acquires_lock_(*spin_lock) _IRQL_requires_min_(
+    DISPATCH_LEVEL) void cxplat_acquire_spin_lock_at_dpc_level(_Inout_ cxplat_spin_lock_t* spin_lock)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_acquire_lock(lock);
+}
+
+_Requires_lock_held_(*spin_lock) _Releases_lock_(*spin_lock) _IRQL_requires_min_(
+    DISPATCH_LEVEL) void cxplat_release_spin_lock_from_dpc_level(_Inout_ cxplat_spin_lock_t* spin_lock)
+{
+    auto lock = reinterpret_cast<volatile uint32_t*>(spin_lock);
+    cxplat_posix_release_lock(lock);
+}
+
+thread_local cxplat_irql_t _cxplat_current_irql = PASSIVE_LEVEL;
+
+_IRQL_requires_max_(HIGH_LEVEL) _IRQL_raises_(irql) _IRQL_saves_ cxplat_irql_t
+    cxplat_raise_irql(_In_ cxplat_irql_t irql)
+{
+    auto old_irql = _cxplat_current_irql;
+    _cxplat_current_irql = irql;
+    return old_irql;
+}
+
+_IRQL_requires_max_(HIGH_LEVEL) void cxplat_lower_irql(_In_ _Notliteral_ _IRQL_restores_ cxplat_irql_t irql)
+{
+    _cxplat_current_irql = irql;
+}
+
+_IRQL_requires_max_(HIGH_LEVEL) _IRQL_saves_ cxplat_irql_t cxplat_get_current_irql() { return _cxplat_current_irql; }
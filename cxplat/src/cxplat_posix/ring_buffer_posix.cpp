@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains the platform services used by the ring buffer.
+#include "../ring_buffer_internal.h"
+#include "cxplat.h"
+#include "posix_internal.h"
+
+#include <errno.h>
+#include <initializer_list>
+#include <limits.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct _cxplat_ring_buffer_section
+{
+    int file; ///< Anonymous memory file holding the data pages.
+    size_t size;
+} cxplat_ring_buffer_section_t;
+
+size_t
+_cxplat_get_ring_buffer_section_granularity()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_create_ring_buffer_section(size_t size, _Outptr_ cxplat_ring_buffer_section_t** section)
+{
+    *section = nullptr;
+    cxplat_ring_buffer_section_t* new_section = new (std::nothrow) cxplat_ring_buffer_section_t{-1, size};
+    if (new_section == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+
+    // A memory file has no path, so nothing outside the process can open it, and its pages start out zeroed.
+    new_section->file = memfd_create("cxplat_ring_buffer", MFD_CLOEXEC);
+    if (new_section->file < 0) {
+        delete new_section;
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    if (ftruncate(new_section->file, (off_t)size) != 0) {
+        (void)close(new_section->file);
+        delete new_section;
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    *section = new_section;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_ring_buffer_section(
+    _In_ const cxplat_ring_buffer_section_t* section, bool read_only, _Outptr_ uint8_t** view)
+{
+    *view = nullptr;
+
+    // Reserve the address range for both copies first, so no other mapping can land between them, and then map the
+    // file over each half.
+    void* reservation = mmap(nullptr, 2 * section->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reservation == MAP_FAILED) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    uint8_t* base = reinterpret_cast<uint8_t*>(reservation);
+    int protection = (read_only) ? PROT_READ : (PROT_READ | PROT_WRITE);
+    for (uint8_t* copy : {base, base + section->size}) {
+        if (mmap(copy, section->size, protection, MAP_SHARED | MAP_FIXED, section->file, 0) == MAP_FAILED) {
+            (void)munmap(base, 2 * section->size);
+            return CXPLAT_STATUS_NO_MEMORY;
+        }
+    }
+    *view = base;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+_cxplat_unmap_ring_buffer_section(_In_ const cxplat_ring_buffer_section_t* section, _In_ uint8_t* view)
+{
+    (void)munmap(view, 2 * section->size);
+}
+
+void
+_cxplat_delete_ring_buffer_section(_Frees_ptr_ cxplat_ring_buffer_section_t* section)
+{
+    (void)close(section->file);
+    delete section;
+}
+
+bool
+_cxplat_wait_on_address(_In_ volatile uint32_t* address, uint32_t expected, uint32_t timeout_ms)
+{
+    return cxplat_posix_futex_wait_for(address, expected, timeout_ms);
+}
+
+void
+_cxplat_wake_by_address_all(_In_ volatile uint32_t* address)
+{
+    cxplat_posix_futex_wake(address, INT_MAX);
+}
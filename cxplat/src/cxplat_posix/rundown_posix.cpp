@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#include "cxplat.h"
+#include "cxplat_fault_injection.h"
+#include "posix_internal.h"
+
+#include <stdexcept>
+
+/***
+ * The rundown state is kept in cxplat_rundown_reference_t itself as a single 32-bit word, mirroring the Windows
+ * Kernel's EX_RUNDOWN_REF:
+ * 1) Bit 0 is set once rundown has started, after which no new references can be acquired.
+ * 2) The remaining bits hold the number of references, so each reference adds CXPLAT_RUNDOWN_COUNT_INCREMENT.
+ * 3) A thread waiting for rundown blocks on the word with a futex, and is only woken by the release that drops the
+ *    last reference while rundown is active.
+ */
+#define CXPLAT_RUNDOWN_ACTIVE 0x1
+#define CXPLAT_RUNDOWN_COUNT_INCREMENT 0x2
+
+void
+cxplat_initialize_rundown_protection(_Out_ cxplat_rundown_reference_t* rundown_reference)
+{
+    rundown_reference->state = 0;
+}
+
+void
+cxplat_reinitialize_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    uint32_t state = __atomic_load_n(&rundown_reference->state, __ATOMIC_ACQUIRE);
+
+    // Check if the entry is not rundown.
+    if ((state & CXPLAT_RUNDOWN_ACTIVE) == 0) {
+        throw std::runtime_error("rundown reference not rundown");
+    }
+
+    if (state != CXPLAT_RUNDOWN_ACTIVE) {
+        throw std::runtime_error("rundown reference corruption");
+    }
+
+    __atomic_store_n(&rundown_reference->state, 0, __ATOMIC_RELEASE);
+}
+
+void
+cxplat_wait_for_rundown_protection_release(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    uint32_t state =
+        __atomic_or_fetch(&rundown_reference->state, (uint32_t)CXPLAT_RUNDOWN_ACTIVE, __ATOMIC_ACQ_REL);
+
+    // Wait for the ref count to reach 0.
+    while (state != CXPLAT_RUNDOWN_ACTIVE) {
+        cxplat_posix_futex_wait(&rundown_reference->state, state);
+        state = __atomic_load_n(&rundown_reference->state, __ATOMIC_ACQUIRE);
+    }
+}
+
+int
+cxplat_acquire_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN)) {
+        return false;
+    }
+#endif
+
+    uint32_t state = __atomic_load_n(&rundown_reference->state, __ATOMIC_RELAXED);
+    for (;;) {
+        // Check if the entry is already rundown.
+        if (state & CXPLAT_RUNDOWN_ACTIVE) {
+            return false;
+        }
+
+        if (__atomic_compare_exchange_n(
+                &rundown_reference->state,
+                &state,
+                state + CXPLAT_RUNDOWN_COUNT_INCREMENT,
+                false,
+                __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+}
+
+void
+cxplat_release_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    // Check for an extra release before writing, so that it doesn't corrupt the state.
+    uint32_t state = __atomic_load_n(&rundown_reference->state, __ATOMIC_RELAXED);
+    for (;;) {
+        if (state < CXPLAT_RUNDOWN_COUNT_INCREMENT) {
+            throw std::runtime_error("rundown reference already released");
+        }
+
+        if (__atomic_compare_exchange_n(
+                &rundown_reference->state,
+                &state,
+                state - CXPLAT_RUNDOWN_COUNT_INCREMENT,
+                false,
+                __ATOMIC_RELEASE,
+                __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    // Only the release that drops the last reference during rundown needs to wake the waiter.
+    if (state - CXPLAT_RUNDOWN_COUNT_INCREMENT == CXPLAT_RUNDOWN_ACTIVE) {
+        cxplat_posix_futex_wake(&rundown_reference->state, INT32_MAX);
+    }
+}
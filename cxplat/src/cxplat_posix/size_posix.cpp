@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#include "cxplat.h"
+
+// The compiler's checked arithmetic builtins play the part of IntSafe here, so the IntSafe name is unused.
+#define CXPLAT_DEFINE_SAFE_INTEGER_OPERATIONS(type, name, intsafe_name)                                                   \
+    _Must_inspect_result_ cxplat_status_t cxplat_safe_##name##_multiply(                                                  \
+        type multiplicand, type multiplier, _Out_ _Deref_out_range_(==, multiplicand * multiplier) type * result)        \
+    {                                                                                                                      \
+        return __builtin_mul_overflow(multiplicand, multiplier, result) ? CXPLAT_STATUS_ARITHMETIC_OVERFLOW               \
+                                                                         : CXPLAT_STATUS_SUCCESS;                          \
+    }                                                                                                                      \
+                                                                                                                           \
+    _Must_inspect_result_ cxplat_status_t                                                                                  \
+    cxplat_safe_##name##_add(type augend, type addend, _Out_ _Deref_out_range_(==, augend + addend) type * result)       \
+    {                                                                                                                      \
+        return __builtin_add_overflow(augend, addend, result) ? CXPLAT_STATUS_ARITHMETIC_OVERFLOW                         \
+                                                               : CXPLAT_STATUS_SUCCESS;                                    \
+    }                                                                                                                      \
+                                                                                                                           \
+    _Must_inspect_result_ cxplat_status_t cxplat_safe_##name##_subtract(                                                  \
+        type minuend, type subtrahend, _Out_ _Deref_out_range_(==, minuend - subtrahend) type * result)                  \
+    {                                                                                                                      \
+        return __builtin_sub_overflow(minuend, subtrahend, result) ? CXPLAT_STATUS_ARITHMETIC_OVERFLOW                    \
+                                                                    : CXPLAT_STATUS_SUCCESS;                               \
+    }
+
+CXPLAT_SAFE_INTEGER_TYPE_LIST(CXPLAT_DEFINE_SAFE_INTEGER_OPERATIONS)
+
+#undef CXPLAT_DEFINE_SAFE_INTEGER_OPERATIONS
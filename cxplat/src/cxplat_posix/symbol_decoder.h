@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "posix_internal.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <mutex>
+#include <optional>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+
+/***
+ * Stacks are only decoded when a leak or double free is reported, so nothing is loaded up front. Names come from the
+ * dynamic symbol table through dladdr, which finds exported functions. Other addresses are reported as an offset
+ * into the file of their module, which `addr2line -e <file> <offset>` turns into a function, file and line.
+ */
+typedef struct _cxplat_decoded_symbol
+{
+    std::string name;
+    uint64_t displacement;
+} cxplat_decoded_symbol_t;
+
+inline cxplat_status_t
+_cxplat_symbol_decoder_initialize()
+{
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+inline void
+_cxplat_symbol_decoder_deinitialize()
+{
+}
+
+inline cxplat_status_t
+_cxplat_decode_symbol(
+    uintptr_t address,
+    std::string& name,
+    uint64_t& displacement,
+    std::optional<uint32_t>& line_number,
+    std::optional<std::string>& file_name)
+{
+    try {
+        // The same frames show up in many reported stacks, so each address is decoded once.
+        static std::mutex cache_mutex;
+        static std::unordered_map<uintptr_t, cxplat_decoded_symbol_t> cache;
+        std::unique_lock lock(cache_mutex);
+
+        // Reading line numbers would need a DWARF reader.
+        line_number = std::nullopt;
+        file_name = std::nullopt;
+
+        auto it = cache.find(address);
+        if (it == cache.end()) {
+            Dl_info info;
+            if (dladdr(reinterpret_cast<void*>(address), &info) == 0 || info.dli_fname == nullptr) {
+                return CXPLAT_STATUS_NOT_FOUND;
+            }
+            cxplat_decoded_symbol_t symbol;
+            if (info.dli_sname != nullptr) {
+                int status;
+                char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                symbol.name = (demangled != nullptr) ? demangled : info.dli_sname;
+                free(demangled);
+                symbol.displacement = address - reinterpret_cast<uintptr_t>(info.dli_saddr);
+            } else {
+                const char* slash = strrchr(info.dli_fname, '/');
+                symbol.name = (slash != nullptr) ? slash + 1 : info.dli_fname;
+                symbol.displacement = address - reinterpret_cast<uintptr_t>(info.dli_fbase);
+            }
+            it = cache.emplace(address, std::move(symbol)).first;
+        }
+        name = it->second.name;
+        displacement = it->second.displacement;
+        return CXPLAT_STATUS_SUCCESS;
+    } catch (std::bad_alloc&) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+}
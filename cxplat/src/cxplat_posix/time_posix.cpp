@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#include "cxplat.h"
+
+#include <time.h>
+
+/**
+ * @brief Read a clock in the 100-nanosecond units that the Windows interrupt time uses.
+ *
+ * @param[in] clock_id Clock to read.
+ * @returns Clock value in 100-nanosecond units.
+ */
+static uint64_t
+_cxplat_query_clock(clockid_t clock_id)
+{
+    struct timespec time;
+    (void)clock_gettime(clock_id, &time);
+    return ((uint64_t)time.tv_sec * 10000000) + ((uint64_t)time.tv_nsec / 100);
+}
+
+uint64_t
+cxplat_query_time_since_boot_precise(bool include_suspended_time)
+{
+    // CLOCK_BOOTTIME keeps counting while the system is suspended, like the (biased) interrupt time on Windows.
+    // CLOCK_MONOTONIC stops, like the unbiased interrupt time.
+    return _cxplat_query_clock(include_suspended_time ? CLOCK_BOOTTIME : CLOCK_MONOTONIC);
+}
+
+uint64_t
+cxplat_query_time_since_boot_approximate(bool include_suspended_time)
+{
+    // Both clocks are read through the vDSO without a system call, so there is no cheaper clock to use here. The
+    // coarse clocks only advance once per scheduler tick, which is too coarse for callers timing short intervals.
+    return _cxplat_query_clock(include_suspended_time ? CLOCK_BOOTTIME : CLOCK_MONOTONIC);
+}
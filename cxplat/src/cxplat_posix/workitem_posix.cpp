@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains the platform services used by the work item pool.
+#include "../workitem_internal.h"
+#include "cxplat.h"
+#include "posix_internal.h"
+
+#include <new>
+#include <pthread.h>
+
+typedef struct _cxplat_work_item_thread
+{
+    pthread_t thread;
+} cxplat_work_item_thread_t;
+
+static void*
+_cxplat_work_item_thread_routine(_In_ void* parameter)
+{
+    _cxplat_run_work_item_worker((size_t)(uintptr_t)parameter);
+    return nullptr;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_create_work_item_thread(size_t worker_index, _Outptr_ cxplat_work_item_thread_t** thread)
+{
+    *thread = nullptr;
+    cxplat_work_item_thread_t* new_thread = new (std::nothrow) cxplat_work_item_thread_t{};
+    if (new_thread == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+
+    int error = pthread_create(
+        &new_thread->thread, nullptr, _cxplat_work_item_thread_routine, (void*)(uintptr_t)worker_index);
+    if (error != 0) {
+        delete new_thread;
+        return (error == EAGAIN) ? CXPLAT_STATUS_NO_MEMORY : CXPLAT_STATUS_FROM_ERRNO(error);
+    }
+    *thread = new_thread;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+_cxplat_join_work_item_thread(_Frees_ptr_ cxplat_work_item_thread_t* thread)
+{
+    (void)pthread_join(thread->thread, nullptr);
+    delete thread;
+}
@@ -2,9 +2,13 @@
 // SPDX-License-Identifier: MIT
 
 // This file contains initialization/cleanup routines for the Windows user-mode cxplat library.
+#include "../debugging_internal.h"
+#include "../leak_detector.h"
+#include "../workitem_internal.h"
 #include "cxplat.h"
+#include "cxplat_environment.h"
 #include "cxplat_fault_injection.h"
-#include "leak_detector.h"
+#include "cxplat_slab_allocator.h"
 #include "symbol_decoder.h"
 
 #include <algorithm>
@@ -22,6 +26,23 @@ cxplat_leak_detector_ptr _cxplat_leak_detector_ptr;
 #define CXPLAT_FAULT_INJECTION_SIMULATION_ENVIRONMENT_VARIABLE_NAME "CXPLAT_FAULT_INJECTION_SIMULATION"
 #define CXPLAT_MEMORY_LEAK_DETECTION_ENVIRONMENT_VARIABLE_NAME "CXPLAT_MEMORY_LEAK_DETECTION"
 
+/**
+ * @brief Environment variable holding a replay token for a deterministic fault injection schedule to follow.
+ */
+#define CXPLAT_FAULT_INJECTION_SCHEDULE_ENVIRONMENT_VARIABLE_NAME "CXPLAT_FAULT_INJECTION_SCHEDULE"
+
+/**
+ * @brief Environment variable to have the leak detector track only 1 in N allocations, for long soak runs.
+ */
+#define CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE_ENVIRONMENT_VARIABLE_NAME "CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE"
+#endif
+
+/**
+ * @brief Environment variable holding the number of threads that run preemptible work items. If unset or 0, one
+ * thread per active processor is used. 1 runs work items one at a time in the order they were queued.
+ */
+#define CXPLAT_WORK_ITEM_THREADS_ENVIRONMENT_VARIABLE_NAME "CXPLAT_WORK_ITEM_THREADS"
+
 /**
  * @brief Get an environment variable as a string.
  *
@@ -42,15 +63,8 @@ _get_environment_variable_as_string(const std::string& name)
     return value;
 }
 
-/**
- * @brief Get an environment variable as a boolean.
- *
- * @param[in] name Environment variable name.
- * @retval false Environment variable is set to "false", "0", or if it's not set.
- * @retval true Environment variable is set to any other value.
- */
-static bool
-_get_environment_variable_as_bool(const std::string& name)
+bool
+cxplat_get_environment_variable_as_bool(_In_z_ const char* name)
 {
     std::string value = _get_environment_variable_as_string(name);
     if (value.empty()) {
@@ -87,11 +101,22 @@ _get_environment_variable_as_size_t(const std::string& name)
         return 0;
     }
 }
-#endif
 
 static std::mutex cxplat_initialization_mutex;
 static ULONG _cxplat_initialization_count = 0;
 
+// Set by cxplat_set_work_item_thread_count, and used instead of the environment variable if not 0.
+static size_t _cxplat_work_item_thread_count_override = 0;
+
+static size_t
+_cxplat_get_work_item_thread_count()
+{
+    if (_cxplat_work_item_thread_count_override != 0) {
+        return _cxplat_work_item_thread_count_override;
+    }
+    return _get_environment_variable_as_size_t(CXPLAT_WORK_ITEM_THREADS_ENVIRONMENT_VARIABLE_NAME);
+}
+
 inline static HMODULE
 _cxplat_get_caller_module()
 {
@@ -134,7 +159,8 @@ cxplat_initialize()
 #ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
         auto fault_injection_stack_depth =
             _get_environment_variable_as_size_t(CXPLAT_FAULT_INJECTION_SIMULATION_ENVIRONMENT_VARIABLE_NAME);
-        auto leak_detector = _get_environment_variable_as_bool(CXPLAT_MEMORY_LEAK_DETECTION_ENVIRONMENT_VARIABLE_NAME);
+        auto leak_detector =
+            cxplat_get_environment_variable_as_bool(CXPLAT_MEMORY_LEAK_DETECTION_ENVIRONMENT_VARIABLE_NAME);
 
         if (fault_injection_stack_depth || leak_detector) {
             cxplat_status_t status = _cxplat_symbol_decoder_initialize();
@@ -154,17 +180,37 @@ cxplat_initialize()
             cxplat_fuzzing_enabled = true;
         }
 
+        auto fault_injection_schedule =
+            _get_environment_variable_as_string(CXPLAT_FAULT_INJECTION_SCHEDULE_ENVIRONMENT_VARIABLE_NAME);
+        if (!fault_injection_schedule.empty()) {
+            cxplat_fault_injection_schedule_t schedule;
+            cxplat_status_t status =
+                cxplat_fault_injection_parse_replay_token(fault_injection_schedule.c_str(), &schedule);
+            if (!CXPLAT_SUCCEEDED(status)) {
+                return status;
+            }
+            cxplat_fault_injection_set_schedule(&schedule);
+            // Set flag to remove some asserts that fire from incorrect client behavior.
+            cxplat_fuzzing_enabled = true;
+        }
+
         if (leak_detector) {
-            _cxplat_leak_detector_ptr = std::make_unique<cxplat_leak_detector_t>();
+            auto sample_rate =
+                _get_environment_variable_as_size_t(CXPLAT_MEMORY_LEAK_DETECTION_SAMPLE_RATE_ENVIRONMENT_VARIABLE_NAME);
+            _cxplat_leak_detector_ptr = std::make_unique<cxplat_leak_detector_t>(sample_rate);
         }
 #endif
 
+        if (cxplat_get_environment_variable_as_bool(CXPLAT_SLAB_ALLOCATOR_ENVIRONMENT_VARIABLE_NAME)) {
+            (void)cxplat_set_slab_allocator_enabled(true);
+        }
+
         cxplat_status_t status = cxplat_winuser_initialize_processor_info();
         if (!CXPLAT_SUCCEEDED(status)) {
             return status;
         }
 
-        status = cxplat_winuser_initialize_thread_pool();
+        status = _cxplat_initialize_thread_pool(_cxplat_get_work_item_thread_count());
         if (!CXPLAT_SUCCEEDED(status)) {
             cxplat_winuser_clean_up_processor_info();
             return status;
@@ -176,6 +222,20 @@ cxplat_initialize()
     return CXPLAT_STATUS_SUCCESS;
 }
 
+_Must_inspect_result_ cxplat_status_t
+cxplat_set_work_item_thread_count(size_t thread_count)
+{
+    std::unique_lock lock(cxplat_initialization_mutex);
+    _cxplat_work_item_thread_count_override = thread_count;
+    if (_cxplat_initialization_count == 0) {
+        // The threads are started with the new count on initialization.
+        return CXPLAT_STATUS_SUCCESS;
+    }
+
+    _cxplat_clean_up_thread_pool();
+    return _cxplat_initialize_thread_pool(_cxplat_get_work_item_thread_count());
+}
+
 void
 cxplat_cleanup()
 {
@@ -190,13 +250,19 @@ cxplat_cleanup()
         return;
     }
 
-    cxplat_winuser_clean_up_thread_pool();
+    _cxplat_clean_up_thread_pool();
     cxplat_winuser_clean_up_processor_info();
 
 #ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
     if (_cxplat_leak_detector_ptr) {
-        _cxplat_leak_detector_ptr->dump_leaks();
+        size_t leaks = _cxplat_leak_detector_ptr->dump_leaks();
         _cxplat_leak_detector_ptr.reset();
+
+        // An in-process fault injection run reports leaks itself rather than failing on the first one.
+        bool leaks_collected = (leaks > 0) && _cxplat_collect_fault_injection_leaks(leaks);
+
+        // assert to make sure that a leaking test throws an exception thereby failing the test.
+        CXPLAT_DEBUG_ASSERT(leaks == 0 || leaks_collected);
     }
     _cxplat_symbol_decoder_deinitialize();
 #endif
@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains the platform services used by the leak detector and fault injection.
+#include "../debugging_internal.h"
+#include "cxplat.h"
+#include "winuser_internal.h"
+
+#include <windows.h>
+#include <DbgHelp.h>
+#include <new>
+#include <psapi.h>
+#include <string>
+
+// Link with DbgHelp.lib
+#pragma comment(lib, "dbghelp.lib")
+
+typedef struct _cxplat_mapped_file
+{
+    HANDLE file;
+    HANDLE mapping;
+    uint8_t* view;
+} cxplat_mapped_file_t;
+
+size_t
+_cxplat_capture_stack_back_trace(
+    size_t frames_to_skip, size_t frames_to_capture, _Out_writes_to_(frames_to_capture, return) uintptr_t* frames)
+{
+    // Skip this function as well.
+    return CaptureStackBackTrace(
+        static_cast<unsigned long>(frames_to_skip + 1),
+        static_cast<unsigned long>(frames_to_capture),
+        reinterpret_cast<void**>(frames),
+        nullptr);
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_module_range(_In_opt_ const void* module_handle, _Out_ uintptr_t* base_address, _Out_ size_t* size)
+{
+    MODULEINFO module_info = {0};
+    HMODULE module = (module_handle == nullptr) ? GetModuleHandle(nullptr) : (HMODULE)module_handle;
+    if (!GetModuleInformation(GetCurrentProcess(), module, &module_info, sizeof(module_info))) {
+        *base_address = 0;
+        *size = 0;
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+    *base_address = reinterpret_cast<uintptr_t>(module_info.lpBaseOfDll);
+    *size = module_info.SizeOfImage;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_process_path(_Out_ std::string& path)
+{
+    char process_name[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, process_name, MAX_PATH);
+    if (length == 0 || length == MAX_PATH) {
+        path.clear();
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+    path.assign(process_name, length);
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_open_mapped_file(_In_z_ const char* path, _Outptr_ cxplat_mapped_file_t** file, _Out_ uint64_t* file_size)
+{
+    *file = nullptr;
+    *file_size = 0;
+    cxplat_mapped_file_t* mapped_file = new (std::nothrow) cxplat_mapped_file_t{INVALID_HANDLE_VALUE, nullptr, nullptr};
+    if (mapped_file == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    mapped_file->file = CreateFileA(
+        path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mapped_file->file == INVALID_HANDLE_VALUE) {
+        delete mapped_file;
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(mapped_file->file, &size)) {
+        *file_size = (uint64_t)size.QuadPart;
+    }
+    *file = mapped_file;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+static void
+_cxplat_unmap_file(_Inout_ cxplat_mapped_file_t* file)
+{
+    if (file->view != nullptr) {
+        UnmapViewOfFile(file->view);
+        file->view = nullptr;
+    }
+    if (file->mapping != nullptr) {
+        CloseHandle(file->mapping);
+        file->mapping = nullptr;
+    }
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_file(_Inout_ cxplat_mapped_file_t* file, uint64_t size, _Outptr_result_maybenull_ uint8_t** view)
+{
+    _cxplat_unmap_file(file);
+    *view = nullptr;
+
+    // Mapping more than the current size of the file grows the file.
+    file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+    if (file->mapping == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    file->view = reinterpret_cast<uint8_t*>(MapViewOfFile(file->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (file->view == nullptr) {
+        _cxplat_unmap_file(file);
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    *view = file->view;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+_cxplat_close_mapped_file(_Frees_ptr_ cxplat_mapped_file_t* file, uint64_t used_size)
+{
+    _cxplat_unmap_file(file);
+    if (used_size != 0) {
+        LARGE_INTEGER end_of_file;
+        end_of_file.QuadPart = (LONGLONG)used_size;
+        if (SetFilePointerEx(file->file, end_of_file, nullptr, FILE_BEGIN)) {
+            (void)SetEndOfFile(file->file);
+        }
+    }
+    CloseHandle(file->file);
+    delete file;
+}
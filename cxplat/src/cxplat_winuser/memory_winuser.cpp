@@ -4,8 +4,9 @@
 #include "../tags.h"
 #include "cxplat.h"
 #include "cxplat_fault_injection.h"
+#include "winuser_internal.h"
 #ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
-#include "leak_detector.h"
+#include "../leak_detector.h"
 #endif
 #if !defined(UNREFERENCED_PARAMETER)
 #define UNREFERENCED_PARAMETER(X) (X)
@@ -26,7 +27,8 @@ extern cxplat_leak_detector_ptr _cxplat_leak_detector_ptr;
 extern "C" size_t cxplat_fuzzing_memory_limit = MAXSIZE_T;
 #endif
 
-#ifndef NDEBUG
+// Every allocation carries a header so that frees can be accounted against the right pool tag, even in release
+// builds where callers may pass a tag of 0 to cxplat_free.
 typedef struct
 {
     cxplat_pool_flags_t pool_flags;
@@ -47,9 +49,6 @@ _header_from_pointer(const void* memory)
 }
 
 #define UNALIGNED_POINTER_OFFSET sizeof(cxplat_allocation_header_t)
-#else
-#define UNALIGNED_POINTER_OFFSET 0
-#endif
 
 #define ALIGNED_POINTER_OFFSET CXPLAT_CACHE_LINE_SIZE
 
@@ -77,40 +76,109 @@ _unaligned_pointer_from_memory_block(const void* memory)
     return ((uint8_t*)memory) + UNALIGNED_POINTER_OFFSET;
 }
 
-__drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(size) void* cxplat_allocate(
-    cxplat_pool_flags_t pool_flags, size_t size, uint32_t tag)
+// Set in a header's pool_flags if the allocation came from the slab allocator. Callers never see this flag.
+#define CXPLAT_ALLOCATION_FLAG_SLAB 0x80000000
+
+static inline cxplat_pool_flags_t
+_pool_flags_from_header(const cxplat_allocation_header_t* header)
 {
-    CXPLAT_RUNTIME_ASSERT(size > 0);
-#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
-    if (size > cxplat_fuzzing_memory_limit) {
-        return nullptr;
-    }
+    return (cxplat_pool_flags_t)(header->pool_flags & ~CXPLAT_ALLOCATION_FLAG_SLAB);
+}
 
-    if (cxplat_fault_injection_inject_fault()) {
-        return nullptr;
-    }
-#endif
+static inline size_t
+_pointer_offset(cxplat_pool_flags_t pool_flags)
+{
+    return (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) ? ALIGNED_POINTER_OFFSET : UNALIGNED_POINTER_OFFSET;
+}
 
+/**
+ * @brief Allocate memory and fill in its header, without initializing the memory itself.
+ *
+ * @param[in] pool_flags Pool flags to use.
+ * @param[in] size Size of memory to allocate.
+ * @param[in] tag Pool tag to use.
+ * @param[in] use_slab Whether to allocate from the slab allocator if the allocation fits.
+ * @returns Pointer to memory block allocated, or null on failure.
+ */
+static void*
+_allocate_memory(cxplat_pool_flags_t pool_flags, size_t size, uint32_t tag, bool use_slab)
+{
     // Allocate space with a cxplat_allocation_header_t prepended.
     void* memory;
-    if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
+    bool from_slab = false;
+    size_t full_size = _pointer_offset(pool_flags) + size;
+    if (use_slab && full_size <= CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE) {
+        // Slab blocks are always cache aligned, so both pointer offsets work.
+        uint8_t* pointer = (uint8_t*)cxplat_winuser_slab_allocate(full_size);
+        if (pointer == nullptr) {
+            return nullptr;
+        }
+        memory = pointer + _pointer_offset(pool_flags);
+        from_slab = true;
+    } else if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
         // The pointer we return has to be cache aligned so we allocate
         // enough extra space to fill a cache line, and put the
         // cxplat_allocation_header_t at the end of that space.
-        size_t full_size = ALIGNED_POINTER_OFFSET + size;
         uint8_t* pointer = (uint8_t*)_aligned_malloc(full_size, CXPLAT_CACHE_LINE_SIZE);
         if (pointer == nullptr) {
             return nullptr;
         }
         memory = _aligned_pointer_from_memory_block(pointer);
     } else {
-        size_t full_size = UNALIGNED_POINTER_OFFSET + size;
         uint8_t* pointer = (uint8_t*)malloc(full_size);
         if (pointer == nullptr) {
             return nullptr;
         }
         memory = _unaligned_pointer_from_memory_block(pointer);
     }
+
+    cxplat_allocation_header_t* header = _header_from_pointer(memory);
+    header->pool_flags = (from_slab) ? (cxplat_pool_flags_t)(pool_flags | CXPLAT_ALLOCATION_FLAG_SLAB) : pool_flags;
+    header->tag = tag;
+    header->size = size;
+    return memory;
+}
+
+/**
+ * @brief Free memory allocated by _allocate_memory.
+ *
+ * @param[in] pointer Allocation to be freed.
+ */
+static void
+_free_memory(_Frees_ptr_ void* pointer)
+{
+    cxplat_allocation_header_t* header = _header_from_pointer(pointer);
+    cxplat_pool_flags_t pool_flags = _pool_flags_from_header(header);
+    if (header->pool_flags & CXPLAT_ALLOCATION_FLAG_SLAB) {
+        size_t offset = _pointer_offset(pool_flags);
+        cxplat_winuser_slab_free((uint8_t*)pointer - offset, offset + header->size);
+    } else if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
+        uint8_t* memory_block = _memory_block_from_aligned_pointer(pointer);
+        _aligned_free(memory_block);
+    } else {
+        uint8_t* memory_block = _memory_block_from_unaligned_pointer(pointer);
+        free(memory_block);
+    }
+}
+
+__drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(size) void* cxplat_allocate(
+    cxplat_pool_flags_t pool_flags, size_t size, uint32_t tag)
+{
+    CXPLAT_RUNTIME_ASSERT(size > 0);
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (size > cxplat_fuzzing_memory_limit) {
+        return nullptr;
+    }
+
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION)) {
+        return nullptr;
+    }
+#endif
+
+    void* memory = _allocate_memory(pool_flags, size, tag, cxplat_winuser_is_slab_allocator_enabled());
+    if (memory == nullptr) {
+        return nullptr;
+    }
     if (!(pool_flags & CXPLAT_POOL_FLAG_UNINITIALIZED)) {
         memset(memory, 0, size);
     }
@@ -120,13 +188,11 @@ __drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(size) void*
         // returning uninitialized memory, we explicitly fill it with 0xcc.
         memset(memory, 0xcc, size);
     }
+#endif
 
-    // Do any initialization.
-    auto header = (cxplat_allocation_header_t*)((uint8_t*)memory - sizeof(cxplat_allocation_header_t));
-    header->pool_flags = pool_flags;
-    header->tag = tag;
-    header->size = size;
+    cxplat_winuser_record_allocation(tag, size);
 
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
     if (memory && _cxplat_leak_detector_ptr) {
         _cxplat_leak_detector_ptr->register_allocation(reinterpret_cast<uintptr_t>(memory), size);
     }
@@ -143,19 +209,28 @@ __drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(new_size) v
         return nullptr;
     }
 
-    if (cxplat_fault_injection_inject_fault()) {
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION)) {
         return nullptr;
     }
 #endif
 
-#ifndef NDEBUG
     cxplat_allocation_header_t* header = _header_from_pointer(pointer);
     CXPLAT_DEBUG_ASSERT(header->size == old_size);
     CXPLAT_DEBUG_ASSERT(!tag || header->tag == tag);
-    CXPLAT_DEBUG_ASSERT(header->pool_flags == pool_flags);
-#endif
+    CXPLAT_DEBUG_ASSERT(_pool_flags_from_header(header) == pool_flags);
+    uint32_t allocation_tag = header->tag;
+
     void* p;
-    if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
+    bool slab_enabled = cxplat_winuser_is_slab_allocator_enabled();
+    if ((header->pool_flags & CXPLAT_ALLOCATION_FLAG_SLAB) ||
+        (slab_enabled && _pointer_offset(pool_flags) + new_size <= CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE)) {
+        // Slab blocks can't be resized in place, so move the allocation.
+        p = _allocate_memory(pool_flags, new_size, allocation_tag, slab_enabled);
+        if (p) {
+            memcpy(p, pointer, min(old_size, new_size));
+            _free_memory(pointer);
+        }
+    } else if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
         uint8_t* old_memory_block = _memory_block_from_aligned_pointer(pointer);
         size_t full_size = ALIGNED_POINTER_OFFSET + new_size;
         void* new_memory_block = _aligned_realloc(old_memory_block, full_size, CXPLAT_CACHE_LINE_SIZE);
@@ -173,6 +248,11 @@ __drv_allocatesMem(Mem) _Must_inspect_result_ _Ret_writes_maybenull_(new_size) v
     }
 #endif
     if (p) {
+        // The header moved with the block, or was filled in by _allocate_memory.
+        _header_from_pointer(p)->size = new_size;
+        cxplat_winuser_record_free(allocation_tag, old_size);
+        cxplat_winuser_record_allocation(allocation_tag, new_size);
+
         if (new_size > old_size) {
             if (!(pool_flags & CXPLAT_POOL_FLAG_UNINITIALIZED)) {
                 memset(((char*)p) + old_size, 0, new_size - old_size);
@@ -199,21 +279,14 @@ cxplat_free(_Frees_ptr_opt_ void* pointer, cxplat_pool_flags_t pool_flags, uint3
     if (pointer == nullptr) {
         return;
     }
-#ifndef NDEBUG
     cxplat_allocation_header_t* header = _header_from_pointer(pointer);
     CXPLAT_DEBUG_ASSERT(!tag || header->tag == tag);
-    CXPLAT_DEBUG_ASSERT(header->pool_flags == pool_flags);
-#endif
+    CXPLAT_DEBUG_ASSERT(_pool_flags_from_header(header) == pool_flags);
+    cxplat_winuser_record_free(header->tag, header->size);
 #ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
     if (_cxplat_leak_detector_ptr) {
         _cxplat_leak_detector_ptr->unregister_allocation(reinterpret_cast<uintptr_t>(pointer));
     }
 #endif
-    if (pool_flags & CXPLAT_POOL_FLAG_CACHE_ALIGNED) {
-        uint8_t* memory_block = _memory_block_from_aligned_pointer(pointer);
-        _aligned_free(memory_block);
-    } else {
-        uint8_t* memory_block = _memory_block_from_unaligned_pointer(pointer);
-        free(memory_block);
-    }
+    _free_memory(pointer);
 }
@@ -0,0 +1,233 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "cxplat_pool_tag_statistics.h"
+#include "winuser_internal.h"
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tags are kept in a fixed-size open-addressed table so that recording an allocation never allocates. Entries are
+// never removed, so a tag keeps its index for the life of the process. Tags beyond the first
+// CXPLAT_POOL_TAG_TABLE_SIZE distinct tags are not tracked.
+#define CXPLAT_POOL_TAG_TABLE_BITS 10
+#define CXPLAT_POOL_TAG_TABLE_SIZE (1 << CXPLAT_POOL_TAG_TABLE_BITS)
+#define CXPLAT_POOL_TAG_NOT_FOUND CXPLAT_POOL_TAG_TABLE_SIZE
+#define CXPLAT_POOL_TAG_KEY_PRESENT 0x100000000LL
+
+// Counters are sharded by processor so that allocations on different processors never share a cache line.
+#define CXPLAT_POOL_TAG_SHARD_COUNT 16 // Must be a power of 2.
+
+// Once a shard's unfolded byte count drifts this far from zero it is folded into the tag's shared total, which is
+// where the peak is tracked. This bounds how far peak_bytes can lag the true peak.
+#define CXPLAT_POOL_TAG_FOLD_THRESHOLD (16 * 1024)
+
+typedef struct _cxplat_pool_tag_entry
+{
+    volatile int64_t key;          ///< CXPLAT_POOL_TAG_KEY_PRESENT | tag, or 0 if the entry is unused.
+    volatile int64_t folded_bytes; ///< Outstanding bytes folded in from the shards.
+    volatile int64_t peak_bytes;   ///< Highest value of folded_bytes observed.
+} cxplat_pool_tag_entry_t;
+
+typedef struct _cxplat_pool_tag_counters
+{
+    volatile int64_t unfolded_bytes; ///< Outstanding bytes not yet folded into the tag's entry.
+    volatile int64_t allocations;    ///< Allocations recorded on this shard.
+    volatile int64_t frees;          ///< Frees recorded on this shard.
+} cxplat_pool_tag_counters_t;
+
+typedef struct alignas(64) _cxplat_pool_tag_shard
+{
+    cxplat_pool_tag_counters_t counters[CXPLAT_POOL_TAG_TABLE_SIZE];
+} cxplat_pool_tag_shard_t;
+
+struct cxplat_pool_tag_snapshot_t
+{
+    cxplat_pool_tag_statistics_t statistics[CXPLAT_POOL_TAG_TABLE_SIZE]; ///< Indexed the same as the tag table.
+};
+
+static cxplat_pool_tag_entry_t _cxplat_pool_tag_entries[CXPLAT_POOL_TAG_TABLE_SIZE];
+static cxplat_pool_tag_shard_t _cxplat_pool_tag_shards[CXPLAT_POOL_TAG_SHARD_COUNT];
+
+static size_t
+_cxplat_find_pool_tag(uint32_t tag, bool insert)
+{
+    int64_t key = CXPLAT_POOL_TAG_KEY_PRESENT | tag;
+    size_t start = (uint32_t)(tag * 0x9E3779B1u) >> (32 - CXPLAT_POOL_TAG_TABLE_BITS);
+    for (size_t probe = 0; probe < CXPLAT_POOL_TAG_TABLE_SIZE; probe++) {
+        size_t index = (start + probe) & (CXPLAT_POOL_TAG_TABLE_SIZE - 1);
+        int64_t current = _cxplat_pool_tag_entries[index].key;
+        if (current == 0) {
+            if (!insert) {
+                return CXPLAT_POOL_TAG_NOT_FOUND;
+            }
+            current = InterlockedCompareExchange64(&_cxplat_pool_tag_entries[index].key, key, 0);
+            if (current == 0) {
+                return index;
+            }
+        }
+        if (current == key) {
+            return index;
+        }
+    }
+    return CXPLAT_POOL_TAG_NOT_FOUND;
+}
+
+static cxplat_pool_tag_counters_t*
+_cxplat_get_current_pool_tag_counters(size_t index)
+{
+    // GetCurrentProcessorNumber needs no initialization, unlike cxplat_get_current_processor_number, which itself
+    // allocates memory while initializing.
+    return &_cxplat_pool_tag_shards[GetCurrentProcessorNumber() & (CXPLAT_POOL_TAG_SHARD_COUNT - 1)].counters[index];
+}
+
+static void
+_cxplat_fold_pool_tag_counters(size_t index, _Inout_ cxplat_pool_tag_counters_t* counters)
+{
+    cxplat_pool_tag_entry_t* entry = &_cxplat_pool_tag_entries[index];
+    int64_t delta = InterlockedExchange64(&counters->unfolded_bytes, 0);
+    int64_t total = InterlockedAdd64(&entry->folded_bytes, delta);
+    int64_t peak = entry->peak_bytes;
+    while (total > peak) {
+        int64_t observed = InterlockedCompareExchange64(&entry->peak_bytes, total, peak);
+        if (observed == peak) {
+            break;
+        }
+        peak = observed;
+    }
+}
+
+void
+cxplat_winuser_record_allocation(uint32_t tag, size_t size)
+{
+    size_t index = _cxplat_find_pool_tag(tag, true);
+    if (index == CXPLAT_POOL_TAG_NOT_FOUND) {
+        return;
+    }
+    cxplat_pool_tag_counters_t* counters = _cxplat_get_current_pool_tag_counters(index);
+    InterlockedIncrement64(&counters->allocations);
+    if (InterlockedAdd64(&counters->unfolded_bytes, (int64_t)size) >= CXPLAT_POOL_TAG_FOLD_THRESHOLD) {
+        _cxplat_fold_pool_tag_counters(index, counters);
+    }
+}
+
+void
+cxplat_winuser_record_free(uint32_t tag, size_t size)
+{
+    size_t index = _cxplat_find_pool_tag(tag, false);
+    if (index == CXPLAT_POOL_TAG_NOT_FOUND) {
+        return;
+    }
+
+    // The free may run on a different processor than the allocation, so a shard's byte count can go negative.
+    cxplat_pool_tag_counters_t* counters = _cxplat_get_current_pool_tag_counters(index);
+    InterlockedIncrement64(&counters->frees);
+    if (InterlockedAdd64(&counters->unfolded_bytes, -(int64_t)size) <= -CXPLAT_POOL_TAG_FOLD_THRESHOLD) {
+        _cxplat_fold_pool_tag_counters(index, counters);
+    }
+}
+
+static void
+_cxplat_read_pool_tag_statistics(size_t index, _Out_ cxplat_pool_tag_statistics_t* statistics)
+{
+    const cxplat_pool_tag_entry_t* entry = &_cxplat_pool_tag_entries[index];
+    int64_t bytes = entry->folded_bytes;
+    int64_t allocations = 0;
+    int64_t frees = 0;
+    for (size_t shard = 0; shard < CXPLAT_POOL_TAG_SHARD_COUNT; shard++) {
+        const cxplat_pool_tag_counters_t* counters = &_cxplat_pool_tag_shards[shard].counters[index];
+        bytes += counters->unfolded_bytes;
+        allocations += counters->allocations;
+        frees += counters->frees;
+    }
+
+    // Reads race with concurrent updates, so don't let a torn sum go negative.
+    statistics->tag = (uint32_t)entry->key;
+    statistics->outstanding_bytes = (bytes > 0) ? (uint64_t)bytes : 0;
+    statistics->outstanding_allocations = (allocations > frees) ? (uint64_t)(allocations - frees) : 0;
+    statistics->peak_bytes = max((uint64_t)entry->peak_bytes, statistics->outstanding_bytes);
+    statistics->total_allocations = (uint64_t)allocations;
+    statistics->total_frees = (uint64_t)frees;
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_query_pool_tag_statistics(uint32_t tag, _Out_ cxplat_pool_tag_statistics_t* statistics) CXPLAT_NOEXCEPT
+{
+    size_t index = _cxplat_find_pool_tag(tag, false);
+    if (index == CXPLAT_POOL_TAG_NOT_FOUND) {
+        memset(statistics, 0, sizeof(*statistics));
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+    _cxplat_read_pool_tag_statistics(index, statistics);
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_enumerate_pool_tag_statistics(
+    _In_ cxplat_pool_tag_statistics_callback_t callback, _In_opt_ void* context) CXPLAT_NOEXCEPT
+{
+    for (size_t index = 0; index < CXPLAT_POOL_TAG_TABLE_SIZE; index++) {
+        if (_cxplat_pool_tag_entries[index].key == 0) {
+            continue;
+        }
+        cxplat_pool_tag_statistics_t statistics;
+        _cxplat_read_pool_tag_statistics(index, &statistics);
+        if (!callback(&statistics, context)) {
+            break;
+        }
+    }
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_capture_pool_tag_snapshot(_Outptr_ cxplat_pool_tag_snapshot_t** snapshot) CXPLAT_NOEXCEPT
+{
+    cxplat_pool_tag_snapshot_t* new_snapshot = (cxplat_pool_tag_snapshot_t*)calloc(1, sizeof(*new_snapshot));
+    if (new_snapshot == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    for (size_t index = 0; index < CXPLAT_POOL_TAG_TABLE_SIZE; index++) {
+        if (_cxplat_pool_tag_entries[index].key != 0) {
+            _cxplat_read_pool_tag_statistics(index, &new_snapshot->statistics[index]);
+        }
+    }
+    *snapshot = new_snapshot;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_free_pool_tag_snapshot(_Frees_ptr_opt_ cxplat_pool_tag_snapshot_t* snapshot) CXPLAT_NOEXCEPT
+{
+    free(snapshot);
+}
+
+size_t
+cxplat_compare_pool_tag_snapshots(
+    _In_ const cxplat_pool_tag_snapshot_t* before,
+    _In_ const cxplat_pool_tag_snapshot_t* after,
+    _In_opt_ cxplat_pool_tag_difference_callback_t callback,
+    _In_opt_ void* context) CXPLAT_NOEXCEPT
+{
+    // A tag keeps its index once inserted, and an unused index reads as all zeros, so the snapshots can be compared
+    // index by index.
+    size_t changed = 0;
+    for (size_t index = 0; index < CXPLAT_POOL_TAG_TABLE_SIZE; index++) {
+        const cxplat_pool_tag_statistics_t* old_statistics = &before->statistics[index];
+        const cxplat_pool_tag_statistics_t* new_statistics = &after->statistics[index];
+        cxplat_pool_tag_difference_t difference;
+        difference.tag = new_statistics->tag;
+        difference.outstanding_bytes =
+            (int64_t)new_statistics->outstanding_bytes - (int64_t)old_statistics->outstanding_bytes;
+        difference.outstanding_allocations =
+            (int64_t)new_statistics->outstanding_allocations - (int64_t)old_statistics->outstanding_allocations;
+        if (difference.outstanding_bytes == 0 && difference.outstanding_allocations == 0) {
+            continue;
+        }
+        changed++;
+        if (callback != nullptr) {
+            callback(&difference, context);
+        }
+    }
+    return changed;
+}
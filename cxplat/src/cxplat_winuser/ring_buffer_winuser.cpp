@@ -0,0 +1,126 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains the platform services used by the ring buffer.
+#include "../ring_buffer_internal.h"
+#include "cxplat.h"
+#include "winuser_internal.h"
+
+#include <windows.h>
+#include <new>
+
+// Link with Mincore.lib for VirtualAlloc2 and MapViewOfFile3.
+#pragma comment(lib, "Mincore.lib")
+
+typedef struct _cxplat_ring_buffer_section
+{
+    HANDLE section; ///< Pagefile-backed section holding the data pages.
+    size_t size;
+} cxplat_ring_buffer_section_t;
+
+size_t
+_cxplat_get_ring_buffer_section_granularity()
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwAllocationGranularity;
+}
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_create_ring_buffer_section(size_t size, _Outptr_ cxplat_ring_buffer_section_t** section)
+{
+    *section = nullptr;
+    cxplat_ring_buffer_section_t* new_section = new (std::nothrow) cxplat_ring_buffer_section_t{nullptr, size};
+    if (new_section == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    new_section->section = CreateFileMapping(
+        INVALID_HANDLE_VALUE,
+        nullptr,
+        PAGE_READWRITE,
+        (unsigned long)((uint64_t)size >> 32),
+        (unsigned long)size,
+        nullptr);
+    if (new_section->section == nullptr) {
+        delete new_section;
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    *section = new_section;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+// This code is derived from the sample at:
+// https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
+
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_ring_buffer_section(
+    _In_ const cxplat_ring_buffer_section_t* section, bool read_only, _Outptr_ uint8_t** view)
+{
+    *view = nullptr;
+    size_t size = section->size;
+    unsigned long protection = (read_only) ? PAGE_READONLY : PAGE_READWRITE;
+
+    // Reserve a placeholder region for both copies, and split it into two placeholders of equal size.
+    uint8_t* placeholder1 = reinterpret_cast<uint8_t*>(
+        VirtualAlloc2(nullptr, nullptr, 2 * size, MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, nullptr, 0));
+    if (placeholder1 == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+#pragma warning(push)
+#pragma warning(disable : 6333)  // Invalid parameter:  passing MEM_RELEASE and a non-zero dwSize parameter to
+                                 // 'VirtualFree' is not allowed.  This causes the call to fail.
+#pragma warning(disable : 28160) // Passing MEM_RELEASE and a non-zero dwSize parameter to VirtualFree is not allowed.
+                                 // This results in the failure of this call.
+    if (!VirtualFree(placeholder1, size, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER)) {
+        VirtualFree(placeholder1, 0, MEM_RELEASE);
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+#pragma warning(pop)
+    uint8_t* placeholder2 = placeholder1 + size;
+
+    // Map the section into each placeholder, which takes ownership of it.
+    void* view1 = MapViewOfFile3(
+        section->section, nullptr, placeholder1, 0, size, MEM_REPLACE_PLACEHOLDER, protection, nullptr, 0);
+    if (view1 == nullptr) {
+        VirtualFree(placeholder1, 0, MEM_RELEASE);
+        VirtualFree(placeholder2, 0, MEM_RELEASE);
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    void* view2 = MapViewOfFile3(
+        section->section, nullptr, placeholder2, 0, size, MEM_REPLACE_PLACEHOLDER, protection, nullptr, 0);
+    if (view2 == nullptr) {
+        UnmapViewOfFileEx(view1, 0);
+        VirtualFree(placeholder2, 0, MEM_RELEASE);
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+
+    *view = reinterpret_cast<uint8_t*>(view1);
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+_cxplat_unmap_ring_buffer_section(_In_ const cxplat_ring_buffer_section_t* section, _In_ uint8_t* view)
+{
+    UnmapViewOfFile(view);
+    UnmapViewOfFile(view + section->size);
+}
+
+void
+_cxplat_delete_ring_buffer_section(_Frees_ptr_ cxplat_ring_buffer_section_t* section)
+{
+    CloseHandle(section->section);
+    delete section;
+}
+
+bool
+_cxplat_wait_on_address(_In_ volatile uint32_t* address, uint32_t expected, uint32_t timeout_ms)
+{
+    return WaitOnAddress(address, &expected, sizeof(expected), (timeout_ms == UINT32_MAX) ? INFINITE : timeout_ms) ||
+           GetLastError() != ERROR_TIMEOUT;
+}
+
+void
+_cxplat_wake_by_address_all(_In_ volatile uint32_t* address)
+{
+    WakeByAddressAll((void*)address);
+}
@@ -1,209 +1,110 @@
 // Copyright (c) Microsoft Corporation
 // SPDX-License-Identifier: MIT
 #include "cxplat.h"
-#include <map>
-#include <memory>
-#include <mutex>
+#include "cxplat_fault_injection.h"
+#include "winuser_internal.h"
+
+#include <stdexcept>
 #include <windows.h>
 
+#pragma comment(lib, "Mincore.lib")
+
 /***
- * @brief This following class implements a mock of the Windows Kernel's rundown reference implementation.
- * 1) It uses a map to track the number of references to a given cxplat_rundown_reference_t structure.
- * 2) The address of the cxplat_rundown_reference_t structure is used as the key to the map.
- * 3) A single condition variable is used to wait for the ref count of any cxplat_rundown_reference_t structure to reach 0.
- * 4) The class is a singleton and is created during static initialization and destroyed during static destruction.
+ * The rundown state is kept in cxplat_rundown_reference_t itself as a single word, mirroring the Windows
+ * Kernel's EX_RUNDOWN_REF:
+ * 1) Bit 0 is set once rundown has started, after which no new references can be acquired.
+ * 2) The remaining bits hold the number of references, so each reference adds CXPLAT_RUNDOWN_COUNT_INCREMENT.
+ * 3) A thread waiting for rundown parks on the word with WaitOnAddress, and is only woken by the release
+ *    that drops the last reference while rundown is active.
  */
-typedef class _rundown_ref_table
+#define CXPLAT_RUNDOWN_ACTIVE 0x1
+#define CXPLAT_RUNDOWN_COUNT_INCREMENT 0x2
+
+void
+cxplat_initialize_rundown_protection(_Out_ cxplat_rundown_reference_t* rundown_reference)
 {
-  private:
-    static std::unique_ptr<_rundown_ref_table> _instance;
-
-  public:
-    // The constructor and destructor should be private to ensure that the class is a singleton, but that is not
-    // possible because the singleton instance is stored in a unique_ptr which requires the constructor to be public.
-    // The instance of the class can be accessed using the instance() method.
-    _rundown_ref_table() = default;
-    ~_rundown_ref_table() = default;
-
-    /**
-     * @brief Get the singleton instance of the rundown ref table.
-     *
-     * @return The singleton instance of the rundown ref table.
-     */
-    static _rundown_ref_table&
-    instance()
-    {
-        return *_instance;
-    }
+    rundown_reference->state = 0;
+}
 
-    /**
-     * @brief Initialize the rundown ref table entry for the given context.
-     *
-     * @param[in] context The address of a cxplat_rundown_reference_t structure.
-     */
-    void
-    initialize_rundown_ref(_In_ const void* context)
-    {
-        std::unique_lock lock(_lock);
-
-        // Re-initialize the entry if it already exists.
-        if (_rundown_ref_counts.find((uint64_t)context) != _rundown_ref_counts.end()) {
-            _rundown_ref_counts.erase((uint64_t)context);
-        }
+void
+cxplat_reinitialize_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    long long state = rundown_reference->state;
 
-        _rundown_ref_counts[(uint64_t)context] = {false, 0};
+    // Check if the entry is not rundown.
+    if ((state & CXPLAT_RUNDOWN_ACTIVE) == 0) {
+        throw std::runtime_error("rundown reference not rundown");
     }
 
-    /**
-     * @brief Reinitialize the rundown ref table entry for the given context.
-     *
-     * @param[in] context The address of a previously run down cxplat_rundown_reference_t structure.
-     */
-    void
-    reinitialize_rundown_ref(_In_ const void* context)
-    {
-        std::unique_lock lock(_lock);
-
-        // Fail if the entry is not initialized.
-        if (_rundown_ref_counts.find((uint64_t)context) == _rundown_ref_counts.end()) {
-            throw std::runtime_error("rundown ref table not initialized");
-        }
-
-        auto& [rundown, ref_count] = _rundown_ref_counts[(uint64_t)context];
-
-        // Check if the entry is not rundown.
-        if (!rundown) {
-            throw std::runtime_error("rundown ref table not rundown");
-        }
-
-        if (ref_count != 0) {
-            throw std::runtime_error("rundown ref table corruption");
-        }
-
-        rundown = false;
+    if (state != CXPLAT_RUNDOWN_ACTIVE) {
+        throw std::runtime_error("rundown reference corruption");
     }
 
-    /**
-     * @brief Acquire a rundown ref for the given context.
-     *
-     * @param[in] context The address of a cxplat_rundown_reference_t structure.
-     * @retval true Rundown has not started.
-     * @retval false Rundown has started.
-     */
-    bool
-    acquire_rundown_ref(_In_ const void* context)
-    {
-        std::unique_lock lock(_lock);
-
-        // Fail if the entry is not initialized.
-        if (_rundown_ref_counts.find((uint64_t)context) == _rundown_ref_counts.end()) {
-            throw std::runtime_error("rundown ref table not initialized");
-        }
-
-        // Check if the entry is already rundown.
-        if (std::get<0>(_rundown_ref_counts[(uint64_t)context])) {
-            return false;
-        }
+    InterlockedExchange64(&rundown_reference->state, 0);
+}
 
-        // Increment the ref count if the entry is not rundown.
-        std::get<1>(_rundown_ref_counts[(uint64_t)context])++;
+void
+cxplat_wait_for_rundown_protection_release(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    long long state = InterlockedOr64(&rundown_reference->state, CXPLAT_RUNDOWN_ACTIVE) | CXPLAT_RUNDOWN_ACTIVE;
 
-        return true;
+    // Wait for the ref count to reach 0.
+    while (state != CXPLAT_RUNDOWN_ACTIVE) {
+        WaitOnAddress(&rundown_reference->state, &state, sizeof(state), INFINITE);
+        state = rundown_reference->state;
     }
+}
 
-    /**
-     * @brief Release a rundown ref for the given context.
-     *
-     * @param[in] context The address of a cxplat_rundown_reference_t structure.
-     */
-    void
-    release_rundown_ref(_In_ const void* context)
-    {
-        std::unique_lock lock(_lock);
-
-        // Fail if the entry is not initialized.
-        if (_rundown_ref_counts.find((uint64_t)context) == _rundown_ref_counts.end()) {
-            throw std::runtime_error("rundown ref table not initialized");
-        }
-
-        if (std::get<1>(_rundown_ref_counts[(uint64_t)context]) == 0) {
-            throw std::runtime_error("rundown ref table already released");
-        }
-
-        std::get<1>(_rundown_ref_counts[(uint64_t)context])--;
-
-        if (std::get<1>(_rundown_ref_counts[(uint64_t)context]) == 0) {
-            _rundown_ref_cv.notify_all();
+int
+cxplat_winuser_acquire_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
+{
+    long long state = rundown_reference->state;
+    for (;;) {
+        // Check if the entry is already rundown.
+        if (state & CXPLAT_RUNDOWN_ACTIVE) {
+            return FALSE;
         }
-    }
 
-    /**
-     * @brief Wait for the rundown ref count to reach 0 for the given context.
-     *
-     * @param[in] context The address of a cxplat_rundown_reference_t structure.
-     */
-    void
-    wait_for_rundown_ref(_In_ const void* context)
-    {
-        std::unique_lock lock(_lock);
-
-        // Fail if the entry is not initialized.
-        if (_rundown_ref_counts.find((uint64_t)context) == _rundown_ref_counts.end()) {
-            throw std::runtime_error("rundown ref table not initialized");
+        long long observed =
+            InterlockedCompareExchange64(&rundown_reference->state, state + CXPLAT_RUNDOWN_COUNT_INCREMENT, state);
+        if (observed == state) {
+            return TRUE;
         }
-
-        auto& [rundown, ref_count] = _rundown_ref_counts[(uint64_t)context];
-        rundown = true;
-        // Wait for the ref count to reach 0.
-        _rundown_ref_cv.wait(lock, [&ref_count] { return ref_count == 0; });
+        state = observed;
     }
-
-  private:
-    std::mutex _lock;
-    std::map<uint64_t, std::tuple<bool, uint64_t>> _rundown_ref_counts;
-    std::condition_variable _rundown_ref_cv;
-} rundown_ref_table_t;
-
-/**
- * @brief The singleton instance of the rundown ref table. Created during static initialization and destroyed during
- * static destruction.
- */
-std::unique_ptr<_rundown_ref_table> rundown_ref_table_t::_instance = std::make_unique<rundown_ref_table_t>();
-
-void
-cxplat_initialize_rundown_protection(_Out_ cxplat_rundown_reference_t* rundown_reference)
-{
-#pragma warning(push)
-#pragma warning(suppress : 6001) // Uninitialized memory. The rundown_ref is used as a key in a map and is not
-                                 // dereferenced.
-    rundown_ref_table_t::instance().initialize_rundown_ref(rundown_reference);
-#pragma warning(pop)
-}
-
-void
-cxplat_reinitialize_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
-{
-    rundown_ref_table_t::instance().reinitialize_rundown_ref(rundown_reference);
-}
-
-void
-cxplat_wait_for_rundown_protection_release(_Inout_ cxplat_rundown_reference_t* rundown_reference)
-{
-    rundown_ref_table_t::instance().wait_for_rundown_ref(rundown_reference);
 }
 
 int
 cxplat_acquire_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
 {
-    if (rundown_ref_table_t::instance().acquire_rundown_ref(rundown_reference)) {
-        return TRUE;
-    } else {
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN)) {
         return FALSE;
     }
+#endif
+    return cxplat_winuser_acquire_rundown_protection(rundown_reference);
 }
 
 void
 cxplat_release_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference)
 {
-    rundown_ref_table_t::instance().release_rundown_ref(rundown_reference);
+    // Check for an extra release before writing, so that it doesn't corrupt the state.
+    long long state = rundown_reference->state;
+    for (;;) {
+        if (state < CXPLAT_RUNDOWN_COUNT_INCREMENT) {
+            throw std::runtime_error("rundown reference already released");
+        }
+
+        long long observed =
+            InterlockedCompareExchange64(&rundown_reference->state, state - CXPLAT_RUNDOWN_COUNT_INCREMENT, state);
+        if (observed == state) {
+            break;
+        }
+        state = observed;
+    }
+
+    // Only the release that drops the last reference during rundown needs to wake the waiter.
+    if (state - CXPLAT_RUNDOWN_COUNT_INCREMENT == CXPLAT_RUNDOWN_ACTIVE) {
+        WakeByAddressAll((void*)&rundown_reference->state);
+    }
 }
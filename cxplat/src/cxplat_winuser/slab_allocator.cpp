@@ -0,0 +1,155 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+// This file contains a size-class slab allocator that cxplat_allocate can use for small allocations.
+#include "cxplat.h"
+#include "cxplat_slab_allocator.h"
+#include "winuser_internal.h"
+
+#include <windows.h>
+
+// Blocks are powers of two from 64 bytes up to CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE. Since every slab is page
+// aligned, every block is aligned to its own size and therefore to a cache line.
+#define CXPLAT_SLAB_MINIMUM_BLOCK_SHIFT 6
+#define CXPLAT_SLAB_CLASS_COUNT 5
+static_assert(
+    (1 << (CXPLAT_SLAB_MINIMUM_BLOCK_SHIFT + CXPLAT_SLAB_CLASS_COUNT - 1)) == CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE);
+
+// Size of each slab carved into blocks.
+#define CXPLAT_SLAB_SIZE (64 * 1024)
+
+// Number of blocks of each class a thread keeps for itself, and the number moved to or from the shared free list
+// at once when a thread's cache runs empty or full.
+#define CXPLAT_SLAB_THREAD_CACHE_SIZE 64
+#define CXPLAT_SLAB_BATCH_SIZE (CXPLAT_SLAB_THREAD_CACHE_SIZE / 2)
+
+typedef struct _cxplat_slab_class
+{
+    SLIST_HEADER free_list; ///< Free blocks shared by all threads.
+    SRWLOCK grow_lock;      ///< Serializes adding slabs so that only one thread grows the class at a time.
+} cxplat_slab_class_t;
+
+// A zeroed SLIST_HEADER is an empty list and a zeroed SRWLOCK is unlocked, so no initialization is needed.
+static cxplat_slab_class_t _cxplat_slab_classes[CXPLAT_SLAB_CLASS_COUNT];
+static volatile long _cxplat_slab_allocator_enabled = 0;
+
+typedef struct _cxplat_slab_thread_cache
+{
+    void* blocks[CXPLAT_SLAB_CLASS_COUNT][CXPLAT_SLAB_THREAD_CACHE_SIZE];
+    size_t count[CXPLAT_SLAB_CLASS_COUNT];
+
+    ~_cxplat_slab_thread_cache()
+    {
+        // Give the blocks cached by an exiting thread back to the shared free lists.
+        for (size_t size_class = 0; size_class < CXPLAT_SLAB_CLASS_COUNT; size_class++) {
+            for (size_t i = 0; i < count[size_class]; i++) {
+                InterlockedPushEntrySList(
+                    &_cxplat_slab_classes[size_class].free_list, (SLIST_ENTRY*)blocks[size_class][i]);
+            }
+            count[size_class] = 0;
+        }
+    }
+} cxplat_slab_thread_cache_t;
+
+static thread_local cxplat_slab_thread_cache_t _cxplat_slab_thread_cache;
+
+bool
+cxplat_set_slab_allocator_enabled(bool enabled) CXPLAT_NOEXCEPT
+{
+    return InterlockedExchange(&_cxplat_slab_allocator_enabled, enabled ? 1 : 0) != 0;
+}
+
+bool
+cxplat_winuser_is_slab_allocator_enabled()
+{
+    return _cxplat_slab_allocator_enabled != 0;
+}
+
+static size_t
+_cxplat_get_slab_class(size_t size)
+{
+    size_t size_class = 0;
+    while (((size_t)1 << (CXPLAT_SLAB_MINIMUM_BLOCK_SHIFT + size_class)) < size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+/**
+ * @brief Move up to CXPLAT_SLAB_BATCH_SIZE free blocks of a class into the calling thread's cache, adding a new slab
+ * if the shared free list is empty.
+ *
+ * @param[in,out] cache The calling thread's cache.
+ * @param[in] size_class Class to refill.
+ */
+static void
+_cxplat_refill_slab_thread_cache(_Inout_ cxplat_slab_thread_cache_t* cache, size_t size_class)
+{
+    cxplat_slab_class_t* slab_class = &_cxplat_slab_classes[size_class];
+    while (cache->count[size_class] < CXPLAT_SLAB_BATCH_SIZE) {
+        SLIST_ENTRY* entry = InterlockedPopEntrySList(&slab_class->free_list);
+        if (entry == nullptr) {
+            break;
+        }
+        cache->blocks[size_class][cache->count[size_class]++] = entry;
+    }
+    if (cache->count[size_class] > 0) {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&slab_class->grow_lock);
+
+    // Another thread may have added a slab while this one waited for the lock.
+    SLIST_ENTRY* entry = InterlockedPopEntrySList(&slab_class->free_list);
+    if (entry != nullptr) {
+        cache->blocks[size_class][cache->count[size_class]++] = entry;
+    } else {
+        // Slabs are never returned to the system, since their blocks may be cached by any thread or still be in use
+        // when cxplat is cleaned up.
+        uint8_t* slab = (uint8_t*)VirtualAlloc(nullptr, CXPLAT_SLAB_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (slab != nullptr) {
+            // Keep the first batch for this thread and share the rest.
+            size_t block_size = (size_t)1 << (CXPLAT_SLAB_MINIMUM_BLOCK_SHIFT + size_class);
+            for (size_t offset = 0; offset < CXPLAT_SLAB_SIZE; offset += block_size) {
+                if (cache->count[size_class] < CXPLAT_SLAB_BATCH_SIZE) {
+                    cache->blocks[size_class][cache->count[size_class]++] = slab + offset;
+                } else {
+                    InterlockedPushEntrySList(&slab_class->free_list, (SLIST_ENTRY*)(slab + offset));
+                }
+            }
+        }
+    }
+
+    ReleaseSRWLockExclusive(&slab_class->grow_lock);
+}
+
+_Must_inspect_result_ _Ret_maybenull_ void*
+cxplat_winuser_slab_allocate(size_t size)
+{
+    CXPLAT_DEBUG_ASSERT(size <= CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE);
+    size_t size_class = _cxplat_get_slab_class(size);
+    cxplat_slab_thread_cache_t* cache = &_cxplat_slab_thread_cache;
+    if (cache->count[size_class] == 0) {
+        _cxplat_refill_slab_thread_cache(cache, size_class);
+        if (cache->count[size_class] == 0) {
+            return nullptr;
+        }
+    }
+    return cache->blocks[size_class][--cache->count[size_class]];
+}
+
+void
+cxplat_winuser_slab_free(_Frees_ptr_ void* block, size_t size)
+{
+    size_t size_class = _cxplat_get_slab_class(size);
+    cxplat_slab_thread_cache_t* cache = &_cxplat_slab_thread_cache;
+    if (cache->count[size_class] == CXPLAT_SLAB_THREAD_CACHE_SIZE) {
+        // Keep half so that a thread alternating between allocating and freeing doesn't hit the shared list each time.
+        cxplat_slab_class_t* slab_class = &_cxplat_slab_classes[size_class];
+        while (cache->count[size_class] > CXPLAT_SLAB_THREAD_CACHE_SIZE - CXPLAT_SLAB_BATCH_SIZE) {
+            InterlockedPushEntrySList(
+                &slab_class->free_list, (SLIST_ENTRY*)cache->blocks[size_class][--cache->count[size_class]]);
+        }
+    }
+    cache->blocks[size_class][cache->count[size_class]++] = block;
+}
@@ -8,13 +8,60 @@
 #define CXPLAT_STATUS_FROM_WIN32(code) ((cxplat_status_t)__HRESULT_FROM_WIN32(code))
 
 cxplat_status_t
-cxplat_winuser_initialize_thread_pool();
+cxplat_winuser_initialize_processor_info();
 
 void
-cxplat_winuser_clean_up_thread_pool();
+cxplat_winuser_clean_up_processor_info();
 
-cxplat_status_t
-cxplat_winuser_initialize_processor_info();
+/**
+ * @brief Account an allocation against its pool tag's statistics.
+ *
+ * @param[in] tag Pool tag of the allocation.
+ * @param[in] size Size of the allocation in bytes.
+ */
+void
+cxplat_winuser_record_allocation(uint32_t tag, size_t size);
 
+/**
+ * @brief Account a free against its pool tag's statistics.
+ *
+ * @param[in] tag Pool tag of the allocation.
+ * @param[in] size Size of the allocation in bytes.
+ */
 void
-cxplat_winuser_clean_up_processor_info();
+cxplat_winuser_record_free(uint32_t tag, size_t size);
+
+// Largest block, including the allocation header, that the slab allocator serves.
+#define CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE 1024
+
+bool
+cxplat_winuser_is_slab_allocator_enabled();
+
+/**
+ * @brief Allocate a block from the slab allocator.
+ *
+ * @param[in] size Size of the block, at most CXPLAT_WINUSER_SLAB_MAXIMUM_BLOCK_SIZE.
+ * @returns Pointer to a cache-aligned block, or null on failure.
+ */
+_Must_inspect_result_ _Ret_maybenull_ void*
+cxplat_winuser_slab_allocate(size_t size);
+
+/**
+ * @brief Free a block allocated by cxplat_winuser_slab_allocate.
+ *
+ * @param[in] block Block to free.
+ * @param[in] size Size passed to cxplat_winuser_slab_allocate.
+ */
+void
+cxplat_winuser_slab_free(_Frees_ptr_ void* block, size_t size);
+
+/**
+ * @brief Acquire rundown protection without giving fault injection a chance to fail it, for internal callers that
+ * can't handle failure.
+ *
+ * @param[in,out] rundown_reference Rundown reference to acquire.
+ * @retval TRUE Rundown protection was acquired.
+ * @retval FALSE Rundown has started.
+ */
+int
+cxplat_winuser_acquire_rundown_protection(_Inout_ cxplat_rundown_reference_t* rundown_reference);
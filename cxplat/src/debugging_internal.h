@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+// The leak detector and fault injection are shared by the user-mode backends, which supply the platform services
+// declared in this file.
+#include "cxplat.h"
+
+#include <string>
+
+/**
+ * @brief Capture the return addresses on the current thread's stack.
+ *
+ * @param[in] frames_to_skip Number of frames to skip, not counting this function.
+ * @param[in] frames_to_capture Largest number of frames to capture.
+ * @param[out] frames Captured return addresses, innermost first.
+ * @return Number of frames captured, which is 0 if the stack could not be walked.
+ */
+size_t
+_cxplat_capture_stack_back_trace(
+    size_t frames_to_skip, size_t frames_to_capture, _Out_writes_to_(frames_to_capture, return) uintptr_t* frames);
+
+/**
+ * @brief Get the address range a loaded module occupies.
+ *
+ * @param[in] module_handle Handle of the module, or null for the executable of the current process.
+ * @param[out] base_address Lowest address of the module.
+ * @param[out] size Number of bytes from the base address to the end of the module.
+ * @retval CXPLAT_STATUS_SUCCESS The range was found.
+ * @retval CXPLAT_STATUS_NOT_FOUND No loaded module has this handle.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_module_range(_In_opt_ const void* module_handle, _Out_ uintptr_t* base_address, _Out_ size_t* size);
+
+/**
+ * @brief Get the path of the executable of the current process.
+ *
+ * @param[out] path Path of the executable.
+ * @retval CXPLAT_STATUS_SUCCESS The path was found.
+ * @retval CXPLAT_STATUS_NOT_FOUND The path could not be determined.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_get_process_path(_Out_ std::string& path);
+
+/**
+ * @brief A file mapped into memory for reading and writing.
+ */
+typedef struct _cxplat_mapped_file cxplat_mapped_file_t;
+
+/**
+ * @brief Open a file to be mapped, creating it if it doesn't exist.
+ *
+ * @param[in] path Path of the file.
+ * @param[out] file The opened file, which is not mapped yet.
+ * @param[out] file_size Current size of the file.
+ * @retval CXPLAT_STATUS_SUCCESS The file was opened.
+ * @retval CXPLAT_STATUS_NO_MEMORY Not enough memory to track the file.
+ * @retval CXPLAT_STATUS_NOT_FOUND The file could not be opened.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_open_mapped_file(_In_z_ const char* path, _Outptr_ cxplat_mapped_file_t** file, _Out_ uint64_t* file_size);
+
+/**
+ * @brief Map a file, replacing any view mapped before. Mapping more than the current size of the file grows it.
+ *
+ * @param[in,out] file File to map.
+ * @param[in] size Number of bytes to map.
+ * @param[out] view The mapped bytes, or null on failure.
+ * @retval CXPLAT_STATUS_SUCCESS The file was mapped.
+ * @retval CXPLAT_STATUS_NO_MEMORY The file could not be grown or mapped.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_file(_Inout_ cxplat_mapped_file_t* file, uint64_t size, _Outptr_result_maybenull_ uint8_t** view);
+
+/**
+ * @brief Unmap and close a file.
+ *
+ * @param[in] file File to close.
+ * @param[in] used_size If not 0, the file is truncated to this size, giving back space mapped but never written.
+ */
+void
+_cxplat_close_mapped_file(_Frees_ptr_ cxplat_mapped_file_t* file, uint64_t used_size);
+
+/**
+ * @brief Hand leaks found while cleaning up cxplat to the in-process fault injection run in progress, if any.
+ *
+ * @param[in] leak_count Number of leaked allocations.
+ * @retval true The leaks were added to the fault injection run's results.
+ * @retval false No fault injection run is in progress.
+ */
+bool
+_cxplat_collect_fault_injection_leaks(size_t leak_count);
@@ -0,0 +1,650 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "cxplat_fault_injection.h"
+#include "debugging_internal.h"
+#include "fault_injection.h"
+#include "leak_detector.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+
+static std::unique_ptr<cxplat_fault_injection_t> _cxplat_fault_injection_singleton;
+
+extern cxplat_leak_detector_ptr _cxplat_leak_detector_ptr;
+
+/**
+ * @brief State of the in-process fault injection run in progress, which counts fault injection sites instead of
+ * tracking stacks.
+ */
+typedef struct _cxplat_fault_injection_site_run
+{
+    std::atomic<bool> active;
+    std::atomic<size_t> sites_reached;
+    size_t site_to_fail;
+    std::atomic<bool> fault_injected;
+    uint64_t leak_detector_epoch;
+    std::atomic<size_t> leaks_collected;
+} cxplat_fault_injection_site_run_t;
+
+static cxplat_fault_injection_site_run_t _cxplat_fault_injection_site_run;
+
+/**
+ * @brief State of the fault injection schedule being followed, if any.
+ */
+typedef struct _cxplat_fault_injection_schedule_state
+{
+    std::atomic<bool> active;
+    cxplat_fault_injection_schedule_t schedule;
+    std::atomic<uint64_t> calls[CXPLAT_FAULT_INJECTION_CLASS_COUNT];
+} cxplat_fault_injection_schedule_state_t;
+
+static cxplat_fault_injection_schedule_state_t _cxplat_fault_injection_schedule;
+
+#define CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_VERSION 1
+
+/**
+ * @brief Thread local storage to track recursing from the fault injection callback.
+ */
+static thread_local int _cxplat_fault_injection_recursion = 0;
+
+/**
+ * @brief Class to automatically increment and decrement the recursion count.
+ */
+class cxplat_fault_injection_recursion_guard
+{
+  public:
+    cxplat_fault_injection_recursion_guard() { _cxplat_fault_injection_recursion++; }
+    ~cxplat_fault_injection_recursion_guard() { _cxplat_fault_injection_recursion--; }
+    /**
+     * @brief Return true if the current thread is recursing from the fault injection callback.
+     * @retval true The current thread is recursing from the fault injection callback.
+     * @retval false The current thread is not recursing from the fault injection callback.
+     */
+    bool
+    is_recursing()
+    {
+        return (_cxplat_fault_injection_recursion > 1);
+    }
+};
+
+static inline uint64_t
+_cxplat_fault_injection_mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t
+_cxplat_compute_stack_fingerprint(_In_reads_(frame_count) const uintptr_t* frames, size_t frame_count)
+{
+    uint64_t fingerprint = _cxplat_fault_injection_mix(0x9e3779b97f4a7c15ULL + frame_count);
+    for (size_t i = 0; i < frame_count; i++) {
+        fingerprint = _cxplat_fault_injection_mix(fingerprint ^ frames[i]);
+    }
+    return fingerprint;
+}
+
+uint32_t
+_cxplat_compute_fault_log_checksum(_In_ const cxplat_fault_log_record_t* record, uint64_t record_size)
+{
+    // 32-bit FNV-1a.
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(record);
+    uint32_t checksum = 0x811c9dc5;
+    for (uint64_t i = sizeof(record->checksum); i < record_size; i++) {
+        checksum = (checksum ^ bytes[i]) * 0x01000193;
+    }
+    return checksum;
+}
+
+_cxplat_fault_injection::_cxplat_fault_injection(size_t stack_depth, _In_opt_ const char* log_file_name)
+    : _stack_depth(stack_depth)
+{
+    if (_stack_depth == 0) {
+        _stack_depth = CXPLAT_FAULT_STACK_CAPTURE_FRAME_COUNT_FOR_HASH;
+    } else if (_stack_depth > CXPLAT_FAULT_STACK_MAXIMUM_FRAME_COUNT) {
+        _stack_depth = CXPLAT_FAULT_STACK_MAXIMUM_FRAME_COUNT;
+    }
+
+    if (log_file_name != nullptr) {
+        _log_file_name = log_file_name;
+    } else {
+        // Get the path to the executable being run.
+        std::string process_name;
+        if (!CXPLAT_SUCCEEDED(_cxplat_get_process_path(process_name))) {
+            process_name = "cxplat";
+        }
+        _log_file_name = process_name + ".fault.log";
+    }
+    load_fault_log();
+}
+
+_cxplat_fault_injection::~_cxplat_fault_injection()
+{
+    std::unique_lock lock(_log_mutex);
+    if (_log_file == nullptr) {
+        return;
+    }
+
+    // Give back the space reserved for records that were never written.
+    uint64_t used_bytes = (_log_view != nullptr) ? log_header()->used_bytes : 0;
+    _cxplat_close_mapped_file(_log_file, used_bytes);
+    _log_file = nullptr;
+    _log_view = nullptr;
+    _log_view_size = 0;
+}
+
+bool
+_cxplat_fault_injection::inject_fault()
+{
+    return is_new_stack();
+}
+
+void
+_cxplat_fault_injection::reset()
+{
+    for (auto& shard : _fingerprint_shards) {
+        std::unique_lock lock(shard.mutex);
+        shard.fingerprints.clear();
+    }
+
+    std::unique_lock lock(_log_mutex);
+
+    // Reset the iteration number.
+    _iteration = 0;
+    _last_fault_stack.clear();
+
+    // Discard every record to clear the log.
+    if (_log_view != nullptr) {
+        log_header()->used_bytes = sizeof(cxplat_fault_log_header_t);
+    }
+}
+
+bool
+_cxplat_fault_injection::record_fault(_In_reads_(frame_count) const uintptr_t* canonical_stack, size_t frame_count)
+{
+    uint64_t fingerprint = _cxplat_compute_stack_fingerprint(canonical_stack, frame_count);
+    if (!insert_fingerprint(fingerprint)) {
+        return false;
+    }
+    log_fault(fingerprint, canonical_stack, frame_count, canonical_stack, frame_count);
+    return true;
+}
+
+bool
+_cxplat_fault_injection::is_known_fault(_In_reads_(frame_count) const uintptr_t* canonical_stack, size_t frame_count)
+{
+    uint64_t fingerprint = _cxplat_compute_stack_fingerprint(canonical_stack, frame_count);
+    fingerprint_shard_t& shard = _fingerprint_shards[fingerprint & (_fingerprint_shard_count - 1)];
+    std::unique_lock lock(shard.mutex);
+    return shard.fingerprints.contains(fingerprint);
+}
+
+uint64_t
+_cxplat_fault_injection::iteration()
+{
+    std::unique_lock lock(_log_mutex);
+    return _iteration;
+}
+
+bool
+_cxplat_fault_injection::insert_fingerprint(uint64_t fingerprint)
+{
+    fingerprint_shard_t& shard = _fingerprint_shards[fingerprint & (_fingerprint_shard_count - 1)];
+    std::unique_lock lock(shard.mutex);
+    return shard.fingerprints.insert(fingerprint).second;
+}
+
+bool
+_cxplat_fault_injection::is_new_stack()
+{
+    // Prevent infinite recursion during fault injection.
+    cxplat_fault_injection_recursion_guard recursion_guard;
+    if (recursion_guard.is_recursing()) {
+        return false;
+    }
+
+    uintptr_t stack[CXPLAT_FAULT_STACK_MAXIMUM_FRAME_COUNT];
+    uintptr_t canonical_stack[CXPLAT_FAULT_STACK_MAXIMUM_FRAME_COUNT];
+    size_t canonical_frame_count = 0;
+
+    // Capture _stack_depth frames of the current stack trace.
+    size_t frame_count = _cxplat_capture_stack_back_trace(0, _stack_depth, stack);
+    if (frame_count == 0) {
+        return false;
+    }
+
+    // Form the canonical stack.
+    for (size_t i = 0; i < frame_count; i++) {
+        uintptr_t base_address = find_base_address(stack[i]);
+        // Only consider frames in the modules being tested.
+        if (base_address) {
+            canonical_stack[canonical_frame_count++] = stack[i] - base_address;
+        }
+    }
+
+    uint64_t fingerprint = _cxplat_compute_stack_fingerprint(canonical_stack, canonical_frame_count);
+    if (!insert_fingerprint(fingerprint)) {
+        return false;
+    }
+    log_fault(fingerprint, canonical_stack, canonical_frame_count, stack, frame_count);
+    return true;
+}
+
+void
+_cxplat_fault_injection::log_fault(
+    uint64_t fingerprint,
+    _In_reads_(canonical_frame_count) const uintptr_t* canonical_stack,
+    size_t canonical_frame_count,
+    _In_reads_(frame_count) const uintptr_t* stack,
+    size_t frame_count)
+{
+    std::unique_lock lock(_log_mutex);
+    _last_fault_stack.assign(stack, stack + frame_count);
+    append_log_record(CXPLAT_FAULT_LOG_RECORD_FAULT, fingerprint, canonical_stack, canonical_frame_count);
+}
+
+_Requires_lock_held_(_log_mutex) bool
+_cxplat_fault_injection::map_fault_log(uint64_t size)
+{
+    // Mapping more than the current size of the file grows the file.
+    if (!CXPLAT_SUCCEEDED(_cxplat_map_file(_log_file, size, &_log_view))) {
+        _log_view_size = 0;
+        return false;
+    }
+    _log_view_size = size;
+    return true;
+}
+
+_Requires_lock_held_(_log_mutex) void
+_cxplat_fault_injection::append_log_record(
+    cxplat_fault_log_record_type_t type,
+    uint64_t fingerprint,
+    _In_reads_(frame_count) const uintptr_t* frames,
+    size_t frame_count)
+{
+    if (_log_view == nullptr) {
+        return;
+    }
+    uint64_t record_size = sizeof(cxplat_fault_log_record_t) + frame_count * sizeof(uint64_t);
+    uint64_t used_bytes = log_header()->used_bytes;
+    if (used_bytes + record_size > _log_view_size) {
+        uint64_t new_size = _log_view_size * 2;
+        if (new_size < used_bytes + record_size) {
+            new_size = used_bytes + record_size;
+        }
+        if (!map_fault_log(new_size)) {
+            return;
+        }
+    }
+
+    cxplat_fault_log_record_t* record = reinterpret_cast<cxplat_fault_log_record_t*>(_log_view + used_bytes);
+    record->type = type;
+    record->frame_count = static_cast<uint16_t>(frame_count);
+    record->iteration = _iteration;
+    record->fingerprint = fingerprint;
+    uint64_t* record_frames = reinterpret_cast<uint64_t*>(record + 1);
+    for (size_t i = 0; i < frame_count; i++) {
+        record_frames[i] = frames[i];
+    }
+    record->checksum = _cxplat_compute_fault_log_checksum(record, record_size);
+
+    // Only count the record once it is complete, so that a crash while writing it leaves the log intact.
+    log_header()->used_bytes = used_bytes + record_size;
+}
+
+void
+_cxplat_fault_injection::load_fault_log()
+{
+    std::unique_lock lock(_log_mutex);
+    uint64_t file_size;
+    if (!CXPLAT_SUCCEEDED(_cxplat_open_mapped_file(_log_file_name.c_str(), &_log_file, &file_size))) {
+        // Faults are still injected, but not remembered across runs.
+        _log_file = nullptr;
+        return;
+    }
+
+    uint64_t map_size = file_size;
+    if (map_size < CXPLAT_FAULT_LOG_MINIMUM_SIZE) {
+        map_size = CXPLAT_FAULT_LOG_MINIMUM_SIZE;
+    }
+    if (!map_fault_log(map_size)) {
+        return;
+    }
+
+    // Walk the records, stopping at the first one that is incomplete or corrupt.
+    cxplat_fault_log_header_t* header = log_header();
+    uint64_t offset = sizeof(cxplat_fault_log_header_t);
+    if (header->signature == CXPLAT_FAULT_LOG_SIGNATURE && header->version == CXPLAT_FAULT_LOG_VERSION &&
+        header->used_bytes <= _log_view_size) {
+        while (offset + sizeof(cxplat_fault_log_record_t) <= header->used_bytes) {
+            const cxplat_fault_log_record_t* record =
+                reinterpret_cast<const cxplat_fault_log_record_t*>(_log_view + offset);
+            uint64_t record_size = sizeof(cxplat_fault_log_record_t) + record->frame_count * sizeof(uint64_t);
+            if (offset + record_size > header->used_bytes ||
+                record->checksum != _cxplat_compute_fault_log_checksum(record, record_size)) {
+                break;
+            }
+            if (record->type == CXPLAT_FAULT_LOG_RECORD_ITERATION) {
+                // Count the iterations to correlate crashes with the last failed fault.
+                _iteration = record->iteration;
+            } else if (record->type == CXPLAT_FAULT_LOG_RECORD_FAULT) {
+                (void)insert_fingerprint(record->fingerprint);
+            }
+            offset += record_size;
+        }
+    }
+
+    // An empty file, or one that isn't a fault log, starts a new log.
+    header->signature = CXPLAT_FAULT_LOG_SIGNATURE;
+    header->version = CXPLAT_FAULT_LOG_VERSION;
+    header->used_bytes = offset;
+
+    // Add the current iteration number to the log file.
+    _iteration++;
+    append_log_record(CXPLAT_FAULT_LOG_RECORD_ITERATION, 0, nullptr, 0);
+}
+
+uintptr_t
+_cxplat_fault_injection::find_base_address(uintptr_t address)
+{
+
+    // Determine which module this offset is in.
+    // The _modules_under_test set is sorted by start and end offset of the module.
+    // The lower_bound function returns the first entry where the (start, end) offset is >=
+    // (offset, 0). Because this range has an invalid end offset, it will never be an exact match
+    // and will always return the first module that starts after the offset.
+
+    auto iter = _modules_under_test.lower_bound(std::make_pair(address, 0));
+
+    // Boundary conditions are:
+    // 1. The offset is before the first module -> iter == _modules_under_test.begin()
+    // 2. The offset is after the last module -> iter == _modules_under_test.end()
+
+    // _modules_under_test cannot be empty because there is at least one module.
+
+    if (iter == _modules_under_test.begin()) {
+        // The offset is before the first module.
+        return 0;
+    }
+
+    // Select the previous module.
+    iter--;
+
+    auto& module = iter->first;
+
+    // Check if the offset is in the module.
+    return (address >= module.first && address < module.first + module.second) ? module.first : 0;
+}
+
+cxplat_status_t
+cxplat_fault_injection_initialize(size_t stack_depth) noexcept
+{
+    if (_cxplat_fault_injection_singleton) {
+        return CXPLAT_STATUS_INVALID_STATE;
+    }
+
+    try {
+        _cxplat_fault_injection_singleton = std::make_unique<_cxplat_fault_injection>(stack_depth);
+    } catch (...) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_fault_injection_uninitialize() noexcept
+{
+    _cxplat_fault_injection_singleton.reset();
+}
+
+/**
+ * @brief Decide whether the next call at sites of a class fails under the schedule being followed.
+ */
+static bool
+_cxplat_fault_injection_follow_schedule(cxplat_fault_injection_class_t fault_class)
+{
+    const cxplat_fault_injection_class_schedule_t* class_schedule =
+        &_cxplat_fault_injection_schedule.schedule.classes[fault_class];
+    uint64_t call = ++_cxplat_fault_injection_schedule.calls[fault_class];
+    if (call == class_schedule->countdown) {
+        return true;
+    }
+    if (class_schedule->one_in == 0) {
+        return false;
+    }
+
+    // Derive the decision from the seed, class and call number alone, so that it doesn't depend on which thread
+    // makes the call or on any earlier decision.
+    uint64_t call_key = _cxplat_fault_injection_mix(call * CXPLAT_FAULT_INJECTION_CLASS_COUNT + fault_class);
+    uint64_t random = _cxplat_fault_injection_mix(_cxplat_fault_injection_schedule.schedule.seed ^ call_key);
+    return (random % class_schedule->one_in) == 0;
+}
+
+bool
+cxplat_fault_injection_inject_fault_for_class(cxplat_fault_injection_class_t fault_class) noexcept
+{
+    if (fault_class >= CXPLAT_FAULT_INJECTION_CLASS_COUNT) {
+        return false;
+    }
+    if (_cxplat_fault_injection_schedule.active) {
+        return _cxplat_fault_injection_follow_schedule(fault_class);
+    }
+    if (fault_class == CXPLAT_FAULT_INJECTION_CLASS_WORK_ITEM || fault_class == CXPLAT_FAULT_INJECTION_CLASS_RUNDOWN) {
+        return false;
+    }
+    return cxplat_fault_injection_inject_fault();
+}
+
+bool
+cxplat_fault_injection_inject_fault() noexcept
+{
+    if (_cxplat_fault_injection_schedule.active) {
+        return _cxplat_fault_injection_follow_schedule(CXPLAT_FAULT_INJECTION_CLASS_OTHER);
+    }
+    if (_cxplat_fault_injection_site_run.active) {
+        size_t site = ++_cxplat_fault_injection_site_run.sites_reached;
+        if (site != _cxplat_fault_injection_site_run.site_to_fail) {
+            return false;
+        }
+        _cxplat_fault_injection_site_run.fault_injected = true;
+        return true;
+    }
+
+    try {
+        if (_cxplat_fault_injection_singleton) {
+            return _cxplat_fault_injection_singleton->inject_fault();
+        }
+        return false;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool
+cxplat_fault_injection_is_enabled() noexcept
+{
+    return _cxplat_fault_injection_singleton != nullptr || _cxplat_fault_injection_site_run.active ||
+           _cxplat_fault_injection_schedule.active;
+}
+
+void
+cxplat_fault_injection_set_schedule(_In_opt_ const cxplat_fault_injection_schedule_t* schedule) noexcept
+{
+    _cxplat_fault_injection_schedule.active = false;
+    if (schedule == nullptr) {
+        return;
+    }
+    _cxplat_fault_injection_schedule.schedule = *schedule;
+    for (auto& calls : _cxplat_fault_injection_schedule.calls) {
+        calls = 0;
+    }
+    _cxplat_fault_injection_schedule.active = true;
+}
+
+cxplat_status_t
+cxplat_fault_injection_format_replay_token(
+    _In_ const cxplat_fault_injection_schedule_t* schedule,
+    _Out_writes_z_(token_size) char* token,
+    size_t token_size) noexcept
+{
+    // A length of -1 means the token was truncated.
+    int length = snprintf(
+        token,
+        token_size,
+        "%x:%llx",
+        CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_VERSION,
+        (unsigned long long)schedule->seed);
+    length = (length < 0 || (size_t)length >= token_size) ? -1 : length;
+    for (size_t fault_class = 0; fault_class < CXPLAT_FAULT_INJECTION_CLASS_COUNT && length >= 0; fault_class++) {
+        int class_length = snprintf(
+            token + length,
+            token_size - length,
+            ":%x,%llx",
+            schedule->classes[fault_class].one_in,
+            (unsigned long long)schedule->classes[fault_class].countdown);
+        length = (class_length < 0 || (size_t)class_length >= token_size - length) ? -1 : length + class_length;
+    }
+    return (length < 0) ? CXPLAT_STATUS_INVALID_PARAMETER : CXPLAT_STATUS_SUCCESS;
+}
+
+/**
+ * @brief Parse a hexadecimal number from a replay token and skip the separator that follows it.
+ *
+ * @param[in,out] position Current position in the token.
+ * @param[in] separator Character expected after the number, or '\0' for the end of the token.
+ * @param[out] value Parsed number.
+ * @retval true A number and its separator were parsed.
+ * @retval false The token is malformed.
+ */
+static bool
+_cxplat_parse_replay_token_number(_Inout_ const char** position, char separator, _Out_ uint64_t* value)
+{
+    char* end;
+    errno = 0;
+    *value = strtoull(*position, &end, 16);
+    if (end == *position || errno != 0 || *end != separator) {
+        return false;
+    }
+    *position = (separator == '\0') ? end : end + 1;
+    return true;
+}
+
+cxplat_status_t
+cxplat_fault_injection_parse_replay_token(
+    _In_z_ const char* token, _Out_ cxplat_fault_injection_schedule_t* schedule) noexcept
+{
+    memset(schedule, 0, sizeof(*schedule));
+    const char* position = token;
+    uint64_t version;
+    if (!_cxplat_parse_replay_token_number(&position, ':', &version) ||
+        version != CXPLAT_FAULT_INJECTION_REPLAY_TOKEN_VERSION ||
+        !_cxplat_parse_replay_token_number(&position, ':', &schedule->seed)) {
+        return CXPLAT_STATUS_INVALID_PARAMETER;
+    }
+    for (size_t fault_class = 0; fault_class < CXPLAT_FAULT_INJECTION_CLASS_COUNT; fault_class++) {
+        uint64_t one_in;
+        char separator = (fault_class + 1 < CXPLAT_FAULT_INJECTION_CLASS_COUNT) ? ':' : '\0';
+        if (!_cxplat_parse_replay_token_number(&position, ',', &one_in) || one_in > UINT32_MAX ||
+            !_cxplat_parse_replay_token_number(&position, separator, &schedule->classes[fault_class].countdown)) {
+            return CXPLAT_STATUS_INVALID_PARAMETER;
+        }
+        schedule->classes[fault_class].one_in = (uint32_t)one_in;
+    }
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+cxplat_status_t
+cxplat_fault_injection_start_site_run(size_t site_to_fail) noexcept
+{
+    if (_cxplat_fault_injection_site_run.active) {
+        return CXPLAT_STATUS_INVALID_STATE;
+    }
+    _cxplat_fault_injection_site_run.sites_reached = 0;
+    _cxplat_fault_injection_site_run.site_to_fail = site_to_fail;
+    _cxplat_fault_injection_site_run.fault_injected = false;
+    _cxplat_fault_injection_site_run.leak_detector_epoch = cxplat_leak_detector_t::start_epoch();
+    _cxplat_fault_injection_site_run.leaks_collected = 0;
+    _cxplat_fault_injection_site_run.active = true;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_fault_injection_stop_site_run(_Out_ cxplat_fault_injection_site_run_result_t* result) noexcept
+{
+    _cxplat_fault_injection_site_run.active = false;
+    result->sites_reached = _cxplat_fault_injection_site_run.sites_reached;
+    result->fault_injected = _cxplat_fault_injection_site_run.fault_injected;
+    result->leaked_allocations = _cxplat_fault_injection_site_run.leaks_collected;
+    if (_cxplat_leak_detector_ptr) {
+        result->leaked_allocations +=
+            _cxplat_leak_detector_ptr->count_allocations_since(_cxplat_fault_injection_site_run.leak_detector_epoch);
+    }
+}
+
+bool
+_cxplat_collect_fault_injection_leaks(size_t leak_count)
+{
+    if (!_cxplat_fault_injection_site_run.active) {
+        return false;
+    }
+    _cxplat_fault_injection_site_run.leaks_collected += leak_count;
+    return true;
+}
+
+void
+cxplat_fault_injection_reset() noexcept
+{
+    if (_cxplat_fault_injection_singleton) {
+        _cxplat_fault_injection_singleton->reset();
+    }
+}
+
+cxplat_status_t
+cxplat_fault_injection_add_module(_In_ void* module_under_test) noexcept
+{
+    try {
+        if (_cxplat_fault_injection_singleton) {
+            // If the module under test is not specified, use the current process.
+            uintptr_t base_address;
+            size_t size;
+            if (!CXPLAT_SUCCEEDED(_cxplat_get_module_range(module_under_test, &base_address, &size))) {
+                throw std::runtime_error("_cxplat_get_module_range failed");
+            }
+            _cxplat_fault_injection_singleton->add_module_under_test(base_address, size);
+        }
+        return CXPLAT_STATUS_SUCCESS;
+    } catch (...) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+}
+
+cxplat_status_t
+cxplat_fault_injection_remove_module(void* module_under_test) noexcept
+{
+    try {
+        if (_cxplat_fault_injection_singleton) {
+            // If the module under test is not specified, use the current process.
+            uintptr_t base_address;
+            size_t size;
+            if (!CXPLAT_SUCCEEDED(_cxplat_get_module_range(module_under_test, &base_address, &size))) {
+                throw std::runtime_error("_cxplat_get_module_range failed");
+            }
+            _cxplat_fault_injection_singleton->remove_module_under_test(base_address, size);
+        }
+        return CXPLAT_STATUS_SUCCESS;
+    } catch (...) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+}
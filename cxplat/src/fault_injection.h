@@ -0,0 +1,271 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include "cxplat.h"
+#include "debugging_internal.h"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief The maximum number of stack frames that can be compared when tracking faults.
+ */
+#define CXPLAT_FAULT_STACK_MAXIMUM_FRAME_COUNT 32
+
+/**
+ * @brief The number of stack frames to capture to uniquely identify an fault path.
+ */
+#define CXPLAT_FAULT_STACK_CAPTURE_FRAME_COUNT_FOR_HASH 4
+
+// The fault log is an append-only binary file that is mapped into memory, so that records reach the file even if the
+// process crashes right after injecting a fault, without flushing every write. The file starts with a
+// cxplat_fault_log_header_t, and the used_bytes it records are followed by variable length records. Each record is a
+// cxplat_fault_log_record_t followed by frame_count module-relative frame offsets. Loading stops at the first record
+// whose checksum doesn't match, which discards a record torn by a crash.
+#define CXPLAT_FAULT_LOG_SIGNATURE 0x4c464643 // "CFFL"
+#define CXPLAT_FAULT_LOG_VERSION 1
+#define CXPLAT_FAULT_LOG_MINIMUM_SIZE (64 * 1024)
+
+typedef enum _cxplat_fault_log_record_type : uint16_t
+{
+    CXPLAT_FAULT_LOG_RECORD_ITERATION = 1, ///< Start of a test run.
+    CXPLAT_FAULT_LOG_RECORD_FAULT = 2,     ///< A fault was injected.
+} cxplat_fault_log_record_type_t;
+
+typedef struct _cxplat_fault_log_header
+{
+    uint32_t signature;  ///< CXPLAT_FAULT_LOG_SIGNATURE.
+    uint32_t version;    ///< CXPLAT_FAULT_LOG_VERSION.
+    uint64_t used_bytes; ///< Bytes of the file holding valid data, including this header.
+} cxplat_fault_log_header_t;
+
+typedef struct _cxplat_fault_log_record
+{
+    uint32_t checksum;    ///< Checksum of the rest of the record, including the frame offsets.
+    uint16_t type;        ///< A cxplat_fault_log_record_type_t value.
+    uint16_t frame_count; ///< Number of 64-bit frame offsets following this structure.
+    uint64_t iteration;   ///< Iteration in which the record was written.
+    uint64_t fingerprint; ///< Fingerprint of the faulted stack, or 0 for an iteration record.
+} cxplat_fault_log_record_t;
+
+/**
+ * @brief Compute a 64-bit fingerprint of a canonical stack. Each frame is mixed into the running value, so the
+ * fingerprint depends on the order of the frames as well as their values.
+ */
+uint64_t
+_cxplat_compute_stack_fingerprint(_In_reads_(frame_count) const uintptr_t* frames, size_t frame_count);
+
+/**
+ * @brief Compute the checksum of a fault log record, covering everything after the checksum field.
+ */
+uint32_t
+_cxplat_compute_fault_log_checksum(_In_ const cxplat_fault_log_record_t* record, uint64_t record_size);
+
+/**
+ * @brief This class is used to track potential fault points and fail them in
+ * a deterministic manner. Increasing the number of stack frames examined will
+ * increase the accuracy of the test, but also increase the time it takes to run
+ * the test.
+ */
+typedef class _cxplat_fault_injection
+{
+  public:
+    /**
+     * @brief Construct a new fault injection object.
+     * @param[in] stack_depth The number of stack frames to compare when tracking faults.
+     * @param[in] log_file_name Path of the fault log, or nullptr to name it after the process.
+     */
+    _cxplat_fault_injection(size_t stack_depth, _In_opt_ const char* log_file_name = nullptr);
+
+    /**
+     * @brief Destroy the fault injection object.
+     */
+    ~_cxplat_fault_injection();
+
+    bool
+    inject_fault();
+
+    /**
+     * @brief Reset the fault injection state, both in memory and on disk.
+     */
+    void
+    reset();
+
+    /**
+     * @brief Record a fault at a canonical stack, as if it had just been injected there.
+     *
+     * @param[in] canonical_stack Module-relative frame offsets of the stack.
+     * @param[in] frame_count Number of frames in the stack.
+     * @retval true The stack was new, so the fault was added to the log.
+     * @retval false The stack was already known.
+     */
+    bool
+    record_fault(_In_reads_(frame_count) const uintptr_t* canonical_stack, size_t frame_count);
+
+    /**
+     * @brief Determine whether a fault has already been injected at a canonical stack, in this run or a logged one.
+     *
+     * @param[in] canonical_stack Module-relative frame offsets of the stack.
+     * @param[in] frame_count Number of frames in the stack.
+     * @retval true The stack is known.
+     * @retval false The stack is new.
+     */
+    bool
+    is_known_fault(_In_reads_(frame_count) const uintptr_t* canonical_stack, size_t frame_count);
+
+    /**
+     * @brief Get the iteration number of the current test pass, counting the passes recorded in the log.
+     */
+    uint64_t
+    iteration();
+
+    void
+    add_module_under_test(uintptr_t module_base_address, size_t module_size)
+    {
+        std::unique_lock lock(_module_mutex);
+        auto new_module = std::make_pair(module_base_address, module_base_address + module_size);
+        // On first insertion, the count will be 0.
+        _modules_under_test[new_module]++;
+    }
+
+    void
+    remove_module_under_test(uintptr_t module_base_address, size_t module_size)
+    {
+        std::unique_lock lock(_module_mutex);
+        auto module_key = std::make_pair(module_base_address, module_base_address + module_size);
+        if (_modules_under_test.contains(module_key)) {
+            _modules_under_test[module_key]--;
+            if (_modules_under_test[module_key] == 0) {
+                _modules_under_test.erase(module_key);
+            }
+        }
+    }
+
+  private:
+    static const size_t _fingerprint_shard_count = 64; // Must be a power of 2.
+
+    /**
+     * @brief A shard of the set of known fault paths. Shards are selected by fingerprint, so threads checking
+     * different stacks rarely share a lock.
+     */
+    typedef struct _fingerprint_shard
+    {
+        std::mutex mutex;
+        std::unordered_set<uint64_t> fingerprints;
+    } fingerprint_shard_t;
+
+    /**
+     * @brief Determine if this path is new.
+     * If it is new, then inject the fault, add it to the set of known
+     * fault paths and return true.
+     */
+    bool
+    is_new_stack();
+
+    /**
+     * @brief Add a fingerprint to the set of known fault paths.
+     *
+     * @param[in] fingerprint Fingerprint of the canonical stack.
+     * @retval true The fingerprint was not already known.
+     * @retval false The fingerprint was already known.
+     */
+    bool
+    insert_fingerprint(uint64_t fingerprint);
+
+    /**
+     * @brief Append a record for a newly injected fault to the log file.
+     */
+    void
+    log_fault(
+        uint64_t fingerprint,
+        _In_reads_(canonical_frame_count) const uintptr_t* canonical_stack,
+        size_t canonical_frame_count,
+        _In_reads_(frame_count) const uintptr_t* stack,
+        size_t frame_count);
+
+    /**
+     * @brief Load the list of known faults from the log file and keep it mapped for appending.
+     */
+    void
+    load_fault_log();
+
+    /**
+     * @brief Map the log file, growing it to at least the given size.
+     *
+     * @param[in] size Minimum size of the mapping.
+     * @retval true The log file was mapped.
+     * @retval false The log file could not be mapped, so faults will not be logged.
+     */
+    _Requires_lock_held_(_log_mutex) bool
+    map_fault_log(uint64_t size);
+
+    _Requires_lock_held_(_log_mutex) void
+    append_log_record(
+        cxplat_fault_log_record_type_t type,
+        uint64_t fingerprint,
+        _In_reads_(frame_count) const uintptr_t* frames,
+        size_t frame_count);
+
+    _Requires_lock_held_(_log_mutex) cxplat_fault_log_header_t*
+    log_header()
+    {
+        return reinterpret_cast<cxplat_fault_log_header_t*>(_log_view);
+    }
+
+    /**
+     * @brief Find the base address of the module containing the given address or 0 if not found.
+     *
+     * @param[in] address Address to find the base address for.
+     * @return Base address of the module containing the given address or 0 if not found.
+     */
+    uintptr_t
+    find_base_address(uintptr_t address);
+
+    /**
+     * @brief Base address and size of the modules being tested.
+     */
+    std::map<std::pair<uintptr_t, uintptr_t>, size_t> _modules_under_test;
+
+    /**
+     * @brief The mutex to protect changes to the modules being tested.
+     */
+    std::mutex _module_mutex;
+
+    /**
+     * @brief The set of known fault paths, keyed by the fingerprint of the canonical stack.
+     */
+    std::array<fingerprint_shard_t, _fingerprint_shard_count> _fingerprint_shards;
+
+    /**
+     * @brief The mutex to protect the log file.
+     */
+    std::mutex _log_mutex;
+
+    /**
+     * @brief The log file for faults that have been injected, and its mapping.
+     */
+    _Guarded_by_(_log_mutex) cxplat_mapped_file_t* _log_file = nullptr;
+    _Guarded_by_(_log_mutex) uint8_t* _log_view = nullptr;
+    _Guarded_by_(_log_mutex) uint64_t _log_view_size = 0;
+
+    /**
+     * @brief The iteration number of the current test pass.
+     */
+    _Guarded_by_(_log_mutex) uint64_t _iteration = 0;
+
+    /**
+     * @brief The frames of the most recently injected fault, for inspection in a debugger.
+     */
+    _Guarded_by_(_log_mutex) std::vector<uintptr_t> _last_fault_stack;
+
+    size_t _stack_depth;
+
+    std::string _log_file_name;
+
+} cxplat_fault_injection_t;
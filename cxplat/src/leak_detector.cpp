@@ -0,0 +1,215 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "debugging_internal.h"
+#include "leak_detector.h"
+#include "symbol_decoder.h"
+
+#include <iostream>
+
+// Counts allocations on the current thread so that sampling needs no shared state.
+static thread_local size_t _cxplat_leak_detector_allocation_count;
+
+// Current allocation epoch. It only changes when a new epoch is started, so reading it doesn't make allocating threads
+// contend for the cache line.
+static std::atomic<uint64_t> _cxplat_leak_detector_epoch;
+
+static inline uint64_t
+_cxplat_mix_hash(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
+cxplat_leak_detector_t::allocation_shard_t&
+cxplat_leak_detector_t::allocation_shard(uintptr_t address)
+{
+    return _allocation_shards[_cxplat_mix_hash(address) & (_shard_count - 1)];
+}
+
+cxplat_leak_detector_t::stack_shard_t&
+cxplat_leak_detector_t::stack_shard(uint64_t stack_hash)
+{
+    return _stack_shards[stack_hash & (_shard_count - 1)];
+}
+
+uint64_t
+cxplat_leak_detector_t::capture_stack()
+{
+    // Skip this function and its caller in the leak detector.
+    uintptr_t frames[_stack_depth];
+    size_t frame_count = _cxplat_capture_stack_back_trace(2, _stack_depth, frames);
+    if (frame_count == 0) {
+        return 0;
+    }
+
+    uint64_t stack_hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < frame_count; i++) {
+        stack_hash = _cxplat_mix_hash(stack_hash ^ frames[i]);
+    }
+    if (stack_hash == 0) {
+        stack_hash = 1;
+    }
+
+    stack_shard_t& shard = stack_shard(stack_hash);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        if (shard.stacks.contains(stack_hash)) {
+            return stack_hash;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.stacks.try_emplace(stack_hash, frames, frames + frame_count);
+    return stack_hash;
+}
+
+void
+cxplat_leak_detector_t::register_allocation(uintptr_t address, size_t size)
+{
+    if (_sample_rate > 1 && (++_cxplat_leak_detector_allocation_count % _sample_rate) != 0) {
+        return;
+    }
+
+    allocation_t allocation = {address, size, capture_stack(), 0, _cxplat_leak_detector_epoch.load()};
+    allocation_shard_t& shard = allocation_shard(address);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.allocations[address] = allocation;
+    shard.freed_allocations.erase(address);
+}
+
+void
+cxplat_leak_detector_t::flush_output(std::ostringstream& output)
+{
+    _in_memory_log.push_back(output.str());
+    std::cout << output.str();
+    output.str("");
+}
+
+void
+cxplat_leak_detector_t::output_stack_trace(std::ostringstream& output, std::string label, uint64_t stack_hash)
+{
+    std::vector<uintptr_t> stack;
+    {
+        stack_shard_t& shard = stack_shard(stack_hash);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.stacks.find(stack_hash);
+        if (it != shard.stacks.end()) {
+            stack = it->second;
+        }
+    }
+    std::string name;
+    uint64_t displacement;
+    std::optional<uint32_t> line_number;
+    std::optional<std::string> file_name;
+    output << "  " << label << " stack:" << std::endl;
+    for (auto address : stack) {
+        if (CXPLAT_SUCCEEDED(_cxplat_decode_symbol(address, name, displacement, line_number, file_name))) {
+            output << "    " << name << " + " << displacement;
+            if (line_number.has_value() && file_name.has_value()) {
+                output << " (" << file_name.value() << ":" << line_number.value() << ")";
+            }
+            output << std::endl;
+        }
+        flush_output(output);
+    }
+}
+
+void
+cxplat_leak_detector_t::unregister_allocation(uintptr_t address)
+{
+    allocation_shard_t& shard = allocation_shard(address);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.allocations.find(address);
+    if (it == shard.allocations.end()) {
+        if (_sample_rate > 1) {
+            // The allocation wasn't sampled.
+            return;
+        }
+
+        // The output lock is never taken while holding a shard lock, so report the double free after releasing it.
+        allocation_t allocation = shard.freed_allocations[address];
+        lock.unlock();
+        std::unique_lock<std::mutex> output_lock(_output_mutex);
+        std::ostringstream output;
+        output << "Double-free of " << allocation.size << " bytes at " << allocation.address << std::endl;
+        flush_output(output);
+        output_stack_trace(output, "Allocation", allocation.alloc_stack_hash);
+        output_stack_trace(output, "Free", allocation.free_stack_hash);
+        CXPLAT_RUNTIME_ASSERT(false);
+        return;
+    }
+    allocation_t allocation = it->second;
+    shard.allocations.erase(it);
+
+    // Remember the freeing stack so that a later double free can report it. Capturing it doesn't need the shard lock.
+    lock.unlock();
+    allocation.free_stack_hash = capture_stack();
+    lock.lock();
+    if (!shard.allocations.contains(address)) {
+        shard.freed_allocations[address] = allocation;
+    }
+}
+
+uint64_t
+cxplat_leak_detector_t::start_epoch()
+{
+    return ++_cxplat_leak_detector_epoch;
+}
+
+size_t
+cxplat_leak_detector_t::count_allocations_since(uint64_t epoch)
+{
+    size_t count = 0;
+    for (auto& shard : _allocation_shards) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto& allocation : shard.allocations) {
+            if (allocation.second.epoch >= epoch) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+size_t
+cxplat_leak_detector_t::count_stacks()
+{
+    size_t count = 0;
+    for (auto& shard : _stack_shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        count += shard.stacks.size();
+    }
+    return count;
+}
+
+size_t
+cxplat_leak_detector_t::dump_leaks()
+{
+    // Take the leaks out of the shards first, since the output lock is never taken while holding a shard lock.
+    std::vector<allocation_t> leaks;
+    for (auto& shard : _allocation_shards) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto& allocation : shard.allocations) {
+            leaks.push_back(allocation.second);
+        }
+        shard.allocations.clear();
+        shard.freed_allocations.clear();
+    }
+
+    std::unique_lock<std::mutex> output_lock(_output_mutex);
+    for (auto& allocation : leaks) {
+        std::ostringstream output;
+        output << "Leak of " << allocation.size << " bytes at " << allocation.address << std::endl;
+        flush_output(output);
+        output_stack_trace(output, "Allocation", allocation.alloc_stack_hash);
+    }
+
+    for (auto& shard : _stack_shards) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.stacks.clear();
+    }
+    return leaks.size();
+}
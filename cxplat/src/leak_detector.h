@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+typedef class cxplat_leak_detector_t
+{
+  public:
+    /**
+     * @brief Construct a leak detector.
+     *
+     * @param[in] sample_rate Track only 1 in sample_rate allocations on each thread. 0 or 1 tracks every allocation.
+     * Double frees are only reported when every allocation is tracked.
+     */
+    cxplat_leak_detector_t(size_t sample_rate = 1) : _sample_rate(sample_rate > 1 ? sample_rate : 1) {}
+    ~cxplat_leak_detector_t() = default;
+
+    void
+    register_allocation(uintptr_t address, size_t size);
+
+    void
+    unregister_allocation(uintptr_t address);
+
+    /**
+     * @brief Report every outstanding allocation as a leak and stop tracking it.
+     *
+     * @return Number of leaks reported.
+     */
+    size_t
+    dump_leaks();
+
+    /**
+     * @brief Start a new allocation epoch. Epochs are shared by all leak detectors in the process, so an epoch stays
+     * meaningful when cxplat is cleaned up and initialized again.
+     *
+     * @return The new epoch.
+     */
+    static uint64_t
+    start_epoch();
+
+    /**
+     * @brief Count the tracked allocations made since an epoch started that are still outstanding.
+     *
+     * @param[in] epoch Epoch returned by start_epoch.
+     * @return Number of outstanding allocations.
+     */
+    size_t
+    count_allocations_since(uint64_t epoch);
+
+    /**
+     * @brief Count the unique stacks stored. Each is stored once however many allocations were made from it.
+     *
+     * @return Number of stacks.
+     */
+    size_t
+    count_stacks();
+
+  private:
+    static const size_t _stack_depth = 32;
+    static const size_t _shard_count = 64; // Must be a power of 2.
+
+    void
+    flush_output(std::ostringstream& output);
+
+    void
+    output_stack_trace(std::ostringstream& output, std::string label, uint64_t stack_hash);
+
+    /**
+     * @brief Capture the caller's stack and add it to the stack store if it hasn't been seen before.
+     *
+     * @return Hash identifying the stack in the stack store, or 0 if it could not be captured.
+     */
+    uint64_t
+    capture_stack();
+
+    typedef struct allocation_t
+    {
+        uintptr_t address;
+        size_t size;
+        uint64_t alloc_stack_hash;
+        uint64_t free_stack_hash;
+        uint64_t epoch;
+    } allocation_t;
+
+    // Allocations are spread across shards by address, so threads working on different memory rarely share a lock.
+    typedef struct allocation_shard_t
+    {
+        std::mutex mutex;
+        std::unordered_map<uintptr_t, allocation_t> allocations;
+        std::unordered_map<uintptr_t, allocation_t> freed_allocations;
+    } allocation_shard_t;
+
+    // Each unique stack is stored once, keyed by a hash of its frames. Almost every lookup finds an existing stack,
+    // so readers share the lock.
+    typedef struct stack_shard_t
+    {
+        std::shared_mutex mutex;
+        std::unordered_map<uint64_t, std::vector<uintptr_t>> stacks;
+    } stack_shard_t;
+
+    allocation_shard_t&
+    allocation_shard(uintptr_t address);
+
+    stack_shard_t&
+    stack_shard(uint64_t stack_hash);
+
+    const size_t _sample_rate;
+    std::array<allocation_shard_t, _shard_count> _allocation_shards;
+    std::array<stack_shard_t, _shard_count> _stack_shards;
+    std::mutex _output_mutex;
+    std::vector<std::string> _in_memory_log;
+} cxplat_leak_detector_t;
+
+typedef std::unique_ptr<cxplat_leak_detector_t> cxplat_leak_detector_ptr;
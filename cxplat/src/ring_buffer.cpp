@@ -0,0 +1,269 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "cxplat_ring_buffer.h"
+#include "ring_buffer_internal.h"
+#include "tags.h"
+
+#include <atomic>
+#include <string.h>
+
+/***
+ * Records are reserved by advancing the producer offset with a compare-and-swap, and consumed in the same order:
+ * 1) Offsets only ever grow, and the position of a record is its offset modulo the capacity. Because the data is
+ *    mapped twice, a record that crosses the end of the buffer is still contiguous.
+ * 2) A producer only takes space the consumer has given back, and the consumer clears that space before giving it
+ *    back. So the header of a record still being filled in reads as 0, and committing a record is a single release
+ *    store of its length.
+ * 3) The consumer reads records at the consumer offset until it finds one that isn't committed yet, which keeps
+ *    records in reservation order even when producers commit out of order.
+ * 4) A waiting consumer sets a flag and parks on a generation counter. A producer that commits a record while the
+ *    flag is set clears it and bumps the counter, so producers only make a system call when the consumer sleeps.
+ */
+typedef struct cxplat_ring_buffer_t
+{
+    uint8_t* data;
+    uint8_t* readonly_data;
+    size_t capacity;
+    cxplat_ring_buffer_section_t* section;
+    alignas(64) uint64_t producer_offset; ///< Offset of the next byte to reserve.
+    alignas(64) uint64_t consumer_offset; ///< Offset of the oldest record, which only the consumer changes.
+    uint32_t consumer_waiting;
+    uint32_t wake_generation;
+} cxplat_ring_buffer_t;
+
+// The producer and consumer offsets are kept on separate cache lines.
+static const cxplat_pool_flags_t _cxplat_ring_buffer_pool_flags =
+    (cxplat_pool_flags_t)(CXPLAT_POOL_FLAG_NON_PAGED | CXPLAT_POOL_FLAG_CACHE_ALIGNED);
+
+static inline size_t
+_cxplat_ring_buffer_record_size(size_t length)
+{
+    return (sizeof(cxplat_ring_buffer_record_header_t) + length + CXPLAT_RING_BUFFER_RECORD_ALIGNMENT - 1) &
+           ~((size_t)CXPLAT_RING_BUFFER_RECORD_ALIGNMENT - 1);
+}
+
+static inline cxplat_ring_buffer_record_header_t*
+_cxplat_ring_buffer_header_at(_In_ const cxplat_ring_buffer_t* ring, uint64_t offset)
+{
+    return reinterpret_cast<cxplat_ring_buffer_record_header_t*>(ring->data + (offset % ring->capacity));
+}
+
+size_t
+cxplat_get_ring_buffer_granularity()
+{
+    return _cxplat_get_ring_buffer_section_granularity();
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_allocate_ring_buffer(size_t capacity, _Outptr_ cxplat_ring_buffer_t** ring)
+{
+    *ring = nullptr;
+    if (capacity == 0 || (capacity % _cxplat_get_ring_buffer_section_granularity()) != 0) {
+        return CXPLAT_STATUS_INVALID_PARAMETER;
+    }
+
+    cxplat_ring_buffer_t* new_ring = (cxplat_ring_buffer_t*)cxplat_allocate(
+        _cxplat_ring_buffer_pool_flags, sizeof(*new_ring), CXPLAT_TAG_RING_BUFFER);
+    if (new_ring == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    new_ring->capacity = capacity;
+
+    cxplat_status_t status = _cxplat_create_ring_buffer_section(capacity, &new_ring->section);
+    if (status != CXPLAT_STATUS_SUCCESS) {
+        cxplat_free(new_ring, _cxplat_ring_buffer_pool_flags, CXPLAT_TAG_RING_BUFFER);
+        return status;
+    }
+    status = _cxplat_map_ring_buffer_section(new_ring->section, false, &new_ring->data);
+    if (status != CXPLAT_STATUS_SUCCESS) {
+        _cxplat_delete_ring_buffer_section(new_ring->section);
+        cxplat_free(new_ring, _cxplat_ring_buffer_pool_flags, CXPLAT_TAG_RING_BUFFER);
+        return status;
+    }
+
+    *ring = new_ring;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_free_ring_buffer(_Frees_ptr_opt_ cxplat_ring_buffer_t* ring)
+{
+    if (ring == nullptr) {
+        return;
+    }
+    if (ring->readonly_data != nullptr) {
+        _cxplat_unmap_ring_buffer_section(ring->section, ring->readonly_data);
+    }
+    _cxplat_unmap_ring_buffer_section(ring->section, ring->data);
+    _cxplat_delete_ring_buffer_section(ring->section);
+    cxplat_free(ring, _cxplat_ring_buffer_pool_flags, CXPLAT_TAG_RING_BUFFER);
+}
+
+uint8_t*
+cxplat_ring_buffer_get_data(_In_ const cxplat_ring_buffer_t* ring)
+{
+    return ring->data;
+}
+
+size_t
+cxplat_ring_buffer_get_capacity(_In_ const cxplat_ring_buffer_t* ring)
+{
+    return ring->capacity;
+}
+
+_Ret_maybenull_ const uint8_t*
+cxplat_ring_buffer_map_readonly(_Inout_ cxplat_ring_buffer_t* ring)
+{
+    std::atomic_ref<uint8_t*> readonly_data(ring->readonly_data);
+    uint8_t* view = readonly_data.load(std::memory_order_acquire);
+    if (view != nullptr) {
+        return view;
+    }
+    if (_cxplat_map_ring_buffer_section(ring->section, true, &view) != CXPLAT_STATUS_SUCCESS) {
+        return nullptr;
+    }
+
+    // Another thread may have mapped it first, in which case its mapping is kept.
+    uint8_t* existing_view = nullptr;
+    if (!readonly_data.compare_exchange_strong(existing_view, view, std::memory_order_acq_rel)) {
+        _cxplat_unmap_ring_buffer_section(ring->section, view);
+        view = existing_view;
+    }
+    return view;
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_ring_buffer_reserve(_Inout_ cxplat_ring_buffer_t* ring, size_t length, _Outptr_ uint8_t** data)
+{
+    *data = nullptr;
+    if (length == 0 || length >= CXPLAT_RING_BUFFER_RECORD_DISCARDED) {
+        return CXPLAT_STATUS_INVALID_PARAMETER;
+    }
+    size_t record_size = _cxplat_ring_buffer_record_size(length);
+    if (record_size > ring->capacity) {
+        return CXPLAT_STATUS_INVALID_PARAMETER;
+    }
+
+    std::atomic_ref<uint64_t> producer_offset(ring->producer_offset);
+    std::atomic_ref<uint64_t> consumer_offset(ring->consumer_offset);
+    uint64_t offset = producer_offset.load(std::memory_order_relaxed);
+    do {
+        // The acquire pairs with the consumer giving space back, so the space is already cleared. A stale offset
+        // can only make the check pass, and then the compare-and-swap fails.
+        if (offset + record_size > consumer_offset.load(std::memory_order_acquire) + ring->capacity) {
+            return CXPLAT_STATUS_NO_MEMORY;
+        }
+    } while (!producer_offset.compare_exchange_weak(
+        offset, offset + record_size, std::memory_order_relaxed, std::memory_order_relaxed));
+
+    cxplat_ring_buffer_record_header_t* header = _cxplat_ring_buffer_header_at(ring, offset);
+    header->reserved = (uint32_t)length;
+    *data = reinterpret_cast<uint8_t*>(header + 1);
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+static void
+_cxplat_ring_buffer_complete_record(_Inout_ cxplat_ring_buffer_t* ring, _In_ uint8_t* data, uint32_t flags)
+{
+    cxplat_ring_buffer_record_header_t* header = reinterpret_cast<cxplat_ring_buffer_record_header_t*>(data) - 1;
+    std::atomic_ref<uint32_t>(header->length).store(header->reserved | flags, std::memory_order_release);
+
+    // Pairs with the fence in cxplat_ring_buffer_wait(), so either the consumer sees this record or this sees the
+    // consumer waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::atomic_ref<uint32_t> consumer_waiting(ring->consumer_waiting);
+    if (consumer_waiting.load(std::memory_order_relaxed) != 0 &&
+        consumer_waiting.exchange(0, std::memory_order_relaxed) != 0) {
+        std::atomic_ref<uint32_t>(ring->wake_generation).fetch_add(1, std::memory_order_release);
+        _cxplat_wake_by_address_all(&ring->wake_generation);
+    }
+}
+
+void
+cxplat_ring_buffer_commit(_Inout_ cxplat_ring_buffer_t* ring, _In_ uint8_t* data)
+{
+    _cxplat_ring_buffer_complete_record(ring, data, 0);
+}
+
+void
+cxplat_ring_buffer_discard(_Inout_ cxplat_ring_buffer_t* ring, _In_ uint8_t* data)
+{
+    // The consumer still has to see a discarded record to step over it, so it is woken the same way.
+    _cxplat_ring_buffer_complete_record(ring, data, CXPLAT_RING_BUFFER_RECORD_DISCARDED);
+}
+
+static void
+_cxplat_ring_buffer_release_record(_Inout_ cxplat_ring_buffer_t* ring, uint64_t offset, uint32_t length)
+{
+    size_t record_size = _cxplat_ring_buffer_record_size(length);
+    memset(_cxplat_ring_buffer_header_at(ring, offset), 0, record_size);
+    std::atomic_ref<uint64_t>(ring->consumer_offset).store(offset + record_size, std::memory_order_release);
+}
+
+/**
+ * @brief Get the header of the oldest record, giving back the space of any discarded records before it.
+ *
+ * @param[in] ring Ring buffer.
+ * @return Header of the oldest record, or NULL if it isn't committed yet.
+ */
+static _Ret_maybenull_ cxplat_ring_buffer_record_header_t*
+_cxplat_ring_buffer_next_record(_Inout_ cxplat_ring_buffer_t* ring)
+{
+    for (;;) {
+        uint64_t offset = ring->consumer_offset;
+        cxplat_ring_buffer_record_header_t* header = _cxplat_ring_buffer_header_at(ring, offset);
+        uint32_t length = std::atomic_ref<uint32_t>(header->length).load(std::memory_order_acquire);
+        if (length == 0) {
+            return nullptr;
+        }
+        if ((length & CXPLAT_RING_BUFFER_RECORD_DISCARDED) == 0) {
+            return header;
+        }
+        _cxplat_ring_buffer_release_record(ring, offset, length & ~CXPLAT_RING_BUFFER_RECORD_DISCARDED);
+    }
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_ring_buffer_peek(_Inout_ cxplat_ring_buffer_t* ring, _Outptr_ const uint8_t** data, _Out_ size_t* length)
+{
+    cxplat_ring_buffer_record_header_t* header = _cxplat_ring_buffer_next_record(ring);
+    if (header == nullptr) {
+        *data = nullptr;
+        *length = 0;
+        return CXPLAT_STATUS_NOT_FOUND;
+    }
+    *data = reinterpret_cast<const uint8_t*>(header + 1);
+    *length = header->length;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_ring_buffer_return(_Inout_ cxplat_ring_buffer_t* ring)
+{
+    cxplat_ring_buffer_record_header_t* header = _cxplat_ring_buffer_next_record(ring);
+    if (header != nullptr) {
+        _cxplat_ring_buffer_release_record(ring, ring->consumer_offset, header->length);
+    }
+}
+
+bool
+cxplat_ring_buffer_wait(_Inout_ cxplat_ring_buffer_t* ring, uint32_t timeout_ms)
+{
+    std::atomic_ref<uint32_t> consumer_waiting(ring->consumer_waiting);
+    std::atomic_ref<uint32_t> wake_generation(ring->wake_generation);
+    for (;;) {
+        uint32_t generation = wake_generation.load(std::memory_order_acquire);
+        consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_cxplat_ring_buffer_next_record(ring) != nullptr) {
+            consumer_waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        if (!_cxplat_wait_on_address(&ring->wake_generation, generation, timeout_ms)) {
+            consumer_waiting.store(0, std::memory_order_relaxed);
+            return _cxplat_ring_buffer_next_record(ring) != nullptr;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+// The ring buffer is shared by the user-mode backends, which supply the platform services declared in this file.
+#include "cxplat.h"
+
+/**
+ * @brief Memory that backs a ring buffer and can be mapped more than once.
+ */
+typedef struct _cxplat_ring_buffer_section cxplat_ring_buffer_section_t;
+
+/**
+ * @brief Get the value the size of a ring buffer section must be a multiple of.
+ *
+ * @return Granularity in bytes.
+ */
+size_t
+_cxplat_get_ring_buffer_section_granularity();
+
+/**
+ * @brief Create zero-filled memory to back a ring buffer.
+ *
+ * @param[in] size Size of the memory, which is a multiple of the granularity.
+ * @param[out] section The created memory, which is not mapped yet.
+ * @retval CXPLAT_STATUS_SUCCESS The memory was created.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to create the memory.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_create_ring_buffer_section(size_t size, _Outptr_ cxplat_ring_buffer_section_t** section);
+
+/**
+ * @brief Map the memory of a ring buffer twice, with the second copy directly after the first.
+ *
+ * @param[in] section Memory to map.
+ * @param[in] read_only Whether the mapping is read-only.
+ * @param[out] view Base address of the first copy.
+ * @retval CXPLAT_STATUS_SUCCESS The memory was mapped.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to map the memory.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_map_ring_buffer_section(
+    _In_ const cxplat_ring_buffer_section_t* section, bool read_only, _Outptr_ uint8_t** view);
+
+/**
+ * @brief Unmap both copies mapped by _cxplat_map_ring_buffer_section().
+ *
+ * @param[in] section Memory that was mapped.
+ * @param[in] view Base address of the first copy.
+ */
+void
+_cxplat_unmap_ring_buffer_section(_In_ const cxplat_ring_buffer_section_t* section, _In_ uint8_t* view);
+
+/**
+ * @brief Free the memory of a ring buffer once it is no longer mapped.
+ *
+ * @param[in] section Memory to free.
+ */
+void
+_cxplat_delete_ring_buffer_section(_Frees_ptr_ cxplat_ring_buffer_section_t* section);
+
+/**
+ * @brief Block while a 32-bit word holds an expected value. The wait can end spuriously, so callers must check the
+ * word again.
+ *
+ * @param[in] address Word to wait on.
+ * @param[in] expected Value the word must still hold for the thread to block.
+ * @param[in] timeout_ms Longest time to wait, in milliseconds, or UINT32_MAX to wait forever.
+ * @retval false The wait timed out.
+ */
+bool
+_cxplat_wait_on_address(_In_ volatile uint32_t* address, uint32_t expected, uint32_t timeout_ms);
+
+/**
+ * @brief Wake all threads blocked in _cxplat_wait_on_address() on a word.
+ *
+ * @param[in] address Word the threads wait on.
+ */
+void
+_cxplat_wake_by_address_all(_In_ volatile uint32_t* address);
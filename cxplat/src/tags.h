@@ -9,3 +9,4 @@
 #define CXPLAT_TAG_STRING 'tsxc'
 #define CXPLAT_TAG_UTF8_STRING 'suxc'
 #define CXPLAT_TAG_MODULE_INFO 'imxc'
+#define CXPLAT_TAG_RING_BUFFER 'brxc'
@@ -0,0 +1,286 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cxplat.h"
+#include "cxplat_fault_injection.h"
+#include "tags.h"
+#include "workitem_internal.h"
+
+#include <atomic>
+#include <mutex>
+
+/***
+ * Preemptible work items run on a pool of worker threads:
+ * 1) Each worker owns a submission queue. A work item is queued on the queue selected by the submitting processor,
+ *    so threads on different processors rarely share a queue lock.
+ * 2) A worker runs items from its own queue first and steals from the other queues when its own is empty.
+ * 3) Every queued item adds one to a semaphore, and a worker only looks for an item after taking one from it, so a
+ *    woken worker always finds an item in some queue.
+ * 4) Each queue counts the items submitted to it and the items its worker completed. Waiting for work items to
+ *    complete is a barrier that waits until the totals match, which doesn't prevent more items being queued.
+ * With a single worker there is a single queue and no stealing, so work items run one at a time in the order they
+ * were queued.
+ */
+typedef struct cxplat_preemptible_work_item_t
+{
+    cxplat_preemptible_work_item_t* next; ///< Next work item in the same queue.
+    cxplat_work_item_routine_t work_item_routine;
+    void* work_item_context;
+    uint32_t pending_count; ///< Number of times the work item was queued but hasn't started running yet.
+} cxplat_preemptible_work_item_t;
+
+typedef struct alignas(64) _cxplat_work_item_queue
+{
+    std::mutex lock;
+    cxplat_preemptible_work_item_t* head;
+    cxplat_preemptible_work_item_t* tail;
+    std::atomic<uint64_t> submitted_count; ///< Work items queued by threads that selected this queue.
+    std::atomic<uint64_t> completed_count; ///< Work items completed by the worker that owns this queue.
+    cxplat_work_item_thread_t* thread;
+} cxplat_work_item_queue_t;
+
+static cxplat_work_item_queue_t _cxplat_work_item_queues[CXPLAT_MAXIMUM_WORK_ITEM_THREADS];
+static size_t _cxplat_work_item_thread_count = 0;
+static std::atomic<uint32_t> _cxplat_work_item_semaphore = 0;
+static std::atomic<bool> _cxplat_work_item_shutting_down = false;
+
+// Threads waiting for work items to complete, and a counter bumped whenever a work item completes while any are
+// waiting, which is what they wait on.
+static std::atomic<uint32_t> _cxplat_work_item_drain_waiters = 0;
+static std::atomic<uint32_t> _cxplat_work_item_completion_generation = 0;
+
+static void
+_cxplat_release_work_item_semaphore(uint32_t count)
+{
+    _cxplat_work_item_semaphore.fetch_add(count, std::memory_order_release);
+    if (count == 1) {
+        _cxplat_work_item_semaphore.notify_one();
+    } else {
+        _cxplat_work_item_semaphore.notify_all();
+    }
+}
+
+static void
+_cxplat_wait_for_work_item_semaphore()
+{
+    uint32_t count = _cxplat_work_item_semaphore.load(std::memory_order_relaxed);
+    for (;;) {
+        if (count == 0) {
+            _cxplat_work_item_semaphore.wait(0, std::memory_order_relaxed);
+            count = _cxplat_work_item_semaphore.load(std::memory_order_relaxed);
+        } else if (_cxplat_work_item_semaphore.compare_exchange_weak(
+                       count, count - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+static void
+_cxplat_push_work_item(_Inout_ cxplat_work_item_queue_t* queue, _Inout_ cxplat_preemptible_work_item_t* work_item)
+{
+    work_item->next = nullptr;
+    std::unique_lock<std::mutex> l(queue->lock);
+    if (queue->tail == nullptr) {
+        std::atomic_ref<cxplat_preemptible_work_item_t*>(queue->head).store(work_item, std::memory_order_relaxed);
+    } else {
+        queue->tail->next = work_item;
+    }
+    queue->tail = work_item;
+}
+
+static cxplat_preemptible_work_item_t*
+_cxplat_pop_work_item(_Inout_ cxplat_work_item_queue_t* queue)
+{
+    // Check without the lock first, so that workers looking for an item to steal don't contend on empty queues.
+    std::atomic_ref<cxplat_preemptible_work_item_t*> head(queue->head);
+    if (head.load(std::memory_order_relaxed) == nullptr) {
+        return nullptr;
+    }
+    std::unique_lock<std::mutex> l(queue->lock);
+    cxplat_preemptible_work_item_t* work_item = head.load(std::memory_order_relaxed);
+    if (work_item != nullptr) {
+        head.store(work_item->next, std::memory_order_relaxed);
+        if (work_item->next == nullptr) {
+            queue->tail = nullptr;
+        }
+    }
+    return work_item;
+}
+
+void
+_cxplat_run_work_item_worker(size_t worker_index)
+{
+    cxplat_work_item_queue_t* own_queue = &_cxplat_work_item_queues[worker_index];
+    for (;;) {
+        _cxplat_wait_for_work_item_semaphore();
+
+        // The count taken above belongs to an item that is already in some queue, unless shutting down.
+        cxplat_preemptible_work_item_t* work_item = nullptr;
+        while (work_item == nullptr) {
+            work_item = _cxplat_pop_work_item(own_queue);
+            for (size_t i = 1; work_item == nullptr && i < _cxplat_work_item_thread_count; i++) {
+                work_item = _cxplat_pop_work_item(
+                    &_cxplat_work_item_queues[(worker_index + i) % _cxplat_work_item_thread_count]);
+            }
+            if (work_item == nullptr && _cxplat_work_item_shutting_down.load(std::memory_order_acquire)) {
+                return;
+            }
+        }
+
+        // The routine may free the work item, so take everything needed from it first. If the item was queued again
+        // before it started running, run it once per time it was queued.
+        uint32_t run_count = std::atomic_ref<uint32_t>(work_item->pending_count).exchange(0);
+        cxplat_work_item_routine_t work_item_routine = work_item->work_item_routine;
+        void* work_item_context = work_item->work_item_context;
+        for (uint32_t i = 0; i < run_count; i++) {
+            work_item_routine(work_item, work_item_context);
+        }
+
+        own_queue->completed_count += run_count;
+        if (_cxplat_work_item_drain_waiters > 0) {
+            _cxplat_work_item_completion_generation++;
+            _cxplat_work_item_completion_generation.notify_all();
+        }
+    }
+}
+
+_Must_inspect_result_ cxplat_status_t
+cxplat_allocate_preemptible_work_item(
+    _In_opt_ void* caller_context,
+    _Outptr_ cxplat_preemptible_work_item_t** work_item,
+    _In_ cxplat_work_item_routine_t work_item_routine,
+    _In_opt_ void* work_item_context)
+{
+    (void)caller_context;
+
+#ifdef CXPLAT_DEBUGGING_FEATURES_ENABLED
+    if (cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_WORK_ITEM)) {
+        *work_item = nullptr;
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+#endif
+
+    *work_item = (cxplat_preemptible_work_item_t*)cxplat_allocate(
+        CXPLAT_POOL_FLAG_NON_PAGED, sizeof(cxplat_preemptible_work_item_t), CXPLAT_TAG_PREEMPTIBLE_WORK_ITEM);
+    if (*work_item == nullptr) {
+        return CXPLAT_STATUS_NO_MEMORY;
+    }
+    (*work_item)->work_item_routine = work_item_routine;
+    (*work_item)->work_item_context = work_item_context;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_queue_preemptible_work_item(_Inout_ cxplat_preemptible_work_item_t* io_work_item)
+{
+    CXPLAT_RUNTIME_ASSERT(_cxplat_work_item_thread_count > 0);
+    cxplat_work_item_queue_t* queue =
+        &_cxplat_work_item_queues[cxplat_get_current_processor_number() % _cxplat_work_item_thread_count];
+    queue->submitted_count++;
+
+    // An item already waiting in a queue just runs once more when it is dequeued.
+    if (++std::atomic_ref<uint32_t>(io_work_item->pending_count) == 1) {
+        _cxplat_push_work_item(queue, io_work_item);
+        _cxplat_release_work_item_semaphore(1);
+    }
+}
+
+void
+cxplat_free_preemptible_work_item(_Frees_ptr_opt_ cxplat_preemptible_work_item_t* work_item)
+{
+    if (!work_item) {
+        return;
+    }
+
+    cxplat_free(work_item, CXPLAT_POOL_FLAG_NON_PAGED, CXPLAT_TAG_PREEMPTIBLE_WORK_ITEM);
+}
+
+/**
+ * @brief Stop the worker threads, after any queued work items have run.
+ *
+ * @param[in] thread_count Number of worker threads started.
+ */
+static void
+_cxplat_stop_work_item_threads(size_t thread_count)
+{
+    _cxplat_work_item_shutting_down.store(true, std::memory_order_release);
+    _cxplat_release_work_item_semaphore((uint32_t)thread_count);
+    for (size_t i = 0; i < thread_count; i++) {
+        _cxplat_join_work_item_thread(_cxplat_work_item_queues[i].thread);
+        _cxplat_work_item_queues[i].thread = nullptr;
+    }
+    _cxplat_work_item_semaphore = 0;
+    _cxplat_work_item_thread_count = 0;
+}
+
+cxplat_status_t
+_cxplat_initialize_thread_pool(size_t thread_count)
+{
+    if (thread_count == 0) {
+        thread_count = cxplat_get_active_processor_count();
+    }
+    if (thread_count > CXPLAT_MAXIMUM_WORK_ITEM_THREADS) {
+        thread_count = CXPLAT_MAXIMUM_WORK_ITEM_THREADS;
+    }
+
+    _cxplat_work_item_shutting_down = false;
+    _cxplat_work_item_semaphore = 0;
+    for (size_t i = 0; i < thread_count; i++) {
+        cxplat_work_item_queue_t* queue = &_cxplat_work_item_queues[i];
+        queue->head = nullptr;
+        queue->tail = nullptr;
+        queue->submitted_count = 0;
+        queue->completed_count = 0;
+    }
+
+    // Queues are only selected once every worker has started, so a failure here never strands a queued item.
+    for (size_t i = 0; i < thread_count; i++) {
+        cxplat_status_t status = _cxplat_create_work_item_thread(i, &_cxplat_work_item_queues[i].thread);
+        if (status != CXPLAT_STATUS_SUCCESS) {
+            _cxplat_stop_work_item_threads(i);
+            return status;
+        }
+    }
+    _cxplat_work_item_thread_count = thread_count;
+    return CXPLAT_STATUS_SUCCESS;
+}
+
+void
+cxplat_wait_for_preemptible_work_items_complete()
+{
+    if (_cxplat_work_item_thread_count == 0) {
+        return;
+    }
+
+    _cxplat_work_item_drain_waiters++;
+    for (;;) {
+        uint32_t generation = _cxplat_work_item_completion_generation;
+
+        // Counts only grow, so reading every completed count before any submitted count means that equal totals
+        // prove every item submitted so far has completed.
+        uint64_t completed = 0;
+        uint64_t submitted = 0;
+        for (size_t i = 0; i < _cxplat_work_item_thread_count; i++) {
+            completed += _cxplat_work_item_queues[i].completed_count;
+        }
+        for (size_t i = 0; i < _cxplat_work_item_thread_count; i++) {
+            submitted += _cxplat_work_item_queues[i].submitted_count;
+        }
+        if (completed == submitted) {
+            break;
+        }
+        _cxplat_work_item_completion_generation.wait(generation);
+    }
+    _cxplat_work_item_drain_waiters--;
+}
+
+void
+_cxplat_clean_up_thread_pool()
+{
+    if (_cxplat_work_item_thread_count == 0) {
+        return;
+    }
+
+    cxplat_wait_for_preemptible_work_items_complete();
+    _cxplat_stop_work_item_threads(_cxplat_work_item_thread_count);
+}
@@ -0,0 +1,58 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+#pragma once
+
+// The work item pool is shared by the user-mode backends, which supply the platform services declared in this file.
+#include "cxplat.h"
+
+// Largest number of threads that run preemptible work items.
+#define CXPLAT_MAXIMUM_WORK_ITEM_THREADS 64
+
+/**
+ * @brief Start the threads that run preemptible work items.
+ *
+ * @param[in] thread_count Number of threads to start, or 0 for one per active processor. At most
+ * CXPLAT_MAXIMUM_WORK_ITEM_THREADS threads are started. A single thread runs work items in the order they were queued.
+ * @retval CXPLAT_STATUS_SUCCESS The threads were started.
+ */
+cxplat_status_t
+_cxplat_initialize_thread_pool(size_t thread_count);
+
+/**
+ * @brief Stop the threads that run preemptible work items, after any queued work items have run.
+ */
+void
+_cxplat_clean_up_thread_pool();
+
+/**
+ * @brief Run work items until the pool shuts down. Each thread started by _cxplat_create_work_item_thread() calls
+ * this.
+ *
+ * @param[in] worker_index Index of the worker, which selects the queue it owns.
+ */
+void
+_cxplat_run_work_item_worker(size_t worker_index);
+
+/**
+ * @brief A thread that runs preemptible work items.
+ */
+typedef struct _cxplat_work_item_thread cxplat_work_item_thread_t;
+
+/**
+ * @brief Start a thread that calls _cxplat_run_work_item_worker().
+ *
+ * @param[in] worker_index Index to pass to _cxplat_run_work_item_worker().
+ * @param[out] thread The started thread.
+ * @retval CXPLAT_STATUS_SUCCESS The thread was started.
+ * @retval CXPLAT_STATUS_NO_MEMORY Unable to start the thread.
+ */
+_Must_inspect_result_ cxplat_status_t
+_cxplat_create_work_item_thread(size_t worker_index, _Outptr_ cxplat_work_item_thread_t** thread);
+
+/**
+ * @brief Wait for a thread started by _cxplat_create_work_item_thread() to exit, and free it.
+ *
+ * @param[in] thread Thread to wait for.
+ */
+void
+_cxplat_join_work_item_thread(_Frees_ptr_ cxplat_work_item_thread_t* thread);
@@ -39,8 +39,16 @@ typedef struct _EX_SPIN_LOCK
 
 typedef cxplat_rundown_reference_t EX_RUNDOWN_REF;
 
-// Initial usersim version of this API will not be cache aware and will use the same type as EX_RUNDOWN_REF.
-typedef cxplat_rundown_reference_t EX_RUNDOWN_REF_CACHE_AWARE;
+typedef struct _usersim_rundown_slot usersim_rundown_slot_t;
+
+// Cache-aware rundown protection keeps one cache-line-sized reference count per processor so that
+// acquire and release never contend across processors.
+typedef struct _EX_RUNDOWN_REF_CACHE_AWARE
+{
+    usersim_rundown_slot_t* slots;          ///< Per-processor reference counts.
+    ULONG slot_count;                       ///< Number of entries in slots.
+    volatile LONG64 outstanding_references; ///< References still held once rundown has been initiated.
+} EX_RUNDOWN_REF_CACHE_AWARE;
 
 //
 // Pool Allocation routines (in pool.c)
@@ -88,6 +96,65 @@ typedef _Enum_is_bitflag_ enum _POOL_TYPE {
 typedef ULONG64 POOL_FLAGS;
 #define POOL_FLAG_NON_PAGED 0x00000040
 
+//
+// Lookaside lists
+//
+typedef struct _LOOKASIDE_LIST_EX LOOKASIDE_LIST_EX, *PLOOKASIDE_LIST_EX;
+
+typedef _IRQL_requires_same_ _Function_class_(ALLOCATE_FUNCTION_EX) void* ALLOCATE_FUNCTION_EX(
+    _In_ POOL_TYPE PoolType, _In_ SIZE_T NumberOfBytes, _In_ ULONG Tag, _Inout_ PLOOKASIDE_LIST_EX Lookaside);
+typedef ALLOCATE_FUNCTION_EX* PALLOCATE_FUNCTION_EX;
+
+typedef _IRQL_requires_same_ _Function_class_(FREE_FUNCTION_EX) void FREE_FUNCTION_EX(
+    _In_ __drv_freesMem(Mem) void* Buffer, _Inout_ PLOOKASIDE_LIST_EX Lookaside);
+typedef FREE_FUNCTION_EX* PFREE_FUNCTION_EX;
+
+typedef _IRQL_requires_same_ _Function_class_(ALLOCATE_FUNCTION) void* ALLOCATE_FUNCTION(
+    _In_ POOL_TYPE PoolType, _In_ SIZE_T NumberOfBytes, _In_ ULONG Tag);
+typedef ALLOCATE_FUNCTION* PALLOCATE_FUNCTION;
+
+typedef _IRQL_requires_same_ _Function_class_(FREE_FUNCTION) void FREE_FUNCTION(_In_ __drv_freesMem(Mem) void* Buffer);
+typedef FREE_FUNCTION* PFREE_FUNCTION;
+
+typedef struct _usersim_lookaside_magazine usersim_lookaside_magazine_t;
+
+// Free entries are cached in one magazine per processor, so allocations and frees on different processors
+// never touch the same cache line.
+typedef struct _LOOKASIDE_LIST_EX
+{
+    usersim_lookaside_magazine_t* magazines;     ///< Per-processor caches of free entries, or NULL if caching is off.
+    ULONG magazine_count;                        ///< Number of entries in magazines.
+    USHORT depth;                                ///< Maximum number of free entries cached per processor.
+    POOL_TYPE pool_type;                         ///< Pool type passed to the allocate callback.
+    ULONG tag;                                   ///< Pool tag passed to the allocate callback.
+    SIZE_T size;                                 ///< Size of each entry.
+    PALLOCATE_FUNCTION_EX allocate_function;     ///< Allocates an entry when the local magazine is empty.
+    PFREE_FUNCTION_EX free_function;             ///< Frees an entry when the local magazine is full.
+    PALLOCATE_FUNCTION legacy_allocate_function; ///< Callback given to Ex{N}PagedLookasideList initialization.
+    PFREE_FUNCTION legacy_free_function;         ///< Callback given to Ex{N}PagedLookasideList initialization.
+} LOOKASIDE_LIST_EX;
+
+typedef struct _NPAGED_LOOKASIDE_LIST
+{
+    LOOKASIDE_LIST_EX L;
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST;
+
+typedef struct _PAGED_LOOKASIDE_LIST
+{
+    LOOKASIDE_LIST_EX L;
+} PAGED_LOOKASIDE_LIST, *PPAGED_LOOKASIDE_LIST;
+
+/**
+ * @brief Usage counters for a lookaside list, summed across processors.
+ */
+typedef struct _usersim_lookaside_statistics
+{
+    uint64_t total_allocates; ///< Number of entries allocated from the lookaside list.
+    uint64_t allocate_hits;   ///< Number of allocations satisfied from a per-processor magazine.
+    uint64_t total_frees;     ///< Number of entries freed to the lookaside list.
+    uint64_t free_hits;       ///< Number of frees kept in a per-processor magazine for reuse.
+} usersim_lookaside_statistics_t;
+
 USERSIM_API
 void
 ExInitializeRundownProtection(_Out_ EX_RUNDOWN_REF* rundown_ref);
@@ -123,11 +190,97 @@ void ExReleaseRundownProtectionCacheAware(
   _Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware
 );
 
+USERSIM_API
+void
+ExReInitializeRundownProtectionCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware);
+
+USERSIM_API
+void
+ExWaitForRundownProtectionReleaseCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware);
+
 USERSIM_API
 void ExFreeCacheAwareRundownProtection(
   _Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware
 );
 
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) NTSTATUS ExInitializeLookasideListEx(
+    _Out_ PLOOKASIDE_LIST_EX Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION_EX Allocate,
+    _In_opt_ PFREE_FUNCTION_EX Free,
+    _In_ POOL_TYPE PoolType,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExDeleteLookasideListEx(_Inout_ PLOOKASIDE_LIST_EX Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFlushLookasideListEx(_Inout_ PLOOKASIDE_LIST_EX Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) _Ret_maybenull_ void* ExAllocateFromLookasideListEx(
+    _Inout_ PLOOKASIDE_LIST_EX Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFreeToLookasideListEx(
+    _Inout_ PLOOKASIDE_LIST_EX Lookaside, _In_ __drv_freesMem(Entry) void* Entry);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExInitializeNPagedLookasideList(
+    _Out_ PNPAGED_LOOKASIDE_LIST Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION Allocate,
+    _In_opt_ PFREE_FUNCTION Free,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExDeleteNPagedLookasideList(_Inout_ PNPAGED_LOOKASIDE_LIST Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) _Ret_maybenull_ void* ExAllocateFromNPagedLookasideList(
+    _Inout_ PNPAGED_LOOKASIDE_LIST Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFreeToNPagedLookasideList(
+    _Inout_ PNPAGED_LOOKASIDE_LIST Lookaside, _In_ __drv_freesMem(Entry) void* Entry);
+
+USERSIM_API
+_IRQL_requires_max_(APC_LEVEL) void ExInitializePagedLookasideList(
+    _Out_ PPAGED_LOOKASIDE_LIST Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION Allocate,
+    _In_opt_ PFREE_FUNCTION Free,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth);
+
+USERSIM_API
+_IRQL_requires_max_(APC_LEVEL) void ExDeletePagedLookasideList(_Inout_ PPAGED_LOOKASIDE_LIST Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(APC_LEVEL) _Ret_maybenull_ void* ExAllocateFromPagedLookasideList(
+    _Inout_ PPAGED_LOOKASIDE_LIST Lookaside);
+
+USERSIM_API
+_IRQL_requires_max_(APC_LEVEL) void ExFreeToPagedLookasideList(
+    _Inout_ PPAGED_LOOKASIDE_LIST Lookaside, _In_ __drv_freesMem(Entry) void* Entry);
+
+/**
+ * @brief Get the usage counters of a lookaside list.
+ *
+ * @param[in] lookaside Lookaside list to query.
+ * @param[out] statistics Counters summed across all processors.
+ */
+USERSIM_API
+void
+usersim_query_lookaside_list_statistics(
+    _In_ const LOOKASIDE_LIST_EX* lookaside, _Out_ usersim_lookaside_statistics_t* statistics);
+
 USERSIM_API
 _Acquires_exclusive_lock_(push_lock->lock) void ExAcquirePushLockExclusiveEx(
     _Inout_ _Requires_lock_not_held_(*_Curr_) _Acquires_lock_(*_Curr_) EX_PUSH_LOCK* push_lock,
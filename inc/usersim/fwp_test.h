@@ -28,9 +28,45 @@ typedef struct _fwp_classify_parameters
     uint32_t reauthorization_flag;
 } fwp_classify_parameters_t;
 
+/**
+ * @brief Packet to classify with usersim_fwp_classify_packets.
+ */
+typedef struct _fwp_classify_packet
+{
+    const GUID* layer_guid; ///< FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, or an ALE_RESOURCE_ASSIGNMENT or
+                            ///< ALE_CONNECT_REDIRECT layer.
+    NET_IFINDEX if_index;   ///< Interface index, for the MAC frame layer.
+    fwp_classify_parameters_t* parameters; ///< Parameters, for the ALE layers.
+    FWP_ACTION_TYPE action;                ///< Receives the action.
+} fwp_classify_packet_t;
+
+/**
+ * @brief Classify a packet at a layer. This and the other usersim_fwp_* classify hooks return the result of
+ * arbitration across every sublayer of the layer, in sublayer weight order, rather than the action of a single
+ * callout, so a block from one sublayer can override a permit from another.
+ *
+ * @param[in] layer_guid Layer to classify at.
+ * @param[in] if_index Interface index, for the MAC frame layer.
+ * @return The arbitrated action, or FWP_ACTION_CALLOUT_UNKNOWN if no filter matched.
+ */
 USERSIM_API FWP_ACTION_TYPE
 usersim_fwp_classify_packet(_In_ const GUID* layer_guid, NET_IFINDEX if_index);
 
+/**
+ * @brief Classify a batch of packets. One snapshot of the filters and one epoch guard are used for the whole batch,
+ * so every packet sees the same filters, and the packets share preallocated NBLs, so this measures the classify path
+ * rather than the allocator. Connect redirect packets are only classified at that layer; the auth connect layer
+ * isn't invoked for them.
+ *
+ * @param[in, out] packets Packets to classify.
+ * @param[in] count Number of packets.
+ * @retval STATUS_SUCCESS The packets were classified.
+ * @retval STATUS_INVALID_PARAMETER A packet names an unsupported layer or lacks its parameters.
+ * @retval STATUS_NO_MEMORY Unable to allocate the packet shell.
+ */
+USERSIM_API NTSTATUS
+usersim_fwp_classify_packets(_Inout_updates_(count) fwp_classify_packet_t* packets, size_t count);
+
 USERSIM_API FWP_ACTION_TYPE
 usersim_fwp_bind_ipv4(_In_ fwp_classify_parameters_t* parameters);
 
@@ -61,7 +97,11 @@ usersim_fwp_cgroup_inet4_listen(_In_ fwp_classify_parameters_t* parameters);
 USERSIM_API FWP_ACTION_TYPE
 usersim_fwp_cgroup_inet6_listen(_In_ fwp_classify_parameters_t* parameters);
 
-USERSIM_API void
+/**
+ * @brief Deprecated and ignored. Classify evaluates every sublayer of a layer in weight order, so it no longer needs
+ * to be told which sublayers to use.
+ */
+[[deprecated("Ignored: classify arbitrates across every sublayer.")]] USERSIM_API void
 usersim_fwp_set_sublayer_guids(
     _In_ const GUID& default_sublayer, _In_ const GUID& connect_v4_sublayer, _In_ const GUID& connect_v6_sublayer);
 
@@ -24,11 +24,43 @@ typedef enum _usersim_object_type
     USERSIM_OBJECT_TYPE_SEMAPHORE,
     USERSIM_OBJECT_TYPE_TIMER,
     USERSIM_OBJECT_TYPE_EVENT,
+    USERSIM_OBJECT_TYPE_MUTEX,
 } usersim_object_type_t;
 
+/**
+ * @brief Fields shared by all dispatcher objects (events, semaphores, mutexes and timers).
+ * Must be the first member of each dispatcher object.
+ */
+typedef struct _usersim_dispatcher_header
+{
+    usersim_object_type_t object_type;
+    volatile LONG waiters;          ///< Number of threads registered in wait_list.
+    usersim_list_entry_t wait_list; ///< KWAIT_BLOCKs of threads waiting on the object.
+} usersim_dispatcher_header_t;
+
+typedef enum _WAIT_TYPE
+{
+    WaitAll,
+    WaitAny,
+} WAIT_TYPE;
+
+typedef struct _KWAIT_BLOCK
+{
+    usersim_list_entry_t wait_list_entry; ///< Links the block into the object's wait list.
+    void* object;                         ///< Object being waited on.
+    volatile LONG* wake_address;          ///< Word the waiting thread is parked on.
+    USHORT wait_key;                      ///< Index of the object in the wait array.
+} KWAIT_BLOCK;
+typedef KWAIT_BLOCK* PKWAIT_BLOCK;
+typedef KWAIT_BLOCK* PRKWAIT_BLOCK;
+
+// Number of wait blocks KeWaitForMultipleObjects() provides when the caller passes none.
+#define THREAD_WAIT_OBJECTS 3
+
 typedef enum
 {
     IRQL_NOT_LESS_OR_EQUAL = 0x0A,
+    THREAD_NOT_MUTEX_OWNER = 0x11,
     TIMER_OR_DPC_INVALID = 0xC7,
     DRIVER_UNMAPPING_INVALID_VIEW = 0xD7,
 } usersim_bug_check_code_t;
@@ -83,12 +115,52 @@ KfLowerIrql(_In_ KIRQL new_irql);
 USERSIM_API
 _IRQL_requires_min_(DISPATCH_LEVEL) NTKERNELAPI LOGICAL KeShouldYieldProcessor(VOID);
 
+/**
+ * @brief How IRQL changes are emulated.
+ */
+typedef enum _usersim_irql_mode
+{
+    /// Raising to DISPATCH_LEVEL pins the thread to its current processor and takes that processor's
+    /// dispatch lock. This most closely matches the kernel, but costs several system calls per raise.
+    USERSIM_IRQL_MODE_STRICT,
+    /// Raising to DISPATCH_LEVEL only takes the current processor's dispatch lock, and the thread keeps
+    /// reporting that processor as current until it lowers the IRQL, even if the scheduler moves it.
+    USERSIM_IRQL_MODE_FAST,
+} usersim_irql_mode_t;
+
+/**
+ * @brief Initialize IRQL emulation.
+ *
+ * @param[in] mode Initial IRQL emulation mode.
+ * @retval STATUS_SUCCESS The operation succeeded.
+ */
 usersim_result_t
-usersim_initialize_irql();
+usersim_initialize_irql(usersim_irql_mode_t mode);
 
 void
 usersim_clean_up_irql();
 
+/**
+ * @brief Change the IRQL emulation mode. Must be called below DISPATCH_LEVEL.
+ * Threads that are already at DISPATCH_LEVEL keep the mode they raised in until they lower the IRQL.
+ *
+ * @param[in] mode New IRQL emulation mode.
+ * @return The previous IRQL emulation mode.
+ */
+USERSIM_API
+usersim_irql_mode_t
+usersim_set_irql_mode(usersim_irql_mode_t mode);
+
+/**
+ * @brief Get the processor that the current thread is emulating, if it raised to DISPATCH_LEVEL in fast mode.
+ *
+ * @param[out] processor_index Index of the emulated processor.
+ * @retval true The thread is emulating *processor_index.
+ * @retval false The thread is not emulating a processor.
+ */
+bool
+usersim_get_current_virtual_processor(_Out_ uint32_t* processor_index);
+
 USERSIM_API
 bool
 usersim_set_current_thread_priority(int priority, int* old_priority);
@@ -184,8 +256,9 @@ usersim_get_current_thread_group_affinity(_Out_ GROUP_AFFINITY* Affinity);
 
 typedef struct _ksemaphore
 {
-    usersim_object_type_t object_type;
-    HANDLE handle;
+    usersim_dispatcher_header_t header;
+    volatile LONG count; ///< Current count.
+    LONG limit;          ///< Maximum count.
 } KSEMAPHORE;
 typedef KSEMAPHORE* PKSEMAPHORE;
 typedef KSEMAPHORE* PRKSEMAPHORE;
@@ -205,11 +278,33 @@ USERSIM_API
 LONG
 KeReadStateSemaphore(_In_ PRKSEMAPHORE semaphore);
 
-void
-usersim_free_semaphores();
-
 #pragma endregion semaphores
 
+#pragma region mutexes
+
+typedef struct _kmutex
+{
+    usersim_dispatcher_header_t header;
+    PKTHREAD volatile owner_thread; ///< Owning thread, or nullptr.
+    LONG recursion_count;           ///< Number of times the owner has acquired the mutex.
+} KMUTEX;
+typedef KMUTEX* PKMUTEX;
+typedef KMUTEX* PRKMUTEX;
+
+USERSIM_API
+_IRQL_requires_max_(DISPATCH_LEVEL) NTKERNELAPI VOID KeInitializeMutex(_Out_ PRKMUTEX mutex, _In_ ULONG level);
+
+USERSIM_API
+_When_(wait == 0, _IRQL_requires_max_(DISPATCH_LEVEL))
+    _When_(wait == 1, _IRQL_requires_max_(APC_LEVEL)) NTKERNELAPI LONG
+    KeReleaseMutex(_Inout_ PRKMUTEX mutex, _In_ BOOLEAN wait);
+
+USERSIM_API
+LONG
+KeReadStateMutex(_In_ PRKMUTEX mutex);
+
+#pragma endregion mutexes
+
 #pragma region events
 
 typedef enum _EVENT_TYPE
@@ -220,10 +315,9 @@ typedef enum _EVENT_TYPE
 
 typedef struct _kevent
 {
-    usersim_object_type_t object_type;
+    usersim_dispatcher_header_t header;
     EVENT_TYPE type;
-    KSPIN_LOCK spin_lock;
-    BOOLEAN signaled;
+    volatile BOOLEAN signaled;
 } KEVENT;
 typedef KEVENT* PKEVENT;
 typedef KEVENT* PRKEVENT;
@@ -259,6 +353,19 @@ _IRQL_requires_min_(PASSIVE_LEVEL) _When_((timeout == NULL || timeout->QuadPart
         _In_ BOOLEAN alertable,
         _In_opt_ PLARGE_INTEGER timeout);
 
+USERSIM_API
+_IRQL_requires_min_(PASSIVE_LEVEL) _When_((timeout == NULL || timeout->QuadPart != 0), _IRQL_requires_max_(APC_LEVEL))
+    _When_((timeout != NULL && timeout->QuadPart == 0), _IRQL_requires_max_(DISPATCH_LEVEL)) NTKERNELAPI NTSTATUS
+    KeWaitForMultipleObjects(
+        _In_ ULONG count,
+        _In_reads_(count) PVOID object[],
+        _In_ _Strict_type_match_ WAIT_TYPE wait_type,
+        _In_ _Strict_type_match_ KWAIT_REASON wait_reason,
+        _In_ __drv_strictType(KPROCESSOR_MODE / enum _MODE, __drv_typeConst) KPROCESSOR_MODE wait_mode,
+        _In_ BOOLEAN alertable,
+        _In_opt_ PLARGE_INTEGER timeout,
+        _Out_opt_ PKWAIT_BLOCK wait_block_array);
+
 USERSIM_API
 _IRQL_requires_same_ ULONG64
 KeQueryUnbiasedInterruptTimePrecise(_Out_ PULONG64 qpc_time_stamp);
@@ -279,7 +386,8 @@ typedef KDEFERRED_ROUTINE* PKDEFERRED_ROUTINE;
 
 struct _KDPC
 {
-    usersim_list_entry_t entry;
+    KDPC* next;          ///< Next DPC in the per-CPU queue while this DPC is queued.
+    volatile long state; ///< Queue state bits, only modified with interlocked operations.
     void* context;
     uint32_t cpu_id;
     void* parameter_1;
@@ -325,8 +433,10 @@ usersim_clean_up_dpcs();
 
 typedef struct _ktimer
 {
-    usersim_object_type_t object_type;
-    TP_TIMER* threadpool_timer;
+    usersim_dispatcher_header_t header;
+    usersim_list_entry_t wheel_entry; ///< Links the timer into a timer wheel slot while it is armed.
+    uint64_t expiration_tick;         ///< Interrupt time, in milliseconds, at which the timer expires.
+    ULONG period;                     ///< Period in milliseconds, or 0 for a one-shot timer.
     KDPC* dpc;
     BOOLEAN signaled;
 } KTIMER;
@@ -358,7 +468,10 @@ BOOLEAN
 KeReadStateTimer(_In_ PKTIMER timer);
 
 void
-usersim_free_threadpool_timers();
+usersim_initialize_timers();
+
+void
+usersim_clean_up_timers();
 
 #pragma endregion timers
 
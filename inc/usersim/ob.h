@@ -9,6 +9,63 @@ _IRQL_requires_max_(DISPATCH_LEVEL) USERSIM_API LONG_PTR ObfReferenceObject(_In_
 
 _IRQL_requires_max_(DISPATCH_LEVEL) USERSIM_API LONG_PTR ObfDereferenceObject(_In_ PVOID object);
 
+/**
+ * @brief Function called when the reference count of an object drops to zero.
+ *
+ * @param[in] object Object that is no longer referenced.
+ * @param[in] context Context passed to usersim_set_object_release_callback().
+ */
+typedef void (*usersim_object_release_callback_t)(_In_ PVOID object, _In_opt_ void* context);
+
+/**
+ * @brief Set the function called when the reference count of an object drops to zero. Without one, the object is
+ * closed with CloseHandle. This must not be called while objects are being dereferenced.
+ *
+ * @param[in] callback Function to call, or NULL to close objects with CloseHandle.
+ * @param[in] context Context to pass to the function.
+ */
+USERSIM_API void
+usersim_set_object_release_callback(_In_opt_ usersim_object_release_callback_t callback, _In_opt_ void* context);
+
+typedef struct _usersim_object_reference_trace_entry
+{
+    void* caller;             ///< Return address of the code that changed the reference count.
+    LONG_PTR reference_count; ///< Reference count after the change.
+} usersim_object_reference_trace_entry_t;
+
+/**
+ * @brief Start recording every change to the reference count of an object, to find the code that leaks a
+ * reference. Each change is also logged at verbose level.
+ *
+ * @param[in] object Object to trace.
+ * @retval STATUS_SUCCESS The operation was successful.
+ * @retval STATUS_NO_MEMORY Unable to allocate resources for the trace.
+ */
+USERSIM_API NTSTATUS
+usersim_start_object_reference_trace(_In_ PVOID object);
+
+/**
+ * @brief Stop recording changes to the reference count of an object, and discard those recorded so far.
+ *
+ * @param[in] object Object being traced.
+ */
+USERSIM_API void
+usersim_stop_object_reference_trace(_In_ PVOID object);
+
+/**
+ * @brief Get the changes recorded to the reference count of an object, oldest first.
+ *
+ * @param[in] object Object being traced.
+ * @param[out] entries Buffer to copy the changes into.
+ * @param[in] entry_count Number of changes the buffer can hold.
+ * @return Number of changes recorded, which may be more than were copied.
+ */
+USERSIM_API size_t
+usersim_get_object_reference_trace(
+    _In_ PVOID object,
+    _Out_writes_opt_(entry_count) usersim_object_reference_trace_entry_t* entries,
+    size_t entry_count);
+
 typedef struct _OBJECT_TYPE* POBJECT_TYPE;
 
 USERSIM_API extern POBJECT_TYPE* ExEventObjectType;
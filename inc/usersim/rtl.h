@@ -97,6 +97,12 @@ USERSIM_API
 _Must_inspect_result_ NTSTATUS
 RtlSizeTSub(size_t minuend, size_t subtrahend, _Out_ _Deref_out_range_(==, minuend - subtrahend) size_t* result);
 
+/**
+ * @brief Return a pseudorandom number in the range [0, MAXLONG - 1], and advance the seed.
+ *
+ * @param[in, out] seed Seed, which is updated so that the next call returns a different number.
+ * @return A pseudorandom number.
+ */
 USERSIM_API
 ULONG
 RtlRandomEx(_Inout_ PULONG seed);
@@ -13,6 +13,8 @@
 #include <sstream>
 #include <tuple>
 
+#define USERSIM_CACHE_LINE_SIZE 64
+
 // Ex* functions.
 
 void
@@ -45,15 +47,44 @@ ExReleaseRundownProtection(_Inout_ EX_RUNDOWN_REF* rundown_reference)
     cxplat_release_rundown_protection(rundown_reference);
 }
 
+#define USERSIM_RUNDOWN_ACTIVE 0x1
+#define USERSIM_RUNDOWN_COUNT_INCREMENT 0x2
+
+typedef struct alignas(USERSIM_CACHE_LINE_SIZE) _usersim_rundown_slot
+{
+    // A reference may be released on a different processor than the one that acquired it, so an individual
+    // slot's count can go negative. Only the sum across all slots is meaningful.
+    volatile LONG64 state; ///< Signed reference count in the upper bits, rundown active flag in bit 0.
+} usersim_rundown_slot_t;
+
+static_assert(sizeof(usersim_rundown_slot_t) == USERSIM_CACHE_LINE_SIZE);
+
+// Offset of the slot array from the start of a cache-aware rundown reference allocation.
+#define USERSIM_RUNDOWN_SLOTS_OFFSET                                                                              \
+    ((sizeof(EX_RUNDOWN_REF_CACHE_AWARE) + USERSIM_CACHE_LINE_SIZE - 1) & ~(size_t)(USERSIM_CACHE_LINE_SIZE - 1))
+
+static usersim_rundown_slot_t*
+_usersim_get_current_rundown_slot(_In_ const EX_RUNDOWN_REF_CACHE_AWARE* rundown_reference)
+{
+    return &rundown_reference->slots[KeGetCurrentProcessorNumberEx(nullptr) % rundown_reference->slot_count];
+}
+
 EX_RUNDOWN_REF_CACHE_AWARE*
 ExAllocateCacheAwareRundownProtection(
     _In_ __drv_strictTypeMatch(__drv_typeExpr) POOL_TYPE PoolType, unsigned long PoolTag)
 {
-    EX_RUNDOWN_REF_CACHE_AWARE* rundown_reference =
-        (EX_RUNDOWN_REF_CACHE_AWARE*)ExAllocatePoolWithTag(PoolType, sizeof(EX_RUNDOWN_REF_CACHE_AWARE), PoolTag);
+    // The slots share the allocation with the reference itself, so ask for cache-aligned pool to keep each slot
+    // on its own cache line.
+    POOL_TYPE cache_aligned_pool_type = (PoolType == PagedPool) ? PagedPoolCacheAligned : NonPagedPoolNxCacheAligned;
+    ULONG slot_count = KeQueryMaximumProcessorCount();
+    EX_RUNDOWN_REF_CACHE_AWARE* rundown_reference = (EX_RUNDOWN_REF_CACHE_AWARE*)ExAllocatePoolWithTag(
+        cache_aligned_pool_type, USERSIM_RUNDOWN_SLOTS_OFFSET + slot_count * sizeof(usersim_rundown_slot_t), PoolTag);
 
     if (rundown_reference != nullptr) {
-        cxplat_initialize_rundown_protection(rundown_reference);
+        rundown_reference->slots =
+            (usersim_rundown_slot_t*)((uint8_t*)rundown_reference + USERSIM_RUNDOWN_SLOTS_OFFSET);
+        rundown_reference->slot_count = slot_count;
+        rundown_reference->outstanding_references = 0;
     }
     return rundown_reference;
 }
@@ -61,13 +92,71 @@ ExAllocateCacheAwareRundownProtection(
 BOOLEAN
 ExAcquireRundownProtectionCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware)
 {
-    return (BOOLEAN)cxplat_acquire_rundown_protection(RunRefCacheAware);
+    usersim_rundown_slot_t* slot = _usersim_get_current_rundown_slot(RunRefCacheAware);
+    LONG64 state = slot->state;
+    for (;;) {
+        if (state & USERSIM_RUNDOWN_ACTIVE) {
+            return FALSE;
+        }
+        LONG64 observed = InterlockedCompareExchange64(&slot->state, state + USERSIM_RUNDOWN_COUNT_INCREMENT, state);
+        if (observed == state) {
+            return TRUE;
+        }
+        state = observed;
+    }
 }
 
 void
 ExReleaseRundownProtectionCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware)
 {
-    cxplat_release_rundown_protection(RunRefCacheAware);
+    usersim_rundown_slot_t* slot = _usersim_get_current_rundown_slot(RunRefCacheAware);
+    LONG64 state = slot->state;
+    while (!(state & USERSIM_RUNDOWN_ACTIVE)) {
+        LONG64 observed = InterlockedCompareExchange64(&slot->state, state - USERSIM_RUNDOWN_COUNT_INCREMENT, state);
+        if (observed == state) {
+            return;
+        }
+        state = observed;
+    }
+
+    // The slot was frozen by rundown and its count folded into the shared count, so release from there instead.
+    if (InterlockedDecrement64(&RunRefCacheAware->outstanding_references) == 0) {
+        WakeByAddressAll((void*)&RunRefCacheAware->outstanding_references);
+    }
+}
+
+void
+ExReInitializeRundownProtectionCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware)
+{
+    for (ULONG i = 0; i < RunRefCacheAware->slot_count; i++) {
+        InterlockedExchange64(&RunRefCacheAware->slots[i].state, 0);
+    }
+    InterlockedExchange64(&RunRefCacheAware->outstanding_references, 0);
+}
+
+void
+ExWaitForRundownProtectionReleaseCacheAware(_Inout_ EX_RUNDOWN_REF_CACHE_AWARE* RunRefCacheAware)
+{
+    // Freeze each slot and fold its count into the shared count. Releases that land on an already frozen slot
+    // decrement the shared count before this sum is added, which can only drive it negative, so it reaches zero
+    // only once every reference counted here has been released.
+    LONG64 references = 0;
+    for (ULONG i = 0; i < RunRefCacheAware->slot_count; i++) {
+        LONG64 state = InterlockedOr64(&RunRefCacheAware->slots[i].state, USERSIM_RUNDOWN_ACTIVE);
+        if (!(state & USERSIM_RUNDOWN_ACTIVE)) {
+            references += state / USERSIM_RUNDOWN_COUNT_INCREMENT;
+        }
+    }
+
+    LONG64 outstanding_references = InterlockedAdd64(&RunRefCacheAware->outstanding_references, references);
+    while (outstanding_references != 0) {
+        WaitOnAddress(
+            &RunRefCacheAware->outstanding_references,
+            &outstanding_references,
+            sizeof(outstanding_references),
+            INFINITE);
+        outstanding_references = RunRefCacheAware->outstanding_references;
+    }
 }
 
 void
@@ -148,7 +237,6 @@ _Releases_shared_lock_(spin_lock->lock) void ExReleaseSpinLockSharedEx(
     ReleaseSRWLockShared(&spin_lock->lock);
 }
 
-#define USERSIM_CACHE_LINE_SIZE 64
 typedef struct
 {
     union
@@ -274,6 +362,256 @@ ExFreePoolWithTag(_Frees_ptr_ void* p, ULONG tag)
     ExFreePoolWithTagCPP(p, tag);
 }
 
+#pragma region lookaside_lists
+
+// Default and maximum number of free entries cached per processor, matching the kernel's MAXIMUM_LOOKASIDE_DEPTH.
+#define USERSIM_LOOKASIDE_DEFAULT_DEPTH 256
+
+typedef struct alignas(USERSIM_CACHE_LINE_SIZE) _usersim_lookaside_magazine
+{
+    SLIST_HEADER free_list;          ///< Free entries cached on this processor.
+    volatile LONG64 total_allocates; ///< Allocations made on this processor.
+    volatile LONG64 allocate_hits;   ///< Allocations on this processor satisfied from free_list.
+    volatile LONG64 total_frees;     ///< Frees made on this processor.
+    volatile LONG64 free_hits;       ///< Frees on this processor kept in free_list.
+} usersim_lookaside_magazine_t;
+
+static_assert(sizeof(usersim_lookaside_magazine_t) == USERSIM_CACHE_LINE_SIZE);
+
+static _Function_class_(ALLOCATE_FUNCTION_EX) void* _usersim_lookaside_default_allocate(
+    _In_ POOL_TYPE pool_type, _In_ SIZE_T number_of_bytes, _In_ ULONG tag, _Inout_ PLOOKASIDE_LIST_EX lookaside)
+{
+    UNREFERENCED_PARAMETER(lookaside);
+
+    // Like the kernel's lookaside lists, entries are not zeroed.
+    return ExAllocatePoolUninitialized(pool_type, number_of_bytes, tag);
+}
+
+static _Function_class_(FREE_FUNCTION_EX) void _usersim_lookaside_default_free(
+    _In_ __drv_freesMem(Mem) void* buffer, _Inout_ PLOOKASIDE_LIST_EX lookaside)
+{
+    UNREFERENCED_PARAMETER(lookaside);
+    ExFreePool(buffer);
+}
+
+static _Function_class_(ALLOCATE_FUNCTION_EX) void* _usersim_lookaside_legacy_allocate(
+    _In_ POOL_TYPE pool_type, _In_ SIZE_T number_of_bytes, _In_ ULONG tag, _Inout_ PLOOKASIDE_LIST_EX lookaside)
+{
+    return lookaside->legacy_allocate_function(pool_type, number_of_bytes, tag);
+}
+
+static _Function_class_(FREE_FUNCTION_EX) void _usersim_lookaside_legacy_free(
+    _In_ __drv_freesMem(Mem) void* buffer, _Inout_ PLOOKASIDE_LIST_EX lookaside)
+{
+    lookaside->legacy_free_function(buffer);
+}
+
+static usersim_lookaside_magazine_t*
+_usersim_get_current_lookaside_magazine(_In_ const LOOKASIDE_LIST_EX* lookaside)
+{
+    return &lookaside->magazines[KeGetCurrentProcessorNumberEx(nullptr) % lookaside->magazine_count];
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) NTSTATUS ExInitializeLookasideListEx(
+    _Out_ PLOOKASIDE_LIST_EX Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION_EX Allocate,
+    _In_opt_ PFREE_FUNCTION_EX Free,
+    _In_ POOL_TYPE PoolType,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth)
+{
+    // Allocation failures are always reported by returning NULL, so the flags have no effect.
+    UNREFERENCED_PARAMETER(Flags);
+
+    memset(Lookaside, 0, sizeof(*Lookaside));
+    Lookaside->pool_type = PoolType;
+    Lookaside->tag = Tag;
+    Lookaside->size = max(Size, sizeof(SLIST_ENTRY));
+    Lookaside->depth =
+        (Depth == 0 || Depth > USERSIM_LOOKASIDE_DEFAULT_DEPTH) ? (USHORT)USERSIM_LOOKASIDE_DEFAULT_DEPTH : Depth;
+    Lookaside->allocate_function = (Allocate != nullptr) ? Allocate : _usersim_lookaside_default_allocate;
+    Lookaside->free_function = (Free != nullptr) ? Free : _usersim_lookaside_default_free;
+
+    ULONG magazine_count = KeQueryMaximumProcessorCount();
+    Lookaside->magazines = (usersim_lookaside_magazine_t*)ExAllocatePoolWithTag(
+        NonPagedPoolNxCacheAligned, magazine_count * sizeof(usersim_lookaside_magazine_t), Tag);
+    if (Lookaside->magazines == nullptr) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    for (ULONG i = 0; i < magazine_count; i++) {
+        InitializeSListHead(&Lookaside->magazines[i].free_list);
+    }
+    Lookaside->magazine_count = magazine_count;
+    return STATUS_SUCCESS;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFlushLookasideListEx(_Inout_ PLOOKASIDE_LIST_EX Lookaside)
+{
+    for (ULONG i = 0; i < Lookaside->magazine_count; i++) {
+        SLIST_ENTRY* entry = InterlockedFlushSList(&Lookaside->magazines[i].free_list);
+        while (entry != nullptr) {
+            SLIST_ENTRY* next = entry->Next;
+            Lookaside->free_function(entry, Lookaside);
+            entry = next;
+        }
+    }
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExDeleteLookasideListEx(_Inout_ PLOOKASIDE_LIST_EX Lookaside)
+{
+    ExFlushLookasideListEx(Lookaside);
+    if (Lookaside->magazines != nullptr) {
+        ExFreePool(Lookaside->magazines);
+        Lookaside->magazines = nullptr;
+    }
+    Lookaside->magazine_count = 0;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) _Ret_maybenull_ void* ExAllocateFromLookasideListEx(
+    _Inout_ PLOOKASIDE_LIST_EX Lookaside)
+{
+    if (Lookaside->magazine_count == 0) {
+        return Lookaside->allocate_function(Lookaside->pool_type, Lookaside->size, Lookaside->tag, Lookaside);
+    }
+
+    usersim_lookaside_magazine_t* magazine = _usersim_get_current_lookaside_magazine(Lookaside);
+    InterlockedIncrement64(&magazine->total_allocates);
+    SLIST_ENTRY* entry = InterlockedPopEntrySList(&magazine->free_list);
+    if (entry != nullptr) {
+        // A cached entry never reaches cxplat_allocate, so give fault injection its chance to fail the call here
+        // to keep allocation-failure paths covered.
+        if (cxplat_fault_injection_is_enabled() &&
+            cxplat_fault_injection_inject_fault_for_class(CXPLAT_FAULT_INJECTION_CLASS_ALLOCATION)) {
+            InterlockedPushEntrySList(&magazine->free_list, entry);
+            return nullptr;
+        }
+        InterlockedIncrement64(&magazine->allocate_hits);
+        return entry;
+    }
+    return Lookaside->allocate_function(Lookaside->pool_type, Lookaside->size, Lookaside->tag, Lookaside);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFreeToLookasideListEx(
+    _Inout_ PLOOKASIDE_LIST_EX Lookaside, _In_ __drv_freesMem(Entry) void* Entry)
+{
+    if (Lookaside->magazine_count == 0) {
+        Lookaside->free_function(Entry, Lookaside);
+        return;
+    }
+
+    // The depth check races with other threads on the same processor, so a magazine can briefly exceed its
+    // depth. This is harmless and matches the kernel.
+    usersim_lookaside_magazine_t* magazine = _usersim_get_current_lookaside_magazine(Lookaside);
+    InterlockedIncrement64(&magazine->total_frees);
+    if (QueryDepthSList(&magazine->free_list) < Lookaside->depth) {
+        InterlockedIncrement64(&magazine->free_hits);
+        InterlockedPushEntrySList(&magazine->free_list, (SLIST_ENTRY*)Entry);
+        return;
+    }
+    Lookaside->free_function(Entry, Lookaside);
+}
+
+static void
+_usersim_initialize_legacy_lookaside_list(
+    _Out_ PLOOKASIDE_LIST_EX lookaside,
+    _In_opt_ PALLOCATE_FUNCTION allocate,
+    _In_opt_ PFREE_FUNCTION free,
+    POOL_TYPE pool_type,
+    ULONG flags,
+    SIZE_T size,
+    ULONG tag,
+    USHORT depth)
+{
+    // If the magazines cannot be allocated the list still works, it just never caches entries.
+    (void)ExInitializeLookasideListEx(
+        lookaside,
+        (allocate != nullptr) ? _usersim_lookaside_legacy_allocate : nullptr,
+        (free != nullptr) ? _usersim_lookaside_legacy_free : nullptr,
+        pool_type,
+        flags,
+        size,
+        tag,
+        depth);
+    lookaside->legacy_allocate_function = allocate;
+    lookaside->legacy_free_function = free;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExInitializeNPagedLookasideList(
+    _Out_ PNPAGED_LOOKASIDE_LIST Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION Allocate,
+    _In_opt_ PFREE_FUNCTION Free,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth)
+{
+    _usersim_initialize_legacy_lookaside_list(&Lookaside->L, Allocate, Free, NonPagedPoolNx, Flags, Size, Tag, Depth);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExDeleteNPagedLookasideList(_Inout_ PNPAGED_LOOKASIDE_LIST Lookaside)
+{
+    ExDeleteLookasideListEx(&Lookaside->L);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) _Ret_maybenull_ void* ExAllocateFromNPagedLookasideList(
+    _Inout_ PNPAGED_LOOKASIDE_LIST Lookaside)
+{
+    return ExAllocateFromLookasideListEx(&Lookaside->L);
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) void ExFreeToNPagedLookasideList(
+    _Inout_ PNPAGED_LOOKASIDE_LIST Lookaside, _In_ __drv_freesMem(Entry) void* Entry)
+{
+    ExFreeToLookasideListEx(&Lookaside->L, Entry);
+}
+
+_IRQL_requires_max_(APC_LEVEL) void ExInitializePagedLookasideList(
+    _Out_ PPAGED_LOOKASIDE_LIST Lookaside,
+    _In_opt_ PALLOCATE_FUNCTION Allocate,
+    _In_opt_ PFREE_FUNCTION Free,
+    _In_ ULONG Flags,
+    _In_ SIZE_T Size,
+    _In_ ULONG Tag,
+    _In_ USHORT Depth)
+{
+    _usersim_initialize_legacy_lookaside_list(&Lookaside->L, Allocate, Free, PagedPool, Flags, Size, Tag, Depth);
+}
+
+_IRQL_requires_max_(APC_LEVEL) void ExDeletePagedLookasideList(_Inout_ PPAGED_LOOKASIDE_LIST Lookaside)
+{
+    ExDeleteLookasideListEx(&Lookaside->L);
+}
+
+_IRQL_requires_max_(APC_LEVEL) _Ret_maybenull_ void* ExAllocateFromPagedLookasideList(
+    _Inout_ PPAGED_LOOKASIDE_LIST Lookaside)
+{
+    return ExAllocateFromLookasideListEx(&Lookaside->L);
+}
+
+_IRQL_requires_max_(APC_LEVEL) void ExFreeToPagedLookasideList(
+    _Inout_ PPAGED_LOOKASIDE_LIST Lookaside, _In_ __drv_freesMem(Entry) void* Entry)
+{
+    ExFreeToLookasideListEx(&Lookaside->L, Entry);
+}
+
+void
+usersim_query_lookaside_list_statistics(
+    _In_ const LOOKASIDE_LIST_EX* lookaside, _Out_ usersim_lookaside_statistics_t* statistics)
+{
+    memset(statistics, 0, sizeof(*statistics));
+    for (ULONG i = 0; i < lookaside->magazine_count; i++) {
+        const usersim_lookaside_magazine_t* magazine = &lookaside->magazines[i];
+        statistics->total_allocates += magazine->total_allocates;
+        statistics->allocate_hits += magazine->allocate_hits;
+        statistics->total_frees += magazine->total_frees;
+        statistics->free_hits += magazine->free_hits;
+    }
+}
+
+#pragma endregion lookaside_lists
+
 void
 ExInitializePushLock(_Out_ EX_PUSH_LOCK* push_lock)
 {
@@ -38,6 +38,15 @@ _is_connection_redirected(
     return true;
 }
 
+// Initialize FWPS_CONNECT_REQUEST0 with the destination the connect redirect callout may rewrite.
+void static _initialize_connection_request(
+    _Out_ FWPS_CONNECT_REQUEST0* request, ADDRESS_FAMILY family, _In_ const fwp_classify_parameters_t* parameters)
+{
+    *request = {};
+    request->remoteAddressAndPort.ss_family = family;
+    INETADDR_SET_PORT((PSOCKADDR)&request->remoteAddressAndPort, parameters->destination_port);
+}
+
 // Allocate and initialize FWPS_CONNECT_REQUEST0.
 void static _allocate_and_initialize_connection_request(
     ADDRESS_FAMILY family, _In_ const fwp_classify_parameters_t* parameters)
@@ -50,8 +59,7 @@ void static _allocate_and_initialize_connection_request(
         return;
     }
 
-    _fwp_um_connect_request->remoteAddressAndPort.ss_family = family;
-    INETADDR_SET_PORT((PSOCKADDR)&_fwp_um_connect_request->remoteAddressAndPort, parameters->destination_port);
+    _initialize_connection_request(_fwp_um_connect_request, family, parameters);
     return;
 }
 
@@ -65,74 +73,709 @@ void static _free_connection_request()
 
 std::unique_ptr<fwp_engine_t> fwp_engine_t::_engine;
 
-// Attempt to classify a test packet at a given WFP layer on a given interface index.
-// This is used to test the xdp hook.
-FWP_ACTION_TYPE
-fwp_engine_t::classify_test_packet(_In_ const GUID* layer_guid, NET_IFINDEX if_index)
+#define USERSIM_CACHE_LINE_SIZE 64
+#define FWP_FLOW_ID_BLOCK_SIZE 64
+
+/***
+ * Classify reads the published snapshot under epoch-based reclamation instead of a lock or a reference count, so a
+ * classify makes no atomic writes to memory that other threads use:
+ *
+ * 1. Each thread that classifies owns a reader record on its own cache line. Entering its outermost classify, the
+ *    thread copies the global epoch into the record; leaving, it stores 0.
+ * 2. A writer publishes a new snapshot and then advances the global epoch. The replaced snapshot is retired with
+ *    the new epoch and freed once no record holds an older nonzero epoch, as every classify that could have loaded
+ *    it has finished by then.
+ * 3. FwpsCalloutUnregister waits for the same condition before returning, since its caller may unload the callout.
+ *
+ * Records are never freed, so writers can scan them without synchronizing with thread exit. The record of a thread
+ * that exits is reused by the next thread to classify.
+ */
+typedef struct alignas(USERSIM_CACHE_LINE_SIZE) _fwp_epoch_reader
+{
+    std::atomic<uint64_t> epoch = 0; ///< Epoch the owner entered classify in, or 0 if it is not classifying.
+    bool in_use = false;             ///< Protected by _fwp_epoch_readers_lock.
+
+    // The remaining fields are only used by the owning thread.
+    uint32_t depth = 0; ///< Classify nesting depth.
+    uint64_t next_flow_id = 0;
+    uint64_t flow_id_limit = 0;
+    std::unique_ptr<fwp_packet_shell_t> packet_shell; ///< Null while the owner is using it.
+} fwp_epoch_reader_t;
+
+static std::atomic<uint64_t> _fwp_global_epoch = 1;
+static std::atomic<uint64_t> _fwp_next_flow_id = 1;
+static std::mutex _fwp_epoch_readers_lock;
+static std::vector<std::unique_ptr<fwp_epoch_reader_t>> _fwp_epoch_readers;
+
+// Releases the current thread's reader record when the thread exits.
+typedef struct _fwp_epoch_reader_owner
+{
+    fwp_epoch_reader_t* reader = nullptr;
+
+    ~_fwp_epoch_reader_owner()
+    {
+        if (reader != nullptr) {
+            reader->packet_shell.reset();
+            std::unique_lock l(_fwp_epoch_readers_lock);
+            reader->in_use = false;
+        }
+    }
+} fwp_epoch_reader_owner_t;
+
+thread_local static fwp_epoch_reader_owner_t _fwp_epoch_reader_owner;
+
+static fwp_epoch_reader_t*
+_fwp_get_epoch_reader()
 {
-    shared_lock_t l(lock);
-    const GUID* callout_key = get_callout_key_from_layer_guid_under_lock(layer_guid);
-    if (callout_key == nullptr) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+    if (_fwp_epoch_reader_owner.reader != nullptr) {
+        return _fwp_epoch_reader_owner.reader;
     }
-    const FWPS_CALLOUT3* callout = get_callout_from_key_under_lock(callout_key);
-    if (callout == nullptr) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+
+    std::unique_lock l(_fwp_epoch_readers_lock);
+    fwp_epoch_reader_t* reader = nullptr;
+    for (std::unique_ptr<fwp_epoch_reader_t>& record : _fwp_epoch_readers) {
+        if (!record->in_use) {
+            reader = record.get();
+            break;
+        }
     }
-    FWPS_CLASSIFY_OUT0 result = {};
-    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_MAX] = {};
-    FWPS_INCOMING_VALUES incoming_fixed_values = {.incomingValue = incoming_value};
-    incoming_fixed_values.incomingValue[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_INTERFACE_INDEX].value.uint32 = if_index;
-    FWPS_INCOMING_METADATA_VALUES incoming_metadata_values = {};
-    const FWPM_FILTER* fwpm_filter = get_fwpm_filter_with_context_under_lock(*layer_guid);
-    if (!fwpm_filter) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+    if (reader == nullptr) {
+        _fwp_epoch_readers.push_back(std::make_unique<fwp_epoch_reader_t>());
+        reader = _fwp_epoch_readers.back().get();
     }
-    FWPS_FILTER fwps_filter = {.context = fwpm_filter->rawContext};
-    NET_BUFFER_LIST_POOL_PARAMETERS pool_parameters = {};
-    std::unique_ptr<void, decltype(&NdisFreeNetBufferListPool)> nbl_pool_handle(
-        NdisAllocateNetBufferListPool(nullptr, &pool_parameters), NdisFreeNetBufferListPool);
-    if (!nbl_pool_handle) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+    reader->in_use = true;
+    _fwp_epoch_reader_owner.reader = reader;
+    return reader;
+}
+
+// Get the oldest epoch a classify is running in, ignoring the given record, or UINT64_MAX if none is running.
+static uint64_t
+_fwp_get_oldest_reader_epoch(_In_opt_ const fwp_epoch_reader_t* ignore)
+{
+    // Order the caller's publish before reading the records; this pairs with the fence in fwp_epoch_guard_t.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = UINT64_MAX;
+    std::unique_lock l(_fwp_epoch_readers_lock);
+    for (std::unique_ptr<fwp_epoch_reader_t>& record : _fwp_epoch_readers) {
+        uint64_t epoch = record->epoch.load(std::memory_order_acquire);
+        if (record.get() != ignore && epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
     }
+    return oldest;
+}
 
-    std::unique_ptr<NET_BUFFER_LIST, decltype(&NdisFreeNetBufferList)> nbl(
-        NdisAllocateNetBufferList(nbl_pool_handle.get(), 0, 0), NdisFreeNetBufferList);
-    if (!nbl) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+// Keeps the current thread in an epoch, so that a snapshot it loads stays allocated until the guard is destroyed.
+class fwp_epoch_guard_t
+{
+  public:
+    fwp_epoch_guard_t() : reader(_fwp_get_epoch_reader())
+    {
+        if (reader->depth++ == 0) {
+            reader->epoch.store(_fwp_global_epoch.load(), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
     }
 
-    unsigned long data = 0;
-    std::unique_ptr<MDL, decltype(&IoFreeMdl)> mdl_chain(
-        IoAllocateMdl(&data, sizeof(data), FALSE, FALSE, nullptr), IoFreeMdl);
-    if (!mdl_chain) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+    ~fwp_epoch_guard_t()
+    {
+        if (--reader->depth == 0) {
+            reader->epoch.store(0, std::memory_order_release);
+        }
     }
 
-    std::unique_ptr<NET_BUFFER, decltype(&NdisFreeNetBuffer)> nb(
-        NdisAllocateNetBuffer(nbl_pool_handle.get(), mdl_chain.get(), 0, sizeof(data)), NdisFreeNetBuffer);
-    if (!nb) {
-        return FWP_ACTION_CALLOUT_UNKNOWN;
+    fwp_epoch_guard_t(const fwp_epoch_guard_t&) = delete;
+    fwp_epoch_guard_t&
+    operator=(const fwp_epoch_guard_t&) = delete;
+
+    fwp_epoch_reader_t* const reader;
+};
+
+// Take the next flow handle from the thread's block, so that classifies on different threads don't contend.
+static uint64_t
+_fwp_allocate_flow_id(_Inout_ fwp_epoch_reader_t* reader)
+{
+    if (reader->next_flow_id == reader->flow_id_limit) {
+        reader->next_flow_id = _fwp_next_flow_id.fetch_add(FWP_FLOW_ID_BLOCK_SIZE);
+        reader->flow_id_limit = reader->next_flow_id + FWP_FLOW_ID_BLOCK_SIZE;
     }
+    return reader->next_flow_id++;
+}
 
-    nbl->FirstNetBuffer = nb.get();
-    callout->classifyFn(
-        &incoming_fixed_values,
-        &incoming_metadata_values,
-        nbl.get(),
-        nullptr, // classifyContext,
-        &fwps_filter,
-        0, // flowContext,
-        &result);
+_Requires_lock_held_(this->lock) void fwp_engine_t::publish_snapshot_under_lock()
+{
+    auto snapshot = std::make_unique<const fwp_engine_snapshot_t>(fwp_engine_snapshot_t{fwpm_layer_chains});
+    published_snapshot.store(snapshot.get());
+    uint64_t epoch = _fwp_global_epoch.fetch_add(1) + 1;
+    retired_snapshots.push_back({epoch, std::move(current_snapshot)});
+    current_snapshot = std::move(snapshot);
+    reclaim_snapshots_under_lock();
+}
 
-    return result.actionType;
+_Requires_lock_held_(this->lock) void fwp_engine_t::reclaim_snapshots_under_lock()
+{
+    uint64_t oldest = _fwp_get_oldest_reader_epoch(nullptr);
+    std::erase_if(
+        retired_snapshots, [oldest](const fwp_retired_snapshot_t& retired) { return retired.epoch <= oldest; });
 }
 
-// This is used to test the bind hook.
-FWP_ACTION_TYPE
-fwp_engine_t::test_bind_ipv4(_In_ fwp_classify_parameters_t* parameters)
+// Wait until every classify that started before the last publish has finished, other than the caller's own.
+void
+fwp_engine_t::wait_for_readers()
+{
+    uint64_t epoch = _fwp_global_epoch.load();
+    while (_fwp_get_oldest_reader_epoch(_fwp_epoch_reader_owner.reader) < epoch) {
+        std::this_thread::yield();
+    }
+
+    exclusive_lock_t l(lock);
+    reclaim_snapshots_under_lock();
+}
+
+typedef struct _fwp_condition_field
+{
+    const GUID* layer;
+    const GUID* condition;
+    uint16_t field;
+    FWP_DATA_TYPE type;
+} fwp_condition_field_t;
+
+#define FWP_CONDITION_FIELD(layer, name, type) \
+    {&FWPM_LAYER_##layer, &FWPM_CONDITION_##name, FWPS_FIELD_##layer##_##name, type}
+#define FWP_LOCAL_CONDITION_FIELDS(layer, address_type)              \
+    FWP_CONDITION_FIELD(layer, IP_LOCAL_ADDRESS, address_type),      \
+        FWP_CONDITION_FIELD(layer, IP_LOCAL_PORT, FWP_UINT16),       \
+        FWP_CONDITION_FIELD(layer, COMPARTMENT_ID, FWP_UINT32)
+#define FWP_REMOTE_CONDITION_FIELDS(layer, address_type)             \
+    FWP_CONDITION_FIELD(layer, IP_REMOTE_ADDRESS, address_type),     \
+        FWP_CONDITION_FIELD(layer, IP_REMOTE_PORT, FWP_UINT16),      \
+        FWP_CONDITION_FIELD(layer, IP_PROTOCOL, FWP_UINT8)
+#define FWP_INTERFACE_CONDITION_FIELD(layer) FWP_CONDITION_FIELD(layer, IP_LOCAL_INTERFACE, FWP_UINT64)
+
+// Fields that filter conditions can test, which are the fields the test entry points below fill in.
+static const fwp_condition_field_t _fwp_condition_fields[] = {
+    FWP_LOCAL_CONDITION_FIELDS(ALE_RESOURCE_ASSIGNMENT_V4, FWP_UINT32),
+    FWP_CONDITION_FIELD(ALE_RESOURCE_ASSIGNMENT_V4, IP_PROTOCOL, FWP_UINT8),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_RESOURCE_ASSIGNMENT_V4),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_RESOURCE_ASSIGNMENT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_CONDITION_FIELD(ALE_RESOURCE_ASSIGNMENT_V6, IP_PROTOCOL, FWP_UINT8),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_RESOURCE_ASSIGNMENT_V6),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_RECV_ACCEPT_V4, FWP_UINT32),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_AUTH_RECV_ACCEPT_V4, FWP_UINT32),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_RECV_ACCEPT_V4),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_RECV_ACCEPT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_AUTH_RECV_ACCEPT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_RECV_ACCEPT_V6),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_CONNECT_REDIRECT_V4, FWP_UINT32),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_CONNECT_REDIRECT_V4, FWP_UINT32),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_CONNECT_REDIRECT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_CONNECT_REDIRECT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_CONNECT_V4, FWP_UINT32),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_AUTH_CONNECT_V4, FWP_UINT32),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_CONNECT_V4),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_CONNECT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_AUTH_CONNECT_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_CONNECT_V6),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_FLOW_ESTABLISHED_V4, FWP_UINT32),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_FLOW_ESTABLISHED_V4, FWP_UINT32),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_FLOW_ESTABLISHED_V4),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_FLOW_ESTABLISHED_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_REMOTE_CONDITION_FIELDS(ALE_FLOW_ESTABLISHED_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_FLOW_ESTABLISHED_V6),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_LISTEN_V4, FWP_UINT32),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_LISTEN_V4),
+    FWP_LOCAL_CONDITION_FIELDS(ALE_AUTH_LISTEN_V6, FWP_BYTE_ARRAY16_TYPE),
+    FWP_INTERFACE_CONDITION_FIELD(ALE_AUTH_LISTEN_V6),
+    FWP_CONDITION_FIELD(INBOUND_MAC_FRAME_NATIVE, INTERFACE_INDEX, FWP_UINT32),
+};
+
+template <typename value_t>
+static bool
+_fwp_get_integer(_In_ const value_t& value, _Out_ uint64_t* integer)
+{
+    *integer = 0;
+    switch (value.type) {
+    case FWP_UINT8:
+        *integer = value.uint8;
+        return true;
+    case FWP_UINT16:
+        *integer = value.uint16;
+        return true;
+    case FWP_UINT32:
+        *integer = value.uint32;
+        return true;
+    case FWP_UINT64:
+        if (value.uint64 == nullptr) {
+            return false;
+        }
+        *integer = *value.uint64;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Compile a filter condition. Conditions on fields that the simulated layers don't fill in are ignored, as
+ * the filter conditions were before they were evaluated at all.
+ *
+ * @param[in] layer Layer of the filter.
+ * @param[in] condition Condition to compile.
+ * @param[out] compiled The compiled condition.
+ * @param[out] known False if the condition is ignored.
+ * @retval STATUS_SUCCESS The condition was compiled or ignored.
+ * @retval STATUS_FWP_NULL_POINTER The condition value is missing.
+ * @retval STATUS_FWP_TYPE_MISMATCH The value or match type doesn't suit the field.
+ */
+static NTSTATUS
+_fwp_compile_filter_condition(
+    _In_ const GUID& layer,
+    _In_ const FWPM_FILTER_CONDITION0& condition,
+    _Out_ fwp_filter_condition_t* compiled,
+    _Out_ bool* known)
+{
+    *compiled = {};
+    *known = false;
+    const fwp_condition_field_t* field = std::find_if(
+        std::begin(_fwp_condition_fields), std::end(_fwp_condition_fields), [&](const fwp_condition_field_t& entry) {
+            return *entry.layer == layer && *entry.condition == condition.fieldKey;
+        });
+    if (field == std::end(_fwp_condition_fields)) {
+        return STATUS_SUCCESS;
+    }
+
+    compiled->field = field->field;
+    compiled->field_type = field->type;
+    compiled->match_type = condition.matchType;
+    const FWP_CONDITION_VALUE0& value = condition.conditionValue;
+    bool address_field = (field->type == FWP_BYTE_ARRAY16_TYPE);
+    bool equality_match = (condition.matchType == FWP_MATCH_EQUAL || condition.matchType == FWP_MATCH_NOT_EQUAL);
+    switch (value.type) {
+    case FWP_UINT8:
+    case FWP_UINT16:
+    case FWP_UINT32:
+    case FWP_UINT64:
+        if (address_field || condition.matchType == FWP_MATCH_RANGE || condition.matchType > FWP_MATCH_NOT_EQUAL ||
+            condition.matchType == FWP_MATCH_EQUAL_CASE_INSENSITIVE) {
+            return STATUS_FWP_TYPE_MISMATCH;
+        }
+        if (!_fwp_get_integer(value, &compiled->low)) {
+            return STATUS_FWP_NULL_POINTER;
+        }
+        compiled->value_type = FWP_UINT64;
+        break;
+    case FWP_RANGE_TYPE:
+        if (value.rangeValue == nullptr) {
+            return STATUS_FWP_NULL_POINTER;
+        }
+        if (address_field || condition.matchType != FWP_MATCH_RANGE ||
+            !_fwp_get_integer(value.rangeValue->valueLow, &compiled->low) ||
+            !_fwp_get_integer(value.rangeValue->valueHigh, &compiled->high)) {
+            return STATUS_FWP_TYPE_MISMATCH;
+        }
+        compiled->value_type = FWP_RANGE_TYPE;
+        break;
+    case FWP_V4_ADDR_MASK:
+        if (value.v4AddrMask == nullptr) {
+            return STATUS_FWP_NULL_POINTER;
+        }
+        if (field->type != FWP_UINT32 || !equality_match) {
+            return STATUS_FWP_TYPE_MISMATCH;
+        }
+        compiled->low = value.v4AddrMask->addr;
+        compiled->high = value.v4AddrMask->mask;
+        compiled->value_type = FWP_V4_ADDR_MASK;
+        break;
+    case FWP_BYTE_ARRAY16_TYPE:
+        if (value.byteArray16 == nullptr) {
+            return STATUS_FWP_NULL_POINTER;
+        }
+        if (!address_field || !equality_match) {
+            return STATUS_FWP_TYPE_MISMATCH;
+        }
+        memcpy(compiled->address, value.byteArray16->byteArray16, sizeof(compiled->address));
+        compiled->prefix_length = 128;
+        compiled->value_type = FWP_V6_ADDR_MASK;
+        break;
+    case FWP_V6_ADDR_MASK:
+        if (value.v6AddrMask == nullptr) {
+            return STATUS_FWP_NULL_POINTER;
+        }
+        if (!address_field || !equality_match || value.v6AddrMask->prefixLength > 128) {
+            return STATUS_FWP_TYPE_MISMATCH;
+        }
+        memcpy(compiled->address, value.v6AddrMask->addr, sizeof(compiled->address));
+        compiled->prefix_length = value.v6AddrMask->prefixLength;
+        compiled->value_type = FWP_V6_ADDR_MASK;
+        break;
+    default:
+        return STATUS_FWP_TYPE_MISMATCH;
+    }
+
+    *known = true;
+    return STATUS_SUCCESS;
+}
+
+static bool
+_fwp_condition_matches(_In_ const fwp_filter_condition_t& condition, _In_ const FWPS_INCOMING_VALUE0* incoming_value)
+{
+    const FWP_VALUE0& value = incoming_value[condition.field].value;
+    bool equal;
+    if (condition.value_type == FWP_V6_ADDR_MASK) {
+        static const uint8_t zero_address[16] = {};
+        const uint8_t* address = (value.byteArray16 != nullptr) ? value.byteArray16->byteArray16 : zero_address;
+        size_t whole_bytes = condition.prefix_length / 8;
+        uint8_t last_byte_mask = (uint8_t)(0xff00 >> (condition.prefix_length % 8));
+        equal = memcmp(address, condition.address, whole_bytes) == 0 &&
+                (last_byte_mask == 0 ||
+                 ((address[whole_bytes] ^ condition.address[whole_bytes]) & last_byte_mask) == 0);
+        return (condition.match_type == FWP_MATCH_EQUAL) == equal;
+    }
+
+    uint64_t integer = 0;
+    switch (condition.field_type) {
+    case FWP_UINT8:
+        integer = value.uint8;
+        break;
+    case FWP_UINT16:
+        integer = value.uint16;
+        break;
+    case FWP_UINT32:
+        integer = value.uint32;
+        break;
+    case FWP_UINT64:
+        integer = (value.uint64 != nullptr) ? *value.uint64 : 0;
+        break;
+    default:
+        return false;
+    }
+
+    switch (condition.value_type) {
+    case FWP_V4_ADDR_MASK:
+        equal = ((integer ^ condition.low) & condition.high) == 0;
+        return (condition.match_type == FWP_MATCH_EQUAL) == equal;
+    case FWP_RANGE_TYPE:
+        return condition.low <= integer && integer <= condition.high;
+    default:
+        break;
+    }
+
+    switch (condition.match_type) {
+    case FWP_MATCH_EQUAL:
+        return integer == condition.low;
+    case FWP_MATCH_NOT_EQUAL:
+        return integer != condition.low;
+    case FWP_MATCH_GREATER:
+        return integer > condition.low;
+    case FWP_MATCH_LESS:
+        return integer < condition.low;
+    case FWP_MATCH_GREATER_OR_EQUAL:
+        return integer >= condition.low;
+    case FWP_MATCH_LESS_OR_EQUAL:
+        return integer <= condition.low;
+    case FWP_MATCH_FLAGS_ALL_SET:
+        return (integer & condition.low) == condition.low;
+    case FWP_MATCH_FLAGS_ANY_SET:
+        return (integer & condition.low) != 0;
+    case FWP_MATCH_FLAGS_NONE_SET:
+        return (integer & condition.low) == 0;
+    default:
+        return false;
+    }
+}
+
+static bool
+_fwp_filter_matches(_In_ const fwp_compiled_filter_t& filter, _In_ const FWPS_INCOMING_VALUE0* incoming_value)
+{
+    // Conditions are sorted by field: every field must match one of its conditions.
+    const std::vector<fwp_filter_condition_t>& conditions = filter.conditions;
+    for (size_t i = 0; i < conditions.size();) {
+        uint16_t field = conditions[i].field;
+        bool field_matches = false;
+        for (; i < conditions.size() && conditions[i].field == field; i++) {
+            field_matches = field_matches || _fwp_condition_matches(conditions[i], incoming_value);
+        }
+        if (!field_matches) {
+            return false;
+        }
+    }
+    return true;
+}
+
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS fwp_engine_t::add_fwpm_filter(
+    _In_ const fwp_session_t* session, _In_ const FWPM_FILTER0* filter, _Out_ uint64_t* id)
+{
+    *id = 0;
+    auto compiled = std::make_shared<fwp_compiled_filter_t>();
+    compiled->weight = get_fwpm_filter_weight(filter);
+    compiled->sublayer = filter->subLayerKey;
+    compiled->action = filter->action.type;
+    compiled->callout_key = filter->action.calloutKey;
+    compiled->flags = filter->flags;
+    compiled->raw_context = filter->rawContext;
+    for (uint32_t i = 0; i < filter->numFilterConditions; i++) {
+        fwp_filter_condition_t condition;
+        bool known;
+        NTSTATUS status =
+            _fwp_compile_filter_condition(filter->layerKey, filter->filterCondition[i], &condition, &known);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+        if (known) {
+            compiled->conditions.push_back(condition);
+        }
+    }
+    std::stable_sort(
+        compiled->conditions.begin(),
+        compiled->conditions.end(),
+        [](const fwp_filter_condition_t& a, const fwp_filter_condition_t& b) { return a.field < b.field; });
+
+    FWPS_CALLOUT3* callout = nullptr;
+    FWPS_FILTER fwps_filter = {};
+    {
+        std::unique_lock<std::mutex> t = enter_change(session);
+        exclusive_lock_t l(lock);
+        compiled->id = *id = next_id++;
+
+        // The caller owns the conditions and the weight, so the copy kept here must not point to them.
+        FWPM_FILTER0 copy = *filter;
+        copy.weight = {};
+        copy.numFilterConditions = 0;
+        copy.filterCondition = nullptr;
+        copy.filterId = *id;
+        fwpm_filters.insert({*id, copy});
+        index_fwpm_filter_under_lock(filter->layerKey, std::move(compiled));
+        update_layer_chain_under_lock(filter->layerKey);
+
+        fwps_filter.context = filter->rawContext;
+        fwps_filter.filterId = *id;
+        if (filter->action.type & FWP_ACTION_FLAG_CALLOUT) {
+            if (transaction) {
+                transaction->notifications.push_back(
+                    {FWPS_CALLOUT_NOTIFY_ADD_FILTER, filter->action.calloutKey, fwps_filter});
+            } else {
+                callout = get_fwps_callout(&filter->action.calloutKey);
+            }
+        }
+    }
+
+    if (callout != nullptr) {
+        // Invoke filter add notification callback.
+        callout->notifyFn(FWPS_CALLOUT_NOTIFY_ADD_FILTER, &filter->action.calloutKey, &fwps_filter);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+    fwp_engine_t::begin_transaction(_In_ const fwp_session_t* session)
+{
+    // Changes from other sessions wait on transaction_done until the transaction commits or aborts.
+    std::unique_lock<std::mutex> t(transaction_lock);
+    if (transaction && transaction_owner == session) {
+        return STATUS_FWP_TXN_IN_PROGRESS;
+    }
+    transaction_done.wait(t, [this]() { return !transaction; });
+    exclusive_lock_t l(lock);
+    transaction = std::make_unique<fwp_transaction_t>(fwp_transaction_t{
+        fwpm_callouts,
+        fwpm_filters,
+        fwpm_sub_layers,
+        fwpm_callout_ids_by_key,
+        fwpm_callout_ids_by_layer,
+        fwpm_sub_layer_ids_by_key,
+        fwpm_filters_by_layer});
+    transaction_owner = session;
+    return STATUS_SUCCESS;
+}
+
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+    fwp_engine_t::commit_transaction(_In_ const fwp_session_t* session)
+{
+    std::unique_lock<std::mutex> t(transaction_lock);
+    if (!transaction || transaction_owner != session) {
+        return STATUS_FWP_NO_TXN_IN_PROGRESS;
+    }
+
+    std::vector<fwp_filter_notification_t> notifications;
+    {
+        exclusive_lock_t l(lock);
+        std::unique_ptr<fwp_transaction_t> committed = std::move(transaction);
+        if (committed->all_layers_changed) {
+            build_layer_chains_under_lock();
+        } else {
+            for (const GUID& layer : committed->changed_layers) {
+                build_layer_chain_under_lock(layer);
+            }
+        }
+        publish_snapshot_under_lock();
+        notifications = std::move(committed->notifications);
+        transaction_owner = nullptr;
+    }
+    t.unlock();
+    transaction_done.notify_all();
+
+    // Notify the callouts of the filters the transaction added and deleted, as long as they are still registered.
+    for (fwp_filter_notification_t& notification : notifications) {
+        FWPS_CALLOUT3 callout = {};
+        {
+            shared_lock_t l(lock);
+            FWPS_CALLOUT3* registered = get_fwps_callout(&notification.callout_key);
+            if (registered == nullptr) {
+                continue;
+            }
+            callout = *registered;
+        }
+        callout.notifyFn(notification.type, &notification.callout_key, &notification.filter);
+    }
+    return STATUS_SUCCESS;
+}
+
+_Requires_lock_held_(this->lock) void fwp_engine_t::abort_transaction_under_lock()
+{
+    std::unique_ptr<fwp_transaction_t> aborted = std::move(transaction);
+    fwpm_callouts = std::move(aborted->fwpm_callouts);
+    fwpm_filters = std::move(aborted->fwpm_filters);
+    fwpm_sub_layers = std::move(aborted->fwpm_sub_layers);
+    fwpm_callout_ids_by_key = std::move(aborted->fwpm_callout_ids_by_key);
+    fwpm_callout_ids_by_layer = std::move(aborted->fwpm_callout_ids_by_layer);
+    fwpm_sub_layer_ids_by_key = std::move(aborted->fwpm_sub_layer_ids_by_key);
+    fwpm_filters_by_layer = std::move(aborted->fwpm_filters_by_layer);
+
+    // The transaction may have changed any layer, so rebuild every chain.
+    build_layer_chains_under_lock();
+    publish_snapshot_under_lock();
+    transaction_owner = nullptr;
+}
+
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+    fwp_engine_t::abort_transaction(_In_ const fwp_session_t* session)
+{
+    std::unique_lock<std::mutex> t(transaction_lock);
+    if (!transaction || transaction_owner != session) {
+        return STATUS_FWP_NO_TXN_IN_PROGRESS;
+    }
+
+    {
+        exclusive_lock_t l(lock);
+        abort_transaction_under_lock();
+    }
+    t.unlock();
+    transaction_done.notify_all();
+    return STATUS_SUCCESS;
+}
+
+_Must_inspect_result_ NTSTATUS
+fwp_engine_t::open_session(_Outptr_ fwp_session_t** session)
+{
+    fwp_session_t* new_session = new (std::nothrow) fwp_session_t{this};
+    if (new_session == nullptr) {
+        return STATUS_NO_MEMORY;
+    }
+
+    std::unique_lock<std::mutex> t(transaction_lock);
+    try {
+        sessions.insert(new_session);
+    } catch (const std::bad_alloc&) {
+        delete new_session;
+        return STATUS_NO_MEMORY;
+    }
+    *session = new_session;
+    return STATUS_SUCCESS;
+}
+
+// Closing a session aborts a transaction left open on it, since otherwise every later change from another session
+// would wait for it forever. A transaction begun by another session is left alone.
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+    fwp_engine_t::close_session(_In_ fwp_session_t* session)
+{
+    std::unique_lock<std::mutex> t(transaction_lock);
+    if (sessions.erase(session) == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    bool aborted = false;
+    if (transaction && transaction_owner == session) {
+        exclusive_lock_t l(lock);
+        abort_transaction_under_lock();
+        aborted = true;
+    }
+    t.unlock();
+    delete session;
+    if (aborted) {
+        transaction_done.notify_all();
+    }
+    return STATUS_SUCCESS;
+}
+
+_Requires_lock_held_(this->lock) void fwp_engine_t::build_layer_chain_under_lock(_In_ const GUID& layer)
+{
+    auto filters = fwpm_filters_by_layer.find(layer);
+    if (filters == fwpm_filters_by_layer.end()) {
+        fwpm_layer_chains.erase(layer);
+        return;
+    }
+
+    // The filters of the layer are sorted by weight, so each sublayer's filters are too.
+    auto chain = std::make_shared<fwp_layer_chain_t>();
+    for (const std::shared_ptr<const fwp_compiled_filter_t>& filter : filters->second) {
+        auto sublayer = std::find_if(
+            chain->sublayers.begin(), chain->sublayers.end(), [&](const fwp_sublayer_chain_t& sublayer) {
+                return sublayer.sublayer == filter->sublayer;
+            });
+        if (sublayer == chain->sublayers.end()) {
+            auto sublayer_id = fwpm_sub_layer_ids_by_key.find(filter->sublayer);
+            uint16_t weight =
+                (sublayer_id == fwpm_sub_layer_ids_by_key.end()) ? 0 : fwpm_sub_layers.at(sublayer_id->second).weight;
+            sublayer = chain->sublayers.insert(chain->sublayers.end(), {filter->sublayer, weight, {}});
+        }
+
+        fwp_chain_filter_t entry = {filter, 0, {}};
+        bind_callout_under_lock(entry);
+        sublayer->filters.push_back(std::move(entry));
+    }
+    std::stable_sort(
+        chain->sublayers.begin(),
+        chain->sublayers.end(),
+        [](const fwp_sublayer_chain_t& a, const fwp_sublayer_chain_t& b) { return a.weight > b.weight; });
+    fwpm_layer_chains[layer] = std::move(chain);
+}
+
+_Requires_lock_held_(this->lock) void fwp_engine_t::bind_callout_under_lock(_Inout_ fwp_chain_filter_t& entry)
+{
+    if (!(entry.filter->action & FWP_ACTION_FLAG_CALLOUT)) {
+        return;
+    }
+    auto callout_id = fwps_callout_ids_by_key.find(entry.filter->callout_key);
+    if (callout_id == fwps_callout_ids_by_key.end()) {
+        entry.callout_id = 0;
+        entry.callout = {};
+    } else {
+        entry.callout_id = (uint32_t)callout_id->second;
+        entry.callout = fwps_callouts.at(callout_id->second);
+    }
+}
+
+_Requires_lock_held_(this->lock) void fwp_engine_t::update_callouts_under_lock()
+{
+    for (auto& [layer, chain] : fwpm_layer_chains) {
+        auto updated = std::make_shared<fwp_layer_chain_t>(*chain);
+        for (fwp_sublayer_chain_t& sublayer : updated->sublayers) {
+            for (fwp_chain_filter_t& entry : sublayer.filters) {
+                bind_callout_under_lock(entry);
+            }
+        }
+        chain = std::move(updated);
+    }
+    publish_snapshot_under_lock();
+}
+
+// Fill in the incoming values of the bind hook.
+static void
+_fwp_initialize_bind_v4_values(
+    _In_ fwp_classify_parameters_t* parameters,
+    _Inout_updates_(FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_MAX) FWPS_INCOMING_VALUE0* incoming_value)
 {
-    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_MAX] = {};
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_IP_LOCAL_PORT].value.uint16 = parameters->destination_port;
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_IP_LOCAL_ADDRESS].value.uint32 =
         parameters->destination_ipv4_address;
@@ -142,20 +785,14 @@ fwp_engine_t::test_bind_ipv4(_In_ fwp_classify_parameters_t* parameters)
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_IP_LOCAL_INTERFACE].value.uint64 =
         const_cast<UINT64*>(&parameters->interface_luid);
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_ALE_USER_ID].value.byteBlob = &parameters->user_id;
-
-    return test_callout(
-        FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V4,
-        FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4,
-        _default_sublayer,
-        incoming_value,
-        nullptr);
 }
 
-// This is used to test the IPv6 bind hook.
-FWP_ACTION_TYPE
-fwp_engine_t::test_bind_ipv6(_In_ fwp_classify_parameters_t* parameters)
+// Fill in the incoming values of the IPv6 bind hook.
+static void
+_fwp_initialize_bind_v6_values(
+    _In_ fwp_classify_parameters_t* parameters,
+    _Inout_updates_(FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_MAX) FWPS_INCOMING_VALUE0* incoming_value)
 {
-    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_MAX] = {};
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_IP_LOCAL_PORT].value.uint16 = parameters->destination_port;
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_IP_LOCAL_ADDRESS].value.byteArray16 =
         &parameters->destination_ipv6_address;
@@ -165,62 +802,359 @@ fwp_engine_t::test_bind_ipv6(_In_ fwp_classify_parameters_t* parameters)
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_IP_LOCAL_INTERFACE].value.uint64 =
         const_cast<UINT64*>(&parameters->interface_luid);
     incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_ALE_USER_ID].value.byteBlob = &parameters->user_id;
+}
 
-    return test_callout(
-        FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V6,
-        FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V6,
-        _default_sublayer,
-        incoming_value,
-        nullptr);
+// Fill in the incoming values of the INET4_CONNECT redirect hook.
+static void
+_fwp_initialize_connect_redirect_v4_values(
+    _In_ fwp_classify_parameters_t* parameters,
+    _Inout_updates_(FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_MAX) FWPS_INCOMING_VALUE0* incoming_value)
+{
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_LOCAL_ADDRESS].value.uint32 = parameters->source_ipv4_address;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_LOCAL_PORT].value.uint16 = parameters->source_port;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_REMOTE_ADDRESS].value.uint32 =
+        parameters->destination_ipv4_address;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_REMOTE_PORT].value.uint16 = parameters->destination_port;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_PROTOCOL].value.uint8 = parameters->protocol;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_COMPARTMENT_ID].value.uint32 = parameters->compartment_id;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_ALE_APP_ID].value.byteBlob = &parameters->app_id;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_ALE_USER_ID].value.byteBlob = &parameters->user_id;
 }
 
-_Requires_lock_not_held_(this->lock) FWP_ACTION_TYPE fwp_engine_t::test_callout(
-    uint16_t layer_id,
-    _In_ const GUID& layer_guid,
-    _In_ const GUID& sublayer_guid,
-    _In_ FWPS_INCOMING_VALUE0* incoming_value,
-    _Out_opt_ uint64_t* flow_id)
+// Fill in the incoming values of the INET6_CONNECT redirect hook.
+static void
+_fwp_initialize_connect_redirect_v6_values(
+    _In_ fwp_classify_parameters_t* parameters,
+    _Inout_updates_(FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_MAX) FWPS_INCOMING_VALUE0* incoming_value)
 {
-    FWPS_INCOMING_VALUES incoming_fixed_values = {.layerId = layer_id, .incomingValue = incoming_value};
-    FWPS_INCOMING_METADATA_VALUES incoming_metadata_values = {};
-    FWPS_FILTER fwps_filter = {};
-    const FWPS_CALLOUT3* callout = nullptr;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_LOCAL_ADDRESS].value.byteArray16 =
+        &parameters->source_ipv6_address;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_LOCAL_PORT].value.uint16 = parameters->source_port;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_REMOTE_ADDRESS].value.byteArray16 =
+        &parameters->destination_ipv6_address;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_REMOTE_PORT].value.uint16 = parameters->destination_port;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_PROTOCOL].value.uint8 = parameters->protocol;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_COMPARTMENT_ID].value.uint32 = parameters->compartment_id;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_ALE_APP_ID].value.byteBlob = &parameters->app_id;
+    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_ALE_USER_ID].value.byteBlob = &parameters->user_id;
+}
 
-    {
-        shared_lock_t l(lock);
-        const FWPM_FILTER* fwpm_filter = get_fwpm_filter_with_context_under_lock(layer_guid, sublayer_guid);
-        if (!fwpm_filter) {
-            return FWP_ACTION_CALLOUT_UNKNOWN;
+// Reset a packet shell to describe an empty test packet, undoing whatever the last callout did to it.
+static void
+_fwp_reset_packet_shell(_Inout_ fwp_packet_shell_t* shell)
+{
+    shell->data = 0;
+    MmInitializeMdl(shell->mdl.get(), &shell->data, sizeof(shell->data));
+    shell->nb->MdlChain = shell->mdl.get();
+    shell->nb->DataLength = sizeof(shell->data);
+    shell->nb->DataOffset = 0;
+    shell->nbl->FirstNetBuffer = shell->nb.get();
+}
+
+// Take the thread's cached packet shell, or allocate one if a classify further up the stack is using it.
+_Must_inspect_result_ static std::unique_ptr<fwp_packet_shell_t>
+_fwp_acquire_packet_shell(_Inout_ fwp_epoch_reader_t* reader)
+{
+    if (reader->packet_shell) {
+        return std::move(reader->packet_shell);
+    }
+
+    auto shell = std::make_unique<fwp_packet_shell_t>();
+    NET_BUFFER_LIST_POOL_PARAMETERS pool_parameters = {};
+    shell->nbl_pool.reset(NdisAllocateNetBufferListPool(nullptr, &pool_parameters));
+    if (!shell->nbl_pool) {
+        return nullptr;
+    }
+    shell->nbl.reset(NdisAllocateNetBufferList(shell->nbl_pool.get(), 0, 0));
+    if (!shell->nbl) {
+        return nullptr;
+    }
+    shell->mdl.reset(IoAllocateMdl(&shell->data, sizeof(shell->data), FALSE, FALSE, nullptr));
+    if (!shell->mdl) {
+        return nullptr;
+    }
+    shell->nb.reset(NdisAllocateNetBuffer(shell->nbl_pool.get(), shell->mdl.get(), 0, sizeof(shell->data)));
+    if (!shell->nb) {
+        return nullptr;
+    }
+    return shell;
+}
+
+static void
+_fwp_release_packet_shell(_Inout_ fwp_epoch_reader_t* reader, _In_ std::unique_ptr<fwp_packet_shell_t> shell)
+{
+    if (!reader->packet_shell) {
+        reader->packet_shell = std::move(shell);
+    }
+}
+
+// Attempt to classify a test packet at a given WFP layer on a given interface index.
+// This is used to test the xdp hook.
+FWP_ACTION_TYPE
+fwp_engine_t::classify_test_packet(_In_ const GUID* layer_guid, NET_IFINDEX if_index)
+{
+    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_MAX] = {};
+    incoming_value[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_INTERFACE_INDEX].value.uint32 = if_index;
+    fwp_epoch_guard_t guard;
+    std::unique_ptr<fwp_packet_shell_t> shell = _fwp_acquire_packet_shell(guard.reader);
+    if (!shell) {
+        return FWP_ACTION_CALLOUT_UNKNOWN;
+    }
+
+    _fwp_reset_packet_shell(shell.get());
+    FWP_ACTION_TYPE action = classify(0, *layer_guid, incoming_value, shell->nbl.get(), nullptr);
+    _fwp_release_packet_shell(guard.reader, std::move(shell));
+    return action;
+}
+
+typedef enum _fwp_batch_layer
+{
+    FWP_BATCH_LAYER_MAC_FRAME,
+    FWP_BATCH_LAYER_BIND_V4,
+    FWP_BATCH_LAYER_BIND_V6,
+    FWP_BATCH_LAYER_CONNECT_REDIRECT_V4,
+    FWP_BATCH_LAYER_CONNECT_REDIRECT_V6,
+    FWP_BATCH_LAYER_COUNT,
+} fwp_batch_layer_t;
+
+typedef struct _fwp_batch_layer_info
+{
+    const GUID* layer_guid;
+    uint16_t layer_id;
+} fwp_batch_layer_info_t;
+
+// Layers usersim_fwp_classify_packets supports, indexed by fwp_batch_layer_t.
+static const fwp_batch_layer_info_t _fwp_batch_layers[FWP_BATCH_LAYER_COUNT] = {
+    {&FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, 0},
+    {&FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4, FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V4},
+    {&FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V6, FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V6},
+    {&FWPM_LAYER_ALE_CONNECT_REDIRECT_V4, FWPS_LAYER_ALE_CONNECT_REDIRECT_V4},
+    {&FWPM_LAYER_ALE_CONNECT_REDIRECT_V6, FWPS_LAYER_ALE_CONNECT_REDIRECT_V6},
+};
+
+// Number of incoming values needed by the largest of the layers above.
+static constexpr size_t _fwp_batch_max_fields = std::max(
+    {(size_t)FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_MAX,
+     (size_t)FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_MAX,
+     (size_t)FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_MAX,
+     (size_t)FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_MAX,
+     (size_t)FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_MAX});
+
+static bool
+_fwp_get_batch_layer(_In_ const fwp_classify_packet_t& packet, _Out_ fwp_batch_layer_t* layer)
+{
+    for (int i = 0; i < FWP_BATCH_LAYER_COUNT; i++) {
+        if (packet.layer_guid != nullptr && *packet.layer_guid == *_fwp_batch_layers[i].layer_guid) {
+            *layer = (fwp_batch_layer_t)i;
+            return (*layer == FWP_BATCH_LAYER_MAC_FRAME) || (packet.parameters != nullptr);
+        }
+    }
+    *layer = FWP_BATCH_LAYER_COUNT;
+    return false;
+}
+
+_Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+    fwp_engine_t::classify_test_packets(_Inout_updates_(count) fwp_classify_packet_t* packets, size_t count)
+{
+    fwp_batch_layer_t layer;
+    for (size_t i = 0; i < count; i++) {
+        if (!_fwp_get_batch_layer(packets[i], &layer)) {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    fwp_epoch_guard_t guard;
+    std::unique_ptr<fwp_packet_shell_t> shell = _fwp_acquire_packet_shell(guard.reader);
+    if (!shell) {
+        return STATUS_NO_MEMORY;
+    }
+
+    // Load the snapshot once for the whole batch, so every packet sees the same filters.
+    const fwp_engine_snapshot_t* snapshot = published_snapshot.load(std::memory_order_acquire);
+    const fwp_layer_chain_t* chains[FWP_BATCH_LAYER_COUNT] = {};
+    for (int i = 0; i < FWP_BATCH_LAYER_COUNT; i++) {
+        auto it = snapshot->layer_chains.find(*_fwp_batch_layers[i].layer_guid);
+        if (it != snapshot->layer_chains.end()) {
+            chains[i] = it->second.get();
         }
-        fwps_filter.context = fwpm_filter->rawContext;
-
-        // Look up the callout via the filter's calloutKey rather than scanning by layer.
-        // This matches real WFP behavior where each filter is bound to a specific callout
-        // and correctly handles multiple callouts registered at the same WFP layer.
-        callout = get_callout_from_key_under_lock(&fwpm_filter->action.calloutKey);
-        if (callout == nullptr) {
-            return FWP_ACTION_CALLOUT_UNKNOWN;
+    }
+
+    // The connect redirect callouts rewrite the connect request, which lives on the stack for the whole batch.
+    FWPS_CONNECT_REQUEST0 connect_request;
+    FWPS_CONNECT_REQUEST0* previous_connect_request = _fwp_um_connect_request;
+    _fwp_um_connect_request = &connect_request;
+
+    for (size_t i = 0; i < count; i++) {
+        fwp_classify_packet_t& packet = packets[i];
+        (void)_fwp_get_batch_layer(packet, &layer);
+        const fwp_layer_chain_t* chain = chains[layer];
+        if (chain == nullptr) {
+            packet.action = FWP_ACTION_CALLOUT_UNKNOWN;
+            continue;
         }
 
-        incoming_metadata_values.flowHandle = InterlockedIncrement(&next_flow_id);
+        FWPS_INCOMING_VALUE0 incoming_value[_fwp_batch_max_fields] = {};
+        void* layer_data = nullptr;
+        switch (layer) {
+        case FWP_BATCH_LAYER_MAC_FRAME:
+            incoming_value[FWPS_FIELD_INBOUND_MAC_FRAME_NATIVE_INTERFACE_INDEX].value.uint32 = packet.if_index;
+            _fwp_reset_packet_shell(shell.get());
+            layer_data = shell->nbl.get();
+            break;
+        case FWP_BATCH_LAYER_BIND_V4:
+            _fwp_initialize_bind_v4_values(packet.parameters, incoming_value);
+            break;
+        case FWP_BATCH_LAYER_BIND_V6:
+            _fwp_initialize_bind_v6_values(packet.parameters, incoming_value);
+            break;
+        case FWP_BATCH_LAYER_CONNECT_REDIRECT_V4:
+            _initialize_connection_request(&connect_request, AF_INET, packet.parameters);
+            _fwp_initialize_connect_redirect_v4_values(packet.parameters, incoming_value);
+            break;
+        case FWP_BATCH_LAYER_CONNECT_REDIRECT_V6:
+            _initialize_connection_request(&connect_request, AF_INET6, packet.parameters);
+            _fwp_initialize_connect_redirect_v6_values(packet.parameters, incoming_value);
+            break;
+        }
+        packet.action =
+            classify_chain(*chain, _fwp_batch_layers[layer].layer_id, incoming_value, layer_data, nullptr);
     }
 
+    _fwp_um_connect_request = previous_connect_request;
+    _fwp_release_packet_shell(guard.reader, std::move(shell));
+    return STATUS_SUCCESS;
+}
+
+// This is used to test the bind hook.
+FWP_ACTION_TYPE
+fwp_engine_t::test_bind_ipv4(_In_ fwp_classify_parameters_t* parameters)
+{
+    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V4_MAX] = {};
+    _fwp_initialize_bind_v4_values(parameters, incoming_value);
+
+    return classify(
+        FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V4, FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4, incoming_value, nullptr, nullptr);
+}
+
+// This is used to test the IPv6 bind hook.
+FWP_ACTION_TYPE
+fwp_engine_t::test_bind_ipv6(_In_ fwp_classify_parameters_t* parameters)
+{
+    FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_RESOURCE_ASSIGNMENT_V6_MAX] = {};
+    _fwp_initialize_bind_v6_values(parameters, incoming_value);
+
+    return classify(
+        FWPS_LAYER_ALE_RESOURCE_ASSIGNMENT_V6, FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V6, incoming_value, nullptr, nullptr);
+}
+
+/***
+ * The classify walk follows WFP filter arbitration:
+ *
+ * 1. Sublayers are evaluated in order of descending weight, and so are the filters within a sublayer. The first
+ *    matching filter in a sublayer whose action (or whose callout's action) is permit or block decides the
+ *    sublayer; a callout that returns anything else, or an inspection callout, lets the walk go on to the next
+ *    filter.
+ * 2. A decision is hard if FWPS_RIGHT_ACTION_WRITE was cleared, by the callout or by
+ *    FWPM_FILTER_FLAG_CLEAR_ACTION_RIGHT. Callouts in later sublayers then see the right cleared.
+ * 3. A later block overrides a permit, hard or not (a veto). A later permit overrides only a soft block.
+ * 4. A hard block is final and ends the walk, as does a callout that absorbs the packet.
+ *
+ * If no sublayer decides, the action the last callout returned is the result, or FWP_ACTION_CALLOUT_UNKNOWN if no
+ * callout was invoked.
+ */
+_Requires_lock_not_held_(this->lock) FWP_ACTION_TYPE fwp_engine_t::classify(
+    uint16_t layer_id,
+    _In_ const GUID& layer_guid,
+    _In_ FWPS_INCOMING_VALUE0* incoming_value,
+    _Inout_opt_ void* layer_data,
+    _Out_opt_ uint64_t* flow_id)
+{
+    fwp_epoch_guard_t guard;
+    const fwp_engine_snapshot_t* snapshot = published_snapshot.load(std::memory_order_acquire);
+    auto it = snapshot->layer_chains.find(layer_guid);
+    if (it == snapshot->layer_chains.end()) {
+        return FWP_ACTION_CALLOUT_UNKNOWN;
+    }
+
+    return classify_chain(*it->second, layer_id, incoming_value, layer_data, flow_id);
+}
+
+FWP_ACTION_TYPE
+fwp_engine_t::classify_chain(
+    _In_ const fwp_layer_chain_t& chain,
+    uint16_t layer_id,
+    _In_ FWPS_INCOMING_VALUE0* incoming_value,
+    _Inout_opt_ void* layer_data,
+    _Out_opt_ uint64_t* flow_id)
+{
+    FWPS_INCOMING_VALUES incoming_fixed_values = {.layerId = layer_id, .incomingValue = incoming_value};
+    FWPS_INCOMING_METADATA_VALUES incoming_metadata_values = {};
+    incoming_metadata_values.flowHandle = _fwp_allocate_flow_id(_fwp_get_epoch_reader());
     if (flow_id) {
         *flow_id = incoming_metadata_values.flowHandle;
     }
 
-    FWPS_CLASSIFY_OUT0 result = {};
-    result.rights = FWPS_RIGHT_ACTION_WRITE;
-    callout->classifyFn(
-        &incoming_fixed_values,
-        &incoming_metadata_values,
-        nullptr, // layer_data
-        nullptr, // classify_context,
-        &fwps_filter,
-        0, // flow_context,
-        &result);
+    FWP_ACTION_TYPE decision = FWP_ACTION_NONE;
+    bool hard = false;
+    FWP_ACTION_TYPE callout_action = FWP_ACTION_CALLOUT_UNKNOWN;
+    for (const fwp_sublayer_chain_t& sublayer : chain.sublayers) {
+        FWP_ACTION_TYPE sublayer_action = FWP_ACTION_NONE;
+        bool sublayer_hard = false;
+        for (const fwp_chain_filter_t& entry : sublayer.filters) {
+            const fwp_compiled_filter_t& filter = *entry.filter;
+            if (!_fwp_filter_matches(filter, incoming_value)) {
+                continue;
+            }
+            FWP_ACTION_TYPE action = filter.action;
+            bool clear_rights = (filter.flags & FWPM_FILTER_FLAG_CLEAR_ACTION_RIGHT) != 0;
+            if (action & FWP_ACTION_FLAG_CALLOUT) {
+                if (entry.callout.classifyFn == nullptr) {
+                    continue;
+                }
+                FWPS_FILTER fwps_filter = {
+                    .filterId = filter.id, .subLayerWeight = sublayer.weight, .context = filter.raw_context};
+                FWPS_CLASSIFY_OUT0 result = {};
+                result.rights = (hard) ? 0 : FWPS_RIGHT_ACTION_WRITE;
+                entry.callout.classifyFn(
+                    &incoming_fixed_values,
+                    &incoming_metadata_values,
+                    layer_data,
+                    nullptr, // classify_context
+                    &fwps_filter,
+                    0, // flow_context
+                    &result);
+                if (result.flags & FWPS_CLASSIFY_OUT_FLAG_ABSORB) {
+                    return FWP_ACTION_BLOCK;
+                }
+                if (action == FWP_ACTION_CALLOUT_INSPECTION) {
+                    continue;
+                }
+                action = callout_action = result.actionType;
+                clear_rights = clear_rights || !(result.rights & FWPS_RIGHT_ACTION_WRITE);
+            }
+            if (action == FWP_ACTION_PERMIT || action == FWP_ACTION_BLOCK) {
+                sublayer_action = action;
+                sublayer_hard = clear_rights;
+                break;
+            }
+        }
 
-    return result.actionType;
+        if (sublayer_action == FWP_ACTION_NONE) {
+            continue;
+        }
+        if (decision == FWP_ACTION_NONE || (decision == FWP_ACTION_PERMIT && sublayer_action == FWP_ACTION_BLOCK) ||
+            (decision == FWP_ACTION_BLOCK && !hard && sublayer_action == FWP_ACTION_PERMIT)) {
+            decision = sublayer_action;
+            hard = sublayer_hard;
+        } else if (decision == sublayer_action) {
+            hard = hard || sublayer_hard;
+        }
+        if (decision == FWP_ACTION_BLOCK && hard) {
+            break;
+        }
+    }
+
+    return (decision != FWP_ACTION_NONE) ? decision : callout_action;
 }
 
 void fwp_engine_t::test_sock_ops_v4_remove_flow_context(_In_ uint64_t flow_id)
@@ -276,8 +1210,8 @@ fwp_engine_t::test_cgroup_inet4_recv_accept(_In_ fwp_classify_parameters_t* para
         const_cast<FWP_BYTE_BLOB*>(&parameters->user_id);
     incoming_value[FWPS_FIELD_ALE_AUTH_CONNECT_V4_FLAGS].value.uint32 = parameters->reauthorization_flag;
 
-    return test_callout(
-        FWPS_LAYER_ALE_AUTH_RECV_ACCEPT_V4, FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4, _default_sublayer, incoming_value, nullptr);
+    return classify(
+        FWPS_LAYER_ALE_AUTH_RECV_ACCEPT_V4, FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V4, incoming_value, nullptr, nullptr);
 }
 
 // This is used to test the INET6_RECV_ACCEPT hook.
@@ -298,8 +1232,8 @@ fwp_engine_t::test_cgroup_inet6_recv_accept(_In_ fwp_classify_parameters_t* para
     incoming_value[FWPS_FIELD_ALE_AUTH_RECV_ACCEPT_V6_ALE_USER_ID].value.byteBlob = &parameters->user_id;
     incoming_value[FWPS_FIELD_ALE_AUTH_CONNECT_V6_FLAGS].value.uint32 = parameters->reauthorization_flag;
 
-    return test_callout(
-        FWPS_LAYER_ALE_AUTH_RECV_ACCEPT_V6, FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V6, _default_sublayer, incoming_value, nullptr);
+    return classify(
+        FWPS_LAYER_ALE_AUTH_RECV_ACCEPT_V6, FWPM_LAYER_ALE_AUTH_RECV_ACCEPT_V6, incoming_value, nullptr, nullptr);
 }
 
 // This is used to test the INET4_CONNECT hook.
@@ -317,18 +1251,10 @@ fwp_engine_t::test_cgroup_inet4_connect(_In_ fwp_classify_parameters_t* paramete
     // For CGROUP_CONNECT* attach type, first CONNECT_REDIRECT callout is invoked, followed by
     // AUTH_CONNECT.
     FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_MAX] = {};
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_LOCAL_ADDRESS].value.uint32 = parameters->source_ipv4_address;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_LOCAL_PORT].value.uint16 = parameters->source_port;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_REMOTE_ADDRESS].value.uint32 =
-        parameters->destination_ipv4_address;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_REMOTE_PORT].value.uint16 = parameters->destination_port;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_IP_PROTOCOL].value.uint8 = parameters->protocol;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_COMPARTMENT_ID].value.uint32 = parameters->compartment_id;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_ALE_APP_ID].value.byteBlob = &parameters->app_id;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V4_ALE_USER_ID].value.byteBlob = &parameters->user_id;
+    _fwp_initialize_connect_redirect_v4_values(parameters, incoming_value);
 
-    action = test_callout(
-        FWPS_LAYER_ALE_CONNECT_REDIRECT_V4, FWPM_LAYER_ALE_CONNECT_REDIRECT_V4, _default_sublayer, incoming_value, nullptr);
+    action = classify(
+        FWPS_LAYER_ALE_CONNECT_REDIRECT_V4, FWPM_LAYER_ALE_CONNECT_REDIRECT_V4, incoming_value, nullptr, nullptr);
     CXPLAT_DEBUG_ASSERT(action == FWP_ACTION_PERMIT || action == FWP_ACTION_CONTINUE || fault_injection_enabled);
 
     if (_fwp_um_connect_request != nullptr) {
@@ -357,8 +1283,8 @@ fwp_engine_t::test_cgroup_inet4_connect(_In_ fwp_classify_parameters_t* paramete
         &parameters->interface_luid;                                                      // Use same as local interface
     incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V4_SUB_INTERFACE_INDEX].value.uint32 = 0; // Default sub-interface index
 
-    action = test_callout(
-        FWPS_LAYER_ALE_AUTH_CONNECT_V4, FWPM_LAYER_ALE_AUTH_CONNECT_V4, _default_sublayer, incoming_value2, nullptr);
+    action = classify(
+        FWPS_LAYER_ALE_AUTH_CONNECT_V4, FWPM_LAYER_ALE_AUTH_CONNECT_V4, incoming_value2, nullptr, nullptr);
 
     if (redirected) {
         // In case the connection is redirected, AUTH_CONNECT callout will be invoked twice.
@@ -368,8 +1294,8 @@ fwp_engine_t::test_cgroup_inet4_connect(_In_ fwp_classify_parameters_t* paramete
         incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V4_IP_REMOTE_ADDRESS].value.uint32 =
             ntohl(*((uint32_t*)redirected_address));
 
-        action = test_callout(
-            FWPS_LAYER_ALE_AUTH_CONNECT_V4, FWPM_LAYER_ALE_AUTH_CONNECT_V4, _default_sublayer, incoming_value2, nullptr);
+        action = classify(
+            FWPS_LAYER_ALE_AUTH_CONNECT_V4, FWPM_LAYER_ALE_AUTH_CONNECT_V4, incoming_value2, nullptr, nullptr);
     }
 
     _free_connection_request();
@@ -392,20 +1318,10 @@ fwp_engine_t::test_cgroup_inet6_connect(_In_ fwp_classify_parameters_t* paramete
     // For CGROUP_CONNECT* attach type, first CONNECT_REDIRECT callout is invoked, followed by
     // AUTH_CONNECT.
     FWPS_INCOMING_VALUE0 incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_MAX] = {};
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_LOCAL_ADDRESS].value.byteArray16 =
-        &parameters->source_ipv6_address;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_LOCAL_PORT].value.uint16 = parameters->source_port;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_REMOTE_ADDRESS].value.byteArray16 =
-        &parameters->destination_ipv6_address;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_REMOTE_PORT].value.uint16 = parameters->destination_port;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_IP_PROTOCOL].value.uint8 = parameters->protocol;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_COMPARTMENT_ID].value.uint32 = parameters->compartment_id;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_ALE_APP_ID].value.byteBlob = &parameters->app_id;
-    incoming_value[FWPS_FIELD_ALE_CONNECT_REDIRECT_V6_ALE_USER_ID].value.byteBlob = &parameters->user_id;
+    _fwp_initialize_connect_redirect_v6_values(parameters, incoming_value);
 
-    // TODO: why does this use _connect_v6_sublayer but test_cgroup_inet4_connect uses _default_sublayer?
-    action = test_callout(
-        FWPS_LAYER_ALE_CONNECT_REDIRECT_V6, FWPM_LAYER_ALE_CONNECT_REDIRECT_V6, _connect_v6_sublayer, incoming_value, nullptr);
+    action = classify(
+        FWPS_LAYER_ALE_CONNECT_REDIRECT_V6, FWPM_LAYER_ALE_CONNECT_REDIRECT_V6, incoming_value, nullptr, nullptr);
     CXPLAT_DEBUG_ASSERT(action == FWP_ACTION_PERMIT || action == FWP_ACTION_CONTINUE || fault_injection_enabled);
 
     if (_fwp_um_connect_request != nullptr) {
@@ -433,8 +1349,8 @@ fwp_engine_t::test_cgroup_inet6_connect(_In_ fwp_classify_parameters_t* paramete
     incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V6_IP_NEXTHOP_INTERFACE].value.uint64 = &parameters->interface_luid; // Use same as local interface
     incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V6_SUB_INTERFACE_INDEX].value.uint32 = 0; // Default sub-interface index
 
-    action = test_callout(
-        FWPS_LAYER_ALE_AUTH_CONNECT_V6, FWPM_LAYER_ALE_AUTH_CONNECT_V6, _default_sublayer, incoming_value2, nullptr);
+    action = classify(
+        FWPS_LAYER_ALE_AUTH_CONNECT_V6, FWPM_LAYER_ALE_AUTH_CONNECT_V6, incoming_value2, nullptr, nullptr);
 
     if (redirected) {
         // In case the connection is redirected, AUTH_CONNECT callout will be invoked twice.
@@ -446,8 +1362,8 @@ fwp_engine_t::test_cgroup_inet6_connect(_In_ fwp_classify_parameters_t* paramete
         incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V6_IP_REMOTE_PORT].value.uint16 = ntohs(redirected_port);
         incoming_value2[FWPS_FIELD_ALE_AUTH_CONNECT_V6_IP_REMOTE_ADDRESS].value.byteArray16 = &destination_ip;
 
-        action = test_callout(
-            FWPS_LAYER_ALE_AUTH_CONNECT_V6, FWPM_LAYER_ALE_AUTH_CONNECT_V6, _default_sublayer, incoming_value2, nullptr);
+        action = classify(
+            FWPS_LAYER_ALE_AUTH_CONNECT_V6, FWPM_LAYER_ALE_AUTH_CONNECT_V6, incoming_value2, nullptr, nullptr);
     }
 
     _free_connection_request();
@@ -470,8 +1386,8 @@ fwp_engine_t::test_sock_ops_v4(_In_ fwp_classify_parameters_t* parameters, _Out_
     incoming_value[FWPS_FIELD_ALE_FLOW_ESTABLISHED_V4_IP_LOCAL_INTERFACE].value.uint64 = &parameters->interface_luid;
     incoming_value[FWPS_FIELD_ALE_FLOW_ESTABLISHED_V4_ALE_APP_ID].value.byteBlob = &parameters->app_id;
 
-    return test_callout(
-        FWPS_LAYER_ALE_FLOW_ESTABLISHED_V4, FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4, _default_sublayer, incoming_value, flow_id);
+    return classify(
+        FWPS_LAYER_ALE_FLOW_ESTABLISHED_V4, FWPM_LAYER_ALE_FLOW_ESTABLISHED_V4, incoming_value, nullptr, flow_id);
 }
 
 // This is used to test the SOCK_OPS hook for IPv6 traffic.
@@ -490,8 +1406,8 @@ fwp_engine_t::test_sock_ops_v6(_In_ fwp_classify_parameters_t* parameters, _Out_
     incoming_value[FWPS_FIELD_ALE_FLOW_ESTABLISHED_V6_IP_LOCAL_INTERFACE].value.uint64 = &parameters->interface_luid;
     incoming_value[FWPS_FIELD_ALE_FLOW_ESTABLISHED_V6_ALE_APP_ID].value.byteBlob = &parameters->app_id;
 
-    return test_callout(
-        FWPS_LAYER_ALE_FLOW_ESTABLISHED_V6, FWPM_LAYER_ALE_FLOW_ESTABLISHED_V6, _default_sublayer, incoming_value, flow_id);
+    return classify(
+        FWPS_LAYER_ALE_FLOW_ESTABLISHED_V6, FWPM_LAYER_ALE_FLOW_ESTABLISHED_V6, incoming_value, nullptr, flow_id);
 }
 
 // This is used to test the sock_addr listen hook for IPv4 traffic.
@@ -505,8 +1421,8 @@ fwp_engine_t::test_cgroup_inet4_listen(_In_ fwp_classify_parameters_t* parameter
     incoming_value[FWPS_FIELD_ALE_AUTH_LISTEN_V4_IP_LOCAL_INTERFACE].value.uint64 = &parameters->interface_luid;
     incoming_value[FWPS_FIELD_ALE_AUTH_LISTEN_V4_ALE_APP_ID].value.byteBlob = &parameters->app_id;
 
-    return test_callout(
-        FWPS_LAYER_ALE_AUTH_LISTEN_V4, FWPM_LAYER_ALE_AUTH_LISTEN_V4, _default_sublayer, incoming_value, nullptr);
+    return classify(
+        FWPS_LAYER_ALE_AUTH_LISTEN_V4, FWPM_LAYER_ALE_AUTH_LISTEN_V4, incoming_value, nullptr, nullptr);
 }
 
 // This is used to test the sock_addr listen hook for IPv6 traffic.
@@ -521,8 +1437,8 @@ fwp_engine_t::test_cgroup_inet6_listen(_In_ fwp_classify_parameters_t* parameter
     incoming_value[FWPS_FIELD_ALE_AUTH_LISTEN_V6_IP_LOCAL_INTERFACE].value.uint64 = &parameters->interface_luid;
     incoming_value[FWPS_FIELD_ALE_AUTH_LISTEN_V6_ALE_APP_ID].value.byteBlob = &parameters->app_id;
 
-    return test_callout(
-        FWPS_LAYER_ALE_AUTH_LISTEN_V6, FWPM_LAYER_ALE_AUTH_LISTEN_V6, _default_sublayer, incoming_value, nullptr);
+    return classify(
+        FWPS_LAYER_ALE_AUTH_LISTEN_V6, FWPM_LAYER_ALE_AUTH_LISTEN_V6, incoming_value, nullptr, nullptr);
 }
 
 #pragma endregion fwp_engine_t
@@ -532,9 +1448,10 @@ fwp_engine_t::test_cgroup_inet6_listen(_In_ fwp_classify_parameters_t* parameter
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmFilterDeleteById0(_In_ HANDLE engine_handle, _In_ uint64_t id)
 {
     // Skip fault injection for this API because return failure status requires to remove filter from the list.
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    if (engine.remove_fwpm_filter(id)) {
+    if (engine.remove_fwpm_filter(&session, id)) {
         return STATUS_SUCCESS;
     } else {
         return STATUS_INVALID_PARAMETER;
@@ -548,9 +1465,11 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
         return STATUS_NO_MEMORY;
     }
 
-    UNREFERENCED_PARAMETER(engine_handle);
     UNREFERENCED_PARAMETER(flags);
-    return STATUS_SUCCESS;
+
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
+    return engine.begin_transaction(&session);
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmFilterAdd0(
@@ -565,29 +1484,33 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmFilterAdd0(
 
     UNREFERENCED_PARAMETER(sd);
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    auto id_returned = engine.add_fwpm_filter(filter);
+    uint64_t id_returned;
+    NTSTATUS status = engine.add_fwpm_filter(&session, filter, &id_returned);
 
-    if (id) {
+    if (NT_SUCCESS(status) && id) {
         *id = id_returned;
     }
 
-    return STATUS_SUCCESS;
+    return status;
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmTransactionCommit0(_In_ _Releases_lock_(_Curr_) HANDLE engine_handle)
 {
     // Skip fault injection for this API because return failure status requires cleanup.
-    UNREFERENCED_PARAMETER(engine_handle);
-    return STATUS_SUCCESS;
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
+    return engine.commit_transaction(&session);
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmTransactionAbort0(_In_ _Releases_lock_(_Curr_) HANDLE engine_handle)
 {
     // Skip fault injection for this API because return failure status requires cleanup.
-    UNREFERENCED_PARAMETER(engine_handle);
-    return STATUS_SUCCESS;
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
+    return engine.abort_transaction(&session);
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmCalloutAdd0(
@@ -600,9 +1523,10 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmCalloutAdd0(
         return STATUS_NO_MEMORY;
     }
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    auto id_returned = engine.add_fwpm_callout(callout);
+    auto id_returned = engine.add_fwpm_callout(&session, callout);
 
     if (id) {
         *id = id_returned;
@@ -617,9 +1541,10 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmCalloutDeleteByKey0(_In_ HANDLE
         return STATUS_NO_MEMORY;
     }
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    if (!engine.remove_fwpm_callout(key)) {
+    if (!engine.remove_fwpm_callout(&session, key)) {
         return STATUS_NOT_FOUND;
     }
     return STATUS_SUCCESS;
@@ -641,8 +1566,12 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmEngineOpen0(
     UNREFERENCED_PARAMETER(auth_identity);
     UNREFERENCED_PARAMETER(session);
 
-    *engine_handle = fwp_engine_t::get()->get();
-    return STATUS_SUCCESS;
+    fwp_session_t* new_session = nullptr;
+    NTSTATUS status = fwp_engine_t::get()->open_session(&new_session);
+    if (NT_SUCCESS(status)) {
+        *engine_handle = new_session;
+    }
+    return status;
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
@@ -652,7 +1581,8 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
         return STATUS_NO_MEMORY;
     }
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
     engine.add_fwpm_provider(provider);
 
@@ -666,7 +1596,8 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmProviderDeleteByKey0(_In_ HANDLE
         return STATUS_NO_MEMORY;
     }
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
     engine.remove_fwpm_provider(key);
     if (cxplat_fault_injection_inject_fault()) {
@@ -684,9 +1615,10 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
     }
 
     UNREFERENCED_PARAMETER(sd);
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    engine.add_fwpm_sub_layer(sub_layer);
+    engine.add_fwpm_sub_layer(&session, sub_layer);
 
     return STATUS_SUCCESS;
 }
@@ -698,9 +1630,10 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS
         return STATUS_NO_MEMORY;
     }
 
-    auto& engine = *reinterpret_cast<fwp_engine_t*>(engine_handle);
+    auto& session = *reinterpret_cast<fwp_session_t*>(engine_handle);
+    auto& engine = *session.engine;
 
-    if (!engine.remove_fwpm_sub_layer(sub_layer_key)) {
+    if (!engine.remove_fwpm_sub_layer(&session, sub_layer_key)) {
         return STATUS_NOT_FOUND;
     }
     return STATUS_SUCCESS;
@@ -712,11 +1645,7 @@ _IRQL_requires_max_(PASSIVE_LEVEL) NTSTATUS FwpmEngineClose0(_Inout_ HANDLE engi
         return STATUS_NO_MEMORY;
     }
 
-    if (engine_handle != fwp_engine_t::get()->get()) {
-        return STATUS_INVALID_PARAMETER;
-    } else {
-        return STATUS_SUCCESS;
-    }
+    return fwp_engine_t::get()->close_session(reinterpret_cast<fwp_session_t*>(engine_handle));
 }
 
 #pragma endregion fwpm_apis
@@ -1057,6 +1986,12 @@ usersim_fwp_classify_packet(_In_ const GUID* layer_guid, NET_IFINDEX if_index)
     return fwp_engine_t::get()->classify_test_packet(layer_guid, if_index);
 }
 
+NTSTATUS
+usersim_fwp_classify_packets(_Inout_updates_(count) fwp_classify_packet_t* packets, size_t count)
+{
+    return fwp_engine_t::get()->classify_test_packets(packets, count);
+}
+
 FWP_ACTION_TYPE
 usersim_fwp_bind_ipv4(_In_ fwp_classify_parameters_t* parameters)
 {
@@ -1121,7 +2056,10 @@ void
 usersim_fwp_set_sublayer_guids(
     _In_ const GUID& default_sublayer, _In_ const GUID& connect_v4_sublayer, _In_ const GUID& connect_v6_sublayer)
 {
-    fwp_engine_t::get()->set_sublayer_guids(default_sublayer, connect_v4_sublayer, connect_v6_sublayer);
+    // Classify evaluates every sublayer of a layer in weight order, so it no longer needs to be told which ones to use.
+    UNREFERENCED_PARAMETER(default_sublayer);
+    UNREFERENCED_PARAMETER(connect_v4_sublayer);
+    UNREFERENCED_PARAMETER(connect_v6_sublayer);
 }
 
 void
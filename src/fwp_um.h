@@ -5,53 +5,168 @@
 #include "net_platform.h"
 #include "usersim/fwp_test.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 typedef std::unique_lock<std::shared_mutex> exclusive_lock_t;
 typedef std::shared_lock<std::shared_mutex> shared_lock_t;
 
+typedef struct _fwp_guid_hash
+{
+    size_t
+    operator()(_In_ const GUID& guid) const
+    {
+        uint64_t halves[2];
+        memcpy(halves, &guid, sizeof(halves));
+        return std::hash<uint64_t>{}(halves[0] ^ (halves[1] * 0x9E3779B97F4A7C15ull));
+    }
+} fwp_guid_hash_t;
+
+/**
+ * @brief Filter condition, compiled when the filter is added.
+ */
+typedef struct _fwp_filter_condition
+{
+    uint16_t field;            ///< Index of the incoming value to test.
+    FWP_DATA_TYPE field_type;  ///< Type of the incoming value.
+    FWP_DATA_TYPE value_type;  ///< FWP_UINT64, FWP_RANGE_TYPE, FWP_V4_ADDR_MASK or FWP_V6_ADDR_MASK.
+    FWP_MATCH_TYPE match_type; ///< FWP_MATCH_EQUAL or FWP_MATCH_NOT_EQUAL for masks, FWP_MATCH_RANGE for ranges.
+    uint64_t low;              ///< Value, low end of a range, or IPv4 address.
+    uint64_t high;             ///< High end of a range, or IPv4 mask.
+    uint8_t address[16];       ///< IPv6 address.
+    uint8_t prefix_length;     ///< IPv6 prefix length.
+} fwp_filter_condition_t;
+
+/**
+ * @brief Filter as the classify walk uses it. Conditions on the same field are OR'ed and conditions on different
+ * fields are AND'ed, so the conditions are sorted by field.
+ */
+typedef struct _fwp_compiled_filter
+{
+    uint64_t id;
+    uint64_t weight;
+    GUID sublayer;
+    FWP_ACTION_TYPE action;
+    GUID callout_key;
+    uint32_t flags;
+    uint64_t raw_context;
+    std::vector<fwp_filter_condition_t> conditions;
+} fwp_compiled_filter_t;
+
+typedef struct _fwp_chain_filter
+{
+    std::shared_ptr<const fwp_compiled_filter_t> filter;
+    uint32_t callout_id;
+    FWPS_CALLOUT3 callout; ///< Copy of the registered callout, or zeroed if the callout isn't registered.
+} fwp_chain_filter_t;
+
+typedef struct _fwp_sublayer_chain
+{
+    GUID sublayer;
+    uint16_t weight;
+    std::vector<fwp_chain_filter_t> filters; ///< Sorted by descending weight.
+} fwp_sublayer_chain_t;
+
+/**
+ * @brief Everything the classify walk needs for one layer. A chain is never changed once built; adding or deleting
+ * a filter, sublayer or callout builds a new one, so a walk can use a chain without holding the engine lock.
+ */
+typedef struct _fwp_layer_chain
+{
+    std::vector<fwp_sublayer_chain_t> sublayers; ///< Sorted by descending weight.
+} fwp_layer_chain_t;
+
+/**
+ * @brief The layer chains, published as one snapshot so that a commit changes every layer at once. Classify reads
+ * the current snapshot inside an epoch rather than under the engine lock, and a replaced snapshot is only freed
+ * once every classify that could have read it has finished.
+ */
+typedef struct _fwp_engine_snapshot
+{
+    std::unordered_map<GUID, std::shared_ptr<const fwp_layer_chain_t>, fwp_guid_hash_t> layer_chains;
+} fwp_engine_snapshot_t;
+
+typedef struct _fwp_retired_snapshot
+{
+    uint64_t epoch; ///< First epoch in which the snapshot was no longer published.
+    std::unique_ptr<const fwp_engine_snapshot_t> snapshot;
+} fwp_retired_snapshot_t;
+
+typedef struct _fwp_filter_notification
+{
+    FWPS_CALLOUT_NOTIFY_TYPE type;
+    GUID callout_key;
+    FWPS_FILTER filter;
+} fwp_filter_notification_t;
+
+/**
+ * @brief NBL, NET_BUFFER and MDL describing a test packet. Each thread keeps a shell and resets it before each
+ * classify, so classifying a packet doesn't allocate.
+ */
+typedef struct _fwp_packet_shell
+{
+    std::unique_ptr<void, decltype(&NdisFreeNetBufferListPool)> nbl_pool{nullptr, NdisFreeNetBufferListPool};
+    std::unique_ptr<NET_BUFFER_LIST, decltype(&NdisFreeNetBufferList)> nbl{nullptr, NdisFreeNetBufferList};
+    std::unique_ptr<MDL, decltype(&IoFreeMdl)> mdl{nullptr, IoFreeMdl};
+    std::unique_ptr<NET_BUFFER, decltype(&NdisFreeNetBuffer)> nb{nullptr, NdisFreeNetBuffer};
+    unsigned long data = 0;
+} fwp_packet_shell_t;
+
+class fwp_engine_t;
+
+/**
+ * @brief A handle returned by FwpmEngineOpen0. A transaction belongs to the session that began it: changes made
+ * through that session are part of it, changes made through any other session wait for it to end, and closing the
+ * session aborts it.
+ */
+typedef struct _fwp_session
+{
+    fwp_engine_t* engine;
+} fwp_session_t;
+
 typedef class fwp_engine_t
 {
   public:
     fwp_engine_t() = default;
 
-    void
-    set_sublayer_guids(
-        _In_ const GUID& default_sublayer, _In_ const GUID& connect_v4_sublayer, _In_ const GUID& connect_v6_sublayer)
-    {
-        _default_sublayer = default_sublayer;
-        _connect_v4_sublayer = connect_v4_sublayer;
-        _connect_v6_sublayer = connect_v6_sublayer;
-    }
-
     uint32_t
-    add_fwpm_callout(_In_ const FWPM_CALLOUT0* callout)
+    add_fwpm_callout(_In_ const fwp_session_t* session, _In_ const FWPM_CALLOUT0* callout)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
         uint32_t id = next_id++;
         fwpm_callouts.insert({id, *callout});
+        fwpm_callout_ids_by_key.try_emplace(callout->calloutKey, id);
+        fwpm_callout_ids_by_layer[callout->applicableLayer].push_back(id);
         return id;
     }
 
     bool
-    remove_fwpm_callout(size_t id)
+    remove_fwpm_callout(_In_ const fwp_session_t* session, size_t id)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
-        return fwpm_callouts.erase(id) == 1;
+        return remove_fwpm_callout_under_lock(id);
     }
 
     bool
-    remove_fwpm_callout(_In_ const GUID* key)
+    remove_fwpm_callout(_In_ const fwp_session_t* session, _In_ const GUID* key)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
-        for (auto& [first, callout] : fwpm_callouts) {
-            if (memcmp(&callout.calloutKey, key, sizeof(GUID)) == 0) {
-                return fwpm_callouts.erase(first) == 1;
-            }
+        auto it = fwpm_callout_ids_by_key.find(*key);
+        if (it == fwpm_callout_ids_by_key.end()) {
+            return false;
         }
-
-        return false;
+        return remove_fwpm_callout_under_lock(it->second);
     }
 
     uint32_t
@@ -60,35 +175,40 @@ typedef class fwp_engine_t
         exclusive_lock_t l(lock);
         uint32_t id = next_id++;
         fwps_callouts.insert({id, *callout});
+        fwps_callout_ids_by_key.try_emplace(callout->calloutKey, id);
+        update_callouts_under_lock();
         return id;
     }
 
     _Requires_lock_held_(this->lock) FWPS_CALLOUT3* get_fwps_callout(_In_ const GUID* callout_key)
     {
-        for (auto& it : fwps_callouts) {
-            if (memcmp(&it.second.calloutKey, callout_key, sizeof(GUID)) == 0) {
-                return &it.second;
-            }
-        }
-
-        return nullptr;
+        auto it = fwps_callout_ids_by_key.find(*callout_key);
+        return (it == fwps_callout_ids_by_key.end()) ? nullptr : &fwps_callouts.at(it->second);
     }
 
     _Requires_lock_held_(this->lock) FWPS_CALLOUT3* get_fwps_callout(uint32_t callout_id)
     {
-        for (auto& it : fwps_callouts) {
-            if (it.first == callout_id) {
-                return &it.second;
-            }
-        }
-
-        return nullptr;
+        auto it = fwps_callouts.find(callout_id);
+        return (it == fwps_callouts.end()) ? nullptr : &it->second;
     }
 
     _Requires_lock_not_held_(this->lock) bool remove_fwps_callout(size_t id)
     {
-        exclusive_lock_t l(lock);
-        return fwps_callouts.erase(id) == 1;
+        {
+            exclusive_lock_t l(lock);
+            auto it = fwps_callouts.find(id);
+            if (it == fwps_callouts.end()) {
+                return false;
+            }
+            GUID key = it->second.calloutKey;
+            fwps_callouts.erase(it);
+            reindex_key_under_lock(fwps_callouts, fwps_callout_ids_by_key, key, id, &FWPS_CALLOUT3::calloutKey);
+            update_callouts_under_lock();
+        }
+
+        // The caller may unload the callout once this returns, so wait out any classify that could still call it.
+        wait_for_readers();
+        return true;
     }
 
     _Requires_lock_not_held_(this->lock) void associate_flow_context(
@@ -126,52 +246,42 @@ typedef class fwp_engine_t
         callout->flowDeleteFn(layer_id, callout_id, flow_context);
     }
 
-    _Requires_lock_not_held_(this->lock) uint32_t add_fwpm_filter(_In_ const FWPM_FILTER0* filter)
-    {
-        FWPS_CALLOUT3* callout = nullptr;
-        FWPS_FILTER fwps_filter = {};
-        uint32_t id;
-
-        {
-            exclusive_lock_t l(lock);
-            id = next_id++;
-            fwpm_filters.insert({id, *filter});
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+        add_fwpm_filter(_In_ const fwp_session_t* session, _In_ const FWPM_FILTER0* filter, _Out_ uint64_t* id);
 
-            callout = get_fwps_callout(&filter->action.calloutKey);
-            CXPLAT_DEBUG_ASSERT(callout != nullptr);
-            fwps_filter.context = filter->rawContext;
-        }
-
-        __analysis_assume(callout != nullptr);
-        // Invoke filter add notification callback.
-        callout->notifyFn(FWPS_CALLOUT_NOTIFY_ADD_FILTER, &filter->action.calloutKey, &fwps_filter);
-
-        return id;
-    }
-
-    _Requires_lock_not_held_(this->lock) bool remove_fwpm_filter(size_t id)
+    _Requires_lock_not_held_(this->lock) bool remove_fwpm_filter(_In_ const fwp_session_t* session, size_t id)
     {
         FWPS_CALLOUT3* callout = nullptr;
         FWPS_FILTER fwps_filter = {};
         bool return_value = false;
         {
+            std::unique_lock<std::mutex> t = enter_change(session);
             exclusive_lock_t l(lock);
-            for (auto& it : fwpm_filters) {
-                if (it.first == id) {
-                    callout = get_fwps_callout(&it.second.action.calloutKey);
-                    CXPLAT_DEBUG_ASSERT(callout != nullptr);
-                    fwps_filter.context = it.second.rawContext;
-                    break;
+            auto it = fwpm_filters.find(id);
+            if (it == fwpm_filters.end()) {
+                return false;
+            }
+            fwps_filter.context = it->second.rawContext;
+            fwps_filter.filterId = id;
+            if (it->second.action.type & FWP_ACTION_FLAG_CALLOUT) {
+                if (transaction) {
+                    transaction->notifications.push_back(
+                        {FWPS_CALLOUT_NOTIFY_DELETE_FILTER, it->second.action.calloutKey, fwps_filter});
+                } else {
+                    callout = get_fwps_callout(&it->second.action.calloutKey);
                 }
             }
-
-            return_value = fwpm_filters.erase(id) == 1;
+            GUID layer = it->second.layerKey;
+            unindex_fwpm_filter_under_lock(id, layer);
+            fwpm_filters.erase(it);
+            update_layer_chain_under_lock(layer);
+            return_value = true;
         }
 
-        CXPLAT_DEBUG_ASSERT(callout != nullptr);
-        __analysis_assume(callout != nullptr);
-        // Invoke filter delete notification callback.
-        callout->notifyFn(FWPS_CALLOUT_NOTIFY_DELETE_FILTER, &callout->calloutKey, &fwps_filter);
+        if (callout != nullptr) {
+            // Invoke filter delete notification callback.
+            callout->notifyFn(FWPS_CALLOUT_NOTIFY_DELETE_FILTER, &callout->calloutKey, &fwps_filter);
+        }
 
         return return_value;
     }
@@ -188,35 +298,57 @@ typedef class fwp_engine_t
         return;
     }
 
-    _Requires_lock_not_held_(this->lock) uint32_t add_fwpm_sub_layer(_In_ const FWPM_SUBLAYER0* sub_layer)
+    _Requires_lock_not_held_(this->lock) uint32_t
+        add_fwpm_sub_layer(_In_ const fwp_session_t* session, _In_ const FWPM_SUBLAYER0* sub_layer)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
         uint32_t id = next_id++;
         fwpm_sub_layers.insert({id, *sub_layer});
+        fwpm_sub_layer_ids_by_key.try_emplace(sub_layer->subLayerKey, id);
+        update_layer_chains_under_lock();
         return id;
     }
 
-    _Requires_lock_not_held_(this->lock) bool remove_fwpm_sub_layer(size_t id)
+    _Requires_lock_not_held_(this->lock) bool remove_fwpm_sub_layer(_In_ const fwp_session_t* session, size_t id)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
-        return fwpm_sub_layers.erase(id) == 1;
+        return remove_fwpm_sub_layer_under_lock(id);
     }
 
-    _Requires_lock_not_held_(this->lock) bool remove_fwpm_sub_layer(_In_ const GUID* key)
+    _Requires_lock_not_held_(this->lock) bool
+        remove_fwpm_sub_layer(_In_ const fwp_session_t* session, _In_ const GUID* key)
     {
+        std::unique_lock<std::mutex> t = enter_change(session);
         exclusive_lock_t l(lock);
-        for (auto& [first, sub_layer] : fwpm_sub_layers) {
-            if (memcmp(&sub_layer.subLayerKey, key, sizeof(GUID)) == 0) {
-                return fwpm_sub_layers.erase(first) == 1;
-            }
+        auto it = fwpm_sub_layer_ids_by_key.find(*key);
+        if (it == fwpm_sub_layer_ids_by_key.end()) {
+            return false;
         }
-
-        return false;
+        return remove_fwpm_sub_layer_under_lock(it->second);
     }
 
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+        begin_transaction(_In_ const fwp_session_t* session);
+
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+        commit_transaction(_In_ const fwp_session_t* session);
+
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+        abort_transaction(_In_ const fwp_session_t* session);
+
+    _Must_inspect_result_ NTSTATUS
+    open_session(_Outptr_ fwp_session_t** session);
+
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS close_session(_In_ fwp_session_t* session);
+
     FWP_ACTION_TYPE
     classify_test_packet(_In_ const GUID* layer_guid, NET_IFINDEX if_index);
 
+    _Requires_lock_not_held_(this->lock) _Must_inspect_result_ NTSTATUS
+        classify_test_packets(_Inout_updates_(count) fwp_classify_packet_t* packets, size_t count);
+
     FWP_ACTION_TYPE
     test_bind_ipv4(_In_ fwp_classify_parameters_t* parameters);
 
@@ -263,11 +395,19 @@ typedef class fwp_engine_t
     }
 
   private:
-    _Requires_lock_not_held_(this->lock) FWP_ACTION_TYPE test_callout(
+    _Requires_lock_not_held_(this->lock) FWP_ACTION_TYPE classify(
         uint16_t layer_id,
         _In_ const GUID& layer_guid,
-        _In_ const GUID& sublayer_guid,
         _In_ FWPS_INCOMING_VALUE0* incoming_value,
+        _Inout_opt_ void* layer_data,
+        _Out_opt_ uint64_t* flow_handle);
+
+    FWP_ACTION_TYPE
+    classify_chain(
+        _In_ const fwp_layer_chain_t& chain,
+        uint16_t layer_id,
+        _In_ FWPS_INCOMING_VALUE0* incoming_value,
+        _Inout_opt_ void* layer_data,
         _Out_opt_ uint64_t* flow_handle);
 
     _Requires_lock_not_held_(this->lock) void test_remove_flow_context(
@@ -275,73 +415,236 @@ typedef class fwp_engine_t
     uint16_t layer_id,
     _In_ const GUID& layer_guid);
 
-    _Ret_maybenull_ const FWPM_FILTER*
-    get_fwpm_filter_with_context_under_lock(_In_ const GUID& layer_guid)
+    /**
+     * @brief Return the weight filters are sorted by. A FWP_UINT64 weight is used as is, a FWP_UINT8 weight range
+     * selects the top four bits as WFP does, and a filter without a weight sorts last.
+     */
+    static uint64_t
+    get_fwpm_filter_weight(_In_ const FWPM_FILTER0* filter)
+    {
+        switch (filter->weight.type) {
+        case FWP_UINT64:
+            return (filter->weight.uint64 != nullptr) ? *filter->weight.uint64 : 0;
+        case FWP_UINT8:
+            return (uint64_t)(filter->weight.uint8 & 0xf) << 60;
+        default:
+            return 0;
+        }
+    }
+
+    _Requires_lock_held_(this->lock) void index_fwpm_filter_under_lock(
+        _In_ const GUID& layer, std::shared_ptr<const fwp_compiled_filter_t> filter)
+    {
+        auto heavier = [](const std::shared_ptr<const fwp_compiled_filter_t>& a,
+                          const std::shared_ptr<const fwp_compiled_filter_t>& b) { return a->weight > b->weight; };
+        std::vector<std::shared_ptr<const fwp_compiled_filter_t>>& index = fwpm_filters_by_layer[layer];
+        index.insert(std::upper_bound(index.begin(), index.end(), filter, heavier), std::move(filter));
+    }
+
+    _Requires_lock_held_(this->lock) void unindex_fwpm_filter_under_lock(size_t id, _In_ const GUID& layer)
+    {
+        auto it = fwpm_filters_by_layer.find(layer);
+        if (it == fwpm_filters_by_layer.end()) {
+            return;
+        }
+        std::erase_if(it->second, [id](const std::shared_ptr<const fwp_compiled_filter_t>& filter) {
+            return filter->id == id;
+        });
+        if (it->second.empty()) {
+            fwpm_filters_by_layer.erase(it);
+        }
+    }
+
+    _Requires_lock_held_(this->lock) void build_layer_chain_under_lock(_In_ const GUID& layer);
+
+    _Requires_lock_held_(this->lock) void bind_callout_under_lock(_Inout_ fwp_chain_filter_t& entry);
+
+    /**
+     * @brief Point the filters of every published chain at the callouts registered now, and publish the result.
+     * FWPS callouts are not part of FWPM transactions, so this happens right away even while one is open: the
+     * published chains only hold committed filters.
+     */
+    _Requires_lock_held_(this->lock) void update_callouts_under_lock();
+
+    _Requires_lock_held_(this->lock) void build_layer_chains_under_lock()
+    {
+        fwpm_layer_chains.clear();
+        for (auto& [layer, filters] : fwpm_filters_by_layer) {
+            build_layer_chain_under_lock(layer);
+        }
+    }
+
+    _Requires_lock_held_(this->lock) void publish_snapshot_under_lock();
+
+    _Requires_lock_held_(this->lock) void reclaim_snapshots_under_lock();
+
+    void
+    wait_for_readers();
+
+    /**
+     * @brief Rebuild and publish the chain of a layer whose filters changed. Inside a transaction this is deferred
+     * to the commit.
+     */
+    _Requires_lock_held_(this->lock) void update_layer_chain_under_lock(_In_ const GUID& layer)
+    {
+        if (transaction) {
+            transaction->changed_layers.insert(layer);
+            return;
+        }
+        build_layer_chain_under_lock(layer);
+        publish_snapshot_under_lock();
+    }
+
+    _Requires_lock_held_(this->lock) void update_layer_chains_under_lock()
+    {
+        if (transaction) {
+            transaction->all_layers_changed = true;
+            return;
+        }
+        build_layer_chains_under_lock();
+        publish_snapshot_under_lock();
+    }
+
+    /**
+     * @brief Wait for a transaction begun by another session to finish before changing the engine. Changes made
+     * through the session that began the transaction are part of it.
+     */
+    _Must_inspect_result_ std::unique_lock<std::mutex>
+    enter_change(_In_ const fwp_session_t* session)
+    {
+        std::unique_lock<std::mutex> t(transaction_lock);
+        transaction_done.wait(t, [this, session]() { return !transaction || transaction_owner == session; });
+        return t;
+    }
+
+    _Requires_lock_held_(this->lock) void abort_transaction_under_lock();
+
+    /**
+     * @brief After an object is removed, point its key at another object with the same key, if any. Keys are
+     * expected to be unique, so this only scans the objects when there really was a duplicate.
+     */
+    template <typename objects_t, typename member_t>
+    static void
+    reindex_key_under_lock(
+        _In_ const objects_t& objects,
+        _Inout_ std::unordered_map<GUID, size_t, fwp_guid_hash_t>& ids_by_key,
+        _In_ const GUID& key,
+        size_t removed_id,
+        member_t key_member)
     {
-        for (auto& [first, filter] : fwpm_filters) {
-            if (memcmp(&filter.layerKey, &layer_guid, sizeof(GUID)) == 0 && filter.rawContext != 0) {
-                return &filter;
+        auto it = ids_by_key.find(key);
+        if (it == ids_by_key.end() || it->second != removed_id) {
+            return;
+        }
+        ids_by_key.erase(it);
+        for (auto& [id, object] : objects) {
+            if (object.*key_member == key) {
+                ids_by_key.try_emplace(key, id);
+                break;
             }
         }
-        return nullptr;
     }
 
-    _Ret_maybenull_ const FWPM_FILTER*
-    get_fwpm_filter_with_context_under_lock(_In_ const GUID& layer_guid, _In_ const GUID& sublayer_guid)
+    _Requires_lock_held_(this->lock) bool remove_fwpm_callout_under_lock(size_t id)
     {
-        for (auto& [first, filter] : fwpm_filters) {
-            if (memcmp(&filter.layerKey, &layer_guid, sizeof(GUID)) == 0 &&
-                memcmp(&filter.subLayerKey, &sublayer_guid, sizeof(GUID)) == 0 && filter.rawContext != 0) {
-                return &filter;
+        auto it = fwpm_callouts.find(id);
+        if (it == fwpm_callouts.end()) {
+            return false;
+        }
+        GUID key = it->second.calloutKey;
+        GUID layer = it->second.applicableLayer;
+        fwpm_callouts.erase(it);
+        reindex_key_under_lock(fwpm_callouts, fwpm_callout_ids_by_key, key, id, &FWPM_CALLOUT0::calloutKey);
+
+        auto layer_it = fwpm_callout_ids_by_layer.find(layer);
+        if (layer_it != fwpm_callout_ids_by_layer.end()) {
+            std::erase(layer_it->second, id);
+            if (layer_it->second.empty()) {
+                fwpm_callout_ids_by_layer.erase(layer_it);
             }
         }
-        return nullptr;
+        return true;
+    }
+
+    _Requires_lock_held_(this->lock) bool remove_fwpm_sub_layer_under_lock(size_t id)
+    {
+        auto it = fwpm_sub_layers.find(id);
+        if (it == fwpm_sub_layers.end()) {
+            return false;
+        }
+        GUID key = it->second.subLayerKey;
+        fwpm_sub_layers.erase(it);
+        reindex_key_under_lock(fwpm_sub_layers, fwpm_sub_layer_ids_by_key, key, id, &FWPM_SUBLAYER0::subLayerKey);
+        update_layer_chains_under_lock();
+        return true;
     }
 
     _Ret_maybenull_ const GUID*
     get_callout_key_from_layer_guid_under_lock(_In_ const GUID* layer_guid)
     {
-        for (auto& [first, callout] : fwpm_callouts) {
-            if (callout.applicableLayer == *layer_guid) {
-                return &callout.calloutKey;
-            }
-        }
-        return nullptr;
+        auto it = fwpm_callout_ids_by_layer.find(*layer_guid);
+        return (it == fwpm_callout_ids_by_layer.end()) ? nullptr : &fwpm_callouts.at(it->second.front()).calloutKey;
     }
 
     _Ret_maybenull_ const FWPS_CALLOUT3*
     get_callout_from_key_under_lock(_In_ const GUID* callout_key)
     {
-        for (auto& [first, callout] : fwps_callouts) {
-            if (callout.calloutKey == *callout_key) {
-                return &callout;
-            }
-        }
-        return nullptr;
+        return get_fwps_callout(callout_key);
     }
 
     _Ret_maybenull_
     size_t get_callout_id_from_key_under_lock(_In_ const GUID* callout_key)
     {
-        for (auto& [first, callout] : fwps_callouts) {
-            if (callout.calloutKey == *callout_key) {
-                return first;
-            }
-        }
-        return 0;
+        auto it = fwps_callout_ids_by_key.find(*callout_key);
+        return (it == fwps_callout_ids_by_key.end()) ? 0 : it->second;
     }
 
     static std::unique_ptr<fwp_engine_t> _engine;
 
     std::shared_mutex lock;
     uint32_t next_id = 1;
-    uint32_t next_flow_id = 1;
     std::unordered_map<size_t, FWPS_CALLOUT3> fwps_callouts;
     std::unordered_map<size_t, FWPM_CALLOUT0> fwpm_callouts;
     std::unordered_map<size_t, FWPM_FILTER0> fwpm_filters;
     std::unordered_map<size_t, FWPM_SUBLAYER0> fwpm_sub_layers;
     std::unordered_map<uint64_t, uint64_t> fwpm_flow_contexts;
-    GUID _default_sublayer = {};
-    GUID _connect_v4_sublayer = {};
-    GUID _connect_v6_sublayer = {};
+
+    // Indexes over the objects above, kept consistent with them under the same lock.
+    std::unordered_map<GUID, size_t, fwp_guid_hash_t> fwps_callout_ids_by_key;
+    std::unordered_map<GUID, size_t, fwp_guid_hash_t> fwpm_callout_ids_by_key;
+    std::unordered_map<GUID, std::vector<size_t>, fwp_guid_hash_t> fwpm_callout_ids_by_layer;
+    std::unordered_map<GUID, size_t, fwp_guid_hash_t> fwpm_sub_layer_ids_by_key;
+    std::unordered_map<GUID, std::vector<std::shared_ptr<const fwp_compiled_filter_t>>, fwp_guid_hash_t>
+        fwpm_filters_by_layer; ///< Sorted by descending weight.
+    std::unordered_map<GUID, std::shared_ptr<const fwp_layer_chain_t>, fwp_guid_hash_t> fwpm_layer_chains;
+
+    std::unique_ptr<const fwp_engine_snapshot_t> current_snapshot = std::make_unique<const fwp_engine_snapshot_t>();
+    std::atomic<const fwp_engine_snapshot_t*> published_snapshot = current_snapshot.get();
+    std::vector<fwp_retired_snapshot_t> retired_snapshots;
+
+    /**
+     * @brief A transaction changes the FWPM objects in place, but the changed chains are only published, and
+     * the callouts only notified, when it commits. The objects as they were when it began are kept so that
+     * aborting can put them back.
+     */
+    typedef struct _fwp_transaction
+    {
+        std::unordered_map<size_t, FWPM_CALLOUT0> fwpm_callouts;
+        std::unordered_map<size_t, FWPM_FILTER0> fwpm_filters;
+        std::unordered_map<size_t, FWPM_SUBLAYER0> fwpm_sub_layers;
+        std::unordered_map<GUID, size_t, fwp_guid_hash_t> fwpm_callout_ids_by_key;
+        std::unordered_map<GUID, std::vector<size_t>, fwp_guid_hash_t> fwpm_callout_ids_by_layer;
+        std::unordered_map<GUID, size_t, fwp_guid_hash_t> fwpm_sub_layer_ids_by_key;
+        std::unordered_map<GUID, std::vector<std::shared_ptr<const fwp_compiled_filter_t>>, fwp_guid_hash_t>
+            fwpm_filters_by_layer;
+        std::unordered_set<GUID, fwp_guid_hash_t> changed_layers;
+        bool all_layers_changed = false;
+        std::vector<fwp_filter_notification_t> notifications;
+    } fwp_transaction_t;
+
+    std::mutex transaction_lock; ///< Held while a transaction or session starts or ends, and by each change.
+    std::condition_variable transaction_done;
+    const fwp_session_t* transaction_owner = nullptr; ///< Session that began the transaction. Under transaction_lock.
+    std::unique_ptr<fwp_transaction_t> transaction;   ///< Changed under both transaction_lock and lock.
+    std::unordered_set<const fwp_session_t*> sessions; ///< Open sessions. Under transaction_lock.
 } fwp_engine_t;
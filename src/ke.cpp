@@ -5,9 +5,10 @@
 #include "usersim/ke.h"
 #include "utilities.h"
 
+#include <atomic>
+#include <bit>
 #include <format>
 #include <mutex>
-#include <optional>
 #include <sstream>
 #include <vector>
 #undef ASSERT
@@ -15,6 +16,8 @@
     if (!(x))     \
     KeBugCheckCPP(0)
 
+#define USERSIM_CACHE_LINE_SIZE 64
+
 #pragma comment(lib, "mincore.lib")
 
 // Ke* functions.
@@ -29,38 +32,75 @@ thread_local int _usersim_thread_priority_cache =
     THREAD_PRIORITY_NORMAL; ///< The effective priority of the current thread.
 thread_local int
     _usersim_thread_priority_before_raise_irql; ///< The priority of the current thread before raising IRQL.
+thread_local bool _usersim_irql_raised_fast =
+    false; ///< The current thread raised to DISPATCH_LEVEL in fast IRQL mode and holds a dispatch lock.
+thread_local uint32_t
+    _usersim_virtual_processor; ///< The processor the current thread is emulating while _usersim_irql_raised_fast.
 
-static uint32_t _usersim_original_priority_class;
-static std::vector<std::mutex> _usersim_dispatch_locks;
+#define USERSIM_DISPATCH_LOCK_SPIN_COUNT 1000 ///< Number of times to retry a contended dispatch lock before parking.
 
-static TP_POOL* _usersim_threadpool = nullptr;
-static std::optional<TP_CALLBACK_ENVIRON> _usersim_threadpool_callback_environment = std::nullopt;
+/**
+ * @brief Per-CPU lock that is held by the thread running at DISPATCH_LEVEL on that CPU.
+ * Each lock is on its own cache line so that CPUs don't contend on each other's locks.
+ */
+typedef struct alignas(USERSIM_CACHE_LINE_SIZE) _usersim_dispatch_lock
+{
+    volatile long owner;   ///< Id of the owning thread, or 0 if not owned.
+    volatile long waiters; ///< Number of threads parked on owner.
+} usersim_dispatch_lock_t;
 
-static NTSTATUS
-_wait_for_kevent(_Inout_ KEVENT* event, _In_opt_ PLARGE_INTEGER timeout);
+static uint32_t _usersim_original_priority_class;
+static std::vector<usersim_dispatch_lock_t> _usersim_dispatch_locks;
+static volatile usersim_irql_mode_t _usersim_irql_mode = USERSIM_IRQL_MODE_STRICT;
 
-usersim_result_t
-usersim_initialize_irql()
+/**
+ * @brief Acquire the dispatch lock of a CPU, spinning briefly and then parking if it is contended.
+ *
+ * @param[in] processor_index Index of the CPU.
+ */
+static void
+_usersim_acquire_dispatch_lock(uint32_t processor_index)
 {
-    usersim_result_t result;
-
-    _usersim_threadpool = CreateThreadpool(nullptr);
-    if (_usersim_threadpool == nullptr) {
-        result = win32_error_to_usersim_error(GetLastError());
-        goto Exit;
+    usersim_dispatch_lock_t* lock = &_usersim_dispatch_locks[processor_index];
+    long thread_id = (long)GetCurrentThreadId();
+    for (uint32_t spin_count = 0;; spin_count++) {
+        long owner = InterlockedCompareExchange(&lock->owner, thread_id, 0);
+        if (owner == 0) {
+            return;
+        }
+        ASSERT(owner != thread_id);
+        if (spin_count < USERSIM_DISPATCH_LOCK_SPIN_COUNT) {
+            YieldProcessor();
+            continue;
+        }
+        InterlockedIncrement(&lock->waiters);
+        WaitOnAddress(&lock->owner, &owner, sizeof(owner), INFINITE);
+        InterlockedDecrement(&lock->waiters);
     }
+}
 
-    // Reserve one thread per processor.
-    if (!SetThreadpoolThreadMinimum(_usersim_threadpool, cxplat_get_maximum_processor_count())) {
-        result = win32_error_to_usersim_error(GetLastError());
-        goto Exit;
+/**
+ * @brief Release the dispatch lock of a CPU.
+ *
+ * @param[in] processor_index Index of the CPU.
+ */
+static void
+_usersim_release_dispatch_lock(uint32_t processor_index)
+{
+    usersim_dispatch_lock_t* lock = &_usersim_dispatch_locks[processor_index];
+    ASSERT(lock->owner == (long)GetCurrentThreadId());
+    InterlockedExchange(&lock->owner, 0);
+    if (lock->waiters > 0) {
+        WakeByAddressSingle((void*)&lock->owner);
     }
+}
 
-    _usersim_threadpool_callback_environment = std::make_optional<TP_CALLBACK_ENVIRON>();
-
-    InitializeThreadpoolEnvironment(&_usersim_threadpool_callback_environment.value());
+usersim_result_t
+usersim_initialize_irql(usersim_irql_mode_t mode)
+{
+    usersim_result_t result;
 
-    SetThreadpoolCallbackPool(&_usersim_threadpool_callback_environment.value(), _usersim_threadpool);
+    _usersim_irql_mode = mode;
 
     _usersim_original_priority_class = GetPriorityClass(GetCurrentProcess());
     if (_usersim_original_priority_class == 0) {
@@ -73,22 +113,11 @@ usersim_initialize_irql()
         goto Exit;
     }
 
-    _usersim_dispatch_locks = std::move(std::vector<std::mutex>(GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS)));
+    _usersim_dispatch_locks = std::vector<usersim_dispatch_lock_t>(GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS));
 
     result = STATUS_SUCCESS;
 
 Exit:
-    if (result != STATUS_SUCCESS) {
-        if (_usersim_threadpool_callback_environment.has_value()) {
-            DestroyThreadpoolEnvironment(&_usersim_threadpool_callback_environment.value());
-            _usersim_threadpool_callback_environment.reset();
-        }
-        if (_usersim_threadpool != nullptr) {
-            CloseThreadpool(_usersim_threadpool);
-            _usersim_threadpool = nullptr;
-        }
-    }
-
     return result;
 }
 
@@ -102,15 +131,22 @@ usersim_clean_up_irql()
 
         _usersim_original_priority_class = 0;
     }
+}
 
-    if (_usersim_threadpool_callback_environment.has_value()) {
-        DestroyThreadpoolEnvironment(&_usersim_threadpool_callback_environment.value());
-        _usersim_threadpool_callback_environment.reset();
-    }
-    if (_usersim_threadpool != nullptr) {
-        CloseThreadpool(_usersim_threadpool);
-        _usersim_threadpool = nullptr;
-    }
+usersim_irql_mode_t
+usersim_set_irql_mode(usersim_irql_mode_t mode)
+{
+    // Threads that are already at DISPATCH_LEVEL remember which mode they raised in, so switching
+    // only affects subsequent raises.
+    ASSERT(KeGetCurrentIrql() < DISPATCH_LEVEL);
+    return (usersim_irql_mode_t)InterlockedExchange((volatile long*)&_usersim_irql_mode, mode);
+}
+
+bool
+usersim_get_current_virtual_processor(_Out_ uint32_t* processor_index)
+{
+    *processor_index = _usersim_virtual_processor;
+    return _usersim_irql_raised_fast;
 }
 
 /**
@@ -228,6 +264,20 @@ KeRaiseIrql(_In_ KIRQL new_irql, _Out_ PKIRQL old_irql)
 _IRQL_requires_max_(HIGH_LEVEL) _IRQL_raises_(new_irql) _IRQL_saves_ KIRQL KfRaiseIrql(_In_ KIRQL new_irql)
 {
     KIRQL old_irql = KeGetCurrentIrql();
+    if (_usersim_irql_mode == USERSIM_IRQL_MODE_FAST) {
+        // Track the IRQL and processor in thread state only. The thread keeps running wherever the
+        // scheduler puts it, but emulates the processor it raised on for as long as it holds that
+        // processor's dispatch lock.
+        if (new_irql >= DISPATCH_LEVEL && old_irql < DISPATCH_LEVEL) {
+            uint32_t processor_index = KeGetCurrentProcessorNumberEx(nullptr);
+            _usersim_acquire_dispatch_lock(processor_index);
+            _usersim_virtual_processor = processor_index;
+            _usersim_irql_raised_fast = true;
+        }
+        _usersim_current_irql = new_irql;
+        return old_irql;
+    }
+
     _usersim_current_irql = new_irql;
     BOOL result = _set_current_thread_priority_by_irql(new_irql);
     ASSERT(result);
@@ -240,7 +290,7 @@ _IRQL_requires_max_(HIGH_LEVEL) _IRQL_raises_(new_irql) _IRQL_saves_ KIRQL KfRai
         new_affinity.Mask = (ULONG_PTR)1 << processor.Number;
         result = usersim_set_current_thread_affinity(&new_affinity, &_usersim_group_before_raise_irql);
         ASSERT(result);
-        _usersim_dispatch_locks[processor_index].lock();
+        _usersim_acquire_dispatch_lock(processor_index);
     }
 
     return old_irql;
@@ -258,9 +308,18 @@ void
 KeLowerIrql(_In_ KIRQL new_irql)
 {
     BOOL result;
+    if (_usersim_irql_raised_fast) {
+        // The IRQL was raised in fast mode, so there is no priority or affinity to restore.
+        if (new_irql < DISPATCH_LEVEL) {
+            _usersim_irql_raised_fast = false;
+            _usersim_release_dispatch_lock(_usersim_virtual_processor);
+        }
+        _usersim_current_irql = new_irql;
+        return;
+    }
     if (_usersim_current_irql >= DISPATCH_LEVEL && new_irql < DISPATCH_LEVEL) {
         uint32_t processor_index = KeGetCurrentProcessorNumberEx(nullptr);
-        _usersim_dispatch_locks[processor_index].unlock();
+        _usersim_release_dispatch_lock(processor_index);
         result = usersim_set_current_thread_affinity(&_usersim_group_before_raise_irql, nullptr);
         ASSERT(result);
     }
@@ -419,35 +478,135 @@ KeGetCurrentThread(VOID) { return (PKTHREAD)usersim_get_current_thread_id(); }
 
 #pragma endregion threads
 
-#pragma region semaphores
+#pragma region dispatcher_objects
 
-static std::vector<HANDLE>* g_usersim_semaphore_handles = nullptr;
+// Protects the wait list of every dispatcher object. Object state itself is updated with interlocked
+// operations, so this lock is only taken by threads that have to park and by signalers that find
+// parked waiters.
+static SRWLOCK _usersim_dispatcher_lock = SRWLOCK_INIT;
 
-_IRQL_requires_max_(DISPATCH_LEVEL) NTKERNELAPI VOID
-    KeInitializeSemaphore(_Out_ PRKSEMAPHORE semaphore, _In_ LONG count, _In_ LONG limit)
+/**
+ * @brief Initialize the fields shared by all dispatcher objects.
+ *
+ * @param[out] header Header to initialize.
+ * @param[in] object_type Type of the object that contains the header.
+ */
+static void
+_usersim_initialize_dispatcher_header(_Out_ usersim_dispatcher_header_t* header, usersim_object_type_t object_type)
+{
+    header->object_type = object_type;
+    header->waiters = 0;
+    usersim_list_initialize(&header->wait_list);
+}
+
+/**
+ * @brief Wake every thread parked on a dispatcher object after its state changed.
+ * The woken threads re-check the state of all the objects they wait on, so a thread that
+ * loses the race for the object simply parks again.
+ *
+ * @param[in,out] header Header of the object whose state changed.
+ */
+static void
+_usersim_wake_waiters(_Inout_ usersim_dispatcher_header_t* header)
 {
-    semaphore->handle = CreateSemaphore(nullptr, count, limit, nullptr);
-    ASSERT(semaphore->handle != INVALID_HANDLE_VALUE);
-    semaphore->object_type = USERSIM_OBJECT_TYPE_SEMAPHORE;
+    // A waiter registers itself before re-checking object state, so if none is registered here,
+    // any thread about to park will observe the new state and not sleep.
+    MemoryBarrier();
+    if (header->waiters == 0) {
+        return;
+    }
 
-    // There is no kernel function to uninitialize a semaphore, but there is in user mode,
-    // so add the handle to a list we can clean up later.
-    if (g_usersim_semaphore_handles == nullptr) {
-        g_usersim_semaphore_handles = new std::vector<HANDLE>();
+    AcquireSRWLockExclusive(&_usersim_dispatcher_lock);
+    for (usersim_list_entry_t* entry = header->wait_list.Flink; entry != &header->wait_list; entry = entry->Flink) {
+        KWAIT_BLOCK* wait_block = CONTAINING_RECORD(entry, KWAIT_BLOCK, wait_list_entry);
+        InterlockedExchange(wait_block->wake_address, 1);
+        WakeByAddressSingle((void*)wait_block->wake_address);
     }
-    g_usersim_semaphore_handles->push_back(semaphore->handle);
+    ReleaseSRWLockExclusive(&_usersim_dispatcher_lock);
 }
 
-void
-usersim_free_semaphores()
+/**
+ * @brief Convert an absolute system time into a delay from now. System time can differ from interrupt
+ * time by an arbitrary offset, so absolute times must be converted before being compared to interrupt time.
+ *
+ * @param[in] system_time Absolute system time, in 100ns units.
+ * @return Delay in 100ns units, or 0 if the time has already passed.
+ */
+static uint64_t
+_usersim_system_time_to_delay(uint64_t system_time)
 {
-    if (g_usersim_semaphore_handles) {
-        for (auto handle : *g_usersim_semaphore_handles) {
-            ::CloseHandle(handle);
+    FILETIME file_time;
+    GetSystemTimePreciseAsFileTime(&file_time);
+    ULARGE_INTEGER now;
+    now.LowPart = file_time.dwLowDateTime;
+    now.HighPart = file_time.dwHighDateTime;
+    return (system_time > now.QuadPart) ? system_time - now.QuadPart : 0;
+}
+
+/**
+ * @brief Compute the interrupt time at which a wait should time out.
+ *
+ * @param[in] timeout The timeout for the wait, or nullptr for no timeout. Negative values are relative
+ * to now, positive values are absolute system time, both in 100ns units.
+ * @return The end time, or UINT64_MAX for no timeout.
+ */
+static uint64_t
+_usersim_get_wait_end_time(_In_opt_ PLARGE_INTEGER timeout)
+{
+    if (timeout == nullptr) {
+        return UINT64_MAX;
+    }
+    uint64_t qpc_time_stamp = 0;
+    uint64_t now = KeQueryInterruptTimePrecise(&qpc_time_stamp);
+    if (timeout->QuadPart > 0) {
+        return now + _usersim_system_time_to_delay((uint64_t)timeout->QuadPart);
+    }
+    return now - timeout->QuadPart;
+}
+
+/**
+ * @brief Park the current thread until the value at an address differs from a captured value,
+ * or until the end time is reached.
+ *
+ * @param[in] address Address to wait on.
+ * @param[in] compare_address Captured value that the value at address must differ from.
+ * @param[in] size Size of the value, in bytes.
+ * @param[in] end_time Interrupt time at which to give up, or UINT64_MAX for no timeout.
+ * @retval true The thread was woken, or the value had already changed. The caller must recheck its condition.
+ * @retval false The end time was reached.
+ */
+static bool
+_usersim_wait_on_address(_In_ volatile void* address, _In_ void* compare_address, size_t size, uint64_t end_time)
+{
+    DWORD timeout_ms = INFINITE;
+    if (end_time != UINT64_MAX) {
+        uint64_t qpc_time_stamp = 0;
+        uint64_t now = KeQueryInterruptTimePrecise(&qpc_time_stamp);
+        if (now >= end_time) {
+            return false;
         }
-        delete g_usersim_semaphore_handles;
-        g_usersim_semaphore_handles = nullptr;
+
+        // Round up, so a wait for less than a millisecond doesn't degrade into a busy loop.
+        timeout_ms = (DWORD)min((end_time - now + 9999) / 10000, (uint64_t)INFINITE - 1);
+    }
+    if (!WaitOnAddress(address, compare_address, size, timeout_ms)) {
+        // Only a timeout is reported as failure; the end time is rechecked on the next call in case
+        // the wait returned early.
+        return GetLastError() != ERROR_TIMEOUT;
     }
+    return true;
+}
+
+#pragma endregion dispatcher_objects
+#pragma region semaphores
+
+_IRQL_requires_max_(DISPATCH_LEVEL) NTKERNELAPI VOID
+    KeInitializeSemaphore(_Out_ PRKSEMAPHORE semaphore, _In_ LONG count, _In_ LONG limit)
+{
+    ASSERT(count >= 0 && count <= limit);
+    _usersim_initialize_dispatcher_header(&semaphore->header, USERSIM_OBJECT_TYPE_SEMAPHORE);
+    semaphore->count = count;
+    semaphore->limit = limit;
 }
 
 _When_(wait == 0, _IRQL_requires_max_(DISPATCH_LEVEL))
@@ -457,80 +616,315 @@ _When_(wait == 0, _IRQL_requires_max_(DISPATCH_LEVEL))
     UNREFERENCED_PARAMETER(increment);
     UNREFERENCED_PARAMETER(wait);
 
-    ASSERT(semaphore->object_type == USERSIM_OBJECT_TYPE_SEMAPHORE);
-    LONG previous_count;
-    ReleaseSemaphore(semaphore->handle, adjustment, &previous_count);
-    ASSERT(previous_count >= 0);
+    ASSERT(semaphore->header.object_type == USERSIM_OBJECT_TYPE_SEMAPHORE);
+    ASSERT(adjustment > 0);
+    LONG previous_count = semaphore->count;
+    for (;;) {
+        if (adjustment > semaphore->limit - previous_count) {
+            // The kernel raises an exception rather than bug checking in this case.
+            RaiseException(STATUS_SEMAPHORE_LIMIT_EXCEEDED, 0, 0, NULL);
+        }
+        LONG observed = InterlockedCompareExchange(&semaphore->count, previous_count + adjustment, previous_count);
+        if (observed == previous_count) {
+            break;
+        }
+        previous_count = observed;
+    }
+
+    _usersim_wake_waiters(&semaphore->header);
     return previous_count;
 }
 
-_IRQL_requires_min_(PASSIVE_LEVEL) _When_((timeout == NULL || timeout->QuadPart != 0), _IRQL_requires_max_(APC_LEVEL))
-    _When_((timeout != NULL && timeout->QuadPart == 0), _IRQL_requires_max_(DISPATCH_LEVEL)) NTKERNELAPI NTSTATUS
-    KeWaitForSingleObject(
-        _In_ _Points_to_data_ PVOID object,
-        _In_ _Strict_type_match_ KWAIT_REASON wait_reason,
-        _In_ __drv_strictType(KPROCESSOR_MODE / enum _MODE, __drv_typeConst) KPROCESSOR_MODE wait_mode,
-        _In_ BOOLEAN alertable,
-        _In_opt_ PLARGE_INTEGER timeout)
+// Returns the current count, so 0 for non-signaled and non-zero for signaled.
+LONG
+KeReadStateSemaphore(_In_ PRKSEMAPHORE semaphore)
 {
-    UNREFERENCED_PARAMETER(wait_reason);
-    UNREFERENCED_PARAMETER(wait_mode);
-    UNREFERENCED_PARAMETER(alertable);
+    ASSERT(semaphore->header.object_type == USERSIM_OBJECT_TYPE_SEMAPHORE);
+    return semaphore->count;
+}
 
-    DWORD timeout_ms = INFINITE;
-    if (timeout != nullptr) {
-        // Timeout is in 100-ns units.
-        // 1 ms == 1000000 ns == 10000 units of 100 ns.
-        timeout_ms = (DWORD)(timeout->QuadPart / 10000);
+#pragma endregion semaphores
+#pragma region mutexes
+
+_IRQL_requires_max_(DISPATCH_LEVEL) NTKERNELAPI VOID KeInitializeMutex(_Out_ PRKMUTEX mutex, _In_ ULONG level)
+{
+    UNREFERENCED_PARAMETER(level);
+
+    _usersim_initialize_dispatcher_header(&mutex->header, USERSIM_OBJECT_TYPE_MUTEX);
+    mutex->owner_thread = nullptr;
+    mutex->recursion_count = 0;
+}
+
+_When_(wait == 0, _IRQL_requires_max_(DISPATCH_LEVEL))
+    _When_(wait == 1, _IRQL_requires_max_(APC_LEVEL)) NTKERNELAPI LONG
+    KeReleaseMutex(_Inout_ PRKMUTEX mutex, _In_ BOOLEAN wait)
+{
+    UNREFERENCED_PARAMETER(wait);
+
+    ASSERT(mutex->header.object_type == USERSIM_OBJECT_TYPE_MUTEX);
+    PKTHREAD current_thread = KeGetCurrentThread();
+    if (mutex->owner_thread != current_thread) {
+        KeBugCheckEx(THREAD_NOT_MUTEX_OWNER, (ULONG_PTR)mutex, (ULONG_PTR)mutex->owner_thread, 0, 0);
+    }
+
+    // Report the signal state the kernel would have had before the release: 1 - (number of acquisitions).
+    LONG previous_state = 1 - mutex->recursion_count;
+    if (--mutex->recursion_count == 0) {
+        InterlockedExchangePointer((void* volatile*)&mutex->owner_thread, nullptr);
+        _usersim_wake_waiters(&mutex->header);
+    }
+    return previous_state;
+}
+
+// Returns 1 if the mutex is not owned, otherwise 1 - (number of times the owner has acquired it).
+LONG
+KeReadStateMutex(_In_ PRKMUTEX mutex)
+{
+    ASSERT(mutex->header.object_type == USERSIM_OBJECT_TYPE_MUTEX);
+    PKTHREAD owner = mutex->owner_thread;
+    if (owner == nullptr) {
+        return 1;
     }
+    return (owner == KeGetCurrentThread()) ? 1 - mutex->recursion_count : 0;
+}
+
+#pragma endregion mutexes
+#pragma region waits
 
-    // TODO: Unify semaphore and event handling once https://github.com/microsoft/usersim/issues/95
-    // is fixed.
+/**
+ * @brief Check whether a dispatcher object is signaled for the current thread, without changing its state.
+ *
+ * @param[in] header Header of the object.
+ * @retval true The object is signaled.
+ * @retval false The object is not signaled.
+ */
+static bool
+_usersim_is_object_signaled(_In_ usersim_dispatcher_header_t* header)
+{
+    switch (header->object_type) {
+    case USERSIM_OBJECT_TYPE_SEMAPHORE:
+        return ((KSEMAPHORE*)header)->count > 0;
+    case USERSIM_OBJECT_TYPE_MUTEX: {
+        PKTHREAD owner = ((KMUTEX*)header)->owner_thread;
+        return owner == nullptr || owner == KeGetCurrentThread();
+    }
+    case USERSIM_OBJECT_TYPE_EVENT:
+        return ((KEVENT*)header)->signaled;
+    case USERSIM_OBJECT_TYPE_TIMER:
+        return ((KTIMER*)header)->signaled;
+    default:
+        ASSERT(FALSE);
+        return false;
+    }
+}
 
-    // Get handle from object.
-    usersim_object_type_t type = *(usersim_object_type_t*)object;
-    switch (type) {
+/**
+ * @brief Try to satisfy a wait on a dispatcher object, applying the side effects of a successful wait.
+ *
+ * @param[in,out] header Header of the object.
+ * @retval true The wait was satisfied.
+ * @retval false The object is not signaled.
+ */
+static bool
+_usersim_try_acquire_object(_Inout_ usersim_dispatcher_header_t* header)
+{
+    switch (header->object_type) {
     case USERSIM_OBJECT_TYPE_SEMAPHORE: {
-        PRKSEMAPHORE semaphore = (PRKSEMAPHORE)object;
-        DWORD result = WaitForSingleObject(semaphore->handle, timeout_ms);
-        switch (result) {
-        case WAIT_OBJECT_0:
-            return STATUS_SUCCESS;
-        case WAIT_TIMEOUT:
-            return STATUS_TIMEOUT;
-        case WAIT_ABANDONED:
-        case WAIT_FAILED:
-        default:
-            return STATUS_UNSUCCESSFUL;
+        KSEMAPHORE* semaphore = (KSEMAPHORE*)header;
+        LONG count = semaphore->count;
+        while (count > 0) {
+            LONG observed = InterlockedCompareExchange(&semaphore->count, count - 1, count);
+            if (observed == count) {
+                return true;
+            }
+            count = observed;
+        }
+        return false;
+    }
+    case USERSIM_OBJECT_TYPE_MUTEX: {
+        KMUTEX* mutex = (KMUTEX*)header;
+        PKTHREAD current_thread = KeGetCurrentThread();
+        if (mutex->owner_thread == current_thread) {
+            mutex->recursion_count++;
+            return true;
+        }
+        if (InterlockedCompareExchangePointer((void* volatile*)&mutex->owner_thread, current_thread, nullptr) !=
+            nullptr) {
+            return false;
         }
+        mutex->recursion_count = 1;
+        return true;
     }
     case USERSIM_OBJECT_TYPE_EVENT: {
-        return _wait_for_kevent((KEVENT*)object, timeout);
+        KEVENT* event = (KEVENT*)header;
+        if (event->type == NotificationEvent) {
+            return event->signaled;
+        }
+        // Auto-reset events are consumed by the waiter.
+        return InterlockedCompareExchange8((volatile char*)&event->signaled, FALSE, TRUE) == TRUE;
     }
+    case USERSIM_OBJECT_TYPE_TIMER:
+        // Only notification timers are supported, and they stay signaled until reset.
+        return ((KTIMER*)header)->signaled;
     default:
         ASSERT(FALSE);
-        return STATUS_INVALID_PARAMETER;
+        return false;
     }
 }
 
-// Returns 0 for non-signaled, non-zero for signaled.
-LONG
-KeReadStateSemaphore(_In_ PRKSEMAPHORE semaphore)
+/**
+ * @brief Undo the side effects of _usersim_try_acquire_object(), waking any waiters.
+ *
+ * @param[in,out] header Header of the object.
+ */
+static void
+_usersim_release_object(_Inout_ usersim_dispatcher_header_t* header)
 {
-    ASSERT(semaphore->object_type == USERSIM_OBJECT_TYPE_SEMAPHORE);
-    DWORD result = WaitForSingleObject(semaphore->handle, 0);
-    if (result == WAIT_TIMEOUT) {
-        return 0; // Not signaled.
+    switch (header->object_type) {
+    case USERSIM_OBJECT_TYPE_SEMAPHORE:
+        KeReleaseSemaphore((KSEMAPHORE*)header, 0, 1, FALSE);
+        break;
+    case USERSIM_OBJECT_TYPE_MUTEX:
+        KeReleaseMutex((KMUTEX*)header, FALSE);
+        break;
+    case USERSIM_OBJECT_TYPE_EVENT:
+        if (((KEVENT*)header)->type == SynchronizationEvent) {
+            KeSetEvent((KEVENT*)header, 0, FALSE);
+        }
+        break;
+    default:
+        break;
     }
+}
 
-    // Release the reference we just acquired.
-    ReleaseSemaphore(semaphore->handle, 1, nullptr);
+/**
+ * @brief Try to satisfy a WaitAny or WaitAll wait without blocking.
+ *
+ * For WaitAll, objects are acquired one at a time and rolled back if a later one is not signaled,
+ * so other threads may briefly observe some of the objects as acquired. To keep that rare, nothing
+ * is acquired unless all the objects are signaled at the time they are checked.
+ *
+ * @param[in] count Number of objects.
+ * @param[in] objects Headers of the objects.
+ * @param[in] wait_type WaitAny or WaitAll.
+ * @param[out] status Result of the wait if it was satisfied.
+ * @retval true The wait was satisfied.
+ * @retval false The wait was not satisfied and no object state was changed.
+ */
+static bool
+_usersim_try_satisfy_wait(
+    ULONG count, _In_reads_(count) usersim_dispatcher_header_t* objects[], WAIT_TYPE wait_type, _Out_ NTSTATUS* status)
+{
+    if (wait_type == WaitAny) {
+        for (ULONG i = 0; i < count; i++) {
+            if (_usersim_try_acquire_object(objects[i])) {
+                *status = STATUS_WAIT_0 + i;
+                return true;
+            }
+        }
+        return false;
+    }
 
-    // Report that the semaphore is signaled.
-    return 1;
+    for (ULONG i = 0; i < count; i++) {
+        if (!_usersim_is_object_signaled(objects[i])) {
+            return false;
+        }
+    }
+    for (ULONG i = 0; i < count; i++) {
+        if (!_usersim_try_acquire_object(objects[i])) {
+            while (i-- > 0) {
+                _usersim_release_object(objects[i]);
+            }
+            return false;
+        }
+    }
+    *status = STATUS_SUCCESS;
+    return true;
 }
 
-#pragma endregion semaphores
+_IRQL_requires_min_(PASSIVE_LEVEL) _When_((timeout == NULL || timeout->QuadPart != 0), _IRQL_requires_max_(APC_LEVEL))
+    _When_((timeout != NULL && timeout->QuadPart == 0), _IRQL_requires_max_(DISPATCH_LEVEL)) NTKERNELAPI NTSTATUS
+    KeWaitForMultipleObjects(
+        _In_ ULONG count,
+        _In_reads_(count) PVOID object[],
+        _In_ _Strict_type_match_ WAIT_TYPE wait_type,
+        _In_ _Strict_type_match_ KWAIT_REASON wait_reason,
+        _In_ __drv_strictType(KPROCESSOR_MODE / enum _MODE, __drv_typeConst) KPROCESSOR_MODE wait_mode,
+        _In_ BOOLEAN alertable,
+        _In_opt_ PLARGE_INTEGER timeout,
+        _Out_opt_ PKWAIT_BLOCK wait_block_array)
+{
+    UNREFERENCED_PARAMETER(wait_reason);
+    UNREFERENCED_PARAMETER(wait_mode);
+    UNREFERENCED_PARAMETER(alertable);
+
+    ASSERT(count > 0 && count <= MAXIMUM_WAIT_OBJECTS);
+    ASSERT(wait_type == WaitAny || wait_type == WaitAll);
+    KWAIT_BLOCK thread_wait_blocks[THREAD_WAIT_OBJECTS];
+    if (wait_block_array == nullptr) {
+        ASSERT(count <= THREAD_WAIT_OBJECTS);
+        wait_block_array = thread_wait_blocks;
+    }
+    usersim_dispatcher_header_t** objects = (usersim_dispatcher_header_t**)object;
+
+    NTSTATUS status;
+    if (_usersim_try_satisfy_wait(count, objects, wait_type, &status)) {
+        return status;
+    }
+    if (timeout != nullptr && timeout->QuadPart == 0) {
+        return STATUS_TIMEOUT;
+    }
+    uint64_t end_time = _usersim_get_wait_end_time(timeout);
+
+    // Register on every object, so that a change to any of them wakes this thread. All the wait
+    // blocks share one wake word, so the thread parks in a single place however many objects it waits on.
+    volatile LONG wake = 0;
+    AcquireSRWLockExclusive(&_usersim_dispatcher_lock);
+    for (ULONG i = 0; i < count; i++) {
+        wait_block_array[i].object = objects[i];
+        wait_block_array[i].wake_address = &wake;
+        wait_block_array[i].wait_key = (USHORT)i;
+        usersim_list_insert_tail(&objects[i]->wait_list, &wait_block_array[i].wait_list_entry);
+        InterlockedIncrement(&objects[i]->waiters);
+    }
+    ReleaseSRWLockExclusive(&_usersim_dispatcher_lock);
+
+    for (;;) {
+        // Clear the wake word before checking state, so a signal that arrives after the check is not lost.
+        InterlockedExchange(&wake, 0);
+        if (_usersim_try_satisfy_wait(count, objects, wait_type, &status)) {
+            break;
+        }
+        LONG not_woken = 0;
+        if (!_usersim_wait_on_address(&wake, &not_woken, sizeof(wake), end_time)) {
+            status = STATUS_TIMEOUT;
+            break;
+        }
+    }
+
+    AcquireSRWLockExclusive(&_usersim_dispatcher_lock);
+    for (ULONG i = 0; i < count; i++) {
+        usersim_list_remove_entry(&wait_block_array[i].wait_list_entry);
+        InterlockedDecrement(&objects[i]->waiters);
+    }
+    ReleaseSRWLockExclusive(&_usersim_dispatcher_lock);
+
+    return status;
+}
+
+_IRQL_requires_min_(PASSIVE_LEVEL) _When_((timeout == NULL || timeout->QuadPart != 0), _IRQL_requires_max_(APC_LEVEL))
+    _When_((timeout != NULL && timeout->QuadPart == 0), _IRQL_requires_max_(DISPATCH_LEVEL)) NTKERNELAPI NTSTATUS
+    KeWaitForSingleObject(
+        _In_ _Points_to_data_ PVOID object,
+        _In_ _Strict_type_match_ KWAIT_REASON wait_reason,
+        _In_ __drv_strictType(KPROCESSOR_MODE / enum _MODE, __drv_typeConst) KPROCESSOR_MODE wait_mode,
+        _In_ BOOLEAN alertable,
+        _In_opt_ PLARGE_INTEGER timeout)
+{
+    return KeWaitForMultipleObjects(1, &object, WaitAny, wait_reason, wait_mode, alertable, timeout, nullptr);
+}
+
+#pragma endregion waits
 
 _IRQL_requires_max_(APC_LEVEL) NTKERNELAPI VOID
     KeStackAttachProcess(_Inout_ PRKPROCESS process, _Out_ PRKAPC_STATE apc_state)
@@ -626,10 +1020,43 @@ KeBugCheckEx(
 class _usersim_emulated_dpc;
 static std::vector<std::shared_ptr<_usersim_emulated_dpc>> _usersim_emulated_dpcs;
 
+// Bits in KDPC::state.
+#define USERSIM_DPC_STATE_QUEUED 0x1 ///< The DPC is linked into a per-CPU queue and will run unless it is removed.
+#define USERSIM_DPC_STATE_ARMING 0x2 ///< KeInsertQueueDpc() is still storing the arguments and linking the DPC.
+
+/**
+ * @brief Deferred routine used as the KeFlushQueuedDpcs() marker. Signals the flushing thread.
+ *
+ * @param[in] dpc The marker DPC.
+ * @param[in] deferred_context Pointer to the flag the flushing thread is waiting on.
+ * @param[in] system_argument1 Unused.
+ * @param[in] system_argument2 Unused.
+ */
+static void
+_usersim_flush_dpc_routine(
+    _In_ KDPC* dpc, _In_opt_ void* deferred_context, _In_opt_ void* system_argument1, _In_opt_ void* system_argument2)
+{
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(system_argument1);
+    UNREFERENCED_PARAMETER(system_argument2);
+
+    volatile long* flushed = (volatile long*)deferred_context;
+    InterlockedExchange(flushed, 1);
+    WakeByAddressAll((void*)flushed);
+}
+
 /**
  * @brief This class emulates kernel mode DPCs by maintaining a per-CPU thread running at maximum priority.
  * Work items can be queued to this thread, which then executes them without being interrupted by lower
  * priority threads.
+ *
+ * Producers push onto a multi-producer lock-free stack (the inbox) with a compare-exchange, and only wake the
+ * worker when the stack goes from empty to non-empty. The worker moves the whole inbox to its batch at once,
+ * restores FIFO order, and runs the batch under a single acquisition of the dispatch lock.
+ *
+ * The batch, and the entries behind the head of the inbox, are only changed under the queue mutex. Producers never
+ * take it, but it lets KeRemoveQueueDpc() unlink a DPC wherever it is, so a removed DPC is no longer referenced by
+ * the queue and may be freed or reinitialized.
  */
 class _usersim_emulated_dpc
 {
@@ -641,46 +1068,30 @@ class _usersim_emulated_dpc
      *
      * @param[in] i CPU to run on.
      */
-    _usersim_emulated_dpc(size_t i) : head({}), terminate(false)
+    _usersim_emulated_dpc(size_t i) : inbox(nullptr), batch(nullptr), terminate(false)
     {
-        usersim_list_initialize(&head);
-        usersim_list_initialize(&flush_entry);
+        memset(&terminate_entry, 0, sizeof(terminate_entry));
         thread = std::thread([i, this]() {
             _set_current_thread_priority_by_irql(DISPATCH_LEVEL);
             KeSetSystemAffinityThreadEx((ULONG_PTR)1 << i);
-            std::unique_lock<std::mutex> l(mutex);
             for (;;) {
-                if (terminate) {
-                    _set_current_thread_priority_by_irql(PASSIVE_LEVEL);
-                    return;
+                // The batch is always drained before the worker parks, so only the inbox needs to be checked.
+                if (inbox == nullptr) {
+                    if (terminate) {
+                        break;
+                    }
+
+                    // Park until a producer makes the queue non-empty.
+                    KDPC* empty = nullptr;
+                    WaitOnAddress(&inbox, &empty, sizeof(inbox), INFINITE);
+                    continue;
                 }
 
-                if (!usersim_list_is_empty(&head)) {
-                    auto entry = usersim_list_remove_head_entry(&head);
-                    if (entry == &flush_entry) {
-                        usersim_list_initialize(&flush_entry);
-                        condition_variable.notify_all();
-                    } else {
-                        // Snapshot the arguments under the lock, to make sure
-                        // they are atomic, in case KeInsertQueueDpc() gets called
-                        // in parallel with different arguments.
-                        KDPC* work_item = reinterpret_cast<KDPC*>(entry);
-                        void* context = work_item->context;
-                        void* parameter_1 = work_item->parameter_1;
-                        void* parameter_2 = work_item->parameter_2;
-                        usersim_list_initialize(entry);
-
-                        l.unlock();
-                        _usersim_dispatch_locks[i].lock();
-                        _usersim_current_irql = DISPATCH_LEVEL;
-                        work_item->work_item_routine(work_item, context, parameter_1, parameter_2);
-                        _usersim_dispatch_locks[i].unlock();
-                        _usersim_current_irql = PASSIVE_LEVEL;
-                        l.lock();
-                    }
+                if (!drain(i)) {
+                    break;
                 }
-                condition_variable.wait(l, [this]() { return terminate || !usersim_list_is_empty(&head); });
             }
+            _set_current_thread_priority_by_irql(PASSIVE_LEVEL);
         });
     }
 
@@ -691,22 +1102,13 @@ class _usersim_emulated_dpc
     ~_usersim_emulated_dpc()
     {
         _set_current_thread_priority_by_irql(PASSIVE_LEVEL);
-        // Set the flag to terminate the thread while holding the lock, to make
-        // sure the thread is not in the middle of a wait.
-        {
-            std::unique_lock<std::mutex> l(mutex);
-            terminate = true;
-        }
-        condition_variable.notify_all();
-        thread.join();
 
-        // On process termination, the system may have killed the thread before
-        // it could release the mutex. If that happens, the kernel will have
-        // released the mutex, but the user-mode class won't know that yet.
-        // Work around this issue by trying to take the mutex here (forcing
-        // user-mode to be reconciled with the actual kernel-mode state), to
-        // avoid the mutex destructor asserting due to destruction without releasing.
-        std::unique_lock<std::mutex> l(mutex);
+        // Set the flag before pushing the marker, so the worker observes it as soon as the
+        // queue becomes non-empty, even if it was about to park.
+        terminate = true;
+        terminate_entry.state = USERSIM_DPC_STATE_QUEUED;
+        push(&terminate_entry);
+        thread.join();
     }
 
     /**
@@ -716,13 +1118,17 @@ class _usersim_emulated_dpc
     void
     flush_queue()
     {
-        std::unique_lock<std::mutex> l(mutex);
-        // Insert a marker in the queue.
-        usersim_list_initialize(&flush_entry);
-        usersim_list_insert_tail(&head, &flush_entry);
-        condition_variable.notify_all();
+        // Insert a marker in the queue. Each caller uses its own marker, so concurrent flushes don't interfere.
+        volatile long flushed = 0;
+        KDPC marker;
+        KeInitializeDpc(&marker, _usersim_flush_dpc_routine, (void*)&flushed);
+        enqueue(&marker, nullptr, nullptr);
+
         // Wait until the marker is processed.
-        condition_variable.wait(l, [this]() { return terminate || usersim_list_is_empty(&flush_entry); });
+        long not_flushed = 0;
+        while (flushed == 0) {
+            WaitOnAddress(&flushed, &not_flushed, sizeof(flushed), INFINITE);
+        }
     }
 
     /**
@@ -737,17 +1143,7 @@ class _usersim_emulated_dpc
     static bool
     insert(_Inout_ KDPC* work_item, _Inout_opt_ void* parameter_1, _Inout_opt_ void* parameter_2)
     {
-        _usersim_emulated_dpc& dpc_queue = *_usersim_emulated_dpcs[work_item->cpu_id].get();
-        std::unique_lock<std::mutex> l(dpc_queue.mutex);
-        if (!usersim_list_is_empty(&work_item->entry)) {
-            return false;
-        } else {
-            work_item->parameter_1 = parameter_1;
-            work_item->parameter_2 = parameter_2;
-            usersim_list_insert_tail(&dpc_queue.head, &work_item->entry);
-            dpc_queue.condition_variable.notify_all();
-            return true;
-        }
+        return _usersim_emulated_dpcs[work_item->cpu_id]->enqueue(work_item, parameter_1, parameter_2);
     }
 
     /**
@@ -760,22 +1156,233 @@ class _usersim_emulated_dpc
     static bool
     remove(_Inout_ KDPC* work_item)
     {
-        _usersim_emulated_dpc& dpc_queue = *_usersim_emulated_dpcs[work_item->cpu_id].get();
-        std::unique_lock<std::mutex> l(dpc_queue.mutex);
-        if (usersim_list_is_empty(&work_item->entry)) {
+        if (!(work_item->state & USERSIM_DPC_STATE_QUEUED)) {
             return false;
         }
-        usersim_list_remove_entry(&work_item->entry);
-        return true;
+        return _usersim_emulated_dpcs[work_item->cpu_id]->dequeue(work_item);
     }
 
   private:
-    usersim_list_entry_t flush_entry;
-    usersim_list_entry_t head;
-    std::thread thread;
-    std::mutex mutex;
-    std::condition_variable condition_variable;
-    bool terminate;
+    /**
+     * @brief Mark a work item as queued and link it into this queue.
+     *
+     * @param[in, out] work_item Work item to be enqueued.
+     * @param[in] parameter_1 Parameter to pass to worker function.
+     * @param[in] parameter_2 Parameter to pass to worker function.
+     * @retval true Work item wasn't already queued.
+     * @retval false Work item is already queued.
+     */
+    bool
+    enqueue(_Inout_ KDPC* work_item, _Inout_opt_ void* parameter_1, _Inout_opt_ void* parameter_2)
+    {
+        long state = work_item->state;
+        for (;;) {
+            if (state & USERSIM_DPC_STATE_QUEUED) {
+                return false;
+            }
+            long new_state = state | USERSIM_DPC_STATE_QUEUED | USERSIM_DPC_STATE_ARMING;
+            long old_state = InterlockedCompareExchange(&work_item->state, new_state, state);
+            if (old_state == state) {
+                break;
+            }
+            state = old_state;
+        }
+
+        // The DPC is neither claimed nor removed while the arming bit is set, so the arguments are seen atomically
+        // even if KeInsertQueueDpc() gets called in parallel with different arguments, and a DPC that is queued
+        // without the arming bit is always linked.
+        work_item->parameter_1 = parameter_1;
+        work_item->parameter_2 = parameter_2;
+        push(work_item);
+        InterlockedAnd(&work_item->state, ~USERSIM_DPC_STATE_ARMING);
+        return true;
+    }
+
+    /**
+     * @brief Unlink a queued work item from this queue.
+     *
+     * @param[in, out] work_item Work item to be dequeued.
+     * @retval false Work item wasn't queued.
+     * @retval true Work item was queued.
+     */
+    bool
+    dequeue(_Inout_ KDPC* work_item)
+    {
+        std::unique_lock lock(mutex);
+        if (!(wait_until_armed(work_item) & USERSIM_DPC_STATE_QUEUED)) {
+            // The worker claimed it first.
+            return false;
+        }
+
+        // A queued DPC is either in the batch or in the inbox. Producers only ever replace the head of the inbox,
+        // so the entries behind it can be unlinked under the mutex.
+        if (!unlink(&batch, work_item)) {
+            for (;;) {
+                KDPC* head = inbox;
+                if (head != work_item) {
+                    unlink(&head->next, work_item);
+                    break;
+                }
+                if (InterlockedCompareExchangePointer((void* volatile*)&inbox, work_item->next, head) == head) {
+                    break;
+                }
+            }
+        }
+        work_item->next = nullptr;
+        InterlockedAnd(&work_item->state, ~USERSIM_DPC_STATE_QUEUED);
+        return true;
+    }
+
+    /**
+     * @brief Push a work item onto the lock-free stack, waking the worker if the stack was empty.
+     *
+     * @param[in, out] work_item Work item to push.
+     */
+    void
+    push(_Inout_ KDPC* work_item)
+    {
+        KDPC* head = inbox;
+        for (;;) {
+            work_item->next = head;
+            KDPC* old_head = (KDPC*)InterlockedCompareExchangePointer((void* volatile*)&inbox, work_item, head);
+            if (old_head == head) {
+                break;
+            }
+            head = old_head;
+        }
+
+        if (head == nullptr) {
+            WakeByAddressSingle((void*)&inbox);
+        }
+    }
+
+    /**
+     * @brief Wait for a concurrent KeInsertQueueDpc() to finish arming a work item.
+     *
+     * @param[in] work_item Work item to wait for.
+     * @return State of the work item, without the arming bit.
+     */
+    static long
+    wait_until_armed(_In_ const KDPC* work_item)
+    {
+        long state = work_item->state;
+        while (state & USERSIM_DPC_STATE_ARMING) {
+            YieldProcessor();
+            state = work_item->state;
+        }
+        return state;
+    }
+
+    /**
+     * @brief Unlink a work item from a list.
+     *
+     * @param[in, out] link Link to the first work item of the list.
+     * @param[in] work_item Work item to unlink.
+     * @retval true The work item was found and unlinked.
+     * @retval false The work item isn't in the list.
+     */
+    static bool
+    unlink(_Inout_ KDPC** link, _In_ const KDPC* work_item)
+    {
+        for (; *link != nullptr; link = &(*link)->next) {
+            if (*link == work_item) {
+                *link = work_item->next;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Take the next work item to run off the batch, refilling the batch from the inbox if it is empty.
+     *
+     * @param[out] parameter_1 Snapshot of the first system argument.
+     * @param[out] parameter_2 Snapshot of the second system argument.
+     * @return The work item to run, or nullptr if the queue is empty.
+     */
+    _Ret_maybenull_ KDPC*
+    claim(_Out_ void** parameter_1, _Out_ void** parameter_2)
+    {
+        std::unique_lock lock(mutex);
+        if (batch == nullptr) {
+            // The stack is in LIFO order, so reverse it to run the DPCs in the order they were queued.
+            KDPC* list = (KDPC*)InterlockedExchangePointer((void* volatile*)&inbox, nullptr);
+            while (list != nullptr) {
+                KDPC* next = list->next;
+                list->next = batch;
+                batch = list;
+                list = next;
+            }
+        }
+
+        KDPC* work_item = batch;
+        if (work_item == nullptr) {
+            return nullptr;
+        }
+        batch = work_item->next;
+        work_item->next = nullptr;
+
+        // Once the queued bit is cleared, the DPC may be requeued, so snapshot the arguments first.
+        (void)wait_until_armed(work_item);
+        *parameter_1 = work_item->parameter_1;
+        *parameter_2 = work_item->parameter_2;
+        InterlockedAnd(&work_item->state, ~USERSIM_DPC_STATE_QUEUED);
+        return work_item;
+    }
+
+    /**
+     * @brief Run every queued work item in FIFO order at DISPATCH_LEVEL.
+     *
+     * @param[in] i CPU the batch is running on.
+     * @retval true The queue was drained.
+     * @retval false The queue is terminating.
+     */
+    bool
+    drain(size_t i)
+    {
+        bool result = true;
+        _usersim_acquire_dispatch_lock((uint32_t)i);
+        _usersim_current_irql = DISPATCH_LEVEL;
+        for (;;) {
+            if (terminate) {
+                result = false;
+                break;
+            }
+
+            void* parameter_1;
+            void* parameter_2;
+            KDPC* work_item = claim(&parameter_1, &parameter_2);
+            if (work_item == nullptr) {
+                break;
+            }
+            work_item->work_item_routine(work_item, work_item->context, parameter_1, parameter_2);
+        }
+        _usersim_release_dispatch_lock((uint32_t)i);
+        _usersim_current_irql = PASSIVE_LEVEL;
+
+        if (!result) {
+            // Abandon the remaining work items, but release any threads waiting in KeFlushQueuedDpcs().
+            for (;;) {
+                void* parameter_1;
+                void* parameter_2;
+                KDPC* work_item = claim(&parameter_1, &parameter_2);
+                if (work_item == nullptr) {
+                    break;
+                }
+                if (work_item->work_item_routine == _usersim_flush_dpc_routine) {
+                    work_item->work_item_routine(work_item, work_item->context, nullptr, nullptr);
+                }
+            }
+        }
+        return result;
+    }
+
+    KDPC* volatile inbox;        ///< Lock-free stack of queued work items, most recently pushed first.
+    KDPC* batch;                 ///< Work items taken from the inbox, in FIFO order. Protected by the mutex.
+    std::mutex mutex;            ///< Serializes the worker claiming work items with KeRemoveQueueDpc().
+    KDPC terminate_entry;        ///< Marker pushed to wake the worker when the queue is destroyed.
+    std::thread thread;          ///< Worker thread.
+    std::atomic<bool> terminate; ///< Set when the worker must exit.
 };
 
 void
@@ -784,7 +1391,8 @@ KeInitializeDpc(
     _In_ PKDEFERRED_ROUTINE deferred_routine,
     _In_opt_ __drv_aliasesMem PVOID deferred_context)
 {
-    usersim_list_initialize(&dpc->entry);
+    dpc->next = nullptr;
+    dpc->state = 0;
     dpc->cpu_id = 0;
     dpc->work_item_routine = deferred_routine;
     dpc->context = deferred_context;
@@ -837,38 +1445,340 @@ usersim_clean_up_dpcs()
 #pragma endregion dpcs
 #pragma region timers
 
-// The following mutex currently protects two things that can contain a pointer to a TP_TIMER:
-// 1) the g_usersim_threadpool_timers list, and
-// 2) each KTIMER's threadpool_timer member.
-static std::mutex g_usersim_threadpool_mutex;
+// KTIMERs are kept in a hierarchical timer wheel that is serviced by a single dispatch thread.
+// Level 0 has one slot per tick; each higher level has one slot per full rotation of the level below it.
+// A timer is placed in the lowest level whose range covers its expiration, and is moved ("cascaded")
+// down a level each time the wheel reaches the start of its slot, so arming and canceling are O(1).
+#define USERSIM_TIMER_WHEEL_TICK_100NS 10000 ///< Length of a tick in 100ns units (1 millisecond).
+#define USERSIM_TIMER_WHEEL_LEVELS 4
+#define USERSIM_TIMER_WHEEL_SLOT_BITS 6
+#define USERSIM_TIMER_WHEEL_SLOTS (1 << USERSIM_TIMER_WHEEL_SLOT_BITS)
+#define USERSIM_TIMER_WHEEL_RANGE (1ull << (USERSIM_TIMER_WHEEL_SLOT_BITS * USERSIM_TIMER_WHEEL_LEVELS))
 
-// The following is a list of all TP_TIMER objects that are in use.
-static std::vector<TP_TIMER*>* g_usersim_threadpool_timers = nullptr;
+/**
+ * @brief Get the current interrupt time in timer wheel ticks.
+ *
+ * @return Number of whole ticks elapsed.
+ */
+static uint64_t
+_usersim_timer_wheel_now()
+{
+    ULONGLONG interrupt_time;
+    QueryInterruptTimePrecise(&interrupt_time);
+    return interrupt_time / USERSIM_TIMER_WHEEL_TICK_100NS;
+}
 
-void
-KeInitializeTimer(_Out_ PKTIMER timer)
+/**
+ * @brief Convert a KeSetTimer() style due time into an expiration tick.
+ *
+ * @param[in] due_time Negative values are relative to now, positive values are absolute system time,
+ * both in 100ns units.
+ * @param[in] tolerable_delay Delay in milliseconds that the caller can tolerate. The expiration is
+ * rounded up to a multiple of the largest power of two not exceeding it, so that timers with similar
+ * due times share a slot and expire together.
+ * @return Expiration tick.
+ */
+static uint64_t
+_usersim_timer_due_time_to_tick(LARGE_INTEGER due_time, ULONG tolerable_delay)
 {
-    memset(timer, 0, sizeof(*timer));
-    timer->object_type = USERSIM_OBJECT_TYPE_TIMER;
+    ULONGLONG interrupt_time;
+    QueryInterruptTimePrecise(&interrupt_time);
+
+    uint64_t expiration = interrupt_time;
+    if (due_time.QuadPart < 0) {
+        expiration += (uint64_t)(-due_time.QuadPart);
+    } else {
+        expiration += _usersim_system_time_to_delay((uint64_t)due_time.QuadPart);
+    }
+
+    uint64_t tick = (expiration + USERSIM_TIMER_WHEEL_TICK_100NS - 1) / USERSIM_TIMER_WHEEL_TICK_100NS;
+    if (tolerable_delay > 0) {
+        uint64_t granularity = std::bit_floor((uint64_t)tolerable_delay);
+        tick = (tick + granularity - 1) & ~(granularity - 1);
+    }
+    return tick;
 }
 
-VOID CALLBACK
-_usersim_timer_callback(
-    _Inout_ PTP_CALLBACK_INSTANCE instance, _Inout_opt_ PVOID context, _Inout_ PTP_TIMER threadpool_timer)
+/**
+ * @brief This class implements the timer wheel and the thread that expires timers from it.
+ * All wheel state, including the wheel_entry, expiration_tick and signaled members of each
+ * armed KTIMER, is protected by the wheel mutex. Expired timers are signaled and their DPCs
+ * queued while holding the mutex, so once KeCancelTimer() returns the wheel no longer
+ * references the timer.
+ */
+class _usersim_timer_wheel
 {
-    UNREFERENCED_PARAMETER(instance);
-    UNREFERENCED_PARAMETER(threadpool_timer);
+  public:
+    _usersim_timer_wheel()
+        : current_tick(_usersim_timer_wheel_now()), next_wake_tick(UINT64_MAX), wake_generation(0), terminate(false)
+    {
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                usersim_list_initialize(&slot);
+            }
+        }
+        memset(occupied, 0, sizeof(occupied));
+        thread = std::thread([this]() { run(); });
+    }
 
-    PKTIMER timer = (PKTIMER)context;
-    if (timer == nullptr) {
-        return;
+    /**
+     * @brief Stop the dispatch thread and detach any timers that are still armed.
+     *
+     */
+    ~_usersim_timer_wheel()
+    {
+        terminate = true;
+        wake();
+        thread.join();
+
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                while (!usersim_list_is_empty(&slot)) {
+                    usersim_list_remove_entry(slot.Flink);
+                }
+            }
+        }
     }
-    ASSERT(timer->object_type == USERSIM_OBJECT_TYPE_TIMER);
-    timer->signaled = TRUE;
 
-    if (timer->dpc) {
-        KeInsertQueueDpc(timer->dpc, timer->dpc->parameter_1, timer->dpc->parameter_2);
+    /**
+     * @brief Arm a timer, replacing any previous expiration.
+     *
+     * @param[in, out] timer Timer to arm.
+     * @param[in] expiration_tick Tick at which the timer expires.
+     * @param[in] period Period in milliseconds, or 0 for a one-shot timer.
+     * @param[in] dpc Optional DPC to queue when the timer expires.
+     * @retval TRUE The timer was already armed.
+     * @retval FALSE The timer was not armed.
+     */
+    BOOLEAN
+    set(_Inout_ KTIMER* timer, uint64_t expiration_tick, ULONG period, _In_opt_ KDPC* dpc)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        BOOLEAN was_armed = unlink(timer);
+        timer->signaled = FALSE;
+        timer->dpc = dpc;
+        timer->period = period;
+        timer->expiration_tick = expiration_tick;
+        link(timer);
+
+        // Only interrupt the dispatch thread if it would otherwise sleep past this timer.
+        if (expiration_tick < next_wake_tick) {
+            next_wake_tick = expiration_tick;
+            wake();
+        }
+        return was_armed;
     }
+
+    /**
+     * @brief Disarm a timer and reset it to the non-signaled state.
+     *
+     * @param[in, out] timer Timer to cancel.
+     * @retval TRUE The timer was armed.
+     * @retval FALSE The timer was not armed.
+     */
+    BOOLEAN
+    cancel(_Inout_ KTIMER* timer)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        BOOLEAN was_armed = unlink(timer);
+        timer->signaled = FALSE;
+        return was_armed;
+    }
+
+  private:
+    void
+    run()
+    {
+        for (;;) {
+            // Sample the generation before computing the timeout, so a timer armed in between makes the wait
+            // return immediately instead of being missed.
+            long generation = wake_generation;
+            DWORD timeout_ms = INFINITE;
+            {
+                std::unique_lock<std::mutex> l(mutex);
+                if (terminate) {
+                    break;
+                }
+                advance(_usersim_timer_wheel_now());
+                next_wake_tick = next_expiration_tick();
+                if (next_wake_tick != UINT64_MAX) {
+                    timeout_ms = (DWORD)min(next_wake_tick - current_tick, (uint64_t)INFINITE - 1);
+                }
+            }
+            WaitOnAddress(&wake_generation, &generation, sizeof(generation), timeout_ms);
+        }
+    }
+
+    void
+    wake()
+    {
+        InterlockedIncrement(&wake_generation);
+        WakeByAddressSingle((void*)&wake_generation);
+    }
+
+    /**
+     * @brief Insert a timer into the slot covering its expiration tick.
+     *
+     * @param[in, out] timer Timer to insert. Must not currently be linked.
+     */
+    void
+    link(_Inout_ KTIMER* timer)
+    {
+        uint64_t expiration = max(timer->expiration_tick, current_tick + 1);
+        uint64_t delta = expiration - current_tick;
+        if (delta >= USERSIM_TIMER_WHEEL_RANGE) {
+            // Park timers beyond the wheel's range in the farthest slot; they are re-placed when it cascades.
+            expiration = current_tick + USERSIM_TIMER_WHEEL_RANGE - 1;
+            delta = USERSIM_TIMER_WHEEL_RANGE - 1;
+        }
+
+        size_t level = 0;
+        while (delta >= (1ull << (USERSIM_TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+        size_t slot = (expiration >> (USERSIM_TIMER_WHEEL_SLOT_BITS * level)) & (USERSIM_TIMER_WHEEL_SLOTS - 1);
+        usersim_list_insert_tail(&slots[level][slot], &timer->wheel_entry);
+        occupied[level] |= 1ull << slot;
+    }
+
+    /**
+     * @brief Remove a timer from the wheel if it is armed.
+     *
+     * @param[in, out] timer Timer to remove.
+     * @retval TRUE The timer was armed.
+     * @retval FALSE The timer was not armed.
+     */
+    BOOLEAN
+    unlink(_Inout_ KTIMER* timer)
+    {
+        if (usersim_list_is_empty(&timer->wheel_entry)) {
+            return FALSE;
+        }
+
+        // If the timer is the only entry in its slot, both neighbors are the slot's list head.
+        usersim_list_entry_t* neighbor = timer->wheel_entry.Blink;
+        if (usersim_list_remove_entry(&timer->wheel_entry)) {
+            size_t index = neighbor - &slots[0][0];
+            occupied[index / USERSIM_TIMER_WHEEL_SLOTS] &= ~(1ull << (index % USERSIM_TIMER_WHEEL_SLOTS));
+        }
+        return TRUE;
+    }
+
+    /**
+     * @brief Re-insert every timer in a slot relative to the current tick.
+     *
+     * @param[in] level Level of the slot.
+     * @param[in] slot Index of the slot.
+     */
+    void
+    cascade(size_t level, size_t slot)
+    {
+        // Every timer in the slot now lands in a lower level (or, if still out of range, in a different
+        // slot of the top level), so the slot can be drained in place.
+        while (!usersim_list_is_empty(&slots[level][slot])) {
+            usersim_list_entry_t* entry = slots[level][slot].Flink;
+            usersim_list_remove_entry(entry);
+            link(CONTAINING_RECORD(entry, KTIMER, wheel_entry));
+        }
+        occupied[level] &= ~(1ull << slot);
+    }
+
+    /**
+     * @brief Signal a timer that has reached its expiration, queue its DPC, and re-arm it if periodic.
+     *
+     * @param[in, out] timer Timer that expired. Must already be unlinked.
+     */
+    void
+    expire(_Inout_ KTIMER* timer)
+    {
+        timer->signaled = TRUE;
+        _usersim_wake_waiters(&timer->header);
+        if (timer->period != 0) {
+            // Skip any periods that were missed rather than firing them back to back.
+            timer->expiration_tick = max(timer->expiration_tick + timer->period, current_tick + 1);
+            link(timer);
+        }
+        if (timer->dpc) {
+            KeInsertQueueDpc(timer->dpc, timer->dpc->parameter_1, timer->dpc->parameter_2);
+        }
+    }
+
+    /**
+     * @brief Move the wheel forward to a given tick, expiring every timer that is due.
+     *
+     * @param[in] now_tick Tick to advance to.
+     */
+    void
+    advance(uint64_t now_tick)
+    {
+        while (current_tick < now_tick) {
+            if ((occupied[0] | occupied[1] | occupied[2] | occupied[3]) == 0) {
+                current_tick = now_tick;
+                break;
+            }
+            if (occupied[0] == 0) {
+                // Nothing can expire before the next level 0 rotation, so skip straight to it.
+                current_tick = min(current_tick | (USERSIM_TIMER_WHEEL_SLOTS - 1), now_tick - 1);
+            }
+            current_tick++;
+
+            for (size_t level = USERSIM_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+                size_t shift = USERSIM_TIMER_WHEEL_SLOT_BITS * level;
+                if ((current_tick & ((1ull << shift) - 1)) == 0) {
+                    cascade(level, (current_tick >> shift) & (USERSIM_TIMER_WHEEL_SLOTS - 1));
+                }
+            }
+
+            size_t slot = current_tick & (USERSIM_TIMER_WHEEL_SLOTS - 1);
+            while (!usersim_list_is_empty(&slots[0][slot])) {
+                usersim_list_entry_t* entry = slots[0][slot].Flink;
+                usersim_list_remove_entry(entry);
+                expire(CONTAINING_RECORD(entry, KTIMER, wheel_entry));
+            }
+            occupied[0] &= ~(1ull << slot);
+        }
+    }
+
+    /**
+     * @brief Compute the next tick at which the dispatch thread has work to do.
+     *
+     * @return The next expiration or cascade tick, or UINT64_MAX if no timers are armed.
+     */
+    uint64_t
+    next_expiration_tick()
+    {
+        if (occupied[0] != 0) {
+            // Rotate the occupancy bitmap so that bit 0 corresponds to the next tick.
+            int shift = (int)((current_tick + 1) & (USERSIM_TIMER_WHEEL_SLOTS - 1));
+            return current_tick + 1 + std::countr_zero(std::rotr(occupied[0], shift));
+        }
+        for (size_t level = 1; level < USERSIM_TIMER_WHEEL_LEVELS; level++) {
+            if (occupied[level] != 0) {
+                size_t shift = USERSIM_TIMER_WHEEL_SLOT_BITS * level;
+                return ((current_tick >> shift) + 1) << shift;
+            }
+        }
+        return UINT64_MAX;
+    }
+
+    std::mutex mutex;
+    usersim_list_entry_t slots[USERSIM_TIMER_WHEEL_LEVELS][USERSIM_TIMER_WHEEL_SLOTS];
+    uint64_t occupied[USERSIM_TIMER_WHEEL_LEVELS]; ///< Bitmap of non-empty slots in each level.
+    uint64_t current_tick;                         ///< Last tick that has been processed.
+    uint64_t next_wake_tick;                       ///< Tick at which the dispatch thread will next wake up.
+    volatile long wake_generation;                 ///< Incremented to wake the dispatch thread.
+    std::atomic<bool> terminate;
+    std::thread thread;
+};
+
+static std::unique_ptr<_usersim_timer_wheel> _usersim_timer_wheel_instance;
+
+void
+KeInitializeTimer(_Out_ PKTIMER timer)
+{
+    memset(timer, 0, sizeof(*timer));
+    _usersim_initialize_dispatcher_header(&timer->header, USERSIM_OBJECT_TYPE_TIMER);
+    usersim_list_initialize(&timer->wheel_entry);
 }
 
 BOOLEAN
@@ -887,88 +1797,45 @@ BOOLEAN
 KeSetCoalescableTimer(
     _Inout_ PKTIMER timer, LARGE_INTEGER due_time, ULONG period, ULONG tolerable_delay, _In_opt_ PKDPC dpc)
 {
-    ASSERT(dpc != nullptr);
-    ASSERT(timer->object_type == USERSIM_OBJECT_TYPE_TIMER);
-
-    // We currently only support relative expiration times.
-    ASSERT(due_time.QuadPart < 0);
-
-    std::unique_lock<std::mutex> l(g_usersim_threadpool_mutex);
-    BOOLEAN running = (timer->threadpool_timer != nullptr);
-    if (!running) {
-        timer->threadpool_timer =
-            CreateThreadpoolTimer(_usersim_timer_callback, timer, &_usersim_threadpool_callback_environment.value());
-        if (timer->threadpool_timer == nullptr) {
-            KeBugCheck(0);
-            return FALSE; // Keep code analysis happy.
-        }
-
-        // There is no kernel function to clean up a timer, but there is in user mode,
-        // so add the handle to a list we can clean up later.
-        if (g_usersim_threadpool_timers == nullptr) {
-            g_usersim_threadpool_timers = new std::vector<TP_TIMER*>();
-        }
-        g_usersim_threadpool_timers->push_back(timer->threadpool_timer);
-    }
+    ASSERT(timer->header.object_type == USERSIM_OBJECT_TYPE_TIMER);
+    ASSERT(_usersim_timer_wheel_instance != nullptr);
 
-    timer->signaled = FALSE;
-    timer->dpc = dpc;
-    SetThreadpoolTimer(timer->threadpool_timer, (FILETIME*)&due_time, period, tolerable_delay);
-
-    return running;
-}
-
-void
-usersim_free_threadpool_timers()
-{
-    std::unique_lock<std::mutex> l(g_usersim_threadpool_mutex);
-    if (g_usersim_threadpool_timers) {
-        for (TP_TIMER* threadpool_timer : *g_usersim_threadpool_timers) {
-            CloseThreadpoolTimer(threadpool_timer);
-        }
-        delete g_usersim_threadpool_timers;
-        g_usersim_threadpool_timers = nullptr;
-    }
+    uint64_t expiration_tick = _usersim_timer_due_time_to_tick(due_time, tolerable_delay);
+    return _usersim_timer_wheel_instance->set(timer, expiration_tick, period, dpc);
 }
 
 BOOLEAN
 KeCancelTimer(_Inout_ PKTIMER timer)
 {
-    ASSERT(timer->object_type == USERSIM_OBJECT_TYPE_TIMER);
+    ASSERT(timer->header.object_type == USERSIM_OBJECT_TYPE_TIMER);
 
-    std::unique_lock<std::mutex> l(g_usersim_threadpool_mutex);
-    if (timer->threadpool_timer == nullptr) {
+    if (_usersim_timer_wheel_instance == nullptr) {
+        timer->signaled = FALSE;
         return FALSE;
     }
-
-    // Stop generating new callbacks.
-    SetThreadpoolTimer(timer->threadpool_timer, nullptr, 0, 0);
-
-    // Cancel any queued callbacks that have not yet started to execute.
-    WaitForThreadpoolTimerCallbacks(timer->threadpool_timer, TRUE);
-
-    // Clean up timer.
-    auto iterator =
-        std::find(g_usersim_threadpool_timers->begin(), g_usersim_threadpool_timers->end(), timer->threadpool_timer);
-    ASSERT(iterator != g_usersim_threadpool_timers->end());
-    g_usersim_threadpool_timers->erase(iterator);
-    CloseThreadpoolTimer(timer->threadpool_timer);
-    timer->threadpool_timer = nullptr;
-
-    // Return TRUE if the timer was running.
-    BOOLEAN was_running = !timer->signaled;
-    timer->signaled = FALSE;
-    return was_running;
+    return _usersim_timer_wheel_instance->cancel(timer);
 }
 
 // Check whether the current state is signaled.
 BOOLEAN
 KeReadStateTimer(_In_ PKTIMER timer)
 {
-    ASSERT(timer->object_type == USERSIM_OBJECT_TYPE_TIMER);
+    ASSERT(timer->header.object_type == USERSIM_OBJECT_TYPE_TIMER);
     return timer->signaled;
 }
 
+void
+usersim_initialize_timers()
+{
+    _usersim_timer_wheel_instance = std::make_unique<_usersim_timer_wheel>();
+}
+
+void
+usersim_clean_up_timers()
+{
+    _usersim_timer_wheel_instance.reset();
+}
+
 #pragma endregion timers
 
 #pragma region events
@@ -976,10 +1843,9 @@ USERSIM_API
 void
 KeInitializeEvent(_Out_ PKEVENT event, _In_ EVENT_TYPE type, _In_ BOOLEAN initial_state)
 {
+    _usersim_initialize_dispatcher_header(&event->header, USERSIM_OBJECT_TYPE_EVENT);
     event->signaled = initial_state;
     event->type = type;
-    event->object_type = USERSIM_OBJECT_TYPE_EVENT;
-    KeInitializeSpinLock(&event->spin_lock);
 }
 
 USERSIM_API
@@ -989,18 +1855,11 @@ KeSetEvent(_Inout_ PKEVENT event, _In_ KPRIORITY increment, _In_ BOOLEAN wait)
     UNREFERENCED_PARAMETER(increment);
     UNREFERENCED_PARAMETER(wait);
 
-    ASSERT(event->object_type == USERSIM_OBJECT_TYPE_EVENT);
-    KIRQL old_irql;
-    LONG previous_state;
-    KeAcquireSpinLock(&event->spin_lock, &old_irql);
-
-    previous_state = event->signaled ? 1 : 0;
-    event->signaled = TRUE;
-
-    KeReleaseSpinLock(&event->spin_lock, old_irql);
+    ASSERT(event->header.object_type == USERSIM_OBJECT_TYPE_EVENT);
+    LONG previous_state = InterlockedExchange8((volatile char*)&event->signaled, TRUE) ? 1 : 0;
 
     // Wake up any waiters.
-    WakeByAddressAll(&event->signaled);
+    _usersim_wake_waiters(&event->header);
     return previous_state;
 }
 
@@ -1008,69 +1867,8 @@ USERSIM_API
 void
 KeClearEvent(_Inout_ PKEVENT event)
 {
-    ASSERT(event->object_type == USERSIM_OBJECT_TYPE_EVENT);
-    KIRQL old_irql;
-    KeAcquireSpinLock(&event->spin_lock, &old_irql);
-
-    event->signaled = FALSE;
-
-    KeReleaseSpinLock(&event->spin_lock, old_irql);
-}
-
-/**
- * @brief Wait for an event to be signaled.
- *
- * @param[in,out] event The KEVENT to wait on.
- * @param[in,opt] timeout The timeout for the wait, or nullptr for no timeout.
- * @retval STATUS_SUCCESS The event was signaled.
- * @retval STATUS_TIMEOUT The wait timed out.
- */
-static NTSTATUS
-_wait_for_kevent(_Inout_ KEVENT* event, _In_opt_ PLARGE_INTEGER timeout)
-{
-    uint64_t qpc_time_stamp = 0;
-    // Compute the end time for the wait, if any.
-    uint64_t start_time = KeQueryInterruptTimePrecise(&qpc_time_stamp);
-    uint64_t end_time;
-    if (timeout == nullptr) {
-        end_time = UINT64_MAX;
-    } else if (timeout->QuadPart > 0) {
-        end_time = timeout->QuadPart;
-    } else {
-        end_time = start_time - timeout->QuadPart;
-    }
-
-    for (;;) {
-        // Compute the remaining time in milliseconds for the wait.
-        DWORD timeout_ms = (DWORD)((end_time - start_time) / 10000);
-
-        KIRQL old_irql;
-        KeAcquireSpinLock(&event->spin_lock, &old_irql);
-        // Check if the event is signaled.
-        if (event->signaled) {
-            // Clear the event if it is an auto-reset event.
-            if (event->type == SynchronizationEvent) {
-                event->signaled = FALSE;
-            }
-            KeReleaseSpinLock(&event->spin_lock, old_irql);
-            return STATUS_SUCCESS;
-        } else {
-            // Capture the current state of event->signaled, so we can wait for it to change.
-            uint64_t old_state = event->signaled;
-            KeReleaseSpinLock(&event->spin_lock, old_irql);
-
-            // Wait for event->signaled to change.
-            bool wait_return = WaitOnAddress(&event->signaled, &old_state, sizeof(event->signaled), timeout_ms);
-            if (!wait_return) {
-                return STATUS_TIMEOUT;
-            }
-        }
-        // Check if the wait timed out outside of the WaitOnAddress() call.
-        start_time = KeQueryInterruptTimePrecise(&qpc_time_stamp);
-        if (start_time >= end_time) {
-            return STATUS_TIMEOUT;
-        }
-    }
+    ASSERT(event->header.object_type == USERSIM_OBJECT_TYPE_EVENT);
+    InterlockedExchange8((volatile char*)&event->signaled, FALSE);
 }
 
 NTSTATUS
@@ -1093,4 +1891,4 @@ KeExpandKernelStackAndCalloutEx(
     return STATUS_SUCCESS;
 }
 
-#pragma endregion events
\ No newline at end of file
+#pragma endregion events
\ No newline at end of file
@@ -30,6 +30,7 @@ CXPLAT_EXTERN_C_BEGIN
 #define STATUS_ACCESS_DENIED ((NTSTATUS)0xC0000022L)
 #define STATUS_BUFFER_TOO_SMALL ((NTSTATUS)0xC0000023L)
 #define STATUS_OBJECT_PATH_NOT_FOUND ((NTSTATUS)0xC000003AL)
+#define STATUS_SEMAPHORE_LIMIT_EXCEEDED ((NTSTATUS)0xC0000047L)
 #define STATUS_NONE_MAPPED ((NTSTATUS)0xC0000073L)
 #define STATUS_INVALID_IMAGE_FORMAT ((NTSTATUS)0xC000007BL)
 #define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009AL)
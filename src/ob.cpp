@@ -3,10 +3,42 @@
 
 #include "platform.h"
 #include "kernel_um.h"
+#include "tracelog.h"
 #include "usersim/ob.h"
-#include <map>
+#include <atomic>
+#include <intrin.h>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
-static std::map<PVOID, ULONG> _object_references;
+/***
+ * Reference counts are kept in a table split into stripes by object address, each with its own reader/writer lock:
+ * 1) Changing the count of an object already in the table only takes its stripe's lock shared, and updates the count
+ *    atomically, so threads referencing different objects, or the same one, don't serialize.
+ * 2) The first reference adds the object and the last one removes it, both under the stripe's lock held exclusive.
+ *    The release callback runs after the lock is dropped, so it may reference other objects.
+ * 3) While any object is traced, counts change under the stripe's lock held exclusive, and the trace entry is recorded
+ *    under that same lock, so an object's trace lists its counts in the order they changed.
+ */
+#define USERSIM_OBJECT_REFERENCE_STRIPE_COUNT 64
+
+typedef struct alignas(64) _usersim_object_reference_stripe
+{
+    std::shared_mutex lock;
+    std::unordered_map<PVOID, std::atomic<LONG_PTR>> references;
+} usersim_object_reference_stripe_t;
+
+static usersim_object_reference_stripe_t _object_reference_stripes[USERSIM_OBJECT_REFERENCE_STRIPE_COUNT];
+
+static usersim_object_release_callback_t _object_release_callback = nullptr;
+static void* _object_release_callback_context = nullptr;
+
+// Objects whose reference count changes are being recorded. The count lets references skip the lock when no object
+// is traced, which is the normal case.
+static std::mutex _object_reference_trace_mutex;
+static std::unordered_map<PVOID, std::vector<usersim_object_reference_trace_entry_t>> _object_reference_traces;
+static std::atomic<size_t> _object_reference_trace_count = 0;
 
 static POBJECT_TYPE _ExEventObjectType = nullptr;
 USERSIM_API __declspec(align(8)) POBJECT_TYPE* ExEventObjectType = &_ExEventObjectType;
@@ -14,26 +46,160 @@ USERSIM_API __declspec(align(8)) POBJECT_TYPE* ExEventObjectType = &_ExEventObje
 static POBJECT_TYPE _IoFileObjectType = nullptr;
 USERSIM_API __declspec(align(8)) POBJECT_TYPE* IoFileObjectType = &_IoFileObjectType;
 
-_IRQL_requires_max_(DISPATCH_LEVEL) USERSIM_API LONG_PTR
-ObfReferenceObject(_In_ PVOID object)
+static usersim_object_reference_stripe_t&
+_get_object_reference_stripe(_In_ PVOID object)
 {
-    if (!_object_references.contains(object)) {
-        _object_references[object] = 1;
+    // Objects are usually at least 16-byte aligned, so mix the address before picking a stripe.
+    uint64_t hash = (uint64_t)(uintptr_t)object * 0x9E3779B97F4A7C15ull;
+    return _object_reference_stripes[hash >> 58];
+}
+
+static void
+_trace_object_reference(_In_ PVOID object, _In_ void* caller, LONG_PTR reference_count)
+{
+    if (_object_reference_trace_count.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::unique_lock lock(_object_reference_trace_mutex);
+    auto it = _object_reference_traces.find(object);
+    if (it == _object_reference_traces.end()) {
+        return;
+    }
+    try {
+        it->second.push_back({caller, reference_count});
+    } catch (const std::bad_alloc&) {
+        // Tracing is best effort.
+    }
+    USERSIM_LOG_MESSAGE_UINT64_UINT64(
+        USERSIM_TRACELOG_LEVEL_VERBOSE,
+        USERSIM_TRACELOG_KEYWORD_BASE,
+        "Object reference count changed",
+        (uint64_t)(uintptr_t)object,
+        (uint64_t)reference_count);
+}
+
+static LONG_PTR
+_reference_object(_In_ PVOID object, _In_ void* caller)
+{
+    usersim_object_reference_stripe_t& stripe = _get_object_reference_stripe(object);
+    if (_object_reference_trace_count.load(std::memory_order_relaxed) == 0) {
+        std::shared_lock lock(stripe.lock);
+        auto it = stripe.references.find(object);
+        if (it != stripe.references.end()) {
+            return it->second.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+    }
+
+    std::unique_lock lock(stripe.lock);
+    auto [it, inserted] = stripe.references.try_emplace(object, 0);
+    LONG_PTR reference_count = it->second.fetch_add(1, std::memory_order_relaxed) + 1;
+    _trace_object_reference(object, caller, reference_count);
+    return reference_count;
+}
+
+static LONG_PTR
+_dereference_object(_In_ PVOID object, _In_ void* caller)
+{
+    usersim_object_reference_stripe_t& stripe = _get_object_reference_stripe(object);
+    LONG_PTR remaining = -1;
+    if (_object_reference_trace_count.load(std::memory_order_relaxed) == 0) {
+        std::shared_lock lock(stripe.lock);
+        auto it = stripe.references.find(object);
+        if (it != stripe.references.end()) {
+            remaining = it->second.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        }
     } else {
-        _object_references[object]++;
+        std::unique_lock lock(stripe.lock);
+        auto it = stripe.references.find(object);
+        if (it != stripe.references.end()) {
+            remaining = it->second.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        }
+        _trace_object_reference(object, caller, remaining);
+    }
+    if (remaining < 0) {
+        KeBugCheckExCPP(REFERENCE_BY_POINTER, 0, (ULONG_PTR)object, (ULONG_PTR)remaining, 0);
+    }
+    if (remaining > 0) {
+        return remaining;
+    }
+
+    // Another thread may have referenced the object again, or removed it, since the count was dropped.
+    bool released = false;
+    {
+        std::unique_lock lock(stripe.lock);
+        auto it = stripe.references.find(object);
+        if (it != stripe.references.end() && it->second.load(std::memory_order_acquire) == 0) {
+            stripe.references.erase(it);
+            released = true;
+        }
     }
-    return _object_references[object];
+    if (released) {
+        if (_object_release_callback != nullptr) {
+            _object_release_callback(object, _object_release_callback_context);
+        } else {
+            CloseHandle(object);
+        }
+    }
+    return remaining;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL) USERSIM_API LONG_PTR
+ObfReferenceObject(_In_ PVOID object)
+{
+    return _reference_object(object, _ReturnAddress());
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL) USERSIM_API LONG_PTR
 ObfDereferenceObject(_In_ PVOID object)
 {
-    ULONG remaining = --_object_references[object];
-    if (remaining == 0) {
-        _object_references.erase(object);
-        CloseHandle(object);
+    return _dereference_object(object, _ReturnAddress());
+}
+
+USERSIM_API void
+usersim_set_object_release_callback(_In_opt_ usersim_object_release_callback_t callback, _In_opt_ void* context)
+{
+    _object_release_callback_context = context;
+    _object_release_callback = callback;
+}
+
+USERSIM_API NTSTATUS
+usersim_start_object_reference_trace(_In_ PVOID object)
+{
+    std::unique_lock lock(_object_reference_trace_mutex);
+    try {
+        if (_object_reference_traces.try_emplace(object).second) {
+            _object_reference_trace_count++;
+        }
+    } catch (const std::bad_alloc&) {
+        return STATUS_NO_MEMORY;
     }
-    return remaining;
+    return STATUS_SUCCESS;
+}
+
+USERSIM_API void
+usersim_stop_object_reference_trace(_In_ PVOID object)
+{
+    std::unique_lock lock(_object_reference_trace_mutex);
+    if (_object_reference_traces.erase(object) != 0) {
+        _object_reference_trace_count--;
+    }
+}
+
+USERSIM_API size_t
+usersim_get_object_reference_trace(
+    _In_ PVOID object,
+    _Out_writes_opt_(entry_count) usersim_object_reference_trace_entry_t* entries,
+    size_t entry_count)
+{
+    std::unique_lock lock(_object_reference_trace_mutex);
+    auto it = _object_reference_traces.find(object);
+    if (it == _object_reference_traces.end()) {
+        return 0;
+    }
+    for (size_t i = 0; i < entry_count && i < it->second.size(); i++) {
+        entries[i] = it->second[i];
+    }
+    return it->second.size();
 }
 
 _IRQL_requires_max_(PASSIVE_LEVEL) USERSIM_API NTSTATUS
@@ -52,7 +218,7 @@ ObReferenceObjectByHandle(
     if (handle_information != nullptr) {
         return STATUS_NOT_SUPPORTED;
     }
-    ObfReferenceObject(*object);
+    _reference_object(*object, _ReturnAddress());
     return STATUS_SUCCESS;
 }
 
@@ -61,6 +227,6 @@ NTSTATUS
 ObCloseHandle(_In_ _Post_ptr_invalid_ HANDLE handle, _In_ KPROCESSOR_MODE previous_mode)
 {
     UNREFERENCED_PARAMETER(previous_mode);
-    ObfDereferenceObject(handle);
+    _dereference_object(handle, _ReturnAddress());
     return STATUS_SUCCESS;
 }
\ No newline at end of file
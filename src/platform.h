@@ -113,9 +113,11 @@ usersim_ring_descriptor_get_base_address(_In_ const usersim_ring_descriptor_t* r
 
 /**
  * @brief Create a read-only mapping in the calling process of the ring buffer.
+ * Like the writable mapping, the pages are mapped twice. The mapping is only
+ * created once, and stays valid until the ring buffer memory is freed.
  *
  * @param[in] ring Ring buffer to map.
- * @return Pointer to the base of the ring buffer.
+ * @return Pointer to the base of the ring buffer, or NULL on failure.
  */
 _Ret_maybenull_ void*
 usersim_ring_map_readonly_user(_In_ const usersim_ring_descriptor_t* ring);
@@ -410,13 +412,36 @@ usersim_validate_security_descriptor(
     _In_ const usersim_security_descriptor_t* security_descriptor, size_t security_descriptor_length);
 
 /**
- * @brief Return a pseudorandom number.
+ * @brief Return a pseudorandom number. Each thread has its own generator, which is
+ * seeded the first time the thread asks for a number.
  *
  * @return A pseudorandom number.
  */
+USERSIM_API
 uint32_t
 usersim_random_uint32();
 
+/**
+ * @brief Fill a buffer with pseudorandom bytes from the calling thread's generator.
+ *
+ * @param[out] buffer Buffer to fill.
+ * @param[in] length Length of the buffer in bytes.
+ */
+USERSIM_API
+void
+usersim_random_fill(_Out_writes_bytes_(length) void* buffer, size_t length);
+
+/**
+ * @brief Make pseudorandom numbers repeatable, to replay a test run. Every thread's
+ * generator is reseeded from the seed and from the order in which threads next ask
+ * for a number, so a thread that does so first sees the same numbers on every run.
+ *
+ * @param[in] seed Seed to use, or 0 to seed generators from the operating system again.
+ */
+USERSIM_API
+void
+usersim_set_random_seed(uint64_t seed);
+
 /**
  * @brief Return time elapsed since boot in units of 100 nanoseconds.
  *
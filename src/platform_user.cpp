@@ -2,7 +2,9 @@
 // SPDX-License-Identifier: MIT
 
 #include "cxplat.h"
+#include "cxplat_environment.h"
 #include "cxplat_fault_injection.h"
+#include "cxplat_ring_buffer.h"
 #include "tracelog.h"
 #include "usersim/ex.h"
 #include "usersim/ke.h"
@@ -13,6 +15,7 @@
 #include "utilities.h"
 
 #include "../inc/TraceLoggingProvider.h"
+#include <atomic>
 #include <functional>
 #include <intsafe.h>
 #include <map>
@@ -68,12 +71,15 @@ usersim_platform_initiate()
         _usersim_platform_maximum_group_count = GetMaximumProcessorGroupCount();
         _usersim_platform_maximum_processor_count = GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS);
 
-        result = usersim_initialize_irql();
+        result = usersim_initialize_irql(
+            cxplat_get_environment_variable_as_bool("USERSIM_FAST_IRQL") ? USERSIM_IRQL_MODE_FAST
+                                                                        : USERSIM_IRQL_MODE_STRICT);
         if (result != STATUS_SUCCESS) {
             goto Exit;
         }
 
         usersim_initialize_dpcs();
+        usersim_initialize_timers();
 
         // Compute the starting index of each processor group.
         _usersim_platform_group_to_index_map.resize(_usersim_platform_maximum_group_count);
@@ -103,8 +109,7 @@ usersim_platform_terminate()
 {
     cxplat_wait_for_preemptible_work_items_complete();
 
-    usersim_free_semaphores();
-    usersim_free_threadpool_timers();
+    usersim_clean_up_timers();
     usersim_clean_up_ps();
     usersim_clean_up_dpcs();
     usersim_clean_up_irql();
@@ -133,38 +138,25 @@ usersim_get_code_integrity_state(_Out_ usersim_code_integrity_state_t* state)
     USERSIM_RETURN_RESULT(STATUS_SUCCESS);
 }
 
+// The double mapping is built by the cxplat ring buffer, whose reserve and consume functions callers that manage
+// the records themselves simply don't use.
 struct usersim_ring_descriptor_t
 {
-    void* primary_view;
-    void* secondary_view;
-    size_t length;
+    cxplat_ring_buffer_t* ring;
 };
 typedef struct usersim_ring_descriptor_t usersim_ring_descriptor_t;
 
-// This code is derived from the sample at:
-// https://docs.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualalloc2
-
 _Ret_maybenull_ usersim_ring_descriptor_t*
 usersim_allocate_ring_buffer_memory(size_t length)
 {
     USERSIM_LOG_ENTRY();
-    bool result = false;
-    HANDLE section = nullptr;
-    SYSTEM_INFO sysInfo;
-    uint8_t* placeholder1 = nullptr;
-    uint8_t* placeholder2 = nullptr;
-    void* view1 = nullptr;
-    void* view2 = nullptr;
-
-    // Skip fault injection for this VirtualAlloc2 OS API, as usersim_allocate already does that.
-    GetSystemInfo(&sysInfo);
 
     if (length == 0) {
         USERSIM_LOG_MESSAGE(USERSIM_TRACELOG_LEVEL_ERROR, USERSIM_TRACELOG_KEYWORD_BASE, "Ring buffer length is zero");
         return nullptr;
     }
 
-    if ((length % sysInfo.dwAllocationGranularity) != 0) {
+    if ((length % cxplat_get_ring_buffer_granularity()) != 0) {
         USERSIM_LOG_MESSAGE_UINT64(
             USERSIM_TRACELOG_LEVEL_ERROR,
             USERSIM_TRACELOG_KEYWORD_BASE,
@@ -176,110 +168,20 @@ usersim_allocate_ring_buffer_memory(size_t length)
     usersim_ring_descriptor_t* descriptor = (usersim_ring_descriptor_t*)cxplat_allocate(
         CXPLAT_POOL_FLAG_NON_PAGED, sizeof(usersim_ring_descriptor_t), USERSIM_TAG_RING_DESCRIPTOR);
     if (!descriptor) {
-        goto Exit;
-    }
-    descriptor->length = length;
-
-    //
-    // Reserve a placeholder region where the buffer will be mapped.
-    //
-    placeholder1 = reinterpret_cast<uint8_t*>(
-        VirtualAlloc2(nullptr, nullptr, 2 * length, MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, nullptr, 0));
-
-    if (placeholder1 == nullptr) {
-        USERSIM_LOG_WIN32_API_FAILURE(USERSIM_TRACELOG_KEYWORD_BASE, VirtualAlloc2);
-        goto Exit;
-    }
-
-#pragma warning(push)
-#pragma warning(disable : 6333)  // Invalid parameter:  passing MEM_RELEASE and a non-zero dwSize parameter to
-                                 // 'VirtualFree' is not allowed.  This causes the call to fail.
-#pragma warning(disable : 28160) // Passing MEM_RELEASE and a non-zero dwSize parameter to VirtualFree is not allowed.
-                                 // This results in the failure of this call.
-    //
-    // Split the placeholder region into two regions of equal size.
-    //
-    result = VirtualFree(placeholder1, length, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
-    if (result == FALSE) {
-        USERSIM_LOG_WIN32_API_FAILURE(USERSIM_TRACELOG_KEYWORD_BASE, VirtualFree);
-        goto Exit;
-    }
-#pragma warning(pop)
-    placeholder2 = placeholder1 + length;
-
-    //
-    // Create a pagefile-backed section for the buffer.
-    //
-
-    section = CreateFileMapping(
-        INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<unsigned long>(length), nullptr);
-    if (section == nullptr) {
-        USERSIM_LOG_WIN32_API_FAILURE(USERSIM_TRACELOG_KEYWORD_BASE, CreateFileMapping);
-        goto Exit;
-    }
-
-    //
-    // Map the section into the first placeholder region.
-    //
-    view1 =
-        MapViewOfFile3(section, nullptr, placeholder1, 0, length, MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, nullptr, 0);
-    if (view1 == nullptr) {
-        USERSIM_LOG_WIN32_API_FAILURE(USERSIM_TRACELOG_KEYWORD_BASE, MapViewOfFile3);
-        goto Exit;
-    }
-
-    //
-    // Ownership transferred, don't free this now.
-    //
-    placeholder1 = nullptr;
-
-    //
-    // Map the section into the second placeholder region.
-    //
-    view2 =
-        MapViewOfFile3(section, nullptr, placeholder2, 0, length, MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, nullptr, 0);
-    if (view2 == nullptr) {
-        USERSIM_LOG_WIN32_API_FAILURE(USERSIM_TRACELOG_KEYWORD_BASE, MapViewOfFile3);
-        goto Exit;
+        USERSIM_RETURN_POINTER(usersim_ring_descriptor_t*, nullptr);
     }
 
-    result = true;
-
-    //
-    // Success, return both mapped views to the caller.
-    //
-    descriptor->primary_view = view1;
-    descriptor->secondary_view = view2;
-
-    placeholder2 = nullptr;
-    view1 = nullptr;
-    view2 = nullptr;
-Exit:
-    if (!result) {
+    cxplat_status_t status = cxplat_allocate_ring_buffer(length, &descriptor->ring);
+    if (status != CXPLAT_STATUS_SUCCESS) {
+        USERSIM_LOG_MESSAGE_UINT64(
+            USERSIM_TRACELOG_LEVEL_ERROR,
+            USERSIM_TRACELOG_KEYWORD_BASE,
+            "cxplat_allocate_ring_buffer failed",
+            (uint32_t)status);
         cxplat_free(descriptor, CXPLAT_POOL_FLAG_NON_PAGED, USERSIM_TAG_RING_DESCRIPTOR);
         descriptor = nullptr;
     }
 
-    if (section != nullptr) {
-        CloseHandle(section);
-    }
-
-    if (placeholder1 != nullptr) {
-        VirtualFree(placeholder1, 0, MEM_RELEASE);
-    }
-
-    if (placeholder2 != nullptr) {
-        VirtualFree(placeholder2, 0, MEM_RELEASE);
-    }
-
-    if (view1 != nullptr) {
-        UnmapViewOfFileEx(view1, 0);
-    }
-
-    if (view2 != nullptr) {
-        UnmapViewOfFileEx(view2, 0);
-    }
-
     USERSIM_RETURN_POINTER(usersim_ring_descriptor_t*, descriptor);
 }
 
@@ -288,8 +190,7 @@ usersim_free_ring_buffer_memory(_Frees_ptr_opt_ usersim_ring_descriptor_t* ring)
 {
     USERSIM_LOG_ENTRY();
     if (ring) {
-        UnmapViewOfFile(ring->primary_view);
-        UnmapViewOfFile(ring->secondary_view);
+        cxplat_free_ring_buffer(ring->ring);
         cxplat_free(ring, CXPLAT_POOL_FLAG_NON_PAGED, USERSIM_TAG_RING_DESCRIPTOR);
     }
     USERSIM_RETURN_VOID();
@@ -298,14 +199,14 @@ usersim_free_ring_buffer_memory(_Frees_ptr_opt_ usersim_ring_descriptor_t* ring)
 void*
 usersim_ring_descriptor_get_base_address(_In_ const usersim_ring_descriptor_t* ring_descriptor)
 {
-    return ring_descriptor->primary_view;
+    return cxplat_ring_buffer_get_data(ring_descriptor->ring);
 }
 
 _Ret_maybenull_ void*
 usersim_ring_map_readonly_user(_In_ const usersim_ring_descriptor_t* ring)
 {
     USERSIM_LOG_ENTRY();
-    USERSIM_RETURN_POINTER(void*, usersim_ring_descriptor_get_base_address(ring));
+    USERSIM_RETURN_POINTER(void*, (void*)cxplat_ring_buffer_map_readonly(ring->ring));
 }
 
 void
@@ -334,12 +235,107 @@ _Requires_lock_held_(*lock) _Releases_lock_(*lock) _IRQL_requires_(DISPATCH_LEVE
     ReleaseSRWLockExclusive(reinterpret_cast<PSRWLOCK>(lock));
 }
 
+/***
+ * Pseudorandom numbers come from a xoshiro128** generator per thread, which needs neither a lock nor a system call
+ * once seeded. A thread seeds its generator the first time it asks for a number, and again whenever the seed
+ * generation changes, which usersim_set_random_seed() does. Without an overriding seed, the seed comes from the
+ * operating system; with one, it is mixed with the number of threads seeded before, so that threads get different
+ * sequences.
+ */
+typedef struct _usersim_random_state
+{
+    uint32_t state[4];
+    uint32_t seed_generation; ///< Value of _usersim_random_seed_generation when the state was seeded.
+} usersim_random_state_t;
+
+static thread_local usersim_random_state_t _usersim_random_state;
+static std::atomic<uint64_t> _usersim_random_seed = 0;
+static std::atomic<uint64_t> _usersim_random_seeded_thread_count = 0;
+
+// Starts at 1, so that a thread's zero-initialized state is always seeded first.
+static std::atomic<uint32_t> _usersim_random_seed_generation = 1;
+
+static inline uint64_t
+_usersim_splitmix64(_Inout_ uint64_t* value)
+{
+    uint64_t result = (*value += 0x9E3779B97F4A7C15ull);
+    result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9ull;
+    result = (result ^ (result >> 27)) * 0x94D049BB133111EBull;
+    return result ^ (result >> 31);
+}
+
+static void
+_usersim_seed_random_state(_Out_ usersim_random_state_t* random_state)
+{
+    random_state->seed_generation = _usersim_random_seed_generation.load(std::memory_order_acquire);
+    uint64_t seed = _usersim_random_seed.load(std::memory_order_relaxed);
+    if (seed != 0) {
+        seed ^= _usersim_random_seeded_thread_count.fetch_add(1, std::memory_order_relaxed) * 0xD1B54A32D192ED03ull;
+    } else {
+        std::random_device device;
+        seed = ((uint64_t)device() << 32) | device();
+    }
+
+    // Expanding the seed with splitmix64 never leaves the state all zeros, a state xoshiro128** could never leave.
+    for (size_t i = 0; i < 4; i += 2) {
+        uint64_t value = _usersim_splitmix64(&seed);
+        random_state->state[i] = (uint32_t)value;
+        random_state->state[i + 1] = (uint32_t)(value >> 32);
+    }
+}
+
+static inline uint32_t
+_usersim_next_random_uint32(_Inout_ usersim_random_state_t* random_state)
+{
+    uint32_t* state = random_state->state;
+    uint32_t result = _rotl(state[1] * 5, 7) * 9;
+    uint32_t shifted = state[1] << 9;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= shifted;
+    state[3] = _rotl(state[3], 11);
+    return result;
+}
+
+static inline usersim_random_state_t*
+_usersim_get_random_state()
+{
+    usersim_random_state_t* random_state = &_usersim_random_state;
+    if (random_state->seed_generation != _usersim_random_seed_generation.load(std::memory_order_relaxed)) {
+        _usersim_seed_random_state(random_state);
+    }
+    return random_state;
+}
+
 uint32_t
 usersim_random_uint32()
 {
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    return mt();
+    return _usersim_next_random_uint32(_usersim_get_random_state());
+}
+
+void
+usersim_random_fill(_Out_writes_bytes_(length) void* buffer, size_t length)
+{
+    usersim_random_state_t* random_state = _usersim_get_random_state();
+    uint8_t* bytes = (uint8_t*)buffer;
+    for (; length >= sizeof(uint32_t); bytes += sizeof(uint32_t), length -= sizeof(uint32_t)) {
+        uint32_t value = _usersim_next_random_uint32(random_state);
+        memcpy(bytes, &value, sizeof(value));
+    }
+    if (length > 0) {
+        uint32_t value = _usersim_next_random_uint32(random_state);
+        memcpy(bytes, &value, length);
+    }
+}
+
+void
+usersim_set_random_seed(uint64_t seed)
+{
+    _usersim_random_seed.store(seed, std::memory_order_relaxed);
+    _usersim_random_seeded_thread_count.store(0, std::memory_order_relaxed);
+    _usersim_random_seed_generation.fetch_add(1, std::memory_order_release);
 }
 
 uint64_t
@@ -375,6 +371,15 @@ usersim_is_preemptible()
 ULONG
 KeGetCurrentProcessorNumberEx(_Out_opt_ PPROCESSOR_NUMBER ProcNumber)
 {
+    // In fast IRQL mode a thread at DISPATCH_LEVEL isn't pinned, so report the processor it is emulating.
+    uint32_t processor_index;
+    if (usersim_get_current_virtual_processor(&processor_index)) {
+        if (ProcNumber != nullptr) {
+            KeGetProcessorNumberFromIndex(processor_index, ProcNumber);
+        }
+        return processor_index;
+    }
+
     PROCESSOR_NUMBER processor_number;
     GetCurrentProcessorNumberEx(&processor_number);
 
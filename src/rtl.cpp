@@ -134,6 +134,19 @@ RtlSizeTSub(
     return SUCCEEDED(SizeTSub(minuend, subtrahend, result)) ? STATUS_SUCCESS : STATUS_INTEGER_OVERFLOW;
 }
 
+ULONG
+RtlRandomEx(_Inout_ PULONG seed)
+{
+    // Skip Fault Injection.
+    // As in the kernel, the result depends only on the seed the caller keeps, so a seed can be replayed. The seed is
+    // advanced as a PCG state, whose output permutation hides the weak low bits of the underlying linear
+    // congruential step.
+    ULONG state = *seed * 747796405u + 2891336453u;
+    *seed = state;
+    ULONG word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return ((word >> 22) ^ word) % MAXLONG;
+}
+
 __analysis_noreturn VOID NTAPI
 RtlAssertCPP(
     _In_ PVOID void_failed_assertion,
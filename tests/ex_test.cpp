@@ -4,12 +4,16 @@
 #if !defined(CMAKE_NUGET)
 #include <catch2/catch_all.hpp>
 #else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #endif
 #include "usersim/ex.h"
 #include "cxplat_winuser.h"
 
+#include <atomic>
+#include <string>
 #include <thread>
+#include <vector>
 
 TEST_CASE("ExAllocatePool", "[ex]")
 {
@@ -191,7 +195,7 @@ TEST_CASE("EX_RUNDOWN_REF_CACHE_AWARE", "[ex]")
     // Wait for the rundown protection to be released.
     std::thread thread([&]() {
         // Wait for the rundown protection to be released.
-        ExWaitForRundownProtectionRelease(ref);
+        ExWaitForRundownProtectionReleaseCacheAware(ref);
         thread_completed = true;
     });
 
@@ -226,5 +230,224 @@ TEST_CASE("EX_RUNDOWN_REF_CACHE_AWARE", "[ex]")
     // Future acquire of the rundown protection should fail.
     REQUIRE(!ExAcquireRundownProtectionCacheAware(ref));
 
+    // Reinitialize after rundown is completed.
+    ExReInitializeRundownProtectionCacheAware(ref);
+    REQUIRE(ExAcquireRundownProtectionCacheAware(ref));
+    ExReleaseRundownProtectionCacheAware(ref);
+
+    ExFreeCacheAwareRundownProtection(ref);
+}
+
+TEST_CASE("EX_RUNDOWN_REF_CACHE_AWARE cross-processor release", "[ex]")
+{
+    EX_RUNDOWN_REF_CACHE_AWARE* ref = ExAllocateCacheAwareRundownProtection(NonPagedPoolNx, 'tset');
+    REQUIRE(ref != nullptr);
+
+    // Acquire references on one thread and release them on others, which may run on different processors
+    // and so release into a different slot than the one acquired from.
+    const size_t thread_count = 4;
+    const size_t references_per_thread = 1000;
+    for (size_t i = 0; i < thread_count * references_per_thread; i++) {
+        REQUIRE(ExAcquireRundownProtectionCacheAware(ref));
+    }
+
+    std::atomic<bool> rundown_completed = false;
+    std::atomic<bool> completed_early = false;
+    std::thread waiter([&]() {
+        ExWaitForRundownProtectionReleaseCacheAware(ref);
+        rundown_completed = true;
+    });
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&]() {
+            for (size_t j = 0; j < references_per_thread; j++) {
+                if (rundown_completed) {
+                    completed_early = true;
+                }
+                ExReleaseRundownProtectionCacheAware(ref);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    waiter.join();
+    REQUIRE(rundown_completed);
+    REQUIRE(!completed_early);
+
     ExFreeCacheAwareRundownProtection(ref);
-}
\ No newline at end of file
+}
+
+TEST_CASE("rundown protection benchmark", "[.][ex][benchmark]")
+{
+    const size_t iterations = 100000;
+    EX_RUNDOWN_REF ref;
+    ExInitializeRundownProtection(&ref);
+    EX_RUNDOWN_REF_CACHE_AWARE* cache_aware_ref = ExAllocateCacheAwareRundownProtection(NonPagedPoolNx, 'tset');
+    REQUIRE(cache_aware_ref != nullptr);
+
+    // Every thread acquires and releases the same reference, so the time per run stays flat as the thread count
+    // grows only if acquire and release do not contend.
+    auto run = [&](size_t thread_count, auto acquire_and_release) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&]() {
+                for (size_t j = 0; j < iterations; j++) {
+                    acquire_and_release();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return thread_count;
+    };
+
+    for (size_t thread_count = 1; thread_count <= std::thread::hardware_concurrency(); thread_count *= 2) {
+        BENCHMARK("EX_RUNDOWN_REF, " + std::to_string(thread_count) + " threads")
+        {
+            return run(thread_count, [&]() {
+                ExAcquireRundownProtection(&ref);
+                ExReleaseRundownProtection(&ref);
+            });
+        };
+        BENCHMARK("EX_RUNDOWN_REF_CACHE_AWARE, " + std::to_string(thread_count) + " threads")
+        {
+            return run(thread_count, [&]() {
+                ExAcquireRundownProtectionCacheAware(cache_aware_ref);
+                ExReleaseRundownProtectionCacheAware(cache_aware_ref);
+            });
+        };
+    }
+
+    ExFreeCacheAwareRundownProtection(cache_aware_ref);
+}
+TEST_CASE("LOOKASIDE_LIST_EX", "[ex]")
+{
+    LOOKASIDE_LIST_EX lookaside;
+    REQUIRE(
+        ExInitializeLookasideListEx(&lookaside, nullptr, nullptr, NonPagedPoolNx, 0, 100, 'tset', 0) == STATUS_SUCCESS);
+
+    // The first allocation misses, and freeing it caches it for reuse.
+    void* entry = ExAllocateFromLookasideListEx(&lookaside);
+    REQUIRE(entry != nullptr);
+    memset(entry, 0xAB, 100);
+    ExFreeToLookasideListEx(&lookaside, entry);
+
+    // Allocations and frees on different processors land in different magazines, so only check the totals.
+    usersim_lookaside_statistics_t statistics;
+    usersim_query_lookaside_list_statistics(&lookaside, &statistics);
+    REQUIRE(statistics.total_allocates == 1);
+    REQUIRE(statistics.allocate_hits == 0);
+    REQUIRE(statistics.total_frees == 1);
+    REQUIRE(statistics.free_hits == 1);
+
+    // Allocate and free repeatedly from several threads.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            for (size_t j = 0; j < 1000; j++) {
+                void* thread_entry = ExAllocateFromLookasideListEx(&lookaside);
+                if (thread_entry != nullptr) {
+                    ExFreeToLookasideListEx(&lookaside, thread_entry);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    usersim_query_lookaside_list_statistics(&lookaside, &statistics);
+    REQUIRE(statistics.total_allocates == 4001);
+    REQUIRE(statistics.total_frees == 4001);
+    REQUIRE(statistics.allocate_hits > 0);
+
+    ExDeleteLookasideListEx(&lookaside);
+}
+
+static std::atomic<size_t> _lookaside_allocations;
+static std::atomic<size_t> _lookaside_frees;
+
+static void*
+_test_lookaside_allocate(POOL_TYPE pool_type, SIZE_T number_of_bytes, ULONG tag, PLOOKASIDE_LIST_EX lookaside)
+{
+    UNREFERENCED_PARAMETER(lookaside);
+    _lookaside_allocations++;
+    return ExAllocatePoolWithTag(pool_type, number_of_bytes, tag);
+}
+
+static void
+_test_lookaside_free(void* buffer, PLOOKASIDE_LIST_EX lookaside)
+{
+    UNREFERENCED_PARAMETER(lookaside);
+    _lookaside_frees++;
+    ExFreePool(buffer);
+}
+
+static void*
+_test_npaged_lookaside_allocate(POOL_TYPE pool_type, SIZE_T number_of_bytes, ULONG tag)
+{
+    return _test_lookaside_allocate(pool_type, number_of_bytes, tag, nullptr);
+}
+
+static void
+_test_npaged_lookaside_free(void* buffer)
+{
+    _test_lookaside_free(buffer, nullptr);
+}
+
+TEST_CASE("LOOKASIDE_LIST_EX callbacks", "[ex]")
+{
+    _lookaside_allocations = 0;
+    _lookaside_frees = 0;
+
+    // Use a depth of 2 so that the third free overflows the magazine and goes to the free callback.
+    LOOKASIDE_LIST_EX lookaside;
+    NTSTATUS status = ExInitializeLookasideListEx(
+        &lookaside, _test_lookaside_allocate, _test_lookaside_free, NonPagedPoolNx, 0, 8, 'tset', 2);
+    REQUIRE(status == STATUS_SUCCESS);
+    void* entries[3];
+    for (auto& entry : entries) {
+        entry = ExAllocateFromLookasideListEx(&lookaside);
+        REQUIRE(entry != nullptr);
+    }
+    REQUIRE(_lookaside_allocations == 3);
+
+    // Stay on one processor so that every free lands in the same magazine.
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+    for (auto& entry : entries) {
+        ExFreeToLookasideListEx(&lookaside, entry);
+    }
+    KeLowerIrql(old_irql);
+    REQUIRE(_lookaside_frees == 1);
+
+    // Deleting the list frees the cached entries.
+    ExDeleteLookasideListEx(&lookaside);
+    REQUIRE(_lookaside_frees == 3);
+}
+
+TEST_CASE("NPAGED_LOOKASIDE_LIST", "[ex]")
+{
+    _lookaside_allocations = 0;
+    _lookaside_frees = 0;
+
+    NPAGED_LOOKASIDE_LIST lookaside;
+    ExInitializeNPagedLookasideList(
+        &lookaside, _test_npaged_lookaside_allocate, _test_npaged_lookaside_free, 0, 32, 'tset', 0);
+
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+    void* entry = ExAllocateFromNPagedLookasideList(&lookaside);
+    REQUIRE(entry != nullptr);
+    ExFreeToNPagedLookasideList(&lookaside, entry);
+
+    // The freed entry is reused from the processor's magazine.
+    REQUIRE(ExAllocateFromNPagedLookasideList(&lookaside) == entry);
+    ExFreeToNPagedLookasideList(&lookaside, entry);
+    KeLowerIrql(old_irql);
+    REQUIRE(_lookaside_allocations == 1);
+
+    ExDeleteNPagedLookasideList(&lookaside);
+    REQUIRE(_lookaside_frees == 1);
+}
@@ -0,0 +1,622 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#if !defined(CMAKE_NUGET)
+#include <catch2/catch_all.hpp>
+#else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+#endif
+#include "../src/net_platform.h"
+#include "usersim/fwp_test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const GUID _test_callout_key = {0x1a8d5e5b, 0x7f0c, 0x4a8e, {0x9a, 0x3e, 0x51, 0x2d, 0x6c, 0x0b, 0x4f, 0x11}};
+static const GUID _test_sublayer_key = {0x1a8d5e5b, 0x7f0c, 0x4a8e, {0x9a, 0x3e, 0x51, 0x2d, 0x6c, 0x0b, 0x4f, 0x12}};
+static const GUID _test_low_sublayer_key = {
+    0x1a8d5e5b, 0x7f0c, 0x4a8e, {0x9a, 0x3e, 0x51, 0x2d, 0x6c, 0x0b, 0x4f, 0x13}};
+// Per thread, so that classifies on the threads of the concurrent tests neither race nor contend on it.
+thread_local static uint32_t _test_classify_count = 0;
+static uint32_t _test_notify_count = 0;
+
+// The test callout returns the action stored in the context of the filter it is invoked for.
+static void NTAPI
+_test_classify(
+    _In_ const FWPS_INCOMING_VALUES* incoming_fixed_values,
+    _In_ const FWPS_INCOMING_METADATA_VALUES* incoming_metadata_values,
+    _Inout_opt_ void* layer_data,
+    _In_opt_ const void* classify_context,
+    _In_ const FWPS_FILTER* filter,
+    uint64_t flow_context,
+    _Inout_ FWPS_CLASSIFY_OUT0* classify_output)
+{
+    UNREFERENCED_PARAMETER(incoming_fixed_values);
+    UNREFERENCED_PARAMETER(incoming_metadata_values);
+    UNREFERENCED_PARAMETER(layer_data);
+    UNREFERENCED_PARAMETER(classify_context);
+    UNREFERENCED_PARAMETER(flow_context);
+    _test_classify_count++;
+    if (classify_output->rights & FWPS_RIGHT_ACTION_WRITE) {
+        classify_output->actionType = (FWP_ACTION_TYPE)filter->context;
+    }
+}
+
+static NTSTATUS NTAPI
+_test_notify(FWPS_CALLOUT_NOTIFY_TYPE notify_type, _In_ const GUID* filter_key, _Inout_ FWPS_FILTER* filter)
+{
+    UNREFERENCED_PARAMETER(notify_type);
+    UNREFERENCED_PARAMETER(filter_key);
+    UNREFERENCED_PARAMETER(filter);
+    _test_notify_count++;
+    return STATUS_SUCCESS;
+}
+
+static void NTAPI
+_test_flow_delete(uint16_t layer_id, uint32_t callout_id, uint64_t flow_context)
+{
+    UNREFERENCED_PARAMETER(layer_id);
+    UNREFERENCED_PARAMETER(callout_id);
+    UNREFERENCED_PARAMETER(flow_context);
+}
+
+// Add a filter whose callout returns the given action.
+static uint64_t
+_add_test_filter(
+    HANDLE engine,
+    FWP_ACTION_TYPE action,
+    _In_ const FWP_VALUE0& weight,
+    _In_ const GUID& sublayer_key = _test_sublayer_key,
+    uint32_t condition_count = 0,
+    _In_opt_ FWPM_FILTER_CONDITION0* conditions = nullptr)
+{
+    FWPM_FILTER0 filter = {};
+    filter.layerKey = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4;
+    filter.subLayerKey = sublayer_key;
+    filter.weight = weight;
+    filter.numFilterConditions = condition_count;
+    filter.filterCondition = conditions;
+    filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+    filter.action.calloutKey = _test_callout_key;
+    filter.rawContext = action;
+    uint64_t id;
+    REQUIRE(FwpmFilterAdd0(engine, &filter, nullptr, &id) == STATUS_SUCCESS);
+    return id;
+}
+
+static HANDLE
+_open_test_engine(_Out_ uint32_t* callout_id)
+{
+    HANDLE engine;
+    REQUIRE(FwpmEngineOpen0(nullptr, 0, nullptr, nullptr, &engine) == STATUS_SUCCESS);
+
+    FWPS_CALLOUT3 fwps_callout = {
+        .calloutKey = _test_callout_key,
+        .classifyFn = _test_classify,
+        .notifyFn = _test_notify,
+        .flowDeleteFn = _test_flow_delete};
+    REQUIRE(FwpsCalloutRegister3(nullptr, &fwps_callout, callout_id) == STATUS_SUCCESS);
+    FWPM_CALLOUT0 fwpm_callout = {
+        .calloutKey = _test_callout_key, .applicableLayer = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4};
+    REQUIRE(FwpmCalloutAdd0(engine, &fwpm_callout, nullptr, nullptr) == STATUS_SUCCESS);
+    return engine;
+}
+
+static void
+_close_test_engine(HANDLE engine, uint32_t callout_id)
+{
+    REQUIRE(FwpmCalloutDeleteByKey0(engine, &_test_callout_key) == STATUS_SUCCESS);
+    REQUIRE(FwpsCalloutUnregisterById0(callout_id) == STATUS_SUCCESS);
+    REQUIRE(FwpmEngineClose0(engine) == STATUS_SUCCESS);
+}
+
+TEST_CASE("FwpmFilterAdd0 weight order", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+
+    // The heaviest filter is used, whatever the order the filters were added in.
+    uint64_t low_weight = 10;
+    uint64_t high_weight = 1000;
+    FWP_VALUE0 weight = {};
+    weight.type = FWP_UINT64;
+    weight.uint64 = &low_weight;
+    uint64_t low_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    weight.uint64 = &high_weight;
+    uint64_t high_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+    weight = {};
+    uint64_t empty_id = _add_test_filter(engine, FWP_ACTION_CONTINUE, weight);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+
+    // Deleting a filter removes it from the layer.
+    REQUIRE(FwpmFilterDeleteById0(engine, high_id) == STATUS_SUCCESS);
+    REQUIRE(FwpmFilterDeleteById0(engine, high_id) == STATUS_INVALID_PARAMETER);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    REQUIRE(FwpmFilterDeleteById0(engine, low_id) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CONTINUE);
+    REQUIRE(FwpmFilterDeleteById0(engine, empty_id) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+
+    _close_test_engine(engine, callout_id);
+    REQUIRE(FwpmCalloutDeleteByKey0(engine, &_test_callout_key) == STATUS_NOT_FOUND);
+}
+
+TEST_CASE("FWP classify arbitration", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWPM_SUBLAYER0 sublayer = {.subLayerKey = _test_sublayer_key, .weight = 2};
+    REQUIRE(FwpmSubLayerAdd0(engine, &sublayer, nullptr) == STATUS_SUCCESS);
+    sublayer = {.subLayerKey = _test_low_sublayer_key, .weight = 1};
+    REQUIRE(FwpmSubLayerAdd0(engine, &sublayer, nullptr) == STATUS_SUCCESS);
+
+    // Every sublayer is evaluated, and a block in a lower sublayer overrides a permit in a higher one.
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+    FWP_VALUE0 weight = {};
+    uint64_t low_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight, _test_low_sublayer_key);
+    uint64_t high_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+    _test_classify_count = 0;
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    REQUIRE(_test_classify_count == 2);
+
+    // A callout returning continue leaves the decision to the next filter in its sublayer.
+    REQUIRE(FwpmFilterDeleteById0(engine, high_id) == STATUS_SUCCESS);
+    high_id = _add_test_filter(engine, FWP_ACTION_CONTINUE, weight);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+
+    // Conditions on different fields must all match, and those on the same field are alternatives.
+    FWP_RANGE0 port_range = {};
+    port_range.valueLow.type = FWP_UINT16;
+    port_range.valueLow.uint16 = 8000;
+    port_range.valueHigh.type = FWP_UINT16;
+    port_range.valueHigh.uint16 = 8080;
+    FWPM_FILTER_CONDITION0 conditions[3] = {};
+    conditions[0].fieldKey = FWPM_CONDITION_IP_LOCAL_PORT;
+    conditions[0].matchType = FWP_MATCH_EQUAL;
+    conditions[0].conditionValue.type = FWP_UINT16;
+    conditions[0].conditionValue.uint16 = 443;
+    conditions[1].fieldKey = FWPM_CONDITION_IP_LOCAL_PORT;
+    conditions[1].matchType = FWP_MATCH_RANGE;
+    conditions[1].conditionValue.type = FWP_RANGE_TYPE;
+    conditions[1].conditionValue.rangeValue = &port_range;
+    conditions[2].fieldKey = FWPM_CONDITION_IP_PROTOCOL;
+    conditions[2].matchType = FWP_MATCH_EQUAL;
+    conditions[2].conditionValue.type = FWP_UINT8;
+    conditions[2].conditionValue.uint8 = IPPROTO_TCP;
+    weight.type = FWP_UINT8;
+    weight.uint8 = 15;
+    uint64_t condition_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight, _test_low_sublayer_key, 3, conditions);
+    parameters.protocol = IPPROTO_TCP;
+    parameters.destination_port = 443;
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+    parameters.destination_port = 8080;
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+    parameters.destination_port = 80;
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    parameters.destination_port = 443;
+    parameters.protocol = IPPROTO_UDP;
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+
+    // A condition whose value doesn't suit its field is rejected.
+    conditions[0].matchType = FWP_MATCH_PREFIX;
+    FWPM_FILTER0 filter = {};
+    filter.layerKey = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4;
+    filter.numFilterConditions = 1;
+    filter.filterCondition = conditions;
+    filter.action.type = FWP_ACTION_BLOCK;
+    REQUIRE(FwpmFilterAdd0(engine, &filter, nullptr, nullptr) == STATUS_FWP_TYPE_MISMATCH);
+
+    for (uint64_t id : {low_id, high_id, condition_id}) {
+        REQUIRE(FwpmFilterDeleteById0(engine, id) == STATUS_SUCCESS);
+    }
+    REQUIRE(FwpmSubLayerDeleteByKey0(engine, &_test_sublayer_key) == STATUS_SUCCESS);
+    REQUIRE(FwpmSubLayerDeleteByKey0(engine, &_test_low_sublayer_key) == STATUS_SUCCESS);
+    _close_test_engine(engine, callout_id);
+}
+
+// Add a filter at the given layer whose callout returns the given action.
+static uint64_t
+_add_test_layer_filter(HANDLE engine, _In_ const GUID& layer, FWP_ACTION_TYPE action)
+{
+    FWPM_FILTER0 filter = {};
+    filter.layerKey = layer;
+    filter.subLayerKey = _test_sublayer_key;
+    filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+    filter.action.calloutKey = _test_callout_key;
+    filter.rawContext = action;
+    uint64_t id;
+    REQUIRE(FwpmFilterAdd0(engine, &filter, nullptr, &id) == STATUS_SUCCESS);
+    return id;
+}
+
+TEST_CASE("FwpmTransactionCommit0", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_FWP_NO_TXN_IN_PROGRESS);
+    REQUIRE(FwpmTransactionAbort0(engine) == STATUS_FWP_NO_TXN_IN_PROGRESS);
+
+    // Filters added in a transaction are neither classified nor notified until it commits.
+    _test_notify_count = 0;
+    FWP_VALUE0 weight = {};
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_SUCCESS);
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_FWP_TXN_IN_PROGRESS);
+    uint64_t block_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+    REQUIRE(_test_notify_count == 0);
+
+    // A change from another session waits for the transaction to finish.
+    FWPM_FILTER0 permit_filter = {};
+    permit_filter.layerKey = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4;
+    permit_filter.subLayerKey = _test_sublayer_key;
+    permit_filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+    permit_filter.action.calloutKey = _test_callout_key;
+    permit_filter.rawContext = FWP_ACTION_PERMIT;
+    std::atomic<uint64_t> permit_id = 0;
+    std::promise<void> other_started;
+    std::future<NTSTATUS> other_added = std::async(std::launch::async, [&]() {
+        HANDLE other_engine;
+        REQUIRE(FwpmEngineOpen0(nullptr, 0, nullptr, nullptr, &other_engine) == STATUS_SUCCESS);
+        other_started.set_value();
+        uint64_t id = 0;
+        NTSTATUS status = FwpmFilterAdd0(other_engine, &permit_filter, nullptr, &id);
+        permit_id = id;
+        REQUIRE(FwpmEngineClose0(other_engine) == STATUS_SUCCESS);
+        return status;
+    });
+    other_started.get_future().wait();
+    REQUIRE(other_added.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    REQUIRE(permit_id == 0);
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_SUCCESS);
+    REQUIRE(other_added.get() == STATUS_SUCCESS);
+    REQUIRE(permit_id != 0);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    REQUIRE(_test_notify_count == 2);
+
+    // Aborting puts back the filters deleted in the transaction, and drops those added in it.
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_SUCCESS);
+    REQUIRE(FwpmFilterDeleteById0(engine, block_id) == STATUS_SUCCESS);
+    uint64_t aborted_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+    REQUIRE(FwpmTransactionAbort0(engine) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    REQUIRE(_test_notify_count == 2);
+    REQUIRE(FwpmFilterDeleteById0(engine, aborted_id) == STATUS_INVALID_PARAMETER);
+
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_SUCCESS);
+    REQUIRE(FwpmFilterDeleteById0(engine, block_id) == STATUS_SUCCESS);
+    REQUIRE(FwpmFilterDeleteById0(engine, permit_id) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+    REQUIRE(_test_notify_count == 4);
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("FwpmEngineClose0 aborts an open transaction", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWP_VALUE0 weight = {};
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+
+    HANDLE session;
+    REQUIRE(FwpmEngineOpen0(nullptr, 0, nullptr, nullptr, &session) == STATUS_SUCCESS);
+    REQUIRE(FwpmTransactionBegin0(session, 0) == STATUS_SUCCESS);
+    _add_test_filter(session, FWP_ACTION_BLOCK, weight);
+    REQUIRE(FwpmEngineClose0(session) == STATUS_SUCCESS);
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_FWP_NO_TXN_IN_PROGRESS);
+    REQUIRE(FwpmEngineClose0(session) == STATUS_INVALID_PARAMETER);
+
+    // The filter added in the transaction is gone, and another session's change doesn't wait for the transaction.
+    FWPM_FILTER0 filter = {};
+    filter.layerKey = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4;
+    filter.subLayerKey = _test_sublayer_key;
+    filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+    filter.action.calloutKey = _test_callout_key;
+    filter.rawContext = FWP_ACTION_PERMIT;
+    uint64_t filter_id = 0;
+    std::future<NTSTATUS> added =
+        std::async(std::launch::async, [&]() { return FwpmFilterAdd0(engine, &filter, nullptr, &filter_id); });
+    REQUIRE(added.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    REQUIRE(added.get() == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+
+    REQUIRE(FwpmFilterDeleteById0(engine, filter_id) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("FwpmEngineClose0 leaves another session's transaction open", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWP_VALUE0 weight = {};
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_SUCCESS);
+    uint64_t filter_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight);
+
+    // Opening and closing a session on another thread neither waits for the transaction nor aborts it.
+    std::future<NTSTATUS> closed = std::async(std::launch::async, []() {
+        HANDLE other_engine;
+        REQUIRE(FwpmEngineOpen0(nullptr, 0, nullptr, nullptr, &other_engine) == STATUS_SUCCESS);
+        return FwpmEngineClose0(other_engine);
+    });
+    REQUIRE(closed.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    REQUIRE(closed.get() == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_BLOCK);
+
+    REQUIRE(FwpmFilterDeleteById0(engine, filter_id) == STATUS_SUCCESS);
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("FwpsCalloutUnregisterById0 in a transaction", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWP_VALUE0 weight = {};
+    uint64_t filter_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+    fwp_classify_parameters_t parameters = {.family = AF_INET};
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+
+    // FWPS callouts aren't part of the transaction, so unregistering one stops classify from calling it right away.
+    REQUIRE(FwpmTransactionBegin0(engine, 0) == STATUS_SUCCESS);
+    REQUIRE(FwpsCalloutUnregisterById0(callout_id) == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_CALLOUT_UNKNOWN);
+
+    // Nor does registering one from another thread wait for the transaction.
+    FWPS_CALLOUT3 fwps_callout = {
+        .calloutKey = _test_callout_key,
+        .classifyFn = _test_classify,
+        .notifyFn = _test_notify,
+        .flowDeleteFn = _test_flow_delete};
+    std::future<NTSTATUS> registered = std::async(
+        std::launch::async, [&]() { return FwpsCalloutRegister3(nullptr, &fwps_callout, &callout_id); });
+    REQUIRE(registered.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    REQUIRE(registered.get() == STATUS_SUCCESS);
+    REQUIRE(usersim_fwp_bind_ipv4(&parameters) == FWP_ACTION_PERMIT);
+    REQUIRE(FwpmTransactionCommit0(engine) == STATUS_SUCCESS);
+
+    REQUIRE(FwpmFilterDeleteById0(engine, filter_id) == STATUS_SUCCESS);
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("usersim_fwp_classify_packets", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    uint64_t filter_ids[] = {
+        _add_test_layer_filter(engine, FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, FWP_ACTION_PERMIT),
+        _add_test_layer_filter(engine, FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4, FWP_ACTION_BLOCK),
+        _add_test_layer_filter(engine, FWPM_LAYER_ALE_CONNECT_REDIRECT_V6, FWP_ACTION_PERMIT)};
+
+    // Each packet gets the action of its own layer, and a layer without filters has no callout to decide.
+    fwp_classify_parameters_t parameters = {.family = AF_INET, .destination_port = 80, .protocol = IPPROTO_TCP};
+    fwp_classify_packet_t packets[] = {
+        {.layer_guid = &FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, .if_index = 1},
+        {.layer_guid = &FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4, .parameters = &parameters},
+        {.layer_guid = &FWPM_LAYER_ALE_CONNECT_REDIRECT_V6, .parameters = &parameters},
+        {.layer_guid = &FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V6, .parameters = &parameters},
+        {.layer_guid = &FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, .if_index = 2}};
+    _test_classify_count = 0;
+    REQUIRE(usersim_fwp_classify_packets(packets, _countof(packets)) == STATUS_SUCCESS);
+    REQUIRE(packets[0].action == FWP_ACTION_PERMIT);
+    REQUIRE(packets[1].action == FWP_ACTION_BLOCK);
+    REQUIRE(packets[2].action == FWP_ACTION_PERMIT);
+    REQUIRE(packets[3].action == FWP_ACTION_CALLOUT_UNKNOWN);
+    REQUIRE(packets[4].action == FWP_ACTION_PERMIT);
+    REQUIRE(_test_classify_count == 4);
+    REQUIRE(usersim_fwp_classify_packets(packets, 0) == STATUS_SUCCESS);
+
+    // A packet at an unsupported layer, or an ALE packet without parameters, fails the whole batch.
+    fwp_classify_packet_t invalid_packet = {.layer_guid = &FWPM_LAYER_ALE_AUTH_CONNECT_V4, .parameters = &parameters};
+    REQUIRE(usersim_fwp_classify_packets(&invalid_packet, 1) == STATUS_INVALID_PARAMETER);
+    invalid_packet = {.layer_guid = &FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4};
+    REQUIRE(usersim_fwp_classify_packets(&invalid_packet, 1) == STATUS_INVALID_PARAMETER);
+
+    for (uint64_t id : filter_ids) {
+        REQUIRE(FwpmFilterDeleteById0(engine, id) == STATUS_SUCCESS);
+    }
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("usersim_fwp_classify_packets_benchmark", "[.][fwp][benchmark]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    const GUID* layers[] = {
+        &FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE,
+        &FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4,
+        &FWPM_LAYER_ALE_CONNECT_REDIRECT_V4};
+    const char* layer_names[] = {"xdp", "bind", "connect redirect"};
+    std::vector<uint64_t> filter_ids;
+    for (const GUID* layer : layers) {
+        filter_ids.push_back(_add_test_layer_filter(engine, *layer, FWP_ACTION_PERMIT));
+    }
+
+    // Every run classifies the same number of packets, whatever the batch size, so the mean times of all the
+    // benchmarks compare directly, and the packets per second are packet_count divided by the mean.
+    const size_t packet_count = 1024;
+    fwp_classify_parameters_t parameters = {.family = AF_INET, .destination_port = 80, .protocol = IPPROTO_TCP};
+    for (size_t i = 0; i < _countof(layers); i++) {
+        for (size_t batch_size : {1, 64, 1024}) {
+            std::vector<fwp_classify_packet_t> packets(
+                batch_size, {.layer_guid = layers[i], .if_index = 1, .parameters = &parameters});
+            BENCHMARK(
+                std::string(layer_names[i]) + ", " + std::to_string(packet_count) + " packets in batches of " +
+                std::to_string(batch_size))
+            {
+                NTSTATUS status = STATUS_SUCCESS;
+                for (size_t sent = 0; sent < packet_count; sent += batch_size) {
+                    status = usersim_fwp_classify_packets(packets.data(), packets.size());
+                }
+                return status;
+            };
+        }
+    }
+
+    // The single packet entry point, for comparison with batches of one.
+    BENCHMARK("xdp, " + std::to_string(packet_count) + " packets unbatched")
+    {
+        FWP_ACTION_TYPE action = FWP_ACTION_NONE;
+        for (size_t sent = 0; sent < packet_count; sent++) {
+            action = usersim_fwp_classify_packet(&FWPM_LAYER_INBOUND_MAC_FRAME_NATIVE, 1);
+        }
+        return action;
+    };
+
+    for (uint64_t id : filter_ids) {
+        REQUIRE(FwpmFilterDeleteById0(engine, id) == STATUS_SUCCESS);
+    }
+    _close_test_engine(engine, callout_id);
+}
+
+static const GUID _test_slow_callout_key = {
+    0x1a8d5e5b, 0x7f0c, 0x4a8e, {0x9a, 0x3e, 0x51, 0x2d, 0x6c, 0x0b, 0x4f, 0x14}};
+static std::atomic<uint32_t> _test_slow_classify_active = 0;
+
+// A callout that takes long enough to still be running when another thread unregisters it.
+static void NTAPI
+_test_slow_classify(
+    _In_ const FWPS_INCOMING_VALUES* incoming_fixed_values,
+    _In_ const FWPS_INCOMING_METADATA_VALUES* incoming_metadata_values,
+    _Inout_opt_ void* layer_data,
+    _In_opt_ const void* classify_context,
+    _In_ const FWPS_FILTER* filter,
+    uint64_t flow_context,
+    _Inout_ FWPS_CLASSIFY_OUT0* classify_output)
+{
+    _test_slow_classify_active++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    _test_classify(
+        incoming_fixed_values,
+        incoming_metadata_values,
+        layer_data,
+        classify_context,
+        filter,
+        flow_context,
+        classify_output);
+    _test_slow_classify_active--;
+}
+
+TEST_CASE("FWP classify concurrent with changes", "[fwp]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWP_VALUE0 weight = {};
+    uint64_t block_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight);
+
+    // Classifies running while filters are replaced see either the old filters or the new ones.
+    std::atomic<bool> stop = false;
+    std::atomic<uint32_t> unexpected_count = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            fwp_classify_parameters_t parameters = {.family = AF_INET};
+            while (!stop) {
+                FWP_ACTION_TYPE action = usersim_fwp_bind_ipv4(&parameters);
+                if (action != FWP_ACTION_BLOCK && action != FWP_ACTION_PERMIT) {
+                    unexpected_count++;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 100; i++) {
+        uint64_t permit_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+        REQUIRE(FwpmFilterDeleteById0(engine, block_id) == STATUS_SUCCESS);
+        block_id = _add_test_filter(engine, FWP_ACTION_BLOCK, weight);
+        REQUIRE(FwpmFilterDeleteById0(engine, permit_id) == STATUS_SUCCESS);
+    }
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(unexpected_count == 0);
+    REQUIRE(FwpmFilterDeleteById0(engine, block_id) == STATUS_SUCCESS);
+
+    // Unregistering a callout waits for the classifies that are running it.
+    FWPS_CALLOUT3 slow_callout = {
+        .calloutKey = _test_slow_callout_key,
+        .classifyFn = _test_slow_classify,
+        .notifyFn = _test_notify,
+        .flowDeleteFn = _test_flow_delete};
+    uint32_t slow_callout_id;
+    REQUIRE(FwpsCalloutRegister3(nullptr, &slow_callout, &slow_callout_id) == STATUS_SUCCESS);
+    FWPM_FILTER0 filter = {};
+    filter.layerKey = FWPM_LAYER_ALE_RESOURCE_ASSIGNMENT_V4;
+    filter.subLayerKey = _test_sublayer_key;
+    filter.action.type = FWP_ACTION_CALLOUT_TERMINATING;
+    filter.action.calloutKey = _test_slow_callout_key;
+    filter.rawContext = FWP_ACTION_PERMIT;
+    uint64_t slow_filter_id;
+    REQUIRE(FwpmFilterAdd0(engine, &filter, nullptr, &slow_filter_id) == STATUS_SUCCESS);
+
+    FWP_ACTION_TYPE slow_action = FWP_ACTION_NONE;
+    std::thread slow_thread([&]() {
+        fwp_classify_parameters_t parameters = {.family = AF_INET};
+        slow_action = usersim_fwp_bind_ipv4(&parameters);
+    });
+    while (_test_slow_classify_active == 0) {
+        std::this_thread::yield();
+    }
+    REQUIRE(FwpsCalloutUnregisterById0(slow_callout_id) == STATUS_SUCCESS);
+    REQUIRE(_test_slow_classify_active == 0);
+    slow_thread.join();
+    REQUIRE(slow_action == FWP_ACTION_PERMIT);
+
+    REQUIRE(FwpmFilterDeleteById0(engine, slow_filter_id) == STATUS_SUCCESS);
+    _close_test_engine(engine, callout_id);
+}
+
+TEST_CASE("usersim_fwp_bind_ipv4_scaling_benchmark", "[.][fwp][benchmark]")
+{
+    uint32_t callout_id;
+    HANDLE engine = _open_test_engine(&callout_id);
+    FWP_VALUE0 weight = {};
+    uint64_t filter_id = _add_test_filter(engine, FWP_ACTION_PERMIT, weight);
+
+    // Each run has every thread classify the same number of packets, so the packets per second are the thread count
+    // times the packets per thread, divided by the mean time of a run. With no shared writes on the classify path,
+    // the mean should stay flat as threads are added, up to the number of processors.
+    const uint32_t packets_per_thread = 10000;
+    uint32_t max_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t thread_count = 1; thread_count < max_thread_count; thread_count *= 2) {
+        thread_counts.push_back(thread_count);
+    }
+    thread_counts.push_back(max_thread_count);
+    for (uint32_t thread_count : thread_counts) {
+        BENCHMARK(std::to_string(thread_count) + " threads")
+        {
+            std::vector<std::thread> threads;
+            for (uint32_t i = 0; i < thread_count; i++) {
+                threads.emplace_back([&]() {
+                    fwp_classify_parameters_t parameters = {.family = AF_INET};
+                    for (uint32_t j = 0; j < packets_per_thread; j++) {
+                        (void)usersim_fwp_bind_ipv4(&parameters);
+                    }
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        };
+    }
+
+    REQUIRE(FwpmFilterDeleteById0(engine, filter_id) == STATUS_SUCCESS);
+    _close_test_engine(engine, callout_id);
+}
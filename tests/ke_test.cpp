@@ -4,12 +4,15 @@
 #if !defined(CMAKE_NUGET)
 #include <catch2/catch_all.hpp>
 #else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #endif
 #include "usersim/ke.h"
 #include "usersim/mm.h"
 
+#include <atomic>
 #include <thread>
+#include <vector>
 
 TEST_CASE("irql", "[ke]")
 {
@@ -82,6 +85,88 @@ TEST_CASE("KfRaiseIrql", "[ke]")
     REQUIRE(KeGetCurrentIrql() == PASSIVE_LEVEL);
 }
 
+TEST_CASE("fast irql mode", "[ke]")
+{
+    usersim_irql_mode_t original_mode = usersim_set_irql_mode(USERSIM_IRQL_MODE_FAST);
+
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+    REQUIRE(old_irql == PASSIVE_LEVEL);
+    REQUIRE(KeGetCurrentIrql() == DISPATCH_LEVEL);
+
+    // The thread isn't pinned, but keeps reporting the processor it raised on.
+    ULONG processor_index = KeGetCurrentProcessorNumberEx(nullptr);
+    Sleep(10);
+    REQUIRE(KeGetCurrentProcessorNumberEx(nullptr) == processor_index);
+    KeLowerIrql(old_irql);
+    REQUIRE(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    // Verify that threads at DISPATCH_LEVEL on the same processor still exclude each other.
+    const size_t iterations = 10000;
+    uint64_t counter = 0;
+    std::atomic<bool> wrong_processor = false;
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            KeSetSystemAffinityThreadEx(1);
+            for (size_t j = 0; j < iterations; j++) {
+                KIRQL thread_old_irql = KeRaiseIrqlToDpcLevel();
+                if (KeGetCurrentProcessorNumberEx(nullptr) != 0) {
+                    wrong_processor = true;
+                }
+                uint64_t value = counter;
+                YieldProcessor();
+                counter = value + 1;
+                KeLowerIrql(thread_old_irql);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(counter == 4 * iterations);
+    REQUIRE(!wrong_processor);
+
+    usersim_set_irql_mode(original_mode);
+}
+
+TEST_CASE("irql benchmark", "[.][ke][benchmark]")
+{
+    usersim_irql_mode_t original_mode = usersim_set_irql_mode(USERSIM_IRQL_MODE_STRICT);
+    KSPIN_LOCK lock;
+    KeInitializeSpinLock(&lock);
+
+    BENCHMARK("raise and lower (strict)")
+    {
+        KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+        KeLowerIrql(old_irql);
+        return old_irql;
+    };
+    BENCHMARK("spin lock (strict)")
+    {
+        KIRQL old_irql;
+        KeAcquireSpinLock(&lock, &old_irql);
+        KeReleaseSpinLock(&lock, old_irql);
+        return old_irql;
+    };
+
+    usersim_set_irql_mode(USERSIM_IRQL_MODE_FAST);
+    BENCHMARK("raise and lower (fast)")
+    {
+        KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+        KeLowerIrql(old_irql);
+        return old_irql;
+    };
+    BENCHMARK("spin lock (fast)")
+    {
+        KIRQL old_irql;
+        KeAcquireSpinLock(&lock, &old_irql);
+        KeReleaseSpinLock(&lock, old_irql);
+        return old_irql;
+    };
+
+    usersim_set_irql_mode(original_mode);
+}
+
 TEST_CASE("spin lock", "[ke]")
 {
     KSPIN_LOCK lock;
@@ -167,6 +252,68 @@ TEST_CASE("semaphore", "[ke]")
     REQUIRE(KeReadStateSemaphore(&semaphore) != 0);
 }
 
+TEST_CASE("semaphore contention", "[ke]")
+{
+    KSEMAPHORE semaphore;
+    KeInitializeSemaphore(&semaphore, 0, 4);
+    REQUIRE(KeReadStateSemaphore(&semaphore) == 0);
+
+    // Park several waiters and release them in one adjustment.
+    std::atomic<size_t> acquired = 0;
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            if (KeWaitForSingleObject(&semaphore, Executive, KernelMode, FALSE, nullptr) == STATUS_SUCCESS) {
+                acquired++;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(acquired == 0);
+    REQUIRE(KeReleaseSemaphore(&semaphore, 0, 4, FALSE) == 0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(acquired == 4);
+    REQUIRE(KeReadStateSemaphore(&semaphore) == 0);
+
+    // Verify a relative timeout expires.
+    LARGE_INTEGER timeout = {.QuadPart = -10000 * 10ll}; // 10ms.
+    REQUIRE(KeWaitForSingleObject(&semaphore, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT);
+}
+
+TEST_CASE("mutex", "[ke]")
+{
+    KMUTEX mutex;
+    LARGE_INTEGER timeout = {0};
+    KeInitializeMutex(&mutex, 0);
+    REQUIRE(KeReadStateMutex(&mutex) == 1);
+
+    // Verify the owner can acquire the mutex recursively.
+    REQUIRE(KeWaitForSingleObject(&mutex, Executive, KernelMode, FALSE, &timeout) == STATUS_SUCCESS);
+    REQUIRE(KeWaitForSingleObject(&mutex, Executive, KernelMode, FALSE, &timeout) == STATUS_SUCCESS);
+    REQUIRE(KeReadStateMutex(&mutex) == -1);
+
+    // Verify another thread can't acquire it while it is owned.
+    NTSTATUS wait_status = STATUS_SUCCESS;
+    std::jthread([&]() { wait_status = KeWaitForSingleObject(&mutex, Executive, KernelMode, FALSE, &timeout); })
+        .join();
+    REQUIRE(wait_status == STATUS_TIMEOUT);
+
+    // Release both acquisitions, and verify a waiting thread then gets ownership.
+    wait_status = STATUS_UNSUCCESSFUL;
+    auto thread = std::jthread([&]() {
+        wait_status = KeWaitForSingleObject(&mutex, Executive, KernelMode, FALSE, nullptr);
+        KeReleaseMutex(&mutex, FALSE);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(KeReleaseMutex(&mutex, FALSE) == -1);
+    REQUIRE(KeReleaseMutex(&mutex, FALSE) == 0);
+    thread.join();
+    REQUIRE(wait_status == STATUS_SUCCESS);
+    REQUIRE(KeReadStateMutex(&mutex) == 1);
+}
+
 TEST_CASE("threads", "[ke]")
 {
     PKTHREAD thread = KeGetCurrentThread();
@@ -301,6 +448,162 @@ TEST_CASE("dpcs", "[ke]")
     KeFlushQueuedDpcs();
 }
 
+TEST_CASE("dpc requeue after remove", "[ke]")
+{
+    uint64_t context = 0;
+    KDPC dpc;
+    KeInitializeDpc(&dpc, _dpc_routine, &context);
+    KeSetTargetProcessorDpc(&dpc, 0);
+
+    // Block the DPC queue for processor 0 so the DPC stays linked while it is removed and requeued.
+    KAFFINITY user_affinity = KeSetSystemAffinityThreadEx(1);
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+
+    REQUIRE(KeInsertQueueDpc(&dpc, (void*)(uintptr_t)1, (void*)(uintptr_t)2) == TRUE);
+    REQUIRE(KeRemoveQueueDpc(&dpc) == TRUE);
+    REQUIRE(KeRemoveQueueDpc(&dpc) == FALSE);
+    REQUIRE(KeInsertQueueDpc(&dpc, (void*)(uintptr_t)10, (void*)(uintptr_t)20) == TRUE);
+    REQUIRE(KeInsertQueueDpc(&dpc, (void*)(uintptr_t)100, (void*)(uintptr_t)200) == FALSE);
+
+    KeRevertToUserAffinityThreadEx(user_affinity);
+    KeLowerIrql(old_irql);
+    KeFlushQueuedDpcs();
+
+    // Only the requeued arguments are delivered, exactly once.
+    REQUIRE(context == 30);
+}
+
+typedef struct _test_blocking_dpc_context
+{
+    std::atomic<bool> started;
+    std::atomic<bool> released;
+} test_blocking_dpc_context_t;
+
+// Holds up the DPC queue it runs on until the test releases it.
+static void
+_dpc_blocking_routine(
+    _In_ PRKDPC dpc, _In_opt_ void* deferred_context, _In_opt_ void* system_argument1, _In_opt_ void* system_argument2)
+{
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(system_argument1);
+    UNREFERENCED_PARAMETER(system_argument2);
+    test_blocking_dpc_context_t* context = (test_blocking_dpc_context_t*)deferred_context;
+    context->started = true;
+    context->started.notify_all();
+    context->released.wait(false);
+}
+
+/**
+ * @brief Remove a queued DPC and free it, then remove and reinitialize another one that has a DPC queued behind it.
+ */
+static void
+_remove_free_and_reinitialize_dpcs(_Inout_ KDPC* reinitialized, _Inout_ KDPC* freed, _In_ uint64_t* context)
+{
+    REQUIRE(KeRemoveQueueDpc(freed) == TRUE);
+    memset(freed, 0xcc, sizeof(*freed));
+    delete freed;
+
+    REQUIRE(KeRemoveQueueDpc(reinitialized) == TRUE);
+    KeInitializeDpc(reinitialized, _dpc_routine, context);
+    KeSetTargetProcessorDpc(reinitialized, 0);
+    REQUIRE(KeInsertQueueDpc(reinitialized, (void*)(uintptr_t)1000, nullptr) == TRUE);
+}
+
+TEST_CASE("dpc free and reinitialize after remove", "[ke]")
+{
+    uint64_t context = 0;
+    KDPC first;
+    KDPC* freed = new KDPC;
+    KDPC last;
+    KeInitializeDpc(&first, _dpc_routine, &context);
+    KeInitializeDpc(freed, _dpc_routine, &context);
+    KeInitializeDpc(&last, _dpc_routine, &context);
+
+    // Block the DPC queue for processor 0 so the DPCs are still waiting to be taken when they are removed.
+    KAFFINITY user_affinity = KeSetSystemAffinityThreadEx(1);
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+
+    REQUIRE(KeInsertQueueDpc(&first, (void*)(uintptr_t)1, nullptr) == TRUE);
+    REQUIRE(KeInsertQueueDpc(freed, (void*)(uintptr_t)10, nullptr) == TRUE);
+    REQUIRE(KeInsertQueueDpc(&last, (void*)(uintptr_t)100, nullptr) == TRUE);
+    _remove_free_and_reinitialize_dpcs(&first, freed, &context);
+
+    KeRevertToUserAffinityThreadEx(user_affinity);
+    KeLowerIrql(old_irql);
+    KeFlushQueuedDpcs();
+
+    // The DPC queued behind the removed ones still runs, and so does the reinitialized one, exactly once.
+    REQUIRE(context == 1100);
+}
+
+TEST_CASE("dpc free and reinitialize after remove while running", "[ke]")
+{
+    uint64_t context = 0;
+    KDPC first;
+    KDPC* freed = new KDPC;
+    KDPC last;
+    KeInitializeDpc(&first, _dpc_routine, &context);
+    KeInitializeDpc(freed, _dpc_routine, &context);
+    KeInitializeDpc(&last, _dpc_routine, &context);
+
+    // Queue the DPCs behind one that holds up the queue, so the DPC thread has already taken them when they are
+    // removed.
+    test_blocking_dpc_context_t blocking_context = {};
+    KDPC blocking;
+    KeInitializeDpc(&blocking, _dpc_blocking_routine, &blocking_context);
+    KAFFINITY user_affinity = KeSetSystemAffinityThreadEx(1);
+    KIRQL old_irql = KeRaiseIrqlToDpcLevel();
+
+    REQUIRE(KeInsertQueueDpc(&blocking, nullptr, nullptr) == TRUE);
+    REQUIRE(KeInsertQueueDpc(&first, (void*)(uintptr_t)1, nullptr) == TRUE);
+    REQUIRE(KeInsertQueueDpc(freed, (void*)(uintptr_t)10, nullptr) == TRUE);
+    REQUIRE(KeInsertQueueDpc(&last, (void*)(uintptr_t)100, nullptr) == TRUE);
+
+    KeRevertToUserAffinityThreadEx(user_affinity);
+    KeLowerIrql(old_irql);
+    blocking_context.started.wait(false);
+
+    _remove_free_and_reinitialize_dpcs(&first, freed, &context);
+    blocking_context.released = true;
+    blocking_context.released.notify_all();
+    KeFlushQueuedDpcs();
+
+    REQUIRE(context == 1100);
+}
+
+TEST_CASE("dpc concurrent insert", "[ke]")
+{
+    const size_t thread_count = 4;
+    const size_t dpcs_per_thread = 1000;
+    std::vector<KDPC> dpcs(thread_count * dpcs_per_thread);
+    uint64_t context = 0;
+
+    // Target a single processor so the DPCs run serially and can share the context.
+    for (auto& dpc : dpcs) {
+        KeInitializeDpc(&dpc, _dpc_routine, &context);
+        KeSetTargetProcessorDpc(&dpc, 0);
+    }
+
+    std::atomic<size_t> inserted = 0;
+    std::vector<std::jthread> threads;
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < dpcs_per_thread; i++) {
+                if (KeInsertQueueDpc(&dpcs[t * dpcs_per_thread + i], (void*)(uintptr_t)1, nullptr)) {
+                    inserted++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    KeFlushQueuedDpcs();
+    REQUIRE(inserted == dpcs.size());
+    REQUIRE(context == dpcs.size());
+}
+
 static void
 _timer_routine(
     _In_ PRKDPC dpc, _In_opt_ void* deferred_context, _In_opt_ void* system_argument1, _In_opt_ void* system_argument2)
@@ -373,6 +676,59 @@ TEST_CASE("periodic timers", "[ke]")
     REQUIRE(context == 4);
 }
 
+TEST_CASE("absolute timers", "[ke]")
+{
+    uint64_t context = 1;
+    KTIMER timer;
+    KeInitializeTimer(&timer);
+    KDPC dpc;
+    KeInitializeDpc(&dpc, _timer_routine, &context);
+
+    // Absolute due times are expressed in system time.
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    LARGE_INTEGER due_time;
+    due_time.LowPart = now.dwLowDateTime;
+    due_time.HighPart = now.dwHighDateTime;
+    due_time.QuadPart += 10000 * 200ll; // 200 milliseconds.
+    REQUIRE(KeSetTimer(&timer, due_time, &dpc) == FALSE);
+    REQUIRE(KeReadStateTimer(&timer) == FALSE);
+    Sleep(1000);
+    REQUIRE(KeReadStateTimer(&timer) == TRUE);
+    REQUIRE(context == 2);
+
+    // A due time in the past expires immediately.
+    due_time.QuadPart -= 10000 * 1000 * 60ll; // 1 minute ago.
+    REQUIRE(KeSetTimer(&timer, due_time, &dpc) == FALSE);
+    Sleep(1000);
+    REQUIRE(KeReadStateTimer(&timer) == TRUE);
+    REQUIRE(context == 3);
+}
+
+TEST_CASE("coalescable timers", "[ke]")
+{
+    const size_t timer_count = 16;
+    uint64_t context = 0;
+    KTIMER timers[timer_count];
+    KDPC dpcs[timer_count];
+
+    // Timers with nearby due times and a large tolerable delay should all fire.
+    for (size_t i = 0; i < timer_count; i++) {
+        KeInitializeTimer(&timers[i]);
+        KeInitializeDpc(&dpcs[i], _timer_routine, &context);
+        KeSetTargetProcessorDpc(&dpcs[i], 0);
+        LARGE_INTEGER due_time = {.QuadPart = -10000 * (100ll + (LONGLONG)i)};
+        REQUIRE(KeSetCoalescableTimer(&timers[i], due_time, 0, 100, &dpcs[i]) == FALSE);
+    }
+    Sleep(1000);
+    KeFlushQueuedDpcs();
+    REQUIRE(context == timer_count);
+    for (size_t i = 0; i < timer_count; i++) {
+        REQUIRE(KeReadStateTimer(&timers[i]) == TRUE);
+        REQUIRE(KeCancelTimer(&timers[i]) == FALSE);
+    }
+}
+
 TEST_CASE("KeBugCheck", "[ke]")
 {
     try {
@@ -489,3 +845,102 @@ TEST_CASE("event", "[ke]")
     REQUIRE(wait_status == STATUS_TIMEOUT);
     REQUIRE(end_time - start_time >= 1000);
 }
+
+TEST_CASE("wait with an absolute timeout", "[ke]")
+{
+    KEVENT event;
+    KeInitializeEvent(&event, NotificationEvent, FALSE);
+
+    // Absolute timeouts are expressed in system time.
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    LARGE_INTEGER timeout;
+    timeout.LowPart = now.dwLowDateTime;
+    timeout.HighPart = now.dwHighDateTime;
+    timeout.QuadPart += 10000 * 200ll; // 200 milliseconds.
+
+    uint64_t qpc_time;
+    uint64_t start_time = KeQueryInterruptTimePrecise(&qpc_time);
+    REQUIRE(KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT);
+    uint64_t end_time = KeQueryInterruptTimePrecise(&qpc_time);
+    REQUIRE(end_time - start_time >= 10000 * 100ll);
+    REQUIRE(end_time - start_time < 10000 * 10000ll);
+
+    // A timeout in the past expires immediately.
+    timeout.QuadPart -= 10000 * 1000ll;
+    REQUIRE(KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, &timeout) == STATUS_TIMEOUT);
+}
+
+TEST_CASE("wait for multiple objects", "[ke]")
+{
+    KEVENT event;
+    KSEMAPHORE semaphore;
+    KMUTEX mutex;
+    KTIMER timer;
+    KeInitializeEvent(&event, SynchronizationEvent, FALSE);
+    KeInitializeSemaphore(&semaphore, 0, 1);
+    KeInitializeMutex(&mutex, 0);
+    KeInitializeTimer(&timer);
+    LARGE_INTEGER timeout = {0};
+
+    // Verify WaitAny times out when nothing is signaled.
+    void* any_objects[] = {&event, &semaphore};
+    REQUIRE(
+        KeWaitForMultipleObjects(2, any_objects, WaitAny, Executive, KernelMode, FALSE, &timeout, nullptr) ==
+        STATUS_TIMEOUT);
+
+    // Verify WaitAny reports which object satisfied the wait, and consumes only that object.
+    KeReleaseSemaphore(&semaphore, 0, 1, FALSE);
+    REQUIRE(
+        KeWaitForMultipleObjects(2, any_objects, WaitAny, Executive, KernelMode, FALSE, &timeout, nullptr) ==
+        STATUS_WAIT_0 + 1);
+    REQUIRE(KeReadStateSemaphore(&semaphore) == 0);
+
+    // Verify a blocked WaitAny is woken by a signal on any of its objects.
+    NTSTATUS wait_status = STATUS_UNSUCCESSFUL;
+    auto thread = std::jthread([&]() {
+        wait_status =
+            KeWaitForMultipleObjects(2, any_objects, WaitAny, Executive, KernelMode, FALSE, nullptr, nullptr);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    KeSetEvent(&event, 0, FALSE);
+    thread.join();
+    REQUIRE(wait_status == STATUS_WAIT_0);
+
+    // Verify WaitAll doesn't acquire anything until every object is signaled.
+    void* all_objects[] = {&mutex, &semaphore, &timer};
+    REQUIRE(
+        KeWaitForMultipleObjects(3, all_objects, WaitAll, Executive, KernelMode, FALSE, &timeout, nullptr) ==
+        STATUS_TIMEOUT);
+    REQUIRE(KeReadStateMutex(&mutex) == 1);
+
+    // Verify WaitAll completes once the last object (the timer) is signaled.
+    KeReleaseSemaphore(&semaphore, 0, 1, FALSE);
+    LARGE_INTEGER due_time = {.QuadPart = -10000 * 50ll}; // 50ms.
+    KeSetTimer(&timer, due_time, nullptr);
+    timeout.QuadPart = -10000 * 5000ll; // 5 seconds.
+    REQUIRE(
+        KeWaitForMultipleObjects(3, all_objects, WaitAll, Executive, KernelMode, FALSE, &timeout, nullptr) ==
+        STATUS_SUCCESS);
+    REQUIRE(KeReadStateSemaphore(&semaphore) == 0);
+    REQUIRE(KeReadStateMutex(&mutex) == 0);
+    REQUIRE(KeReleaseMutex(&mutex, FALSE) == 0);
+
+    // Verify more than THREAD_WAIT_OBJECTS objects can be waited on with a caller-supplied wait block array.
+    KEVENT events[8];
+    void* event_objects[8];
+    KWAIT_BLOCK wait_blocks[8];
+    for (size_t i = 0; i < 8; i++) {
+        KeInitializeEvent(&events[i], NotificationEvent, FALSE);
+        event_objects[i] = &events[i];
+    }
+    thread = std::jthread([&]() {
+        wait_status =
+            KeWaitForMultipleObjects(8, event_objects, WaitAll, Executive, KernelMode, FALSE, nullptr, wait_blocks);
+    });
+    for (size_t i = 0; i < 8; i++) {
+        KeSetEvent(&events[i], 0, FALSE);
+    }
+    thread.join();
+    REQUIRE(wait_status == STATUS_SUCCESS);
+}
@@ -4,10 +4,16 @@
 #if !defined(CMAKE_NUGET)
 #include <catch2/catch_all.hpp>
 #else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #endif
 #include "usersim/ob.h"
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
 TEST_CASE("ObfReferenceObject", "[ob]")
 {
     int x = 0;
@@ -24,3 +30,186 @@ TEST_CASE("ObfReferenceObject", "[ob]")
     REQUIRE(ObReferenceObjectByHandle(handle, 0, *ExEventObjectType, 0, &object, nullptr) == STATUS_SUCCESS);
     REQUIRE(object == &x);
 }
+
+static void
+_count_object_release(_In_ PVOID object, _In_opt_ void* context)
+{
+    UNREFERENCED_PARAMETER(object);
+    (*(std::atomic<size_t>*)context)++;
+}
+
+TEST_CASE("ObfDereferenceObject release callback", "[ob]")
+{
+    static int object;
+    std::atomic<size_t> release_count = 0;
+    usersim_set_object_release_callback(_count_object_release, &release_count);
+
+    REQUIRE(ObfReferenceObject(&object) == 1);
+    REQUIRE(ObfReferenceObject(&object) == 2);
+    REQUIRE(ObfDereferenceObject(&object) == 1);
+    REQUIRE(release_count == 0);
+    REQUIRE(ObfDereferenceObject(&object) == 0);
+    REQUIRE(release_count == 1);
+
+    // The object starts over once it was released.
+    REQUIRE(ObfReferenceObject(&object) == 1);
+    REQUIRE(ObfDereferenceObject(&object) == 0);
+    REQUIRE(release_count == 2);
+
+    usersim_set_object_release_callback(nullptr, nullptr);
+}
+
+TEST_CASE("object reference trace", "[ob]")
+{
+    static int object;
+    std::atomic<size_t> release_count = 0;
+    usersim_set_object_release_callback(_count_object_release, &release_count);
+
+    REQUIRE(usersim_start_object_reference_trace(&object) == STATUS_SUCCESS);
+    REQUIRE(ObfReferenceObject(&object) == 1);
+    REQUIRE(ObfReferenceObject(&object) == 2);
+    REQUIRE(ObfDereferenceObject(&object) == 1);
+    REQUIRE(ObfDereferenceObject(&object) == 0);
+
+    usersim_object_reference_trace_entry_t entries[4];
+    REQUIRE(usersim_get_object_reference_trace(&object, nullptr, 0) == 4);
+    REQUIRE(usersim_get_object_reference_trace(&object, entries, 4) == 4);
+    LONG_PTR expected_counts[] = {1, 2, 1, 0};
+    for (size_t i = 0; i < 4; i++) {
+        REQUIRE(entries[i].caller != nullptr);
+        REQUIRE(entries[i].reference_count == expected_counts[i]);
+    }
+
+    usersim_stop_object_reference_trace(&object);
+    REQUIRE(usersim_get_object_reference_trace(&object, entries, 4) == 0);
+    REQUIRE(ObfReferenceObject(&object) == 1);
+    REQUIRE(ObfDereferenceObject(&object) == 0);
+    REQUIRE(usersim_get_object_reference_trace(&object, entries, 4) == 0);
+
+    usersim_set_object_release_callback(nullptr, nullptr);
+}
+
+TEST_CASE("object reference trace concurrent", "[ob]")
+{
+    const size_t thread_count = 8;
+    const size_t iterations = 1000;
+    static int object;
+    std::atomic<size_t> release_count = 0;
+    usersim_set_object_release_callback(_count_object_release, &release_count);
+
+    REQUIRE(usersim_start_object_reference_trace(&object) == STATUS_SUCCESS);
+    REQUIRE(ObfReferenceObject(&object) == 1);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&]() {
+            for (size_t j = 0; j < iterations; j++) {
+                ObfReferenceObject(&object);
+                ObfDereferenceObject(&object);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(ObfDereferenceObject(&object) == 0);
+
+    // Entries are recorded in the order the count changed, so each one is a single step from the one before it.
+    size_t entry_count = usersim_get_object_reference_trace(&object, nullptr, 0);
+    REQUIRE(entry_count == 2 * thread_count * iterations + 2);
+    std::vector<usersim_object_reference_trace_entry_t> entries(entry_count);
+    REQUIRE(usersim_get_object_reference_trace(&object, entries.data(), entry_count) == entry_count);
+    bool steps_valid = (entries[0].reference_count == 1);
+    for (size_t i = 1; i < entry_count; i++) {
+        LONG_PTR step = entries[i].reference_count - entries[i - 1].reference_count;
+        steps_valid = steps_valid && (step == 1 || step == -1);
+    }
+    REQUIRE(steps_valid);
+    REQUIRE(entries[entry_count - 1].reference_count == 0);
+    REQUIRE(release_count == 1);
+
+    usersim_stop_object_reference_trace(&object);
+    usersim_set_object_release_callback(nullptr, nullptr);
+}
+
+TEST_CASE("ObfReferenceObject concurrent", "[ob]")
+{
+    const size_t object_count = 64;
+    const size_t thread_count = 8;
+    const size_t iterations = 10000;
+    static int objects[object_count];
+    std::atomic<size_t> release_count = 0;
+    usersim_set_object_release_callback(_count_object_release, &release_count);
+
+    // Hold a reference to every object, so the counts the threads see never drop to zero.
+    for (size_t i = 0; i < object_count; i++) {
+        REQUIRE(ObfReferenceObject(&objects[i]) == 1);
+    }
+
+    std::atomic<bool> counts_valid = true;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back([&, i]() {
+            for (size_t j = 0; j < iterations; j++) {
+                void* object = &objects[(i + j) % object_count];
+                if (ObfReferenceObject(object) < 2 || ObfDereferenceObject(object) < 1) {
+                    counts_valid = false;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(counts_valid);
+    REQUIRE(release_count == 0);
+
+    for (size_t i = 0; i < object_count; i++) {
+        REQUIRE(ObfDereferenceObject(&objects[i]) == 0);
+    }
+    REQUIRE(release_count == object_count);
+
+    usersim_set_object_release_callback(nullptr, nullptr);
+}
+
+TEST_CASE("object reference benchmark", "[.][ob][benchmark]")
+{
+    const size_t iterations = 100000;
+    const size_t object_count = 64;
+    static int objects[object_count];
+    std::atomic<size_t> release_count = 0;
+    usersim_set_object_release_callback(_count_object_release, &release_count);
+    for (size_t i = 0; i < object_count; i++) {
+        REQUIRE(ObfReferenceObject(&objects[i]) == 1);
+    }
+
+    // Threads either all reference the same object, or each one its own.
+    auto run = [&](size_t thread_count, bool shared) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&, i]() {
+                void* object = &objects[(shared) ? 0 : (i % object_count)];
+                for (size_t j = 0; j < iterations; j++) {
+                    ObfReferenceObject(object);
+                    ObfDereferenceObject(object);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return thread_count;
+    };
+
+    for (size_t thread_count = 1; thread_count <= std::thread::hardware_concurrency(); thread_count *= 2) {
+        BENCHMARK("same object, " + std::to_string(thread_count) + " threads") { return run(thread_count, true); };
+        BENCHMARK("separate objects, " + std::to_string(thread_count) + " threads")
+        {
+            return run(thread_count, false);
+        };
+    }
+
+    for (size_t i = 0; i < object_count; i++) {
+        REQUIRE(ObfDereferenceObject(&objects[i]) == 0);
+    }
+    usersim_set_object_release_callback(nullptr, nullptr);
+}
@@ -4,10 +4,16 @@
 #if !defined(CMAKE_NUGET)
 #include <catch2/catch_all.hpp>
 #else
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #endif
 #include "usersim/rtl.h"
 
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
 TEST_CASE("RtlULongAdd", "[rtl]")
 {
     ULONG result;
@@ -464,4 +470,122 @@ TEST_CASE("RtlCopySid", "[rtl]")
     memset(destination_buffer, 0, sizeof(destination_buffer));
     REQUIRE(NT_SUCCESS(RtlCopySid(sid_length, (PSID)destination_buffer, &source_sid)));
     REQUIRE(memcmp(destination_buffer, &source_sid, sid_length) == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("RtlRandomEx", "[rtl]")
+{
+    // The same seed always produces the same sequence.
+    ULONG seed1 = 17;
+    ULONG seed2 = 17;
+    ULONG first = RtlRandomEx(&seed1);
+    REQUIRE(RtlRandomEx(&seed2) == first);
+    bool all_same = true;
+    for (int i = 0; i < 100; i++) {
+        ULONG value = RtlRandomEx(&seed1);
+        REQUIRE(value < MAXLONG);
+        REQUIRE(RtlRandomEx(&seed2) == value);
+        all_same = all_same && (value == first);
+    }
+    REQUIRE(seed1 == seed2);
+    REQUIRE(!all_same);
+}
+
+TEST_CASE("usersim_random_uint32", "[rtl]")
+{
+    // Replaying a seed replays the numbers the first thread to ask for one sees.
+    std::vector<uint32_t> first_run;
+    usersim_set_random_seed(42);
+    for (int i = 0; i < 100; i++) {
+        first_run.push_back(usersim_random_uint32());
+    }
+    usersim_set_random_seed(42);
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(usersim_random_uint32() == first_run[i]);
+    }
+
+    // Other threads get other numbers.
+    std::vector<uint32_t> other_thread;
+    std::thread([&]() {
+        for (int i = 0; i < 100; i++) {
+            other_thread.push_back(usersim_random_uint32());
+        }
+    }).join();
+    REQUIRE(other_thread != first_run);
+
+    // So does another seed, or no seed at all.
+    usersim_set_random_seed(43);
+    std::vector<uint32_t> other_seed;
+    for (int i = 0; i < 100; i++) {
+        other_seed.push_back(usersim_random_uint32());
+    }
+    REQUIRE(other_seed != first_run);
+    usersim_set_random_seed(0);
+    REQUIRE(usersim_random_uint32() != usersim_random_uint32());
+}
+
+TEST_CASE("usersim_random_fill", "[rtl]")
+{
+    // A fill uses the same numbers as usersim_random_uint32, and only writes the bytes asked for.
+    uint8_t buffer[11];
+    memset(buffer, 0xcc, sizeof(buffer));
+    usersim_set_random_seed(42);
+    usersim_random_fill(buffer, 10);
+    REQUIRE(buffer[10] == 0xcc);
+
+    usersim_set_random_seed(42);
+    uint32_t expected[3] = {usersim_random_uint32(), usersim_random_uint32(), usersim_random_uint32()};
+    REQUIRE(memcmp(buffer, expected, 10) == 0);
+    usersim_set_random_seed(0);
+}
+
+TEST_CASE("random number benchmark", "[.][rtl][benchmark]")
+{
+    const size_t iterations = 100000;
+    auto run = [&](size_t thread_count, auto generate) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&]() {
+                for (size_t j = 0; j < iterations; j++) {
+                    generate();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return thread_count;
+    };
+
+    for (size_t thread_count = 1; thread_count <= std::thread::hardware_concurrency(); thread_count *= 4) {
+        std::string threads = ", " + std::to_string(thread_count) + " threads";
+        BENCHMARK("usersim_random_uint32" + threads)
+        {
+            return run(thread_count, []() { return usersim_random_uint32(); });
+        };
+        BENCHMARK("RtlRandomEx" + threads)
+        {
+            return run(thread_count, []() {
+                static thread_local ULONG seed = 1;
+                return RtlRandomEx(&seed);
+            });
+        };
+        BENCHMARK("usersim_random_fill, 64 bytes" + threads)
+        {
+            return run(thread_count, []() {
+                uint8_t buffer[64];
+                usersim_random_fill(buffer, sizeof(buffer));
+                return buffer[0];
+            });
+        };
+
+        // What usersim_random_uint32 used to do, for comparison.
+        BENCHMARK("std::mt19937 seeded per call" + threads)
+        {
+            return run(thread_count, []() {
+                std::random_device device;
+                std::mt19937 generator(device());
+                return generator();
+            });
+        };
+    }
+}